@@ -0,0 +1,152 @@
+#include <argp.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/byte.h"
+
+static char doc[] = "Benchmark the CRC32 implementations used for log batches";
+
+/* Minimum buffer size to benchmark. */
+#define MIN_BUF_SIZE 64
+
+/* Maximum buffer size to benchmark. */
+#define MAX_BUF_SIZE (1024 * 1024)
+
+/* Total amount of data to checksum for each buffer size. */
+#define TOTAL_SIZE (256 * 1024 * 1024)
+
+static const char *impls[] = {[BYTE_CRC32_TABLE] = "table",
+                              [BYTE_CRC32_SLICE8] = "slice8",
+                              [BYTE_CRC32_CLMUL] = "clmul",
+                              [BYTE_CRC32_ARM] = "arm",
+                              NULL};
+
+/* Order of fields: {NAME, KEY, ARG, FLAGS, DOC, GROUP}.*/
+static struct argp_option options[] = {
+    {"buf", 'b', "BUF", 0, "Buffer size (default all powers of 2)", 0},
+    {"impl", 'i', "IMPL", 0, "Implementation to use (default all)", 0},
+    {0}};
+
+struct arguments
+{
+    int buf;
+    int impl;
+};
+
+static int implCode(const char *impl)
+{
+    int i = 0;
+    while (impls[i] != NULL) {
+        if (strcmp(impls[i], impl) == 0) {
+            return i;
+        }
+        i++;
+    }
+    return -1;
+}
+
+static error_t argumentsParse(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+    switch (key) {
+        case 'b':
+            arguments->buf = atoi(arg);
+            break;
+        case 'i':
+            arguments->impl = implCode(arg);
+            if (arguments->impl == -1) {
+                return ARGP_ERR_UNKNOWN;
+            }
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Save current time in 'time'. */
+static void timeNow(struct timespec *time)
+{
+    int rv;
+    rv = clock_gettime(CLOCK_MONOTONIC, time);
+    assert(rv == 0);
+}
+
+/* Calculate how much time has elapsed since 'start', in nanoseconds. */
+static double timeSince(struct timespec *start)
+{
+    struct timespec now;
+    timeNow(&now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e9 +
+           (double)(now.tv_nsec - start->tv_nsec);
+}
+
+static void benchmarkCrc32(int impl, const void *buf, int size)
+{
+    byteCrc32Fn fn = byteCrc32Impl(impl);
+    struct timespec start;
+    unsigned crc = 0;
+    double nsecs;
+    int n = TOTAL_SIZE / size;
+    int i;
+
+    timeNow(&start);
+    for (i = 0; i < n; i++) {
+        crc = fn(buf, (size_t)size, crc);
+    }
+    nsecs = timeSince(&start);
+
+    printf("%-8s: %8d bytes take %10.1f nanosecs on average (%7.2f GB/s) %08x\n",
+           impls[impl], size, nsecs / n, (double)size * n / nsecs, crc);
+}
+
+int main(int argc, char *argv[])
+{
+    struct argp argp = {options, argumentsParse, NULL, doc, 0, 0, 0};
+    struct arguments arguments;
+    unsigned char *buf;
+    int impl;
+    int size;
+    int i;
+
+    arguments.buf = -1;
+    arguments.impl = -1;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.buf != -1 &&
+        (arguments.buf <= 0 || arguments.buf > MAX_BUF_SIZE)) {
+        printf("buffer size must be between 1 and %d\n", MAX_BUF_SIZE);
+        return -1;
+    }
+
+    buf = malloc(MAX_BUF_SIZE);
+    assert(buf != NULL);
+    for (i = 0; i < MAX_BUF_SIZE; i++) {
+        buf[i] = (unsigned char)rand();
+    }
+
+    for (impl = 0; impl < BYTE_CRC32_N; impl++) {
+        if (arguments.impl != impl && arguments.impl != -1) {
+            continue;
+        }
+        if (byteCrc32Impl(impl) == NULL) {
+            printf("%-8s: not supported on this CPU\n", impls[impl]);
+            continue;
+        }
+        if (arguments.buf != -1) {
+            benchmarkCrc32(impl, buf, arguments.buf);
+            continue;
+        }
+        for (size = MIN_BUF_SIZE; size <= MAX_BUF_SIZE; size *= 4) {
+            benchmarkCrc32(impl, buf, size);
+        }
+    }
+
+    free(buf);
+
+    return 0;
+}
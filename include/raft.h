@@ -191,16 +191,9 @@ struct raft_entry
 /**
  * Counter for outstanding references to a log entry.
  *
- * When an entry is first appended to the log, its refcount is set to one (the
- * log itself is the only one referencing the entry). Whenever an entry is
- * included in an I/O request (to write it to disk or to send it to other
- * servers) its refcount is increased by one. Whenever an entry gets deleted
- * from the log its refcount is decreased by one. Likewise, whenever an I/O
- * request is completed the refcount of the relevant entries is decreased by
- * one. When the refcount drops to zero the memory that its @buf attribute
- * points to gets released, or, if the @batch attribute is non-NULL, a check is
- * made to see if all other entries of the same batch also have a zero refcount,
- * and the memory that @batch points to gets released if that's the case.
+ * No longer used: the log now counts references per buffer rather than per
+ * entry (see #raft_log_buffer). Kept only so that code naming the type keeps
+ * compiling.
  */
 struct raft_entry_ref
 {
@@ -210,12 +203,46 @@ struct raft_entry_ref
     struct raft_entry_ref *next; /* Next item in the bucket (for collisions). */
 };
 
+/**
+ * Buffer of log entries that a #raft_log stopped using while some of its
+ * entries were still acquired.
+ *
+ * Acquiring entries from the log does not copy them: it returns a pointer into
+ * the log's circular buffer and increments the reference count of the buffer
+ * as a whole. While the buffer is referenced, the slots of acquired entries are
+ * never overwritten and the memory of deleted entries is not released. If the
+ * log needs to grow or rearrange the buffer, or to append entries after having
+ * deleted some, it copies the entries still in the log into a new buffer and
+ * retires the old one. A retired buffer is released, along with the memory of
+ * the entries deleted from it, once it has no references left and all buffers
+ * retired before it have been released too.
+ */
+struct raft_log_buffer
+{
+    struct raft_entry *entries;   /* Circular buffer of log entries. */
+    size_t size;                  /* Number of slots in the buffer. */
+    size_t front, back;           /* Slots of entries still in the log. */
+    size_t held_front, held_back; /* Slots of entries not yet released. */
+    unsigned refs;                /* Number of outstanding acquisitions. */
+    struct raft_log_buffer *next; /* Buffer retired after this one. */
+};
+
 /**
  * In-memory cache of the persistent raft log stored on disk.
  *
  * The raft log cache is implemented as a circular buffer of log entries, which
  * makes some frequent operations very efficient (e.g. deleting the first N
  * entries when snapshotting).
+ *
+ * If a cache size is set, the payloads of the oldest entries that have been
+ * persisted and applied are released once the total size of the payloads in
+ * memory exceeds it, and get read back from disk when needed. Only the term
+ * and type of those entries are kept.
+ *
+ * The fields of this struct are private. Their layout changed when reference
+ * counting moved from single entries to whole buffers, which changed the size
+ * of #raft and broke binary compatibility with libraft.so.0. Code using this
+ * struct must be recompiled against libraft.so.1.
  */
 struct raft_log
 {
@@ -223,13 +250,23 @@ struct raft_log
     size_t size;                 /* Number of available slots in the buffer. */
     size_t front, back;          /* Indexes of used slots [front, back). */
     raft_index offset;           /* Index of first entry is offset+1. */
-    struct raft_entry_ref *refs; /* Log entries reference counts hash table. */
-    size_t refs_size;            /* Size of the reference counts hash table. */
+    size_t held_front;           /* Deleted entries not yet released are in */
+    size_t held_back;            /* [held_front, held_back) - [front, back). */
+    unsigned refs;               /* Outstanding acquisitions of @entries. */
+    /* Retired buffers that are still referenced, oldest first. */
+    struct raft_log_buffer *retired;
     struct                       /* Information about last snapshot, or zero. */
     {
         raft_index last_index; /* Snapshot replaces all entries up to here. */
         raft_term last_term;   /* Term of last index. */
     } snapshot;
+    struct                       /* Eviction of the payloads of old entries. */
+    {
+        size_t max;            /* Payload bytes to keep, or 0 for no limit. */
+        size_t size;           /* Payload bytes currently in memory. */
+        raft_index bound;      /* Highest index that can be evicted. */
+        raft_index evicted;    /* Highest index evicted so far. */
+    } cache;
 };
 
 /**
@@ -264,12 +301,13 @@ struct raft_request_vote_result
  */
 struct raft_append_entries
 {
-    raft_term term;             /* Leader's term. */
-    raft_index prev_log_index;  /* Index of log entry preceeding new ones. */
-    raft_term prev_log_term;    /* Term of entry at prev_log_index. */
-    raft_index leader_commit;   /* Leader's commit index. */
-    struct raft_entry *entries; /* Log entries to append. */
-    unsigned n_entries;         /* Size of the log entries array. */
+    raft_term term;                /* Leader's term. */
+    raft_index prev_log_index;     /* Index of log entry preceeding new ones. */
+    raft_term prev_log_term;       /* Term of entry at prev_log_index. */
+    raft_index leader_commit;      /* Leader's commit index. */
+    struct raft_entry *entries;    /* Log entries to append. */
+    unsigned n_entries;            /* Size of the log entries array. */
+    unsigned long long read_round; /* Leadership confirmation round. */
 };
 
 /**
@@ -277,13 +315,19 @@ struct raft_append_entries
  */
 struct raft_append_entries_result
 {
-    raft_term term;            /* Receiver's current_term. */
-    raft_index rejected;       /* If non-zero, the index that was rejected. */
-    raft_index last_log_index; /* Receiver's last log entry index, as hint. */
+    raft_term term;                /* Receiver's current_term. */
+    raft_index rejected;           /* If non-zero, index that was rejected. */
+    raft_index last_log_index;     /* Receiver's last log index, as hint. */
+    unsigned long long read_round; /* Round of the request being answered. */
+    raft_term conflict_term;       /* Receiver's term at rejected, if any. */
+    raft_index conflict_index;     /* First index of conflict_term, as hint. */
 };
 
 /**
  * Hold the arguments of an InstallSnapshot RPC (figure 5.3).
+ *
+ * Large snapshots are sent in chunks, each carrying the portion of the snapshot
+ * data starting at the given offset.
  */
 struct raft_install_snapshot
 {
@@ -292,7 +336,21 @@ struct raft_install_snapshot
     raft_term last_term;            /* Term of last_index. */
     struct raft_configuration conf; /* Config as of last_index. */
     raft_index conf_index;          /* Commit index of conf. */
-    struct raft_buffer data;        /* Raw snapshot data. */
+    struct raft_buffer data;        /* Raw snapshot data chunk. */
+    size_t offset;                  /* Offset of the chunk in the snapshot. */
+    bool done;                      /* True if this is the last chunk. */
+};
+
+/**
+ * Hold the result of an InstallSnapshot RPC carrying a chunk which is not the
+ * last one. The last chunk is acknowledged with an AppendEntries result, once
+ * the snapshot has been installed.
+ */
+struct raft_install_snapshot_result
+{
+    raft_term term;        /* Receiver's current_term. */
+    raft_index last_index; /* Index of last entry in the snapshot. */
+    size_t offset;         /* Snapshot bytes received so far. */
 };
 
 /**
@@ -308,6 +366,29 @@ struct raft_timeout_now
     raft_index last_log_term;  /* Term of log entry at last_log_index. */
 };
 
+/**
+ * Hold the arguments of a ForwardRead RPC.
+ *
+ * The ForwardRead RPC is invoked by followers to ask the leader for a read
+ * index, so they can serve linearizable reads locally once they have applied
+ * all entries up to it.
+ */
+struct raft_forward_read
+{
+    raft_term term;         /* Follower's term. */
+    unsigned long long seq; /* Sequence number of the request. */
+};
+
+/**
+ * Hold the result of a ForwardRead RPC.
+ */
+struct raft_forward_read_result
+{
+    raft_term term;         /* Receiver's current_term. */
+    unsigned long long seq; /* Sequence number of the request. */
+    raft_index index;       /* Read index, or 0 if receiver is not leader. */
+};
+
 /**
  * Type codes for RPC messages.
  */
@@ -317,7 +398,10 @@ enum {
     RAFT_IO_REQUEST_VOTE,
     RAFT_IO_REQUEST_VOTE_RESULT,
     RAFT_IO_INSTALL_SNAPSHOT,
-    RAFT_IO_TIMEOUT_NOW
+    RAFT_IO_TIMEOUT_NOW,
+    RAFT_IO_INSTALL_SNAPSHOT_RESULT,
+    RAFT_IO_FORWARD_READ,
+    RAFT_IO_FORWARD_READ_RESULT
 };
 
 /**
@@ -335,6 +419,9 @@ struct raft_message
         struct raft_append_entries_result append_entries_result;
         struct raft_install_snapshot install_snapshot;
         struct raft_timeout_now timeout_now;
+        struct raft_install_snapshot_result install_snapshot_result;
+        struct raft_forward_read forward_read;
+        struct raft_forward_read_result forward_read_result;
     };
 };
 
@@ -406,6 +493,79 @@ struct raft_io_snapshot_get
     raft_io_snapshot_get_cb cb; /* Request callback */
 };
 
+/**
+ * Asynchronous request to run a callback at a later point of the event loop.
+ */
+struct raft_io_defer;
+typedef void (*raft_io_defer_cb)(struct raft_io_defer *req, int status);
+struct raft_io_defer
+{
+    void *data;          /* User data */
+    raft_io_defer_cb cb; /* Request callback */
+};
+
+/**
+ * Asynchronous request to store the current term or vote.
+ */
+struct raft_io_set_meta;
+typedef void (*raft_io_set_meta_cb)(struct raft_io_set_meta *req, int status);
+struct raft_io_set_meta
+{
+    void *data;             /* User data */
+    raft_io_set_meta_cb cb; /* Request callback */
+};
+
+/**
+ * Asynchronous request to read log entries back from disk.
+ *
+ * On success @entries holds at least one entry, starting from the requested
+ * index. Ownership of the array and of the batches of its entries passes to
+ * the callback, which must release them with raft_free().
+ */
+struct raft_io_read;
+typedef void (*raft_io_read_cb)(struct raft_io_read *req,
+                                struct raft_entry entries[],
+                                unsigned n,
+                                int status);
+struct raft_io_read
+{
+    void *data;         /* User data */
+    raft_io_read_cb cb; /* Request callback */
+};
+
+/**
+ * Asynchronous request to read a portion of the data of the most recent
+ * snapshot.
+ *
+ * On success @snapshot holds the metadata of the snapshot and a single buffer
+ * with the requested portion of its data, which is shorter than requested only
+ * at the end of the data, and @size is the total size of the data. Ownership
+ * of the snapshot, of its configuration and of its buffer passes to the
+ * callback, which must release them with raft_free().
+ */
+struct raft_io_snapshot_read;
+typedef void (*raft_io_snapshot_read_cb)(struct raft_io_snapshot_read *req,
+                                         struct raft_snapshot *snapshot,
+                                         size_t size,
+                                         int status);
+struct raft_io_snapshot_read
+{
+    void *data;                  /* User data */
+    raft_io_snapshot_read_cb cb; /* Request callback */
+};
+
+/**
+ * Asynchronous request to store a chunk of a snapshot being received.
+ */
+struct raft_io_snapshot_write;
+typedef void (*raft_io_snapshot_write_cb)(struct raft_io_snapshot_write *req,
+                                          int status);
+struct raft_io_snapshot_write
+{
+    void *data;                   /* User data */
+    raft_io_snapshot_write_cb cb; /* Request callback */
+};
+
 /**
  * Customizable tracer, for debugging purposes.
  */
@@ -483,6 +643,115 @@ struct raft_io
                         raft_io_snapshot_get_cb cb);
     raft_time (*time)(struct raft_io *io);
     int (*random)(struct raft_io *io, int min, int max);
+    /* Fields below added since version 2. */
+
+    /* Optional. Invoke @cb once all events that the implementation is
+     * currently dispatching have been processed (e.g. at the end of the
+     * current event loop iteration) and at least @usecs microseconds have
+     * elapsed. Implementations with a coarser timer resolution round @usecs
+     * up. At most one request is pending at any time. If the instance gets
+     * closed before the callback fires, the callback must be invoked with
+     * RAFT_CANCELED before the close callback. */
+    int (*defer)(struct raft_io *io,
+                 struct raft_io_defer *req,
+                 unsigned usecs,
+                 raft_io_defer_cb cb);
+    /* Fields below added since version 3. */
+
+    /* Optional, must be set together with @async_set_vote. Asynchronous
+     * variants of @set_term and @set_vote, which don't block the caller while
+     * the new value is made durable and invoke @cb once it is. Requests
+     * complete in the order they were submitted. If the instance gets closed
+     * before the callback fires, the callback must be invoked before the close
+     * callback, with RAFT_CANCELED if the value was not stored.
+     *
+     * If set, they are used in place of @set_term and @set_vote, and no
+     * message is sent until all submitted requests have completed. */
+    int (*async_set_term)(struct raft_io *io,
+                          struct raft_io_set_meta *req,
+                          raft_term term,
+                          raft_io_set_meta_cb cb);
+    int (*async_set_vote)(struct raft_io *io,
+                          struct raft_io_set_meta *req,
+                          raft_id server_id,
+                          raft_io_set_meta_cb cb);
+    /* Fields below added since version 4. */
+
+    /* Optional. Read back up to @n persisted entries starting from @index,
+     * which must have been appended and not truncated. Implementations can
+     * return fewer entries than requested, and fail with RAFT_NOTFOUND if they
+     * can't find the entry at @index. If the instance gets closed before the
+     * callback fires, the callback must be invoked with RAFT_CANCELED before
+     * the close callback.
+     *
+     * If set, the log cache size set with raft_set_log_cache_size() is
+     * honored, and the entries whose payload was evicted from memory are read
+     * with this method when a follower needs them. */
+    int (*read)(struct raft_io *io,
+                struct raft_io_read *req,
+                raft_index index,
+                unsigned n,
+                raft_io_read_cb cb);
+    /* Fields below added since version 5. */
+
+    /* Optional, must be set together with @snapshot_write. Read up to @len
+     * bytes of the data of the most recent snapshot, starting from @offset,
+     * without loading the rest of it in memory. If the instance gets closed
+     * before the callback fires, the callback must be invoked with
+     * RAFT_CANCELED before the close callback.
+     *
+     * If set, leaders read the snapshots they send to followers one chunk at a
+     * time with this method, instead of loading them with @snapshot_get. */
+    int (*snapshot_read)(struct raft_io *io,
+                         struct raft_io_snapshot_read *req,
+                         size_t offset,
+                         size_t len,
+                         raft_io_snapshot_read_cb cb);
+
+    /* Write @chunk at @offset of the data of a snapshot being received, which
+     * is set aside until the last chunk, flagged by @done, is written: the
+     * snapshot is then stored with the metadata of @snapshot, whose buffers
+     * are ignored, as if by @snapshot_put with zero trailing entries. Until
+     * then only the index and term of @snapshot are used. A zero @offset
+     * starts over, discarding the data written so far. The @snapshot and
+     * @chunk objects must stay valid until the callback fires. At most one
+     * request is pending at any time, and if the instance gets closed before
+     * the callback fires, the callback must be invoked before the close
+     * callback.
+     *
+     * If set, followers write the chunks of the snapshots they receive with
+     * this method as they arrive, instead of buffering them in memory, and
+     * load the snapshot back with @snapshot_get once it's complete. */
+    int (*snapshot_write)(struct raft_io *io,
+                          struct raft_io_snapshot_write *req,
+                          const struct raft_snapshot *snapshot,
+                          size_t offset,
+                          const struct raft_buffer *chunk,
+                          bool done,
+                          raft_io_snapshot_write_cb cb);
+};
+
+/**
+ * Asynchronous request to apply a batch of commands to the FSM.
+ */
+struct raft_fsm_apply;
+typedef void (*raft_fsm_apply_cb)(struct raft_fsm_apply *req, int status);
+struct raft_fsm_apply
+{
+    void *data;           /* User data */
+    raft_fsm_apply_cb cb; /* Request callback */
+};
+
+/**
+ * Asynchronous request to serialize a frozen snapshot of the FSM.
+ */
+struct raft_fsm_snapshot;
+typedef void (*raft_fsm_snapshot_cb)(struct raft_fsm_snapshot *req,
+                                     int status);
+struct raft_fsm_snapshot
+{
+    void *data;              /* User data */
+    raft_fsm_snapshot_cb cb; /* Request callback */
 };
 
 struct raft_fsm
@@ -496,6 +765,65 @@ struct raft_fsm
                     struct raft_buffer *bufs[],
                     unsigned *n_bufs);
     int (*restore)(struct raft_fsm *fsm, struct raft_buffer *buf);
+    /* Fields below added since version 2. */
+
+    /* Optional. If set, committed commands are not applied one by one with
+     * @apply, but passed to this method in batches of @n consecutive commands,
+     * the first of which has the given @index.
+     *
+     * The FSM must apply the commands in order, store the result of the i'th
+     * command in @results[i] and then invoke @cb exactly once, with a non-zero
+     * status if the batch could not be applied, in which case it will be
+     * submitted again later. The @bufs and @results arrays remain valid until
+     * then. The callback can be invoked from within this method or at a later
+     * time, but always from the thread running the raft instance: FSMs doing
+     * the work on another thread must hand the completion back to it, e.g.
+     * with uv_async_send().
+     *
+     * No other batch is submitted and the @snapshot and @restore methods are
+     * not called until the callback fires. In the meantime new entries keep
+     * being replicated and committed.
+     *
+     * If a non-zero value is returned, the callback must not be invoked. */
+    int (*apply_batch)(struct raft_fsm *fsm,
+                       struct raft_fsm_apply *req,
+                       raft_index index,
+                       const struct raft_buffer bufs[],
+                       void *results[],
+                       unsigned n,
+                       raft_fsm_apply_cb cb);
+    /* Fields below added since version 3. */
+
+    /* Optional, must be set together with @snapshot_serialize. If both are
+     * set, snapshots are taken in two steps instead of calling @snapshot.
+     *
+     * This method is called first and must capture the state of the FSM as
+     * of the last applied command, for example by grabbing a reference to
+     * an immutable or copy-on-write version of it. It runs on the thread of
+     * the raft instance, so it should be fast. Commands keep being applied
+     * after it returns, and must not alter the captured state.
+     *
+     * Returning RAFT_BUSY skips the snapshot, which will be retried later. */
+    int (*snapshot_freeze)(struct raft_fsm *fsm);
+
+    /* Encode the state captured by the last @snapshot_freeze call into
+     * @bufs, which have the same format as the ones returned by @snapshot.
+     *
+     * The work is expected to happen on a thread other than the one running
+     * the raft instance. Once @bufs and @n_bufs are filled in, the FSM must
+     * invoke @cb exactly once, with a non-zero status if the snapshot could
+     * not be encoded. Like for @apply_batch, the callback must be invoked
+     * from the thread running the raft instance.
+     *
+     * The new snapshot is stored with raft_io->snapshot_put() once the
+     * callback fires. Until then no other snapshot is taken or installed.
+     *
+     * If a non-zero value is returned, the callback must not be invoked. */
+    int (*snapshot_serialize)(struct raft_fsm *fsm,
+                              struct raft_fsm_snapshot *req,
+                              struct raft_buffer *bufs[],
+                              unsigned *n_bufs,
+                              raft_fsm_snapshot_cb cb);
 };
 
 /**
@@ -503,6 +831,15 @@ struct raft_fsm
  */
 enum { RAFT_UNAVAILABLE, RAFT_FOLLOWER, RAFT_CANDIDATE, RAFT_LEADER };
 
+/**
+ * An AppendEntries message sent in pipeline mode and not yet acknowledged.
+ */
+struct raft_inflight
+{
+    raft_index last_index; /* Index of the last entry in the message. */
+    size_t bytes;          /* Total size of the entries payloads. */
+};
+
 /**
  * Used by leaders to keep track of replication progress for each server.
  */
@@ -514,6 +851,22 @@ struct raft_progress
     raft_index snapshot_index; /* Last index of most recent snapshot sent. */
     raft_time last_send;       /* Timestamp of last AppendEntries RPC. */
     bool recent_recv;          /* A msg was received within election timeout. */
+    bool reading;              /* Entries or snapshot data being read. */
+
+    /* Last leadership confirmation round acknowledged by the server. */
+    unsigned long long read_round;
+
+    /* Snapshot being sent in chunks while in snapshot mode. */
+    struct raft_snapshot *snapshot; /* Loaded snapshot, NULL while loading. */
+    size_t snapshot_offset;         /* Offset acknowledged by the server. */
+    size_t snapshot_size;           /* Total size of the snapshot data. */
+
+    /* Flow control window of AppendEntries sent in pipeline mode. */
+    struct raft_inflight *inflight; /* Ring of unacknowledged messages. */
+    unsigned inflight_size;         /* Number of slots in the ring. */
+    unsigned inflight_front;        /* Slot of the oldest message. */
+    unsigned inflight_n;            /* Number of messages in the ring. */
+    size_t inflight_bytes;          /* Total size of messages in the ring. */
 };
 
 struct raft; /* Forward declaration. */
@@ -578,6 +931,17 @@ struct raft
     raft_index configuration_index;
     raft_index configuration_uncommitted_index;
 
+    /*
+     * Hash table mapping server IDs to positions in #configuration, built only
+     * for large configurations. Lookups fall back to a linear scan when it's
+     * not allocated.
+     */
+    struct
+    {
+        unsigned *slots; /* Position of a server plus one, or zero if free. */
+        unsigned size;   /* Number of slots, a power of two. */
+    } configuration_hash;
+
     /*
      * Election timeout in milliseconds (default 1000).
      *
@@ -636,6 +1000,11 @@ struct raft
                 raft_id id;
                 char *address;
             } current_leader;
+            void *reads[2];               /* Outstanding read requests. */
+            unsigned long long read_seq;  /* Last ForwardRead RPC sent. */
+            unsigned long long read_done; /* Last ForwardRead RPC answered. */
+            raft_time read_start;         /* Send time of last ForwardRead. */
+            void *install;                /* Deferred InstallSnapshot. */
         } follower_state;
         struct
         {
@@ -647,12 +1016,17 @@ struct raft
         struct
         {
             struct raft_progress *progress; /* Per-server replication state. */
+            raft_index *quorum;             /* Voters match indexes, sorted. */
+            unsigned n_quorum;              /* Number of voters. */
             struct raft_change *change;     /* Pending membership change. */
             raft_id promotee_id;            /* ID of server being promoted. */
             unsigned short round_number;    /* Current sync round. */
             raft_index round_index;         /* Target of the current round. */
             raft_time round_start;          /* Start of current round. */
             void *requests[2];              /* Outstanding client requests. */
+            void *reads[2];                 /* Outstanding read requests. */
+            unsigned long long read_round;  /* Last confirmation round sent. */
+            unsigned long long read_acked;  /* Last round acked by quorum. */
         } leader_state;
     };
 
@@ -674,12 +1048,81 @@ struct raft
      */
     struct
     {
-        unsigned threshold;              /* N. of entries before snapshot */
-        unsigned trailing;               /* N. of trailing entries to retain */
-        struct raft_snapshot pending;    /* In progress snapshot */
-        struct raft_io_snapshot_put put; /* Store snapshot request */
+        unsigned threshold;                 /* N. of entries before snapshot */
+        unsigned trailing;                  /* N. of trailing entries to keep */
+        struct raft_snapshot pending;       /* In progress snapshot */
+        struct raft_io_snapshot_put put;    /* Store snapshot request */
+        struct raft_fsm_snapshot serialize; /* FSM serialize request */
+        raft_io_close_cb close_cb;          /* I/O close callback to resume */
+        size_t chunk_size;                  /* Max data in an InstallSnapshot */
+        struct                              /* Snapshot received in chunks */
+        {
+            raft_index index;       /* Index of last entry in the snapshot. */
+            raft_term term;         /* Term of last entry in the snapshot. */
+            struct raft_buffer buf; /* Data received so far. */
+            size_t cap;             /* Allocated size of buf. */
+            size_t written;         /* Data written with snapshot_write. */
+
+            /* Pending request to write a chunk, if any. */
+            struct raft_io_snapshot_write write;
+        } chunks;
     } snapshot;
 
+    /*
+     * Batch of committed commands being applied by an FSM implementing the
+     * apply_batch method.
+     */
+    struct
+    {
+        struct raft_fsm_apply req;  /* Request submitted to the FSM */
+        raft_index index;           /* Index of the first command */
+        unsigned n;                 /* Number of commands, zero if idle */
+        struct raft_entry *entries; /* Log entries acquired for the batch */
+        unsigned n_entries;         /* Number of acquired entries */
+        struct raft_buffer *bufs;   /* Payloads of the commands */
+        void **results;             /* Results of the commands */
+        raft_io_close_cb close_cb;  /* I/O close callback to resume */
+    } apply;
+
+    /*
+     * Group commit of new entries appended by the leader: their disk write and
+     * their AppendEntries messages are deferred and submitted together.
+     */
+    struct
+    {
+        bool enabled;             /* Whether group commit is on */
+        unsigned window;          /* Microseconds to wait for more entries */
+        unsigned max_entries;     /* Submit right away past this many */
+        raft_index index;         /* First deferred entry, 0 if none */
+        bool pending;             /* Whether the defer request is in flight */
+        struct raft_io_defer req; /* Deferred submission request */
+    } group_commit;
+
+    /*
+     * Leader lease: while it's valid, a majority of voters is known to have
+     * heard from this leader recently enough that no other leader can have
+     * been elected yet, so reads can be served locally.
+     */
+    struct
+    {
+        bool enabled;                 /* Whether lease reads are on */
+        unsigned drift;               /* Clock drift margin in milliseconds */
+        raft_time round_start;        /* Send time of the last read round */
+        raft_time expiry;             /* Lease expiration, 0 if none */
+        unsigned long long n_expired; /* Number of times the lease expired */
+    } lease;
+
+    /*
+     * Updates of the persisted term and vote submitted with the asynchronous
+     * methods of the I/O implementation, if it has them. Outgoing messages
+     * are held back until all updates are durable.
+     */
+    struct
+    {
+        unsigned pending; /* Number of updates in flight */
+        void *held[2];    /* Messages waiting for the updates */
+    } meta;
+
     /*
      * Callback to invoke once a close request has completed.
      */
@@ -699,6 +1142,16 @@ struct raft
      * being promoted to voter. */
     unsigned max_catch_up_rounds;
     unsigned max_catch_up_round_duration;
+
+    /* Limit the number of entries and the total size of their payloads that
+     * are sent to a follower in a single AppendEntries message. */
+    unsigned max_append_entries_count;
+    size_t max_append_entries_bytes;
+
+    /* Limit the number of AppendEntries messages and the total size of their
+     * payloads that a leader keeps in flight to a follower in pipeline mode. */
+    unsigned max_inflight;
+    size_t max_inflight_bytes;
 };
 
 RAFT_API int raft_init(struct raft *r,
@@ -773,6 +1226,15 @@ RAFT_API void raft_set_heartbeat_timeout(struct raft *r, unsigned msecs);
  */
 RAFT_API void raft_set_snapshot_threshold(struct raft *r, unsigned n);
 
+/**
+ * Maximum amount of snapshot data that a leader sends to a follower in a single
+ * InstallSnapshot message. Larger snapshots are sent in chunks, each of which
+ * must be acknowledged before the next one is sent, and chunks that are not
+ * acknowledged within a heartbeat interval are sent again. A value of zero
+ * means no limit. The default is 4 megabytes.
+ */
+RAFT_API void raft_set_snapshot_chunk_size(struct raft *r, size_t size);
+
 /**
  * Enable or disable pre-vote support. Pre-vote is turned off by default.
  */
@@ -785,6 +1247,15 @@ RAFT_API void raft_set_pre_vote(struct raft *r, bool enabled);
  */
 RAFT_API void raft_set_snapshot_trailing(struct raft *r, unsigned n);
 
+/**
+ * Set the total size in bytes of the entry payloads to keep in memory. Once
+ * exceeded, the payloads of the oldest entries that have been persisted and
+ * applied are released, and read back from disk if a follower needs them. This
+ * has no effect unless the I/O implementation supports reading entries (see
+ * raft_io->read). A value of zero means no limit, which is the default.
+ */
+RAFT_API void raft_set_log_cache_size(struct raft *r, size_t size);
+
 /**
  * Set the maximum number of a catch-up rounds to try when replicating entries
  * to a stand-by server that is being promoted to voter, before giving up and
@@ -799,6 +1270,83 @@ RAFT_API void raft_set_max_catch_up_rounds(struct raft *r, unsigned n);
 RAFT_API void raft_set_max_catch_up_round_duration(struct raft *r,
                                                    unsigned msecs);
 
+/**
+ * Set the maximum number of entries that a leader includes in a single
+ * AppendEntries message. A follower that is far behind will be sent the
+ * missing entries in chunks of at most this size. A value of zero means no
+ * limit. The default is 1024.
+ */
+RAFT_API void raft_set_max_append_entries_count(struct raft *r, unsigned n);
+
+/**
+ * Set the maximum total size in bytes of the payloads of the entries that a
+ * leader includes in a single AppendEntries message. At least one entry is
+ * always sent, even if it's bigger than this limit. A value of zero means no
+ * limit. The default is 4 megabytes.
+ */
+RAFT_API void raft_set_max_append_entries_bytes(struct raft *r, size_t bytes);
+
+/**
+ * Set the maximum number of AppendEntries messages that a leader sends to a
+ * follower in pipeline mode without having received a result for them. When
+ * the limit is reached, replication to that follower pauses until results come
+ * back. A value of zero means no limit. The default is 128.
+ */
+RAFT_API void raft_set_max_inflight_messages(struct raft *r, unsigned n);
+
+/**
+ * Set the maximum total size in bytes of the entries payloads that a leader
+ * sends to a follower in pipeline mode without having received a result for
+ * them. A value of zero means no limit. The default is 32 megabytes.
+ */
+RAFT_API void raft_set_max_inflight_bytes(struct raft *r, size_t bytes);
+
+/**
+ * Enable or disable group commit. When enabled, entries created by a leader
+ * with raft_apply(), raft_barrier() and membership changes are not written to
+ * disk and sent to followers right away. Instead, all entries created until
+ * the end of the current event loop iteration, or until the window set with
+ * raft_set_group_commit_window() expires, are submitted with a single disk
+ * write and a single AppendEntries message per follower. It requires an I/O
+ * implementation supporting the raft_io->defer method, and it's a no-op
+ * otherwise. The default is false.
+ */
+RAFT_API void raft_set_group_commit(struct raft *r, bool enabled);
+
+/**
+ * Set how many microseconds a leader doing group commit waits for more entries
+ * after the first deferred one, before submitting them. Larger values trade
+ * commit latency for fewer and bigger writes and messages. The default is 0,
+ * meaning that entries are submitted at the end of the current event loop
+ * iteration.
+ */
+RAFT_API void raft_set_group_commit_window(struct raft *r, unsigned usecs);
+
+/**
+ * Set the number of deferred entries past which a leader doing group commit
+ * submits them right away, without waiting for the window to expire. A value
+ * of zero means no limit. The default is 0.
+ */
+RAFT_API void raft_set_group_commit_max_entries(struct raft *r, unsigned n);
+
+/**
+ * Enable or disable lease reads. When enabled, a leader keeps sending a
+ * leadership confirmation round every heartbeat timeout, and holds a lease
+ * that lasts for the election timeout minus the drift margin set with
+ * raft_set_lease_drift(), counting from the time the last round acknowledged
+ * by a majority of voters was sent. While the lease is valid, reads can be
+ * served locally without any network round, see raft_lease_valid(). This
+ * relies on the clocks of all servers advancing at roughly the same rate. The
+ * default is false.
+ */
+RAFT_API void raft_set_lease_reads(struct raft *r, bool enabled);
+
+/**
+ * Set the number of milliseconds by which the leader lease is shortened, to
+ * account for clock drift between servers. The default is 100.
+ */
+RAFT_API void raft_set_lease_drift(struct raft *r, unsigned msecs);
+
 /**
  * Return a human-readable description of the last error occured.
  */
@@ -824,6 +1372,12 @@ RAFT_API raft_index raft_last_index(struct raft *r);
  */
 RAFT_API raft_index raft_last_applied(struct raft *r);
 
+/**
+ * Return the number of times the leader lease of this server expired before
+ * being renewed.
+ */
+RAFT_API unsigned long long raft_lease_expirations(struct raft *r);
+
 /* Common fields across client request types. */
 #define RAFT__REQUEST \
     void *data;       \
@@ -889,6 +1443,53 @@ RAFT_API int raft_barrier(struct raft *r,
                           struct raft_barrier *req,
                           raft_barrier_cb cb);
 
+/**
+ * Asynchronous request to perform a linearizable read.
+ */
+struct raft_read_index;
+typedef void (*raft_read_index_cb)(struct raft_read_index *req, int status);
+struct raft_read_index
+{
+    RAFT__REQUEST;
+    unsigned long long round; /* Confirmation round to wait for. */
+    raft_read_index_cb cb;
+};
+
+/**
+ * Wait until it is safe to serve a linearizable read from the local FSM.
+ *
+ * If this server is the leader, it records its current commit index as the
+ * read index, confirms that it is still the leader by exchanging a round of
+ * heartbeats with a majority of voters, and then waits for the FSM to apply
+ * all entries up to the read index. Once @cb fires with status 0, the FSM
+ * reflects all writes that were committed before this function was called.
+ *
+ * Unlike raft_barrier(), no entry is appended to the log, except for a barrier
+ * entry if the leader hasn't yet appended any entry in its current term. All
+ * requests submitted while a confirmation round is in flight share the next
+ * round.
+ *
+ * If this server is a follower that knows the current leader, it asks the
+ * leader for a read index with a ForwardRead RPC instead, and waits for its own
+ * FSM to apply all entries up to it. Requests submitted while a ForwardRead RPC
+ * is in flight share the next one. If the leader rejects the request, the
+ * callback fires with #RAFT_NOTLEADER.
+ *
+ * If leadership is lost, or the leader known by a follower changes, before the
+ * read can be served, the callback fires with #RAFT_LEADERSHIPLOST.
+ */
+RAFT_API int raft_read_index(struct raft *r,
+                             struct raft_read_index *req,
+                             raft_read_index_cb cb);
+
+/**
+ * Return true if lease reads are enabled and this server is the leader and
+ * holds a valid lease, see raft_set_lease_reads(). In that case @index is set
+ * to the current commit index, and linearizable reads can be served right away
+ * from the local FSM as soon as raft_last_applied() reaches it.
+ */
+RAFT_API bool raft_lease_valid(struct raft *r, raft_index *index);
+
 /**
  * Asynchronous request to change the raft configuration.
  */
@@ -8,8 +8,6 @@
 
 #include "../raft.h"
 
-#define RAFT_FIXTURE_MAX_SERVERS 8
-
 /**
  * Fixture step event types.
  */
@@ -70,7 +68,9 @@ struct raft_fixture
     raft_index commit_index;         /* Current commit index on leader. */
     struct raft_fixture_event event; /* Last event occurred. */
     raft_fixture_event_cb hook;      /* Event callback. */
-    struct raft_fixture_server servers[RAFT_FIXTURE_MAX_SERVERS];
+
+    /* Servers, each allocated on the heap when added to the fixture. */
+    struct raft_fixture_server **servers;
 };
 
 /**
@@ -139,6 +139,11 @@ RAFT_API unsigned raft_fixture_leader_index(struct raft_fixture *f);
  */
 RAFT_API raft_id raft_fixture_voted_for(struct raft_fixture *f, unsigned i);
 
+/**
+ * Return the term persisted by the @i'th server.
+ */
+RAFT_API raft_term raft_fixture_term(struct raft_fixture *f, unsigned i);
+
 /**
  * Drive the cluster so the @i'th server gets elected as leader.
  *
@@ -385,6 +390,26 @@ RAFT_API void raft_fixture_set_disk_latency(struct raft_fixture *f,
                                             unsigned i,
                                             unsigned msecs);
 
+/**
+ * Enable or disable the asynchronous term and vote methods of the I/O
+ * implementation of the i'th server. When enabled, storing the term or the
+ * vote takes the disk latency to complete, like append requests. They are
+ * disabled by default.
+ */
+RAFT_API void raft_fixture_set_async_meta(struct raft_fixture *f,
+                                          unsigned i,
+                                          bool enabled);
+
+/**
+ * Enable or disable the methods to read and write snapshots in chunks of the
+ * I/O implementation of the i'th server. When enabled, leaders read snapshots
+ * one chunk at a time and followers write the chunks they receive as they
+ * arrive. They are disabled by default.
+ */
+RAFT_API void raft_fixture_set_snapshot_chunks(struct raft_fixture *f,
+                                               unsigned i,
+                                               bool enabled);
+
 /**
  * Set the persisted term of the @i'th server.
  */
@@ -415,6 +440,15 @@ RAFT_API void raft_fixture_io_fault(struct raft_fixture *f,
                                     int delay,
                                     int repeat);
 
+/**
+ * Make the append request of the @i'th server submitted after @delay other
+ * append requests fail with RAFT_IOERR when it completes, without persisting
+ * any of its entries.
+ */
+RAFT_API void raft_fixture_append_fault(struct raft_fixture *f,
+                                        unsigned i,
+                                        int delay);
+
 /**
  * Return the number of messages of the given type that the @i'th server has
  * successfully sent so far.
@@ -431,4 +465,10 @@ RAFT_API unsigned raft_fixture_n_recv(struct raft_fixture *f,
                                       unsigned i,
                                       int type);
 
+/**
+ * Return the number of disk writes of new log entries that the @i'th server has
+ * completed so far.
+ */
+RAFT_API unsigned raft_fixture_n_append(struct raft_fixture *f, unsigned i);
+
 #endif /* RAFT_FIXTURE_H */
@@ -103,9 +103,30 @@ RAFT_API void raft_uv_set_block_size(struct raft_io *io, size_t size);
  * be reduced to the closest multiple.
  *
  * The default is 8 megabytes.
+ *
+ * Entries evicted from memory because of raft_set_log_cache_size() are read
+ * back from closed segments only, so the cache should be sized comfortably
+ * above the segment size, or followers lagging just behind the open segment
+ * will wait for it to be closed before catching up.
  */
 RAFT_API void raft_uv_set_segment_size(struct raft_io *io, size_t size);
 
+/**
+ * Set the maximum number of writes that can be in flight at the same time
+ * against the open segment being written.
+ *
+ * When greater than 1, each write starts at a fresh block and the unused tail
+ * of its last block is filled with padding, trading a bit of disk space for
+ * the ability to submit a new batch of entries without waiting for the previous
+ * one to be persisted. Append callbacks still fire in submission order.
+ * Segments written this way can't be read by versions of this library that
+ * predate this option.
+ *
+ * Must be called before the first entry is appended. The default is 1.
+ */
+RAFT_API void raft_uv_set_max_concurrent_writes(struct raft_io *io,
+                                                unsigned n);
+
 /**
  * Set how many milliseconds to wait between subsequent retries when
  * establishing a connection with another server. The default is 1000
@@ -113,6 +134,65 @@ RAFT_API void raft_uv_set_segment_size(struct raft_io *io, size_t size);
  */
 RAFT_API void raft_uv_set_connect_retry_delay(struct raft_io *io, unsigned msecs);
 
+/**
+ * Enable or disable batching of outbound messages.
+ *
+ * When enabled, messages sent to the same server during a single event loop
+ * iteration are accumulated and written out together with a single vectored
+ * write, right before the loop polls for I/O.
+ *
+ * The default is false.
+ */
+RAFT_API void raft_uv_set_send_batching(struct raft_io *io, bool batching);
+
+/**
+ * Enable or disable compression of snapshot data.
+ *
+ * When enabled, snapshot data is compressed in the thread pool before being
+ * written to disk, and transparently decompressed when loaded. The codec used
+ * is recorded in the snapshot metadata file, so snapshots written with and
+ * without compression can be mixed freely. Snapshots written with compression
+ * can't be read by versions of this library that predate this option.
+ *
+ * Return #RAFT_INVALID if @compressed is true but the library was built
+ * without compression support. The default is false.
+ */
+RAFT_API int raft_uv_set_snapshot_compression(struct raft_io *io,
+                                              bool compressed);
+
+/**
+ * Enable or disable compression of AppendEntries payloads.
+ *
+ * When enabled, compression is offered to other servers when connecting to
+ * them, and the entries of AppendEntries messages whose payload is at least as
+ * large as the threshold set with raft_uv_set_message_compression_threshold()
+ * are sent compressed over connections where the other server accepted it.
+ * Large payloads are compressed in the thread pool. A payload is sent as is if
+ * compressing it would not make it smaller.
+ *
+ * Servers running versions of this library that predate this option can't
+ * accept connections offering compression, so it should be enabled only once
+ * all servers in the cluster have been upgraded.
+ *
+ * Return #RAFT_INVALID if @enabled is true but the library was built without
+ * compression support. The default is false.
+ */
+RAFT_API int raft_uv_set_message_compression(struct raft_io *io, bool enabled);
+
+/**
+ * Set the minimum size in bytes of an AppendEntries payload for it to be
+ * compressed. The default is 4096 bytes.
+ */
+RAFT_API void raft_uv_set_message_compression_threshold(struct raft_io *io,
+                                                        size_t size);
+
+/**
+ * Return the total number of bytes saved so far by compressing AppendEntries
+ * payloads.
+ */
+RAFT_API unsigned long long raft_uv_message_compression_saved(
+    struct raft_io *io);
+
 /**
  * Emit low-level debug messages using the given tracer.
  */
@@ -150,6 +230,8 @@ struct raft_uv_connect
 {
     void *data;            /* User data */
     raft_uv_connect_cb cb; /* Callback */
+    unsigned codecs;       /* Bitmask of compression codecs to offer */
+    unsigned codec;        /* Compression codec accepted by the peer */
 };
 
 /**
@@ -200,6 +282,11 @@ struct raft_uv_transport
      * The @cb callback must be invoked when the connection has been established
      * or the connection attempt has failed. The memory pointed by @req can be
      * released only after @cb has fired.
+     *
+     * If the @codecs field of @req has the bit of any compression codec set,
+     * the implementation may offer those codecs to the other server and set
+     * the @codec field to the one it accepted. Implementations that don't
+     * support compression must leave @codec untouched.
      */
     int (*connect)(struct raft_uv_transport *t,
                    struct raft_uv_connect *req,
@@ -234,4 +321,105 @@ RAFT_API int raft_uv_tcp_init(struct raft_uv_transport *t,
  */
 RAFT_API void raft_uv_tcp_close(struct raft_uv_transport *t);
 
+/**
+ * Host for several raft groups running in the same process, sharing a single
+ * transport.
+ *
+ * The @raft_io instances of all groups attached to the same host send and
+ * receive messages through a single set of connections, one per peer node:
+ * each message is tagged with the ID of the group it belongs to, and incoming
+ * messages are dispatched to the group with the matching ID. All groups are
+ * also driven by a single tick timer, so heartbeats of all groups directed to
+ * the same node go out together, in a single write.
+ */
+struct raft_uv_host
+{
+    void *data; /* User data */
+    void *impl; /* Implementation-defined state */
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+};
+
+/**
+ * Callback invoked after a host has been closed.
+ */
+typedef void (*raft_uv_host_close_cb)(struct raft_uv_host *host);
+
+/**
+ * Initialize a host that uses the given transport.
+ *
+ * The @transport object must not be used by any other @raft_io instance.
+ */
+RAFT_API int raft_uv_host_init(struct raft_uv_host *host,
+                               struct uv_loop_s *loop,
+                               struct raft_uv_transport *transport);
+
+/**
+ * Initialize the transport of the given host for the server with the given ID
+ * and address, and start accepting connections.
+ *
+ * If this function fails, raft_uv_host_close() must still be called.
+ */
+RAFT_API int raft_uv_host_start(struct raft_uv_host *host,
+                                raft_id id,
+                                const char *address);
+
+/**
+ * Open a write-ahead log in the given directory, shared by all groups of the
+ * host, and used to store their entries in place of their own segments.
+ *
+ * Entries appended by different groups are interleaved in the same files, and
+ * all appends submitted in the same loop iteration are written out and synced
+ * together, with a single fsync. Metadata and snapshots are still stored in
+ * the data directory of each group.
+ *
+ * This function must be called before any group is initialized with
+ * raft_uv_init_group(). A new file of the log is started whenever the current
+ * one grows past the segment size set with raft_uv_set_segment_size() on the
+ * @raft_io instance returned by raft_uv_host_io(), which must be called first.
+ *
+ * Groups attached to a shared log can't read evicted entries back, so their
+ * log cache size set with raft_set_log_cache_size() is ignored.
+ */
+RAFT_API int raft_uv_host_set_wal(struct raft_uv_host *host, const char *dir);
+
+/**
+ * Return the @raft_io instance that the host uses to send and receive messages.
+ *
+ * It can only be passed to the raft_uv_set_*() functions that tune networking,
+ * i.e. raft_uv_set_connect_retry_delay(), raft_uv_set_message_compression(),
+ * raft_uv_set_message_compression_threshold() and raft_uv_set_tracer(), and to
+ * raft_uv_set_segment_size() to size the files of the shared write-ahead log.
+ * Send batching is always enabled.
+ */
+RAFT_API struct raft_io *raft_uv_host_io(struct raft_uv_host *host);
+
+/**
+ * Close the given host, which must have no attached group anymore, and
+ * release its memory. If the host was started, the transport gets closed too.
+ */
+RAFT_API void raft_uv_host_close(struct raft_uv_host *host,
+                                 raft_uv_host_close_cb cb);
+
+/**
+ * Configure the given @raft_io instance to use a libuv-based I/O
+ * implementation for the raft group with the given ID, attached to the given
+ * host.
+ *
+ * This works like raft_uv_init(), except that the instance doesn't open any
+ * connection of its own: messages are sent and received through the host,
+ * which must have been started. The ID passed to @raft_io->init must be the
+ * one of the host, and all groups must be closed before the host.
+ *
+ * Group IDs must be greater than zero and lower than 2^48. All nodes must use
+ * the same ID for the same group.
+ *
+ * The @raft_io->start method ignores its @msecs argument if another group of
+ * the same host has been started already, and uses the tick interval of the
+ * host timer instead.
+ */
+RAFT_API int raft_uv_init_group(struct raft_io *io,
+                                struct raft_uv_host *host,
+                                const char *dir,
+                                unsigned long long group);
+
 #endif /* RAFT_UV_H */
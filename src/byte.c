@@ -1,5 +1,14 @@
 #include "byte.h"
 
+#if defined(BYTE__CRC32_CLMUL)
+#include <immintrin.h>
+#endif
+
+#if defined(BYTE__CRC32_ARM)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
 /* Taken from https://github.com/gcc-mirror/gcc/blob/master/libiberty/crc32.c */
 static const unsigned byteCrcTable[] = {
     0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
@@ -46,7 +55,11 @@ static const unsigned byteCrcTable[] = {
     0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf, 0xa2f33668,
     0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4};
 
-unsigned byteCrc32(const void *buf, const size_t size, const unsigned init)
+/* Byte-at-a-time implementation, used as reference and before the faster ones
+ * have been set up. */
+static unsigned byteCrc32Table(const void *buf,
+                               const size_t size,
+                               const unsigned init)
 {
     unsigned crc = init;
     uint8_t *cursor = (uint8_t *)buf;
@@ -59,6 +72,238 @@ unsigned byteCrc32(const void *buf, const size_t size, const unsigned init)
     return crc;
 }
 
+/* Tables for the slicing-by-8 implementation. The k'th table maps a byte to
+ * the CRC of that byte followed by k zero bytes, so the first one is the same
+ * as byteCrcTable. */
+static uint32_t byteCrcSlices[8][256];
+
+static void byteCrc32InitSlices(void)
+{
+    unsigned i;
+    unsigned k;
+    for (i = 0; i < 256; i++) {
+        byteCrcSlices[0][i] = byteCrcTable[i];
+    }
+    for (k = 1; k < 8; k++) {
+        for (i = 0; i < 256; i++) {
+            uint32_t crc = byteCrcSlices[k - 1][i];
+            byteCrcSlices[k][i] = (crc << 8) ^ byteCrcSlices[0][crc >> 24];
+        }
+    }
+}
+
+/* Process 8 bytes at a time, using one table lookup per byte but without the
+ * dependency chain of the byte-at-a-time loop. */
+static unsigned byteCrc32Slice8(const void *buf,
+                                const size_t size,
+                                const unsigned init)
+{
+    const uint8_t *cursor = buf;
+    size_t count = size;
+    uint32_t crc = init;
+
+    while (count >= 8) {
+        uint32_t one = crc ^ ((uint32_t)cursor[0] << 24 |
+                              (uint32_t)cursor[1] << 16 |
+                              (uint32_t)cursor[2] << 8 | (uint32_t)cursor[3]);
+        crc = byteCrcSlices[7][one >> 24] ^
+              byteCrcSlices[6][(one >> 16) & 255] ^
+              byteCrcSlices[5][(one >> 8) & 255] ^
+              byteCrcSlices[4][one & 255] ^ byteCrcSlices[3][cursor[4]] ^
+              byteCrcSlices[2][cursor[5]] ^ byteCrcSlices[1][cursor[6]] ^
+              byteCrcSlices[0][cursor[7]];
+        cursor += 8;
+        count -= 8;
+    }
+    while (count--) {
+        crc = (crc << 8) ^ byteCrcSlices[0][((crc >> 24) ^ *cursor) & 255];
+        cursor++;
+    }
+    return crc;
+}
+
+#if defined(BYTE__CRC32_CLMUL)
+/* Folding constants, i.e. x^n mod P for the CRC32 polynomial P. The high 64
+ * bits of a 128-bit block are multiplied by x^(d+64) mod P and the low ones by
+ * x^d mod P to move the block d bits forward. */
+#define BYTE__CRC32_K576 0x8833794c /* Fold by 4 blocks */
+#define BYTE__CRC32_K512 0xe6228b11
+#define BYTE__CRC32_K192 0xc5b9cd4c /* Fold by 1 block */
+#define BYTE__CRC32_K128 0xe8a45605
+
+#define BYTE__CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+
+/* Load 16 bytes as a 128-bit polynomial whose highest degree term is the most
+ * significant bit of the first byte. */
+BYTE__CLMUL_TARGET static inline __m128i byteCrc32Load(const uint8_t *p,
+                                                       __m128i swap)
+{
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), swap);
+}
+
+BYTE__CLMUL_TARGET static inline __m128i byteCrc32Fold(__m128i x,
+                                                       __m128i k,
+                                                       __m128i next)
+{
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+/* Fold the input 64 bytes at a time with carry-less multiplications, keeping
+ * a 128-bit remainder congruent to the data consumed so far. The remainder is
+ * then reduced to 32 bits by running it through the table implementation. */
+BYTE__CLMUL_TARGET static unsigned byteCrc32Clmul(const void *buf,
+                                                  const size_t size,
+                                                  const unsigned init)
+{
+    const __m128i swap =
+        _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const uint8_t *cursor = buf;
+    size_t count = size;
+    uint8_t block[16];
+    __m128i x0, x1, x2, x3;
+    __m128i k;
+
+    if (count < 64) {
+        return byteCrc32Slice8(buf, size, init);
+    }
+
+    /* Appending the CRC computed so far is equivalent to xor'ing it into the
+     * first 32 bits of the remaining data. */
+    x0 = _mm_xor_si128(byteCrc32Load(cursor, swap),
+                       _mm_set_epi32((int)init, 0, 0, 0));
+    x1 = byteCrc32Load(cursor + 16, swap);
+    x2 = byteCrc32Load(cursor + 32, swap);
+    x3 = byteCrc32Load(cursor + 48, swap);
+    cursor += 64;
+    count -= 64;
+
+    k = _mm_set_epi64x(BYTE__CRC32_K576, BYTE__CRC32_K512);
+    while (count >= 64) {
+        x0 = byteCrc32Fold(x0, k, byteCrc32Load(cursor, swap));
+        x1 = byteCrc32Fold(x1, k, byteCrc32Load(cursor + 16, swap));
+        x2 = byteCrc32Fold(x2, k, byteCrc32Load(cursor + 32, swap));
+        x3 = byteCrc32Fold(x3, k, byteCrc32Load(cursor + 48, swap));
+        cursor += 64;
+        count -= 64;
+    }
+
+    k = _mm_set_epi64x(BYTE__CRC32_K192, BYTE__CRC32_K128);
+    x1 = byteCrc32Fold(x0, k, x1);
+    x2 = byteCrc32Fold(x1, k, x2);
+    x3 = byteCrc32Fold(x2, k, x3);
+    while (count >= 16) {
+        x3 = byteCrc32Fold(x3, k, byteCrc32Load(cursor, swap));
+        cursor += 16;
+        count -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *)block, _mm_shuffle_epi8(x3, swap));
+    return byteCrc32Slice8(cursor, count, byteCrc32Slice8(block, 16, 0));
+}
+#endif /* BYTE__CRC32_CLMUL */
+
+#if defined(BYTE__CRC32_ARM)
+#if defined(__clang__)
+#define BYTE__ARM_TARGET __attribute__((target("crc")))
+#else
+#define BYTE__ARM_TARGET __attribute__((target("+crc")))
+#endif
+
+static inline uint64_t byteRbit64(uint64_t v)
+{
+    __asm__("rbit %x0, %x1" : "=r"(v) : "r"(v));
+    return v;
+}
+
+static inline uint32_t byteRbit32(uint32_t v)
+{
+    __asm__("rbit %w0, %w1" : "=r"(v) : "r"(v));
+    return v;
+}
+
+/* The ARMv8 CRC32 instructions compute the bit-reflected variant of our CRC,
+ * which processes bytes least significant bit first. Reversing the bits of
+ * each input byte and of the CRC register gives back the same checksum. */
+BYTE__ARM_TARGET static unsigned byteCrc32Arm(const void *buf,
+                                              const size_t size,
+                                              const unsigned init)
+{
+    const uint8_t *cursor = buf;
+    size_t count = size;
+    uint32_t crc = byteRbit32(init);
+
+    while (count >= 8) {
+        uint64_t word;
+        memcpy(&word, cursor, sizeof word);
+        /* Reverse the bits of each byte, keeping the byte order. */
+        word = __builtin_bswap64(byteRbit64(word));
+        crc = __crc32d(crc, word);
+        cursor += 8;
+        count -= 8;
+    }
+    while (count--) {
+        crc = __crc32b(crc, (uint8_t)(byteRbit32(*cursor) >> 24));
+        cursor++;
+    }
+    return byteRbit32(crc);
+}
+#endif /* BYTE__CRC32_ARM */
+
+/* Implementation used by byteCrc32(), upgraded at load time to the fastest one
+ * supported by the CPU. */
+static unsigned (*byteCrc32Best)(const void *buf,
+                                 size_t size,
+                                 unsigned init) = byteCrc32Table;
+
+__attribute__((constructor)) static void byteCrc32Init(void)
+{
+    byteCrc32InitSlices();
+    byteCrc32Best = byteCrc32Slice8;
+#if defined(BYTE__CRC32_CLMUL)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+        byteCrc32Best = byteCrc32Clmul;
+    }
+#endif
+#if defined(BYTE__CRC32_ARM)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        byteCrc32Best = byteCrc32Arm;
+    }
+#endif
+}
+
+unsigned byteCrc32(const void *buf, const size_t size, const unsigned init)
+{
+    return byteCrc32Best(buf, size, init);
+}
+
+byteCrc32Fn byteCrc32Impl(int impl)
+{
+    switch (impl) {
+        case BYTE_CRC32_TABLE:
+            return byteCrc32Table;
+        case BYTE_CRC32_SLICE8:
+            return byteCrc32Slice8;
+#if defined(BYTE__CRC32_CLMUL)
+        case BYTE_CRC32_CLMUL:
+            if (byteCrc32Best == byteCrc32Clmul) {
+                return byteCrc32Clmul;
+            }
+            break;
+#endif
+#if defined(BYTE__CRC32_ARM)
+        case BYTE_CRC32_ARM:
+            if (byteCrc32Best == byteCrc32Arm) {
+                return byteCrc32Arm;
+            }
+            break;
+#endif
+    }
+    return NULL;
+}
+
 /* ================ sha1.c ================ */
 /*
 SHA-1 in C
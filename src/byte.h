@@ -175,9 +175,35 @@ BYTE__INLINE size_t bytePad64(size_t size)
     return size;
 }
 
-/* Calculate the CRC32 checksum of the given data buffer. */
+/* Calculate the CRC32 checksum of the given data buffer.
+ *
+ * The fastest implementation supported by the CPU is picked at load time, all
+ * of them produce the same checksum. */
 unsigned byteCrc32(const void *buf, size_t size, unsigned init);
 
+/* Hardware accelerated CRC32 implementations available on this platform. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BYTE__CRC32_CLMUL /* Carry-less multiplication (PCLMULQDQ). */
+#endif
+#if defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#define BYTE__CRC32_ARM /* ARMv8 CRC32 instructions. */
+#endif
+
+/* Codes of the CRC32 implementations. */
+enum {
+    BYTE_CRC32_TABLE = 0, /* Byte at a time table lookup. */
+    BYTE_CRC32_SLICE8,    /* Slicing-by-8 table lookup. */
+    BYTE_CRC32_CLMUL,     /* Folding with PCLMULQDQ on x86-64. */
+    BYTE_CRC32_ARM,       /* ARMv8 CRC32 instructions. */
+    BYTE_CRC32_N
+};
+
+typedef unsigned (*byteCrc32Fn)(const void *buf, size_t size, unsigned init);
+
+/* Return the given CRC32 implementation, or NULL if it's not supported on this
+ * CPU. Meant for tests and benchmarks. */
+byteCrc32Fn byteCrc32Impl(int impl);
+
 struct byteSha1
 {
     uint32_t state[5];
@@ -6,6 +6,7 @@
 #include "membership.h"
 #include "progress.h"
 #include "queue.h"
+#include "read_index.h"
 #include "replication.h"
 #include "request.h"
 #include "tracing.h"
@@ -116,6 +117,46 @@ err:
     return rv;
 }
 
+int raft_read_index(struct raft *r,
+                    struct raft_read_index *req,
+                    raft_read_index_cb cb)
+{
+    bool is_leader;
+    bool has_leader;
+    int rv;
+
+    is_leader = r->state == RAFT_LEADER && r->transfer == NULL;
+    has_leader = r->state == RAFT_FOLLOWER &&
+                 r->follower_state.current_leader.id != 0;
+    if (!is_leader && !has_leader) {
+        rv = RAFT_NOTLEADER;
+        ErrMsgFromCode(r->errmsg, rv);
+        goto err;
+    }
+
+    req->cb = cb;
+
+    rv = readIndexSubmit(r, req);
+    if (rv != 0) {
+        goto err;
+    }
+
+    return 0;
+
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+bool raft_lease_valid(struct raft *r, raft_index *index)
+{
+    if (!readIndexLeaseIsValid(r)) {
+        return false;
+    }
+    *index = r->commit_index;
+    return true;
+}
+
 static int clientChangeConfiguration(
     struct raft *r,
     struct raft_change *req,
@@ -147,7 +188,9 @@ static int clientChangeConfiguration(
     if (configuration != &r->configuration) {
         raft_configuration_close(&r->configuration);
         r->configuration = *configuration;
+        configurationHashRebuild(r);
     }
+    progressRebuildQuorum(r);
 
     /* Start writing the new log entry to disk and send it to the followers. */
     rv = replicationTrigger(r, index);
@@ -237,7 +280,7 @@ int raft_assign(struct raft *r,
         return rv;
     }
 
-    server = configurationGet(&r->configuration, id);
+    server = configurationHashGet(r, id);
     if (server == NULL) {
         rv = RAFT_NOTFOUND;
         ErrMsgPrintf(r->errmsg, "no server has ID %llu", id);
@@ -267,7 +310,7 @@ int raft_assign(struct raft *r,
         goto err;
     }
 
-    server_index = configurationIndexOf(&r->configuration, id);
+    server_index = configurationHashIndexOf(r, id);
     assert(server_index < r->configuration.n);
 
     last_index = logLastIndex(&r->log);
@@ -288,6 +331,7 @@ int raft_assign(struct raft *r,
         rv = clientChangeConfiguration(r, req, &r->configuration);
         if (rv != 0) {
             r->configuration.servers[server_index].role = old_role;
+            progressRebuildQuorum(r);
             return rv;
         }
 
@@ -330,7 +374,7 @@ int raft_remove(struct raft *r,
         return rv;
     }
 
-    server = configurationGet(&r->configuration, id);
+    server = configurationHashGet(r, id);
     if (server == NULL) {
         rv = RAFT_BADID;
         goto err;
@@ -418,7 +462,7 @@ int raft_transfer(struct raft *r,
         }
     }
 
-    server = configurationGet(&r->configuration, id);
+    server = configurationHashGet(r, id);
     if (server == NULL || server->id == r->id || server->role != RAFT_VOTER) {
         rv = RAFT_BADID;
         ErrMsgFromCode(r->errmsg, rv);
@@ -427,7 +471,7 @@ int raft_transfer(struct raft *r,
 
     /* If this follower is up-to-date, we can send it the TimeoutNow message
      * right away. */
-    i = configurationIndexOf(&r->configuration, server->id);
+    i = configurationHashIndexOf(r, server->id);
     assert(i < r->configuration.n);
 
     membershipLeadershipTransferInit(r, req, id, cb);
@@ -0,0 +1,208 @@
+#include "compress.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef RAFT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "assert.h"
+#include "err.h"
+#include "heap.h"
+
+bool compressionIsAvailable(unsigned codec)
+{
+    switch (codec) {
+        case COMPRESSION_NONE:
+            return true;
+#ifdef RAFT_HAVE_ZLIB
+        case COMPRESSION_DEFLATE:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+#ifdef RAFT_HAVE_ZLIB
+
+/* Route zlib's internal allocations through the raft heap. */
+static voidpf compressionAlloc(voidpf opaque, uInt items, uInt size)
+{
+    (void)opaque;
+    return HeapCalloc(items, size);
+}
+
+static void compressionFree(voidpf opaque, voidpf address)
+{
+    (void)opaque;
+    HeapFree(address);
+}
+
+static void compressionStreamInit(z_stream *stream)
+{
+    memset(stream, 0, sizeof *stream);
+    stream->zalloc = compressionAlloc;
+    stream->zfree = compressionFree;
+}
+
+/* Feed at most UINT_MAX bytes at a time, since zlib's counters are 32-bit. */
+static uInt compressionChunk(size_t len)
+{
+    return len > UINT_MAX ? UINT_MAX : (uInt)len;
+}
+
+static int deflateEncode(const struct raft_buffer bufs[],
+                         unsigned n_bufs,
+                         struct raft_buffer *out,
+                         char *errmsg)
+{
+    z_stream stream;
+    size_t len = 0;
+    size_t cap;
+    unsigned i;
+    int rv;
+
+    for (i = 0; i < n_bufs; i++) {
+        len += bufs[i].len;
+    }
+
+    compressionStreamInit(&stream);
+    rv = deflateInit(&stream, Z_BEST_SPEED);
+    if (rv != Z_OK) {
+        ErrMsgPrintf(errmsg, "deflate init: %s", zError(rv));
+        return rv == Z_MEM_ERROR ? RAFT_NOMEM : RAFT_IOERR;
+    }
+
+    /* Size the output for the worst case, so that each call to deflate()
+     * consumes all of its input. */
+    cap = deflateBound(&stream, (uLong)len);
+    out->base = HeapMalloc(cap);
+    if (out->base == NULL) {
+        ErrMsgOom(errmsg);
+        deflateEnd(&stream);
+        return RAFT_NOMEM;
+    }
+
+    stream.next_out = out->base;
+    for (i = 0; i < n_bufs && rv == Z_OK; i++) {
+        const uint8_t *cursor = bufs[i].base;
+        size_t left = bufs[i].len;
+        while (left > 0 && rv == Z_OK) {
+            uInt chunk = compressionChunk(left);
+            stream.next_in = (Bytef *)cursor;
+            stream.avail_in = chunk;
+            stream.avail_out = compressionChunk(cap - stream.total_out);
+            rv = deflate(&stream, Z_NO_FLUSH);
+            cursor += chunk - stream.avail_in;
+            left -= chunk - stream.avail_in;
+        }
+    }
+    while (rv == Z_OK) {
+        stream.avail_out = compressionChunk(cap - stream.total_out);
+        rv = deflate(&stream, Z_FINISH);
+    }
+    out->len = stream.total_out;
+
+    deflateEnd(&stream);
+
+    if (rv != Z_STREAM_END) {
+        ErrMsgPrintf(errmsg, "deflate: %s", zError(rv));
+        HeapFree(out->base);
+        return RAFT_IOERR;
+    }
+
+    return 0;
+}
+
+static int deflateDecode(const struct raft_buffer *buf,
+                         size_t len,
+                         struct raft_buffer *out,
+                         char *errmsg)
+{
+    z_stream stream;
+    const uint8_t *cursor = buf->base;
+    size_t left = buf->len;
+    int rv;
+
+    out->len = len;
+    out->base = HeapMalloc(len > 0 ? len : 1);
+    if (out->base == NULL) {
+        ErrMsgOom(errmsg);
+        return RAFT_NOMEM;
+    }
+
+    compressionStreamInit(&stream);
+    rv = inflateInit(&stream);
+    if (rv != Z_OK) {
+        ErrMsgPrintf(errmsg, "inflate init: %s", zError(rv));
+        HeapFree(out->base);
+        return rv == Z_MEM_ERROR ? RAFT_NOMEM : RAFT_IOERR;
+    }
+
+    stream.next_out = out->base;
+    do {
+        uInt chunk = compressionChunk(left);
+        stream.next_in = (Bytef *)cursor;
+        stream.avail_in = chunk;
+        stream.avail_out = compressionChunk(len - stream.total_out);
+        rv = inflate(&stream, Z_NO_FLUSH);
+        cursor += chunk - stream.avail_in;
+        left -= chunk - stream.avail_in;
+    } while (rv == Z_OK);
+
+    inflateEnd(&stream);
+
+    if (rv != Z_STREAM_END || stream.total_out != len) {
+        ErrMsgPrintf(errmsg, "inflate: %s",
+                     rv == Z_STREAM_END ? "size mismatch" : zError(rv));
+        HeapFree(out->base);
+        return RAFT_CORRUPT;
+    }
+
+    return 0;
+}
+
+#endif /* RAFT_HAVE_ZLIB */
+
+int compressionEncode(unsigned codec,
+                      const struct raft_buffer bufs[],
+                      unsigned n_bufs,
+                      struct raft_buffer *out,
+                      char *errmsg)
+{
+    switch (codec) {
+#ifdef RAFT_HAVE_ZLIB
+        case COMPRESSION_DEFLATE:
+            return deflateEncode(bufs, n_bufs, out, errmsg);
+#endif
+        default:
+            (void)bufs;
+            (void)n_bufs;
+            (void)out;
+            ErrMsgPrintf(errmsg, "unsupported compression codec %u", codec);
+            return RAFT_INVALID;
+    }
+}
+
+int compressionDecode(unsigned codec,
+                      const struct raft_buffer *buf,
+                      size_t len,
+                      struct raft_buffer *out,
+                      char *errmsg)
+{
+    switch (codec) {
+#ifdef RAFT_HAVE_ZLIB
+        case COMPRESSION_DEFLATE:
+            return deflateDecode(buf, len, out, errmsg);
+#endif
+        default:
+            (void)buf;
+            (void)len;
+            (void)out;
+            ErrMsgPrintf(errmsg, "unsupported compression codec %u", codec);
+            return RAFT_MALFORMED;
+    }
+}
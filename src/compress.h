@@ -0,0 +1,34 @@
+/* Compression of snapshot data and message payloads. */
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include "../include/raft.h"
+
+/* Codecs that can be used to compress data. The numeric values are part of the
+ * on-disk and wire formats, so they must never change. */
+enum {
+    COMPRESSION_NONE = 0,
+    COMPRESSION_DEFLATE /* Deflate with zlib framing, tuned for speed. */
+};
+
+/* Return true if support for the given codec was compiled in. */
+bool compressionIsAvailable(unsigned codec);
+
+/* Compress the concatenation of the given buffers into a single newly
+ * allocated buffer, using the given codec. */
+int compressionEncode(unsigned codec,
+                      const struct raft_buffer bufs[],
+                      unsigned n_bufs,
+                      struct raft_buffer *out,
+                      char *errmsg);
+
+/* Decompress the given buffer into a newly allocated buffer, which must have
+ * the given length once decompressed. */
+int compressionDecode(unsigned codec,
+                      const struct raft_buffer *buf,
+                      size_t len,
+                      struct raft_buffer *out,
+                      char *errmsg);
+
+#endif /* COMPRESS_H_ */
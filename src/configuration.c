@@ -6,6 +6,11 @@
 /* Current encoding format version. */
 #define ENCODING_FORMAT 1
 
+/* Minimum number of servers for which r->configuration gets a hash table
+ * mapping server IDs to positions in the servers array. Below that a linear
+ * scan is just as fast and saves an allocation. */
+#define HASH_THRESHOLD 16
+
 void configurationInit(struct raft_configuration *c)
 {
     c->servers = NULL;
@@ -209,6 +214,102 @@ int configurationRemove(struct raft_configuration *c, const raft_id id)
     return 0;
 }
 
+/* Return the first slot of a hash table of the given size to probe for the
+ * given server ID. */
+static unsigned hashSlot(raft_id id, unsigned size)
+{
+    /* Multiplicative hashing, the size of the table is a power of two. */
+    return (unsigned)((id * 0x9E3779B97F4A7C15ULL) & (size - 1));
+}
+
+void configurationHashClose(struct raft *r)
+{
+    if (r->configuration_hash.slots != NULL) {
+        raft_free(r->configuration_hash.slots);
+    }
+    r->configuration_hash.slots = NULL;
+    r->configuration_hash.size = 0;
+}
+
+void configurationHashRebuild(struct raft *r)
+{
+    const struct raft_configuration *c = &r->configuration;
+    unsigned *slots;
+    unsigned size;
+    unsigned slot;
+    unsigned i;
+
+    if (c->n < HASH_THRESHOLD) {
+        configurationHashClose(r);
+        return;
+    }
+
+    /* Keep the table at most half full, so probe sequences stay short. */
+    size = HASH_THRESHOLD * 2;
+    while (c->n * 2 > size) {
+        size *= 2;
+    }
+    if (size != r->configuration_hash.size) {
+        slots = raft_malloc(size * sizeof *slots);
+        configurationHashClose(r);
+        if (slots == NULL) {
+            return;
+        }
+        r->configuration_hash.slots = slots;
+        r->configuration_hash.size = size;
+    }
+
+    /* Use linear probing. Slots hold the position of a server plus one, or
+     * zero if free. */
+    slots = r->configuration_hash.slots;
+    memset(slots, 0, size * sizeof *slots);
+    for (i = 0; i < c->n; i++) {
+        slot = hashSlot(c->servers[i].id, size);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        slots[slot] = i + 1;
+    }
+}
+
+unsigned configurationHashIndexOf(const struct raft *r, const raft_id id)
+{
+    const struct raft_configuration *c = &r->configuration;
+    const unsigned *slots = r->configuration_hash.slots;
+    unsigned size = r->configuration_hash.size;
+    unsigned slot;
+    unsigned i;
+
+    if (slots == NULL) {
+        return configurationIndexOf(c, id);
+    }
+
+    slot = hashSlot(id, size);
+    while (slots[slot] != 0) {
+        i = slots[slot] - 1;
+        assert(i < c->n);
+        if (c->servers[i].id == id) {
+            return i;
+        }
+        slot = (slot + 1) & (size - 1);
+    }
+    return c->n;
+}
+
+const struct raft_server *configurationHashGet(const struct raft *r,
+                                               const raft_id id)
+{
+    unsigned i;
+    assert(id > 0);
+
+    i = configurationHashIndexOf(r, id);
+    if (i == r->configuration.n) {
+        return NULL;
+    }
+
+    return &r->configuration.servers[i];
+}
+
 size_t configurationEncodedSize(const struct raft_configuration *c)
 {
     size_t n = 0;
@@ -40,6 +40,24 @@ const struct raft_server *configurationGet(const struct raft_configuration *c,
  * an existing server in the configuration. */
 int configurationRemove(struct raft_configuration *c, raft_id id);
 
+/* Rebuild the hash table mapping server IDs to positions in r->configuration.
+ * This must be called whenever r->configuration is replaced or servers get
+ * added to or removed from it. Small configurations don't get a table, and if
+ * allocating it fails lookups just fall back to a linear scan. */
+void configurationHashRebuild(struct raft *r);
+
+/* Release the hash table of r->configuration. */
+void configurationHashClose(struct raft *r);
+
+/* Like configurationIndexOf() against r->configuration, but using its hash
+ * table if there is one. */
+unsigned configurationHashIndexOf(const struct raft *r, raft_id id);
+
+/* Like configurationGet() against r->configuration, but using its hash table if
+ * there is one. */
+const struct raft_server *configurationHashGet(const struct raft *r,
+                                               raft_id id);
+
 /* Add all servers in c1 to c2 (which must be empty). */
 int configurationCopy(const struct raft_configuration *src,
                       struct raft_configuration *dst);
@@ -7,6 +7,9 @@
 #include "membership.h"
 #include "progress.h"
 #include "queue.h"
+#include "read_index.h"
+#include "recv_install_snapshot.h"
+#include "replication.h"
 #include "request.h"
 
 /* Set to 1 to enable tracing. */
@@ -37,6 +40,11 @@ static void convertSetState(struct raft *r, unsigned short new_state)
 /* Clear follower state. */
 static void convertClearFollower(struct raft *r)
 {
+    /* Fail all pending read requests. */
+    readIndexFail(r, RAFT_LEADERSHIPLOST);
+
+    recvInstallSnapshotDiscard(r);
+
     r->follower_state.current_leader.id = 0;
     if (r->follower_state.current_leader.address != NULL) {
         raft_free(r->follower_state.current_leader.address);
@@ -77,10 +85,7 @@ static void convertFailChange(struct raft_change *req)
 /* Clear leader state. */
 static void convertClearLeader(struct raft *r)
 {
-    if (r->leader_state.progress != NULL) {
-        raft_free(r->leader_state.progress);
-        r->leader_state.progress = NULL;
-    }
+    progressFreeArray(r);
 
     /* Fail all outstanding requests */
     while (!QUEUE_IS_EMPTY(&r->leader_state.requests)) {
@@ -100,6 +105,9 @@ static void convertClearLeader(struct raft *r)
         };
     }
 
+    /* Fail all pending read requests. */
+    readIndexFail(r, RAFT_LEADERSHIPLOST);
+
     /* Fail any promote request that is still outstanding because the server is
      * still catching up and no entry was submitted. */
     if (r->leader_state.change != NULL) {
@@ -128,6 +136,11 @@ static void convertClear(struct raft *r)
 
 void convertToFollower(struct raft *r)
 {
+    /* Entries that were waiting for a group commit are still part of our log,
+     * so store them. */
+    if (r->state == RAFT_LEADER) {
+        replicationFlushDeferred(r, true);
+    }
     convertClear(r);
     convertSetState(r, RAFT_FOLLOWER);
 
@@ -136,6 +149,13 @@ void convertToFollower(struct raft *r)
 
     r->follower_state.current_leader.id = 0;
     r->follower_state.current_leader.address = NULL;
+
+    /* Reset read requests queue. */
+    QUEUE_INIT(&r->follower_state.reads);
+    r->follower_state.read_seq = 0;
+    r->follower_state.read_done = 0;
+    r->follower_state.read_start = 0;
+    r->follower_state.install = NULL;
 }
 
 int convertToCandidate(struct raft *r, bool disrupt_leader)
@@ -159,7 +179,7 @@ int convertToCandidate(struct raft *r, bool disrupt_leader)
 
     /* Fast-forward to leader if we're the only voting server in the
      * configuration. */
-    server = configurationGet(&r->configuration, r->id);
+    server = configurationHashGet(r, r->id);
     assert(server != NULL);
     assert(server->role == RAFT_VOTER);
 
@@ -192,6 +212,13 @@ int convertToLeader(struct raft *r)
     /* Reset apply requests queue */
     QUEUE_INIT(&r->leader_state.requests);
 
+    /* Reset read requests queue and confirmation rounds. */
+    QUEUE_INIT(&r->leader_state.reads);
+    r->leader_state.read_round = 0;
+    r->leader_state.read_acked = 0;
+    r->lease.round_start = 0;
+    r->lease.expiry = 0;
+
     /* Allocate and initialize the progress array. */
     rv = progressBuildArray(r);
     if (rv != 0) {
@@ -215,6 +242,10 @@ void convertToUnavailable(struct raft *r)
     if (r->transfer != NULL) {
         membershipLeadershipTransferClose(r);
     }
+    if (r->state == RAFT_LEADER) {
+        replicationFlushDeferred(r, false);
+    }
+    electionDropHeld(r);
     convertClear(r);
     convertSetState(r, RAFT_UNAVAILABLE);
 }
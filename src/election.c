@@ -1,9 +1,13 @@
 #include "election.h"
 
+#include <string.h>
+
 #include "assert.h"
 #include "configuration.h"
+#include "convert.h"
 #include "heap.h"
 #include "log.h"
+#include "queue.h"
 #include "tracing.h"
 
 /* Set to 1 to enable tracing. */
@@ -53,19 +57,210 @@ bool electionTimerExpired(struct raft *r)
     return now - r->election_timer_start >= state->randomized_election_timeout;
 }
 
-static void sendRequestVoteCb(struct raft_io_send *send, int status)
+/* Return true if the I/O implementation stores the term and vote
+ * asynchronously. */
+static bool electionHasAsyncMeta(struct raft *r)
+{
+    return r->io->version >= 3 && r->io->async_set_term != NULL &&
+           r->io->async_set_vote != NULL;
+}
+
+/* Message held back until all pending term and vote updates are durable. */
+struct electionHeld
+{
+    struct raft_io_send send;    /* Underlying send request, once released */
+    struct raft_io_send *req;    /* Request submitted by the caller */
+    raft_io_send_cb cb;          /* Callback of the caller's request */
+    struct raft_message message; /* Message to send */
+    char *address;               /* Copy of the destination address */
+    queue queue;                 /* Link in the queue of held messages */
+};
+
+/* Fire the callback of the caller's request and release the held message. */
+static void electionHeldFinish(struct electionHeld *held, int status)
+{
+    if (held->cb != NULL) {
+        held->cb(held->req, status);
+    }
+    HeapFree(held->address);
+    HeapFree(held);
+}
+
+static void electionHeldSendCb(struct raft_io_send *send, int status)
+{
+    electionHeldFinish(send->data, status);
+}
+
+/* Send all messages held back so far. */
+static void electionReleaseHeld(struct raft *r)
+{
+    while (!QUEUE_IS_EMPTY(&r->meta.held)) {
+        struct electionHeld *held;
+        queue *head;
+        int rv;
+
+        head = QUEUE_HEAD(&r->meta.held);
+        QUEUE_REMOVE(head);
+        held = QUEUE_DATA(head, struct electionHeld, queue);
+
+        held->send.data = held;
+        rv = r->io->send(r->io, &held->send, &held->message,
+                         electionHeldSendCb);
+        if (rv != 0) {
+            /* This is not a critical failure, let's just log it. */
+            tracef("failed to send held message to server %llu: %s",
+                   held->message.server_id, raft_strerror(rv));
+            electionHeldFinish(held, rv);
+        }
+    }
+}
+
+void electionDropHeld(struct raft *r)
+{
+    while (!QUEUE_IS_EMPTY(&r->meta.held)) {
+        queue *head;
+        head = QUEUE_HEAD(&r->meta.held);
+        QUEUE_REMOVE(head);
+        electionHeldFinish(QUEUE_DATA(head, struct electionHeld, queue),
+                           RAFT_CANCELED);
+    }
+}
+
+static void electionSetMetaCb(struct raft_io_set_meta *req, int status)
+{
+    struct raft *r = req->data;
+    HeapFree(req);
+    assert(r->meta.pending > 0);
+    r->meta.pending--;
+    if (r->state == RAFT_UNAVAILABLE) {
+        return;
+    }
+    if (status != 0) {
+        tracef("failed to store term and vote: %s", raft_strerror(status));
+        convertToUnavailable(r);
+        return;
+    }
+    if (r->meta.pending == 0) {
+        electionReleaseHeld(r);
+    }
+}
+
+/* Allocate a request for the asynchronous term and vote methods. */
+static struct raft_io_set_meta *electionSetMetaReq(struct raft *r)
+{
+    struct raft_io_set_meta *req = HeapMalloc(sizeof *req);
+    if (req != NULL) {
+        req->data = r;
+    }
+    return req;
+}
+
+int electionSetTerm(struct raft *r, raft_term term)
+{
+    struct raft_io_set_meta *req;
+    int rv;
+
+    if (!electionHasAsyncMeta(r)) {
+        return r->io->set_term(r->io, term);
+    }
+
+    req = electionSetMetaReq(r);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    rv = r->io->async_set_term(r->io, req, term, electionSetMetaCb);
+    if (rv != 0) {
+        HeapFree(req);
+        return rv;
+    }
+    r->meta.pending++;
+
+    return 0;
+}
+
+int electionSetVote(struct raft *r, raft_id server_id)
+{
+    struct raft_io_set_meta *req;
+    int rv;
+
+    if (!electionHasAsyncMeta(r)) {
+        return r->io->set_vote(r->io, server_id);
+    }
+
+    req = electionSetMetaReq(r);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    rv = r->io->async_set_vote(r->io, req, server_id, electionSetMetaCb);
+    if (rv != 0) {
+        HeapFree(req);
+        return rv;
+    }
+    r->meta.pending++;
+
+    return 0;
+}
+
+int electionSend(struct raft *r,
+                 struct raft_io_send *req,
+                 const struct raft_message *message,
+                 raft_io_send_cb cb)
+{
+    struct electionHeld *held;
+
+    if (r->meta.pending == 0) {
+        return r->io->send(r->io, req, message, cb);
+    }
+
+    held = HeapMalloc(sizeof *held);
+    if (held == NULL) {
+        return RAFT_NOMEM;
+    }
+    held->address = HeapMalloc(strlen(message->server_address) + 1);
+    if (held->address == NULL) {
+        HeapFree(held);
+        return RAFT_NOMEM;
+    }
+    strcpy(held->address, message->server_address);
+    held->req = req;
+    held->cb = cb;
+    held->message = *message;
+    held->message.server_address = held->address;
+    QUEUE_PUSH(&r->meta.held, &held->queue);
+
+    return 0;
+}
+
+static void electionSendCb(struct raft_io_send *send, int status)
 {
     (void)status;
     HeapFree(send);
 }
 
+int electionSendMessage(struct raft *r, const struct raft_message *message)
+{
+    struct raft_io_send *send;
+    int rv;
+
+    send = HeapMalloc(sizeof *send);
+    if (send == NULL) {
+        return RAFT_NOMEM;
+    }
+    send->data = r;
+    rv = electionSend(r, send, message, electionSendCb);
+    if (rv != 0) {
+        HeapFree(send);
+        return rv;
+    }
+
+    return 0;
+}
+
 /* Send a RequestVote RPC to the given server. */
-static int electionSend(struct raft *r, const struct raft_server *server)
+static int electionSendRequestVote(struct raft *r, const struct raft_server *server)
 {
     struct raft_message message;
-    struct raft_io_send *send;
     raft_term term;
-    int rv;
     assert(server->id != r->id);
     assert(server->id != 0);
 
@@ -86,20 +281,7 @@ static int electionSend(struct raft *r, const struct raft_server *server)
     message.server_id = server->id;
     message.server_address = server->address;
 
-    send = HeapMalloc(sizeof *send);
-    if (send == NULL) {
-        return RAFT_NOMEM;
-    }
-
-    send->data = r;
-
-    rv = r->io->send(r->io, send, &message, sendRequestVoteCb);
-    if (rv != 0) {
-        HeapFree(send);
-        return rv;
-    }
-
-    return 0;
+    return electionSendMessage(r, &message);
 }
 
 int electionStart(struct raft *r)
@@ -129,7 +311,7 @@ int electionStart(struct raft *r)
      * that vote is no longer valid. */
     if (r->candidate_state.in_pre_vote) {
         /* Reset vote */
-        rv = r->io->set_vote(r->io, 0);
+        rv = electionSetVote(r, 0);
         if (rv != 0) {
             goto err;
         }
@@ -138,13 +320,13 @@ int electionStart(struct raft *r)
     } else {
         /* Increment current term */
         term = r->current_term + 1;
-        rv = r->io->set_term(r->io, term);
+        rv = electionSetTerm(r, term);
         if (rv != 0) {
             goto err;
         }
 
         /* Vote for self */
-        rv = r->io->set_vote(r->io, r->id);
+        rv = electionSetVote(r, r->id);
         if (rv != 0) {
             goto err;
         }
@@ -172,7 +354,7 @@ int electionStart(struct raft *r)
         if (server->id == r->id || server->role != RAFT_VOTER) {
             continue;
         }
-        rv = electionSend(r, server);
+        rv = electionSendRequestVote(r, server);
         if (rv != 0) {
             /* This is not a critical failure, let's just log it. */
             tracef("failed to send vote request to server %llu: %s", server->id,
@@ -201,7 +383,7 @@ int electionVote(struct raft *r,
     assert(args != NULL);
     assert(granted != NULL);
 
-    local_server = configurationGet(&r->configuration, r->id);
+    local_server = configurationHashGet(r, r->id);
 
     *granted = false;
 
@@ -262,7 +444,7 @@ int electionVote(struct raft *r,
 
 grant_vote:
     if (!args->pre_vote) {
-        rv = r->io->set_vote(r->io, args->candidate_id);
+        rv = electionSetVote(r, args->candidate_id);
         if (rv != 0) {
             return rv;
         }
@@ -37,6 +37,39 @@ void electionResetTimer(struct raft *r);
  * Must be called in follower or candidate state. */
 bool electionTimerExpired(struct raft *r);
 
+/* Persist the given term, resetting the vote. If the I/O implementation
+ * supports it, the update is submitted asynchronously and messages sent with
+ * electionSend() are held back until it's durable. */
+int electionSetTerm(struct raft *r, raft_term term);
+
+/* Persist the vote for the given server, like electionSetTerm(). */
+int electionSetVote(struct raft *r, raft_id server_id);
+
+/* Submit a send request like raft_io->send(), holding the message back until
+ * all term and vote updates submitted so far are durable. Every message
+ * carries our current term, and replies also reflect entries that we might
+ * have accepted only because of that term, so none of them can be sent before
+ * the term is stored.
+ *
+ * From Figure 3.1:
+ *
+ *   Persistent state on all servers: (Updated on stable storage before
+ *   responding to RPCs)
+ *
+ * If the message is held back and then dropped, @cb is invoked with
+ * RAFT_CANCELED. */
+int electionSend(struct raft *r,
+                 struct raft_io_send *req,
+                 const struct raft_message *message,
+                 raft_io_send_cb cb);
+
+/* Like electionSend(), but allocate the send request, which gets released
+ * once the message is sent. */
+int electionSendMessage(struct raft *r, const struct raft_message *message);
+
+/* Release all messages held back by electionSend() without sending them. */
+void electionDropHeld(struct raft *r);
+
 /* Start a new election round.
  *
  * From Figure 3.1:
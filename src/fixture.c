@@ -1,5 +1,6 @@
 #include "../include/raft/fixture.h"
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,11 +28,7 @@
 #define DISK_LATENCY 10
 
 /* To keep in sync with raft.h */
-#define N_MESSAGE_TYPES 5
-
-/* Maximum number of peer stub instances connected to a certain stub
- * instance. This should be enough for testing purposes. */
-#define MAX_PEERS 8
+#define N_MESSAGE_TYPES 9
 
 /* Fields common across all request types. */
 #define REQUEST                                                            \
@@ -40,7 +37,18 @@
     queue queue                /* Link the I/O pending requests queue. */
 
 /* Request type codes. */
-enum { APPEND = 1, SEND, TRANSMIT, SNAPSHOT_PUT, SNAPSHOT_GET };
+enum {
+    APPEND = 1,
+    SEND,
+    TRANSMIT,
+    SNAPSHOT_PUT,
+    SNAPSHOT_GET,
+    DEFER,
+    SET_META,
+    READ,
+    SNAPSHOT_READ,
+    SNAPSHOT_WRITE
+};
 
 /* Abstract base type for an asynchronous request submitted to the stub I/o
  * implementation. */
@@ -57,6 +65,7 @@ struct append
     const struct raft_entry *entries;
     unsigned n;
     unsigned start; /* Request timestamp. */
+    int status;     /* Status the request completes with. */
 };
 
 /* Pending request to send a message. */
@@ -83,6 +92,52 @@ struct snapshot_get
     struct raft_io_snapshot_get *req;
 };
 
+/* Pending deferred callback. */
+struct defer
+{
+    REQUEST;
+    struct raft_io_defer *req;
+};
+
+/* Pending request to store the term or the vote. */
+struct set_meta
+{
+    REQUEST;
+    struct raft_io_set_meta *req;
+    bool set_term;     /* Whether this is a set_term request */
+    raft_term term;    /* Term to store, if set_term is true */
+    raft_id voted_for; /* Vote to store */
+};
+
+/* Pending request to read persisted entries. */
+struct read
+{
+    REQUEST;
+    struct raft_io_read *req;
+    raft_index index; /* Index of the first entry to read */
+    unsigned n;       /* Maximum number of entries to read */
+};
+
+/* Pending request to read a chunk of the latest snapshot. */
+struct snapshot_read
+{
+    REQUEST;
+    struct raft_io_snapshot_read *req;
+    size_t offset; /* Offset of the chunk to read */
+    size_t len;    /* Maximum length of the chunk */
+};
+
+/* Pending request to write a chunk of a snapshot being received. */
+struct snapshot_write
+{
+    REQUEST;
+    struct raft_io_snapshot_write *req;
+    const struct raft_snapshot *snapshot;
+    size_t offset;
+    const struct raft_buffer *chunk;
+    bool done;
+};
+
 /* Message that has been written to the network and is waiting to be delivered
  * (or discarded). */
 struct transmit
@@ -114,8 +169,10 @@ struct io
 
     /* Log */
     struct raft_snapshot *snapshot; /* Latest snapshot */
+    struct raft_buffer staged;      /* Snapshot data written in chunks */
     struct raft_entry *entries;     /* Array or persisted entries */
     size_t n;                       /* Size of the persisted entries array */
+    raft_index start;               /* Index of the first persisted entry */
 
     /* Parameters passed via raft_io->init and raft_io->start */
     raft_id id;
@@ -128,8 +185,9 @@ struct io
      * been fired. */
     queue requests;
 
-    /* Peers connected to us. */
-    struct peer peers[MAX_PEERS];
+    /* Peers connected to us, indexed by fixture server index. The array grows
+     * as servers get connected. */
+    struct peer *peers;
     unsigned n_peers;
 
     unsigned randomized_election_timeout; /* Value returned by io->random() */
@@ -142,12 +200,16 @@ struct io
         int n;         /* Repeat the fault this many times. Default is -1. */
     } fault;
 
+    /* Number of append requests to accept before the next one completes with
+     * an error. Default is -1, meaning no failure. */
+    int append_fault;
+
     /* If flag i is true, messages of type i will be silently dropped. */
     bool drop[N_MESSAGE_TYPES];
 
-    /* Counters of events that happened so far. */
-    unsigned n_send[N_MESSAGE_TYPES];
-    unsigned n_recv[N_MESSAGE_TYPES];
+    /* Counters of events that happened so far, indexed by message type. */
+    unsigned n_send[N_MESSAGE_TYPES + 1];
+    unsigned n_recv[N_MESSAGE_TYPES + 1];
     unsigned n_append;
 };
 
@@ -220,6 +282,15 @@ static void ioFlushAppend(struct io *s, struct append *append)
     struct raft_entry *entries;
     unsigned i;
 
+    /* A failed write persists nothing. */
+    if (append->status != 0) {
+        if (append->req->cb != NULL) {
+            append->req->cb(append->req, append->status);
+        }
+        raft_free(append);
+        return;
+    }
+
     /* Allocate an array for the old entries plus the new ones. */
     entries = raft_realloc(s->entries, (s->n + append->n) * sizeof *s->entries);
     assert(entries != NULL);
@@ -234,6 +305,7 @@ static void ioFlushAppend(struct io *s, struct append *append)
 
     s->entries = entries;
     s->n += append->n;
+    s->n_append++;
 
     if (append->req->cb != NULL) {
         append->req->cb(append->req, 0);
@@ -241,8 +313,10 @@ static void ioFlushAppend(struct io *s, struct append *append)
     raft_free(append);
 }
 
-/* Flush a snapshot put request, copying the snapshot data. */
-static void ioFlushSnapshotPut(struct io *s, struct snapshot_put *r)
+/* Store a copy of the given snapshot, replacing the current one. */
+static void ioStoreSnapshot(struct io *s,
+                            const struct raft_snapshot *snapshot,
+                            unsigned trailing)
 {
     int rv;
 
@@ -253,13 +327,20 @@ static void ioFlushSnapshotPut(struct io *s, struct snapshot_put *r)
         snapshotClose(s->snapshot);
     }
 
-    rv = snapshotCopy(r->snapshot, s->snapshot);
+    rv = snapshotCopy(snapshot, s->snapshot);
     assert(rv == 0);
 
-    if (r->trailing == 0) {
+    if (trailing == 0) {
         rv = s->io->truncate(s->io, 1);
         assert(rv == 0);
+        s->start = snapshot->index + 1;
     }
+}
+
+/* Flush a snapshot put request, copying the snapshot data. */
+static void ioFlushSnapshotPut(struct io *s, struct snapshot_put *r)
+{
+    ioStoreSnapshot(s, r->snapshot, r->trailing);
 
     if (r->req->cb != NULL) {
         r->req->cb(r->req, 0);
@@ -281,17 +362,129 @@ static void ioFlushSnapshotGet(struct io *s, struct snapshot_get *r)
     raft_free(r);
 }
 
-/* Search for the peer with the given ID. */
-static struct peer *ioGetPeer(struct io *io, raft_id id)
+/* Flush a snapshot read request, returning to the client the metadata of the
+ * local snapshot and a copy of the requested portion of its data. */
+static void ioFlushSnapshotRead(struct io *s,
+                                struct snapshot_read *r,
+                                int status)
 {
-    unsigned i;
-    for (i = 0; i < io->n_peers; i++) {
-        struct peer *peer = &io->peers[i];
-        if (peer->io->id == id) {
-            return peer;
+    struct raft_io_snapshot_read *req = r->req;
+    size_t offset = r->offset;
+    size_t len = r->len;
+    struct raft_snapshot *snapshot;
+    struct raft_buffer *data;
+    size_t size;
+    int rv;
+
+    raft_free(r);
+
+    if (status == 0 && s->snapshot == NULL) {
+        status = RAFT_NOTFOUND;
+    }
+    if (status != 0) {
+        req->cb(req, NULL, 0, status);
+        return;
+    }
+
+    assert(s->snapshot->n_bufs == 1);
+    data = &s->snapshot->bufs[0];
+    size = data->len;
+    assert(offset <= size);
+    if (len > size - offset) {
+        len = size - offset;
+    }
+
+    snapshot = raft_malloc(sizeof *snapshot);
+    assert(snapshot != NULL);
+    snapshot->term = s->snapshot->term;
+    snapshot->index = s->snapshot->index;
+    snapshot->configuration_index = s->snapshot->configuration_index;
+    rv = configurationCopy(&s->snapshot->configuration,
+                           &snapshot->configuration);
+    assert(rv == 0);
+    snapshot->bufs = raft_malloc(sizeof *snapshot->bufs);
+    assert(snapshot->bufs != NULL);
+    snapshot->n_bufs = 1;
+    snapshot->bufs[0].len = len;
+    snapshot->bufs[0].base = raft_malloc(len);
+    assert(len == 0 || snapshot->bufs[0].base != NULL);
+    if (len > 0) {
+        memcpy(snapshot->bufs[0].base, (uint8_t *)data->base + offset, len);
+    }
+
+    req->cb(req, snapshot, size, 0);
+}
+
+/* Flush a snapshot write request, appending the chunk to the staged data and
+ * storing the snapshot if it was the last one. */
+static void ioFlushSnapshotWrite(struct io *s, struct snapshot_write *r)
+{
+    struct raft_io_snapshot_write *req = r->req;
+    size_t len = r->offset + r->chunk->len;
+
+    assert(r->offset <= s->staged.len);
+    if (len > s->staged.len) {
+        s->staged.base = raft_realloc(s->staged.base, len);
+        assert(s->staged.base != NULL);
+    }
+    if (r->chunk->len > 0) {
+        memcpy((uint8_t *)s->staged.base + r->offset, r->chunk->base,
+               r->chunk->len);
+    }
+    s->staged.len = len;
+
+    if (r->done) {
+        struct raft_snapshot snapshot = *r->snapshot;
+        snapshot.bufs = &s->staged;
+        snapshot.n_bufs = 1;
+        ioStoreSnapshot(s, &snapshot, 0);
+        raft_free(s->staged.base);
+        s->staged.base = NULL;
+        s->staged.len = 0;
+    }
+
+    raft_free(r);
+    req->cb(req, 0);
+}
+
+/* Flush a read request, returning to the client a copy of the persisted
+ * entries starting from the requested index. */
+static void ioFlushRead(struct io *s, struct read *r, int status)
+{
+    struct raft_entry *entries = NULL;
+    unsigned n = 0;
+    int rv;
+    if (status == 0) {
+        if (r->index >= s->start && r->index - s->start < s->n) {
+            size_t i = (size_t)(r->index - s->start);
+            n = r->n;
+            if (n > s->n - i) {
+                n = (unsigned)(s->n - i);
+            }
+            rv = entryBatchCopy(&s->entries[i], &entries, n);
+            assert(rv == 0);
+        } else {
+            status = RAFT_NOTFOUND;
         }
     }
-    return NULL;
+    r->req->cb(r->req, entries, n, status);
+    raft_free(r);
+}
+
+/* Get the peer with the given ID, if connected. The fixture assigns ID i + 1
+ * to the server at index i, so this is a direct lookup. */
+static struct peer *ioGetPeer(struct io *io, raft_id id)
+{
+    struct peer *peer;
+    if (id == 0 || id > io->n_peers) {
+        return NULL;
+    }
+    peer = &io->peers[id - 1];
+    if (peer->io == NULL) {
+        return NULL;
+    }
+    assert(peer->io->id == id);
+    return peer;
 }
 
 /* Copy the dynamically allocated memory of an AppendEntries message. */
@@ -387,6 +580,26 @@ static void ioDestroyTransmit(struct transmit *transmit)
     raft_free(transmit);
 }
 
+/* Fire the callback of a deferred request. */
+static void ioFlushDefer(struct defer *r, int status)
+{
+    struct raft_io_defer *req = r->req;
+    raft_free(r);
+    req->cb(req, status);
+}
+
+/* Store the term or vote of a pending request and fire its callback. */
+static void ioFlushSetMeta(struct io *io, struct set_meta *r)
+{
+    struct raft_io_set_meta *req = r->req;
+    if (r->set_term) {
+        io->term = r->term;
+    }
+    io->voted_for = r->voted_for;
+    raft_free(r);
+    req->cb(req, 0);
+}
+
 /* Flush all requests in the queue. */
 static void ioFlushAll(struct io *io)
 {
@@ -414,6 +627,22 @@ static void ioFlushAll(struct io *io)
             case SNAPSHOT_GET:
                 ioFlushSnapshotGet(io, (struct snapshot_get *)r);
                 break;
+            case DEFER:
+                ioFlushDefer((struct defer *)r, RAFT_CANCELED);
+                break;
+            case SET_META:
+                ioFlushSetMeta(io, (struct set_meta *)r);
+                break;
+            case READ:
+                ioFlushRead(io, (struct read *)r, RAFT_CANCELED);
+                break;
+            case SNAPSHOT_READ:
+                ioFlushSnapshotRead(io, (struct snapshot_read *)r,
+                                    RAFT_CANCELED);
+                break;
+            case SNAPSHOT_WRITE:
+                ioFlushSnapshotWrite(io, (struct snapshot_write *)r);
+                break;
             default:
                 assert(0);
         }
@@ -550,6 +779,55 @@ static int ioMethodSetVote(struct raft_io *raft_io, const raft_id server_id)
     return 0;
 }
 
+/* Queue a request to store the term or the vote, completing after the disk
+ * latency. */
+static int ioSubmitSetMeta(struct io *io,
+                           struct raft_io_set_meta *req,
+                           bool set_term,
+                           raft_term term,
+                           raft_id voted_for,
+                           raft_io_set_meta_cb cb)
+{
+    struct set_meta *r;
+
+    if (ioFaultTick(io)) {
+        return RAFT_IOERR;
+    }
+
+    r = raft_malloc(sizeof *r);
+    assert(r != NULL);
+
+    r->type = SET_META;
+    r->req = req;
+    r->req->cb = cb;
+    r->set_term = set_term;
+    r->term = term;
+    r->voted_for = voted_for;
+    r->completion_time = *io->time + io->disk_latency;
+
+    QUEUE_PUSH(&io->requests, &r->queue);
+
+    return 0;
+}
+
+static int ioMethodAsyncSetTerm(struct raft_io *raft_io,
+                                struct raft_io_set_meta *req,
+                                const raft_term term,
+                                raft_io_set_meta_cb cb)
+{
+    struct io *io = raft_io->impl;
+    return ioSubmitSetMeta(io, req, true, term, 0, cb);
+}
+
+static int ioMethodAsyncSetVote(struct raft_io *raft_io,
+                                struct raft_io_set_meta *req,
+                                const raft_id server_id,
+                                raft_io_set_meta_cb cb)
+{
+    struct io *io = raft_io->impl;
+    return ioSubmitSetMeta(io, req, false, 0, server_id, cb);
+}
+
 static int ioMethodAppend(struct raft_io *raft_io,
                           struct raft_io_append *req,
                           const struct raft_entry entries[],
@@ -571,6 +849,15 @@ static int ioMethodAppend(struct raft_io *raft_io,
     r->req = req;
     r->entries = entries;
     r->n = n;
+    r->status = 0;
+
+    /* Simulate a disk error that only surfaces once the write completes. */
+    if (io->append_fault == 0) {
+        r->status = RAFT_IOERR;
+    }
+    if (io->append_fault >= 0) {
+        io->append_fault--;
+    }
 
     req->cb = cb;
 
@@ -588,7 +875,8 @@ static int ioMethodTruncate(struct raft_io *raft_io, raft_index index)
         return RAFT_IOERR;
     }
 
-    n = (size_t)(index - 1); /* Number of entries left after truncation */
+    /* Number of entries left after truncation */
+    n = index > io->start ? (size_t)(index - io->start) : 0;
 
     if (n > 0) {
         struct raft_entry *entries;
@@ -670,6 +958,104 @@ static int ioMethodSnapshotGet(struct raft_io *raft_io,
     return 0;
 }
 
+static int ioMethodRead(struct raft_io *raft_io,
+                        struct raft_io_read *req,
+                        raft_index index,
+                        unsigned n,
+                        raft_io_read_cb cb)
+{
+    struct io *io = raft_io->impl;
+    struct read *r;
+
+    r = raft_malloc(sizeof *r);
+    assert(r != NULL);
+
+    r->type = READ;
+    r->req = req;
+    r->req->cb = cb;
+    r->index = index;
+    r->n = n;
+    r->completion_time = *io->time + io->disk_latency;
+
+    QUEUE_PUSH(&io->requests, &r->queue);
+
+    return 0;
+}
+
+static int ioMethodSnapshotRead(struct raft_io *raft_io,
+                                struct raft_io_snapshot_read *req,
+                                size_t offset,
+                                size_t len,
+                                raft_io_snapshot_read_cb cb)
+{
+    struct io *io = raft_io->impl;
+    struct snapshot_read *r;
+
+    r = raft_malloc(sizeof *r);
+    assert(r != NULL);
+
+    r->type = SNAPSHOT_READ;
+    r->req = req;
+    r->req->cb = cb;
+    r->offset = offset;
+    r->len = len;
+    r->completion_time = *io->time + io->disk_latency;
+
+    QUEUE_PUSH(&io->requests, &r->queue);
+
+    return 0;
+}
+
+static int ioMethodSnapshotWrite(struct raft_io *raft_io,
+                                 struct raft_io_snapshot_write *req,
+                                 const struct raft_snapshot *snapshot,
+                                 size_t offset,
+                                 const struct raft_buffer *chunk,
+                                 bool done,
+                                 raft_io_snapshot_write_cb cb)
+{
+    struct io *io = raft_io->impl;
+    struct snapshot_write *r;
+
+    r = raft_malloc(sizeof *r);
+    assert(r != NULL);
+
+    r->type = SNAPSHOT_WRITE;
+    r->req = req;
+    r->req->cb = cb;
+    r->snapshot = snapshot;
+    r->offset = offset;
+    r->chunk = chunk;
+    r->done = done;
+    r->completion_time = *io->time + io->disk_latency;
+
+    QUEUE_PUSH(&io->requests, &r->queue);
+
+    return 0;
+}
+
+static int ioMethodDefer(struct raft_io *raft_io,
+                         struct raft_io_defer *req,
+                         unsigned usecs,
+                         raft_io_defer_cb cb)
+{
+    struct io *io = raft_io->impl;
+    struct defer *r;
+
+    r = raft_malloc(sizeof *r);
+    assert(r != NULL);
+
+    /* The fixture clock has millisecond resolution. */
+    r->type = DEFER;
+    r->req = req;
+    r->req->cb = cb;
+    r->completion_time = *io->time + (usecs + 999) / 1000;
+
+    QUEUE_PUSH(&io->requests, &r->queue);
+
+    return 0;
+}
+
 static raft_time ioMethodTime(struct raft_io *raft_io)
 {
     struct io *io = raft_io->impl;
@@ -762,11 +1148,19 @@ static void ioConnect(struct raft_io *raft_io, struct raft_io *other)
 {
     struct io *io = raft_io->impl;
     struct io *io_other = other->impl;
-    assert(io->n_peers < MAX_PEERS);
-    io->peers[io->n_peers].io = io_other;
-    io->peers[io->n_peers].connected = true;
-    io->peers[io->n_peers].saturated = false;
-    io->n_peers++;
+    struct peer *peer;
+    if (io_other->index >= io->n_peers) {
+        unsigned n = io_other->index + 1;
+        peer = raft_realloc(io->peers, n * sizeof *peer);
+        assert(peer != NULL);
+        memset(&peer[io->n_peers], 0, (n - io->n_peers) * sizeof *peer);
+        io->peers = peer;
+        io->n_peers = n;
+    }
+    peer = &io->peers[io_other->index];
+    peer->io = io_other;
+    peer->connected = true;
+    peer->saturated = false;
 }
 
 /* Return whether the connection with the given peer is saturated. */
@@ -845,20 +1239,30 @@ static int ioInit(struct raft_io *raft_io, unsigned index, raft_time *time)
     io->term = 0;
     io->voted_for = 0;
     io->snapshot = NULL;
+    io->staged.base = NULL;
+    io->staged.len = 0;
     io->entries = NULL;
     io->n = 0;
+    io->start = 1;
     QUEUE_INIT(&io->requests);
+    io->peers = NULL;
     io->n_peers = 0;
-    io->randomized_election_timeout = ELECTION_TIMEOUT + index * 100;
+    /* Stagger the timeouts of the first ten servers by 100 msecs, and the
+     * following ones by 1 msec more per group of ten, so they stay distinct
+     * and below twice the election timeout. */
+    io->randomized_election_timeout =
+        ELECTION_TIMEOUT + (index % 10) * 100 + index / 10;
     io->network_latency = NETWORK_LATENCY;
     io->disk_latency = DISK_LATENCY;
     io->fault.countdown = -1;
     io->fault.n = -1;
+    io->append_fault = -1;
     memset(io->drop, 0, sizeof io->drop);
     memset(io->n_send, 0, sizeof io->n_send);
     memset(io->n_recv, 0, sizeof io->n_recv);
     io->n_append = 0;
 
+    raft_io->version = 5;
     raft_io->impl = io;
     raft_io->init = ioMethodInit;
     raft_io->close = ioMethodClose;
@@ -875,6 +1279,13 @@ static int ioInit(struct raft_io *raft_io, unsigned index, raft_time *time)
     raft_io->snapshot_get = ioMethodSnapshotGet;
     raft_io->time = ioMethodTime;
     raft_io->random = ioMethodRandom;
+    raft_io->defer = ioMethodDefer;
+    raft_io->async_set_term = NULL; /* See raft_fixture_set_async_meta() */
+    raft_io->async_set_vote = NULL;
+    raft_io->read = ioMethodRead;
+    /* See raft_fixture_set_snapshot_chunks() */
+    raft_io->snapshot_read = NULL;
+    raft_io->snapshot_write = NULL;
 
     return 0;
 }
@@ -895,6 +1306,8 @@ void ioClose(struct raft_io *raft_io)
         snapshotClose(io->snapshot);
         raft_free(io->snapshot);
     }
+    raft_free(io->staged.base);
+    raft_free(io->peers);
     raft_free(io);
 }
 
@@ -911,7 +1324,11 @@ static void emit(struct raft_tracer *t,
 static int serverInit(struct raft_fixture *f, unsigned i, struct raft_fsm *fsm)
 {
     int rv;
-    struct raft_fixture_server *s = &f->servers[i];
+    struct raft_fixture_server *s = raft_malloc(sizeof *s);
+    if (s == NULL) {
+        return RAFT_NOMEM;
+    }
+    f->servers[i] = s;
     s->alive = true;
     s->id = i + 1;
     sprintf(s->address, "%llu", s->id);
@@ -931,10 +1348,19 @@ static int serverInit(struct raft_fixture *f, unsigned i, struct raft_fsm *fsm)
     return 0;
 }
 
-static void serverClose(struct raft_fixture_server *s)
+/* Release the server once its raft instance is closed, which might happen after
+ * the fixture is closed if the FSM is still applying a batch of commands. */
+static void serverCloseCb(struct raft *raft)
 {
-    raft_close(&s->raft, NULL);
+    struct raft_fixture_server *s =
+        (void *)((char *)raft - offsetof(struct raft_fixture_server, raft));
     ioClose(&s->io);
+    raft_free(s);
+}
+
+static void serverClose(struct raft_fixture_server *s)
+{
+    raft_close(&s->raft, serverCloseCb);
 }
 
 /* Connect the server with the given index to all others */
@@ -942,8 +1368,8 @@ static void serverConnectToAll(struct raft_fixture *f, unsigned i)
 {
     unsigned j;
     for (j = 0; j < f->n; j++) {
-        struct raft_io *io1 = &f->servers[i].io;
-        struct raft_io *io2 = &f->servers[j].io;
+        struct raft_io *io1 = &f->servers[i]->io;
+        struct raft_io *io2 = &f->servers[j]->io;
         if (i == j) {
             continue;
         }
@@ -959,6 +1385,10 @@ int raft_fixture_init(struct raft_fixture *f, unsigned n, struct raft_fsm *fsms)
 
     f->time = 0;
     f->n = n;
+    f->servers = raft_calloc(n, sizeof *f->servers);
+    if (f->servers == NULL) {
+        return RAFT_NOMEM;
+    }
 
     /* Initialize all servers */
     for (i = 0; i < n; i++) {
@@ -984,12 +1414,13 @@ void raft_fixture_close(struct raft_fixture *f)
 {
     unsigned i;
     for (i = 0; i < f->n; i++) {
-        struct io *io = f->servers[i].io.impl;
+        struct io *io = f->servers[i]->io.impl;
         ioFlushAll(io);
     }
     for (i = 0; i < f->n; i++) {
-        serverClose(&f->servers[i]);
+        serverClose(f->servers[i]);
     }
+    raft_free(f->servers);
     logClose(&f->log);
 }
 
@@ -1006,7 +1437,7 @@ int raft_fixture_configuration(struct raft_fixture *f,
         struct raft_fixture_server *s;
         int role = i < n_voting ? RAFT_VOTER : RAFT_STANDBY;
         int rv;
-        s = &f->servers[i];
+        s = f->servers[i];
         rv = raft_configuration_add(configuration, s->id, s->address, role);
         if (rv != 0) {
             return rv;
@@ -1035,7 +1466,7 @@ int raft_fixture_start(struct raft_fixture *f)
     unsigned i;
     int rv;
     for (i = 0; i < f->n; i++) {
-        struct raft_fixture_server *s = &f->servers[i];
+        struct raft_fixture_server *s = f->servers[i];
         rv = raft_start(&s->raft);
         if (rv != 0) {
             return rv;
@@ -1057,13 +1488,13 @@ raft_time raft_fixture_time(struct raft_fixture *f)
 struct raft *raft_fixture_get(struct raft_fixture *f, unsigned i)
 {
     assert(i < f->n);
-    return &f->servers[i].raft;
+    return &f->servers[i]->raft;
 }
 
 bool raft_fixture_alive(struct raft_fixture *f, unsigned i)
 {
     assert(i < f->n);
-    return f->servers[i].alive;
+    return f->servers[i]->alive;
 }
 
 unsigned raft_fixture_leader_index(struct raft_fixture *f)
@@ -1076,10 +1507,16 @@ unsigned raft_fixture_leader_index(struct raft_fixture *f)
 
 raft_id raft_fixture_voted_for(struct raft_fixture *f, unsigned i)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     return io->voted_for;
 }
 
+raft_term raft_fixture_term(struct raft_fixture *f, unsigned i)
+{
+    struct io *io = f->servers[i]->io.impl;
+    return io->term;
+}
+
 /* Update the leader and check for election safety.
  *
  * From figure 3.2:
@@ -1230,6 +1667,12 @@ static void checkLeaderAppendOnly(struct raft_fixture *f)
 
         assert(entry1 != NULL);
 
+        /* Check if the entry was dropped because writing it failed. */
+        if (entry2 == NULL && index > logLastIndex(&raft->log) &&
+            index > raft->last_stored) {
+            continue;
+        }
+
         /* Check if the entry was snapshotted. */
         if (entry2 == NULL) {
             assert(raft->log.snapshot.last_index >= index);
@@ -1239,6 +1682,11 @@ static void checkLeaderAppendOnly(struct raft_fixture *f)
         /* Entry was not overwritten. */
         assert(entry1->type == entry2->type);
         assert(entry1->term == entry2->term);
+
+        /* Check if the payload of either copy was evicted. */
+        if (entry1->buf.base == NULL || entry2->buf.base == NULL) {
+            continue;
+        }
         for (i = 0; i < entry1->buf.len; i++) {
             assert(((uint8_t *)entry1->buf.base)[i] ==
                    ((uint8_t *)entry2->buf.base)[i]);
@@ -1263,12 +1711,15 @@ static void copyLeaderLog(struct raft_fixture *f)
         struct raft_entry *entry = &entries[i];
         struct raft_buffer buf;
         buf.len = entry->buf.len;
-        buf.base = raft_malloc(buf.len);
-        memcpy(buf.base, entry->buf.base, buf.len);
+        buf.base = NULL;
+        if (buf.len > 0) {
+            buf.base = raft_malloc(buf.len);
+            memcpy(buf.base, entry->buf.base, buf.len);
+        }
         rv = logAppend(&f->log, entry->term, entry->type, &buf, NULL);
         assert(rv == 0);
     }
-    logRelease(&raft->log, 1, entries, n);
+    logRelease(&raft->log, entries, n);
 }
 
 /* Update the commit index to match the one from the current leader. */
@@ -1287,7 +1738,7 @@ static void getLowestTickTime(struct raft_fixture *f, raft_time *t, unsigned *i)
     unsigned j;
     *t = (raft_time)-1 /* Maximum value */;
     for (j = 0; j < f->n; j++) {
-        struct io *io = f->servers[j].io.impl;
+        struct io *io = f->servers[j]->io.impl;
         if (io->next_tick < *t) {
             *t = io->next_tick;
             *i = j;
@@ -1304,7 +1755,7 @@ static void getLowestRequestCompletionTime(struct raft_fixture *f,
     unsigned j;
     *t = (raft_time)-1 /* Maximum value */;
     for (j = 0; j < f->n; j++) {
-        struct io *io = f->servers[j].io.impl;
+        struct io *io = f->servers[j]->io.impl;
         queue *head;
         QUEUE_FOREACH(head, &io->requests)
         {
@@ -1320,7 +1771,7 @@ static void getLowestRequestCompletionTime(struct raft_fixture *f,
 /* Fire the tick callback of the i'th server. */
 static void fireTick(struct raft_fixture *f, unsigned i)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     f->time = io->next_tick;
     f->event.server_index = i;
     f->event.type = RAFT_FIXTURE_TICK;
@@ -1331,7 +1782,7 @@ static void fireTick(struct raft_fixture *f, unsigned i)
 /* Complete the first request with completion time @t on the @i'th server. */
 static void completeRequest(struct raft_fixture *f, unsigned i, raft_time t)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     queue *head;
     struct ioRequest *r = NULL;
     bool found = false;
@@ -1368,6 +1819,26 @@ static void completeRequest(struct raft_fixture *f, unsigned i, raft_time t)
             ioFlushSnapshotGet(io, (struct snapshot_get *)r);
             f->event.type = RAFT_FIXTURE_DISK;
             break;
+        case DEFER:
+            ioFlushDefer((struct defer *)r, 0);
+            f->event.type = RAFT_FIXTURE_TICK;
+            break;
+        case SET_META:
+            ioFlushSetMeta(io, (struct set_meta *)r);
+            f->event.type = RAFT_FIXTURE_DISK;
+            break;
+        case READ:
+            ioFlushRead(io, (struct read *)r, 0);
+            f->event.type = RAFT_FIXTURE_DISK;
+            break;
+        case SNAPSHOT_READ:
+            ioFlushSnapshotRead(io, (struct snapshot_read *)r, 0);
+            f->event.type = RAFT_FIXTURE_DISK;
+            break;
+        case SNAPSHOT_WRITE:
+            ioFlushSnapshotWrite(io, (struct snapshot_write *)r);
+            f->event.type = RAFT_FIXTURE_DISK;
+            break;
         default:
             assert(0);
     }
@@ -1481,7 +1952,7 @@ static void dropAllExcept(struct raft_fixture *f,
 {
     unsigned j;
     for (j = 0; j < f->n; j++) {
-        struct raft_fixture_server *s = &f->servers[j];
+        struct raft_fixture_server *s = f->servers[j];
         if (j == i) {
             continue;
         }
@@ -1494,7 +1965,7 @@ static void dropAllExcept(struct raft_fixture *f,
 static void minimizeRandomizedElectionTimeout(struct raft_fixture *f,
                                               unsigned i)
 {
-    struct raft *raft = &f->servers[i].raft;
+    struct raft *raft = &f->servers[i]->raft;
     raft_time now = raft->io->time(raft->io);
     unsigned timeout = raft->election_timeout;
     assert(raft->state == RAFT_FOLLOWER);
@@ -1515,7 +1986,7 @@ static void maximizeAllRandomizedElectionTimeoutsExcept(struct raft_fixture *f,
 {
     unsigned j;
     for (j = 0; j < f->n; j++) {
-        struct raft *raft = &f->servers[j].raft;
+        struct raft *raft = &f->servers[j]->raft;
         unsigned timeout = raft->election_timeout * 2;
         if (j == i) {
             continue;
@@ -1544,7 +2015,7 @@ void raft_fixture_elect(struct raft_fixture *f, unsigned i)
 
     /* Make sure all servers are currently followers. */
     for (j = 0; j < f->n; j++) {
-        assert(raft_state(&f->servers[j].raft) == RAFT_FOLLOWER);
+        assert(raft_state(&f->servers[j]->raft) == RAFT_FOLLOWER);
     }
 
     /* Pretend that the last randomized election timeout was set at the maximum
@@ -1564,7 +2035,7 @@ void raft_fixture_depose(struct raft_fixture *f)
     /* Make sure there's a leader. */
     assert(f->leader_id != 0);
     leader_i = (unsigned)f->leader_id - 1;
-    assert(raft_state(&f->servers[leader_i].raft) == RAFT_LEADER);
+    assert(raft_state(&f->servers[leader_i]->raft) == RAFT_LEADER);
 
     /* Set a very large election timeout on all followers, to prevent them from
      * starting an election. */
@@ -1731,22 +2202,22 @@ bool raft_fixture_step_until_delivered(struct raft_fixture *f,
 
 void raft_fixture_disconnect(struct raft_fixture *f, unsigned i, unsigned j)
 {
-    struct raft_io *io1 = &f->servers[i].io;
-    struct raft_io *io2 = &f->servers[j].io;
+    struct raft_io *io1 = &f->servers[i]->io;
+    struct raft_io *io2 = &f->servers[j]->io;
     ioDisconnect(io1, io2);
 }
 
 void raft_fixture_reconnect(struct raft_fixture *f, unsigned i, unsigned j)
 {
-    struct raft_io *io1 = &f->servers[i].io;
-    struct raft_io *io2 = &f->servers[j].io;
+    struct raft_io *io1 = &f->servers[i]->io;
+    struct raft_io *io2 = &f->servers[j]->io;
     ioReconnect(io1, io2);
 }
 
 void raft_fixture_saturate(struct raft_fixture *f, unsigned i, unsigned j)
 {
-    struct raft_io *io1 = &f->servers[i].io;
-    struct raft_io *io2 = &f->servers[j].io;
+    struct raft_io *io1 = &f->servers[i]->io;
+    struct raft_io *io2 = &f->servers[j]->io;
     ioSaturate(io1, io2);
 }
 
@@ -1764,29 +2235,36 @@ static void disconnectFromAll(struct raft_fixture *f, unsigned i)
 
 bool raft_fixture_saturated(struct raft_fixture *f, unsigned i, unsigned j)
 {
-    struct raft_io *io1 = &f->servers[i].io;
-    struct raft_io *io2 = &f->servers[j].io;
+    struct raft_io *io1 = &f->servers[i]->io;
+    struct raft_io *io2 = &f->servers[j]->io;
     return ioSaturated(io1, io2);
 }
 
 void raft_fixture_desaturate(struct raft_fixture *f, unsigned i, unsigned j)
 {
-    struct raft_io *io1 = &f->servers[i].io;
-    struct raft_io *io2 = &f->servers[j].io;
+    struct raft_io *io1 = &f->servers[i]->io;
+    struct raft_io *io2 = &f->servers[j]->io;
     ioDesaturate(io1, io2);
 }
 
 void raft_fixture_kill(struct raft_fixture *f, unsigned i)
 {
     disconnectFromAll(f, i);
-    f->servers[i].alive = false;
+    f->servers[i]->alive = false;
 }
 
 int raft_fixture_grow(struct raft_fixture *f, struct raft_fsm *fsm)
 {
+    struct raft_fixture_server **servers;
     unsigned i;
     unsigned j;
     int rc;
+
+    servers = raft_realloc(f->servers, (f->n + 1) * sizeof *servers);
+    if (servers == NULL) {
+        return RAFT_NOMEM;
+    }
+    f->servers = servers;
     i = f->n;
     f->n++;
 
@@ -1797,8 +2275,8 @@ int raft_fixture_grow(struct raft_fixture *f, struct raft_fsm *fsm)
 
     serverConnectToAll(f, i);
     for (j = 0; j < f->n; j++) {
-        struct raft_io *io1 = &f->servers[i].io;
-        struct raft_io *io2 = &f->servers[j].io;
+        struct raft_io *io1 = &f->servers[i]->io;
+        struct raft_io *io2 = &f->servers[j]->io;
         ioConnect(io2, io1);
     }
 
@@ -1809,7 +2287,7 @@ void raft_fixture_set_randomized_election_timeout(struct raft_fixture *f,
                                                   unsigned i,
                                                   unsigned msecs)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     io->randomized_election_timeout = msecs;
 }
 
@@ -1817,7 +2295,7 @@ void raft_fixture_set_network_latency(struct raft_fixture *f,
                                       unsigned i,
                                       unsigned msecs)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     io->network_latency = msecs;
 }
 
@@ -1825,13 +2303,31 @@ void raft_fixture_set_disk_latency(struct raft_fixture *f,
                                    unsigned i,
                                    unsigned msecs)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     io->disk_latency = msecs;
 }
 
+void raft_fixture_set_async_meta(struct raft_fixture *f,
+                                 unsigned i,
+                                 bool enabled)
+{
+    struct raft_io *raft_io = &f->servers[i]->io;
+    raft_io->async_set_term = enabled ? ioMethodAsyncSetTerm : NULL;
+    raft_io->async_set_vote = enabled ? ioMethodAsyncSetVote : NULL;
+}
+
+void raft_fixture_set_snapshot_chunks(struct raft_fixture *f,
+                                      unsigned i,
+                                      bool enabled)
+{
+    struct raft_io *raft_io = &f->servers[i]->io;
+    raft_io->snapshot_read = enabled ? ioMethodSnapshotRead : NULL;
+    raft_io->snapshot_write = enabled ? ioMethodSnapshotWrite : NULL;
+}
+
 void raft_fixture_set_term(struct raft_fixture *f, unsigned i, raft_term term)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     io->term = term;
 }
 
@@ -1839,15 +2335,16 @@ void raft_fixture_set_snapshot(struct raft_fixture *f,
                                unsigned i,
                                struct raft_snapshot *snapshot)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     io->snapshot = snapshot;
+    io->start = snapshot->index + 1;
 }
 
 void raft_fixture_add_entry(struct raft_fixture *f,
                             unsigned i,
                             struct raft_entry *entry)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     struct raft_entry *entries;
     entries = raft_realloc(io->entries, (io->n + 1) * sizeof *entries);
     assert(entries != NULL);
@@ -1861,21 +2358,33 @@ void raft_fixture_io_fault(struct raft_fixture *f,
                            int delay,
                            int repeat)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     io->fault.countdown = delay;
     io->fault.n = repeat;
 }
 
+void raft_fixture_append_fault(struct raft_fixture *f, unsigned i, int delay)
+{
+    struct io *io = f->servers[i]->io.impl;
+    io->append_fault = delay;
+}
+
 unsigned raft_fixture_n_send(struct raft_fixture *f, unsigned i, int type)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     return io->n_send[type];
 }
 
 unsigned raft_fixture_n_recv(struct raft_fixture *f, unsigned i, int type)
 {
-    struct io *io = f->servers[i].io.impl;
+    struct io *io = f->servers[i]->io.impl;
     return io->n_recv[type];
 }
 
+unsigned raft_fixture_n_append(struct raft_fixture *f, unsigned i)
+{
+    struct io *io = f->servers[i]->io.impl;
+    return io->n_append;
+}
+
 #undef tracef
@@ -1,416 +1,243 @@
 #include "log.h"
 
+#include <stdint.h>
 #include <string.h>
 
 #include "../include/raft.h"
 #include "assert.h"
 #include "configuration.h"
 
-/* Calculate the reference count hash table key for the given log entry index in
- * an hash table of the given size.
- *
- * The hash is simply the log entry index minus one modulo the size. This
- * minimizes conflicts in the most frequent case, where a new log entry is
- * simply appended to the log and can use the hash table bucket next to the
- * bucket for the entry with the previous index (possibly resizing the table if
- * its cap is reached). */
-static size_t refsKey(const raft_index index, const size_t size)
+void logInit(struct raft_log *l)
 {
-    assert(index > 0);
-    assert(size > 0);
-    return (size_t)((index - 1) % size);
+    assert(l != NULL);
+    l->entries = NULL;
+    l->size = 0;
+    l->front = l->back = 0;
+    l->offset = 0;
+    l->held_front = l->held_back = 0;
+    l->refs = 0;
+    l->retired = NULL;
+    l->snapshot.last_index = 0;
+    l->snapshot.last_term = 0;
+    l->cache.max = 0;
+    l->cache.size = 0;
+    l->cache.bound = 0;
+    l->cache.evicted = 0;
 }
 
-/* Try to insert a new reference count item for the given log entry index into
- * the given reference count hash table.
- *
- * A collision happens when the bucket associated with the hash key of the given
- * log entry index is already used to refcount log entries with a different
- * index. In that case the collision output parameter will be set to true and no
- * new reference count item is inserted into the hash table.
- *
- * If two log entries have the same index but different terms, the associated
- * bucket will be grown accordingly. */
-static int refsTryInsert(struct raft_entry_ref *table,
-                         const size_t size,
-                         const raft_term term,
-                         const raft_index index,
-                         const unsigned short count,
-                         bool *collision)
+/* Return the index of the i'th entry in the log. */
+static raft_index indexAt(struct raft_log *l, size_t i)
 {
-    struct raft_entry_ref *bucket;    /* Bucket associated with this index. */
-    struct raft_entry_ref *next_slot; /* For traversing the bucket slots. */
-    struct raft_entry_ref *last_slot; /* To track the last traversed slot. */
-    struct raft_entry_ref *slot;      /* Actual slot to use for this entry. */
-    size_t key;
+    return l->offset + i + 1;
+}
 
-    assert(table != NULL);
-    assert(size > 0);
-    assert(term > 0);
-    assert(index > 0);
-    assert(count > 0);
-    assert(collision != NULL);
+/* Return the circular buffer position of the i'th entry in the log. */
+static size_t positionAt(struct raft_log *l, size_t i)
+{
+    return (l->front + i) % l->size;
+}
 
-    /* Calculate the hash table key for the given index. */
-    key = refsKey(index, size);
-    bucket = &table[key];
+/* Return the i'th entry in the log. */
+static struct raft_entry *entryAt(struct raft_log *l, size_t i)
+{
+    return &l->entries[positionAt(l, i)];
+}
 
-    /* If a bucket is empty, then there's no collision and we can fill its first
-     * slot. */
-    if (bucket->count == 0) {
-        assert(bucket->next == NULL);
-        slot = bucket;
-        goto fill;
+/* Return the total size of the payloads of @n entries starting from the i'th
+ * one. Evicted entries have an empty payload. */
+static size_t payloadSize(struct raft_log *l, size_t i, size_t n)
+{
+    size_t size = 0;
+    size_t j;
+    for (j = 0; j < n; j++) {
+        size += entryAt(l, i + j)->buf.len;
     }
+    return size;
+}
 
-    /* If the bucket is already used to refcount entries with a different
-     * index, then we have a collision and we must abort here. */
-    if (bucket->index != index) {
-        *collision = true;
-        return 0;
+/* Release the memory used by the data of the given entry, either directly or
+ * via its batch.
+ *
+ * Entries belonging to the same batch are always adjacent, so a batch gets
+ * released together with the first of its entries that we visit, unless it's
+ * the same as the last batch that was released or it's in the @keep list. */
+static void releaseEntry(struct raft_entry *entry, void *keep[2], void **batch)
+{
+    if (entry->batch == NULL) {
+        if (entry->buf.base != NULL) {
+            raft_free(entry->buf.base);
+        }
+        return;
     }
-
-    /* If we get here it means that the bucket is in use to refcount one or more
-     * entries with the same index as the given one, but different terms.
-     *
-     * We must append a newly allocated slot to refcount the entry with this
-     * term.
-     *
-     * So first let's find the last slot in the bucket. */
-    for (next_slot = bucket; next_slot != NULL; next_slot = next_slot->next) {
-        /* All entries in a bucket must have the same index. */
-        assert(next_slot->index == index);
-
-        /* It should never happen that two entries with the same index and term
-         * get appended. So no existing slot in this bucket must track an entry
-         * with the same term as the given one. */
-        assert(next_slot->term != term);
-
-        last_slot = next_slot;
+    if (entry->batch == *batch || entry->batch == keep[0] ||
+        entry->batch == keep[1]) {
+        return;
     }
+    *batch = entry->batch;
+    raft_free(*batch);
+}
 
-    /* The last slot must have no next slot. */
-    assert(last_slot->next == NULL);
+/* Release the memory of the deleted entries held in the slots [held_front,
+ * front) and [back, held_back) of the given circular buffer. The entries in
+ * [front, back) are still in the log, so their batches must be kept alive. */
+static void releaseHeld(struct raft_entry *entries,
+                        size_t size,
+                        size_t held_front,
+                        size_t front,
+                        size_t back,
+                        size_t held_back)
+{
+    void *keep[2] = {NULL, NULL};
+    void *batch = NULL; /* Last batch that has been freed */
+    size_t i;
 
-    slot = raft_malloc(sizeof *slot);
-    if (slot == NULL) {
-        return RAFT_NOMEM;
+    if (front != back) {
+        keep[0] = entries[front].batch;
+        keep[1] = entries[(back + size - 1) % size].batch;
     }
 
-    last_slot->next = slot;
-
-fill:
-    slot->term = term;
-    slot->index = index;
-    slot->count = count;
-    slot->next = NULL;
-
-    *collision = false;
-
-    return 0;
+    for (i = held_front; i != front; i = (i + 1) % size) {
+        releaseEntry(&entries[i], keep, &batch);
+    }
+    for (i = back; i != held_back; i = (i + 1) % size) {
+        releaseEntry(&entries[i], keep, &batch);
+    }
 }
 
-/* Move the slots of the given bucket into the given reference count hash
- * table. The key of the bucket to use in the given table will be re-calculated
- * according to the given size. */
-static int refsMove(struct raft_entry_ref *bucket,
-                    struct raft_entry_ref *table,
-                    const size_t size)
+/* Return true if the slots of the current buffer are holding deleted entries
+ * whose memory has not been released yet. */
+static bool isHolding(struct raft_log *l)
 {
-    struct raft_entry_ref *slot;
-    struct raft_entry_ref *next_slot;
-
-    assert(bucket != NULL);
-    assert(table != NULL);
-    assert(size > 0);
-
-    /* Only non-empty buckets should be moved. */
-    assert(bucket->count > 0);
-
-    /* For each slot in the bucket, insert the relevant entry in the given
-     * table, then free it. */
-    next_slot = bucket;
-    while (next_slot != NULL) {
-        bool collision;
-        int rv;
-
-        slot = next_slot;
-
-        /* Insert the reference count for this entry into the new table. */
-        rv = refsTryInsert(table, size, slot->term, slot->index, slot->count,
-                           &collision);
-
-        next_slot = slot->next;
-
-        /* Unless this is the very first slot in the bucket, we need to free the
-         * slot. */
-        if (slot != bucket) {
-            raft_free(slot);
-        }
-
-        if (rv != 0) {
-            return rv;
-        }
-
-        /* The given hash table is assumed to be large enough to hold all ref
-         * counts without any conflict. */
-        assert(!collision);
-    };
-
-    return 0;
+    return l->held_front != l->held_back;
 }
 
-/* Grow the size of the reference count hash table. */
-static int refsGrow(struct raft_log *l)
+/* Called before deleting entries: if the buffer is not already holding deleted
+ * entries, start tracking the slots that are currently in use, since their
+ * content must be preserved until it's safe to release it. */
+static void hold(struct raft_log *l)
 {
-    struct raft_entry_ref *table; /* New hash table. */
-    size_t size;                  /* Size of the new hash table. */
-    size_t i;
-
-    assert(l != NULL);
-    assert(l->refs_size > 0);
-
-    size = l->refs_size * 2; /* Double the table size */
-
-    table = raft_calloc(size, sizeof *table);
-    if (table == NULL) {
-        return RAFT_NOMEM;
+    if (isHolding(l)) {
+        return;
     }
+    l->held_front = l->front;
+    l->held_back = l->back;
+}
 
-    /* Populate the new hash table, inserting all entries existing in the
-     * current hash table. Each bucket will have a different key in the new hash
-     * table, since the size has changed. */
-    for (i = 0; i < l->refs_size; i++) {
-        struct raft_entry_ref *bucket = &l->refs[i];
-        if (bucket->count > 0) {
-            int rv = refsMove(bucket, table, size);
-            if (rv != 0) {
-                return rv;
-            }
-        } else {
-            /* If the count is zero, we expect that the bucket is unused. */
-            assert(bucket->next == NULL);
-        }
+/* Release retired buffers that are not referenced anymore. A buffer is
+ * released only after all buffers retired before it, since the entries
+ * deleted from it might still be visible through older buffers. */
+static void releaseRetired(struct raft_log *l)
+{
+    while (l->retired != NULL && l->retired->refs == 0) {
+        struct raft_log_buffer *buffer = l->retired;
+        releaseHeld(buffer->entries, buffer->size, buffer->held_front,
+                    buffer->front, buffer->back, buffer->held_back);
+        l->retired = buffer->next;
+        raft_free(buffer->entries);
+        raft_free(buffer);
     }
-
-    raft_free(l->refs);
-
-    l->refs = table;
-    l->refs_size = size;
-
-    return 0;
 }
 
-/* Initialize the reference count of the entry with the given index, setting it
- * to 1. */
-static int refsInit(struct raft_log *l,
-                    const raft_term term,
-                    const raft_index index)
+/* Clear the log if it became empty. */
+static void clearIfEmpty(struct raft_log *l)
 {
-    int i;
-
-    assert(l != NULL);
-    assert(term > 0);
-    assert(index > 0);
-
-    /* Initialize the hash map with a reasonable size */
-    if (l->refs == NULL) {
-        l->refs_size = LOG__REFS_INITIAL_SIZE;
-        l->refs = raft_calloc(l->refs_size, sizeof *l->refs);
-        if (l->refs == NULL) {
-            return RAFT_NOMEM;
-        }
+    if (logNumEntries(l) > 0 || isHolding(l)) {
+        return;
     }
-
-    /* Check if the bucket associated with the given index is available
-     * (i.e. there are no collisions), or grow the table and re-key it
-     * otherwise.
-     *
-     * We limit the number of times we try to grow the table to 10, to avoid
-     * eating up too much memory. In practice, there should never be a case
-     * where this is not enough. */
-    for (i = 0; i < 10; i++) {
-        bool collision;
-        int rc;
-
-        rc = refsTryInsert(l->refs, l->refs_size, term, index, 1, &collision);
-        if (rc != 0) {
-            return RAFT_NOMEM;
-        }
-
-        if (!collision) {
-            return 0;
-        }
-
-        rc = refsGrow(l);
-        if (rc != 0) {
-            return rc;
-        }
-    };
-
-    return RAFT_NOMEM;
+    assert(l->refs == 0);
+    raft_free(l->entries);
+    l->entries = NULL;
+    l->size = 0;
+    l->front = 0;
+    l->back = 0;
 }
 
-/* Increment the refcount of the entry with the given term and index. */
-static void refsIncr(struct raft_log *l,
-                     const raft_term term,
-                     const raft_index index)
+/* Release the memory of the deleted entries held by the current buffer, if
+ * neither it nor any retired buffer is referenced. */
+static void releaseIfUnreferenced(struct raft_log *l)
 {
-    size_t key;                  /* Hash table key for the given index. */
-    struct raft_entry_ref *slot; /* Slot for the given term/index */
-
-    assert(l != NULL);
-    assert(term > 0);
-    assert(index > 0);
-
-    key = refsKey(index, l->refs_size);
-
-    /* Lookup the slot associated with the given term/index, which must have
-     * been previously inserted. */
-    slot = &l->refs[key];
-    while (1) {
-        assert(slot != NULL);
-        assert(slot->index == index);
-        if (slot->term == term) {
-            break;
-        }
-        slot = slot->next;
+    if (!isHolding(l) || l->refs > 0 || l->retired != NULL) {
+        return;
     }
-    assert(slot != NULL);
-
-    slot->count++;
+    releaseHeld(l->entries, l->size, l->held_front, l->front, l->back,
+                l->held_back);
+    l->held_front = l->held_back = 0;
+    clearIfEmpty(l);
 }
 
-/* Decrement the refcount of the entry with the given index. Return a boolean
- * indicating whether the entry has now zero references. */
-static bool refsDecr(struct raft_log *l,
-                     const raft_term term,
-                     const raft_index index)
+/* Replace the current buffer, which is either referenced or holding deleted
+ * entries, with a new buffer of the given size containing a copy of all the
+ * entries in the log. The old buffer gets retired. */
+static int retireEntries(struct raft_log *l, size_t size)
 {
-    size_t key;                       /* Hash table key for the given index. */
-    struct raft_entry_ref *slot;      /* Slot for the given term/index */
-    struct raft_entry_ref *prev_slot; /* Slot preceeding the one to decrement */
+    struct raft_log_buffer *buffer; /* Retired buffer */
+    struct raft_log_buffer **tail;  /* For appending to the retired list */
+    struct raft_entry *entries;     /* New entries array */
+    size_t n;                       /* Current number of entries */
+    size_t i;
 
-    assert(l != NULL);
-    assert(term > 0);
-    assert(index > 0);
+    n = logNumEntries(l);
 
-    key = refsKey(index, l->refs_size);
-    prev_slot = NULL;
+    assert(l->refs > 0 || isHolding(l));
+    assert(n < size);
 
-    /* Lookup the slot associated with the given term/index, keeping track of
-     * its previous slot in the bucket list. */
-    slot = &l->refs[key];
-    while (1) {
-        assert(slot != NULL);
-        assert(slot->index == index);
-        if (slot->term == term) {
-            break;
-        }
-        prev_slot = slot;
-        slot = slot->next;
+    buffer = raft_malloc(sizeof *buffer);
+    if (buffer == NULL) {
+        return RAFT_NOMEM;
     }
 
-    slot->count--;
-
-    if (slot->count > 0) {
-        /* The entry is still referenced. */
-        return false;
+    entries = raft_calloc(size, sizeof *entries);
+    if (entries == NULL) {
+        raft_free(buffer);
+        return RAFT_NOMEM;
     }
 
-    /* If the refcount has dropped to zero, delete the slot. */
-    if (prev_slot != NULL) {
-        /* This isn't the very first slot, simply unlink it from the slot
-         * list. */
-        prev_slot->next = slot->next;
-        raft_free(slot);
-    } else if (slot->next != NULL) {
-        /* This is the very first slot, and slot list is not empty. Copy the
-         * second slot into the first one, then delete it. */
-        struct raft_entry_ref *second_slot = slot->next;
-        *slot = *second_slot;
-        raft_free(second_slot);
+    for (i = 0; i < n; i++) {
+        memcpy(&entries[i], entryAt(l, i), sizeof *entries);
     }
 
-    return true;
-}
-
-void logInit(struct raft_log *l)
-{
-    assert(l != NULL);
-    l->entries = NULL;
-    l->size = 0;
-    l->front = l->back = 0;
-    l->offset = 0;
-    l->refs = NULL;
-    l->refs_size = 0;
-    l->snapshot.last_index = 0;
-    l->snapshot.last_term = 0;
-}
+    buffer->entries = l->entries;
+    buffer->size = l->size;
+    buffer->front = l->front;
+    buffer->back = l->back;
+    if (isHolding(l)) {
+        buffer->held_front = l->held_front;
+        buffer->held_back = l->held_back;
+    } else {
+        buffer->held_front = l->front;
+        buffer->held_back = l->back;
+    }
+    buffer->refs = l->refs;
+    buffer->next = NULL;
 
-/* Return the index of the i'th entry in the log. */
-static raft_index indexAt(struct raft_log *l, size_t i)
-{
-    return l->offset + i + 1;
-}
+    for (tail = &l->retired; *tail != NULL; tail = &(*tail)->next) {
+    }
+    *tail = buffer;
 
-/* Return the circular buffer position of the i'th entry in the log. */
-static size_t positionAt(struct raft_log *l, size_t i)
-{
-    return (l->front + i) % l->size;
-}
+    l->entries = entries;
+    l->size = size;
+    l->front = 0;
+    l->back = n;
+    l->held_front = l->held_back = 0;
+    l->refs = 0;
 
-/* Return the i'th entry in the log. */
-static struct raft_entry *entryAt(struct raft_log *l, size_t i)
-{
-    return &l->entries[positionAt(l, i)];
+    return 0;
 }
 
 void logClose(struct raft_log *l)
 {
-    void *batch = NULL; /* Last batch that has been freed */
-
     assert(l != NULL);
 
-    if (l->entries != NULL) {
-        size_t i;
-        size_t n = logNumEntries(l);
-
-        for (i = 0; i < n; i++) {
-            struct raft_entry *entry = entryAt(l, i);
-            raft_index index = indexAt(l, i);
-            size_t key = refsKey(index, l->refs_size);
-            struct raft_entry_ref *slot = &l->refs[key];
-
-            /* We require that there are no outstanding references to active
-             * entries. */
-            assert(slot->count == 1);
-
-            /* TODO: we should support the case where the bucket has more than
-             * one slot. */
-            assert(slot->next == NULL);
-
-            /* Release the memory used by the entry data (either directly or via
-             * a batch). */
-            if (entry->batch == NULL) {
-                if (entry->buf.base != NULL) {
-                    raft_free(entry->buf.base);
-                }
-            } else {
-                if (entry->batch != batch) {
-                    /* This batch was not released yet, so let's do it now. */
-                    batch = entry->batch;
-                    raft_free(entry->batch);
-                }
-            }
-        }
+    /* We require that there are no outstanding references to entries. */
+    assert(l->refs == 0);
+    assert(l->retired == NULL);
+    assert(!isHolding(l));
 
+    if (l->entries != NULL) {
+        /* Release all entries, as if they had all been deleted. */
+        releaseHeld(l->entries, l->size, l->front, l->back, l->back, l->back);
         raft_free(l->entries);
     }
-
-    if (l->refs != NULL) {
-        raft_free(l->refs);
-    }
 }
 
 void logStart(struct raft_log *l,
@@ -437,6 +264,13 @@ static int ensureCapacity(struct raft_log *l)
 
     n = logNumEntries(l);
 
+    /* The free slots of a buffer holding deleted entries can't be reused, since
+     * their content might still be referenced. */
+    if (isHolding(l)) {
+        size = n + 1 < l->size ? l->size : (l->size + 1) * 2;
+        return retireEntries(l, size);
+    }
+
     if (n + 1 < l->size) {
         return 0;
     }
@@ -445,6 +279,11 @@ static int ensureCapacity(struct raft_log *l)
      * entry). Over-allocating now avoids smaller allocations later. */
     size = (l->size + 1) * 2;
 
+    /* If some entries are referenced, the current buffer must stay around. */
+    if (l->refs > 0) {
+        return retireEntries(l, size);
+    }
+
     entries = raft_calloc(size, sizeof *entries);
     if (entries == NULL) {
         return RAFT_NOMEM;
@@ -477,7 +316,6 @@ int logAppend(struct raft_log *l,
 {
     int rv;
     struct raft_entry *entry;
-    raft_index index;
 
     assert(l != NULL);
     assert(term > 0);
@@ -489,13 +327,6 @@ int logAppend(struct raft_log *l,
         return rv;
     }
 
-    index = logLastIndex(l) + 1;
-
-    rv = refsInit(l, term, index);
-    if (rv != 0) {
-        return rv;
-    }
-
     entry = &l->entries[l->back];
     entry->term = term;
     entry->type = type;
@@ -505,6 +336,8 @@ int logAppend(struct raft_log *l,
     l->back += 1;
     l->back = l->back % l->size;
 
+    l->cache.size += buf->len;
+
     return 0;
 }
 
@@ -633,6 +466,69 @@ raft_term logTermOf(struct raft_log *l, const raft_index index)
     return l->entries[i].term;
 }
 
+/* Return the oldest index we know the term of, or #0 if we know none. */
+static raft_index oldestKnownIndex(struct raft_log *l)
+{
+    if (l->snapshot.last_index != 0 && l->snapshot.last_index == l->offset) {
+        return l->offset;
+    }
+    if (logNumEntries(l) == 0) {
+        return 0;
+    }
+    return l->offset + 1;
+}
+
+/* Terms are non-decreasing along the log, so both lookups below are binary
+ * searches over the range of indexes whose term is known. */
+raft_index logFirstIndexOfTerm(struct raft_log *l, raft_index index)
+{
+    raft_term term = logTermOf(l, index);
+    raft_index low = oldestKnownIndex(l);
+    raft_index high = index;
+
+    assert(term != 0);
+    assert(low != 0 && low <= index);
+
+    /* Invariant: the entry at @high has @term. */
+    while (low < high) {
+        raft_index middle = low + (high - low) / 2;
+        if (logTermOf(l, middle) == term) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return high;
+}
+
+raft_index logLastIndexUpToTerm(struct raft_log *l,
+                                raft_term term,
+                                raft_index index)
+{
+    raft_index low = oldestKnownIndex(l);
+    raft_index high;
+    raft_index last = logLastIndex(l);
+
+    if (low == 0 || index < low) {
+        return 0;
+    }
+    high = index < last ? index : last;
+    if (logTermOf(l, low) > term) {
+        return 0;
+    }
+
+    /* Invariant: the entry at @low has a term lower than or equal to @term. */
+    while (low < high) {
+        raft_index middle = low + (high - low + 1) / 2;
+        if (logTermOf(l, middle) <= term) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
 raft_index logSnapshotIndex(struct raft_log *l)
 {
     return l->snapshot.last_index;
@@ -662,13 +558,47 @@ const struct raft_entry *logGet(struct raft_log *l, const raft_index index)
     return &l->entries[i];
 }
 
+/* Reverse the order of the entries in the given range of the array. */
+static void reverseEntries(struct raft_entry *entries, size_t start, size_t end)
+{
+    while (start + 1 < end) {
+        struct raft_entry tmp = entries[start];
+        entries[start] = entries[end - 1];
+        entries[end - 1] = tmp;
+        start++;
+        end--;
+    }
+}
+
+/* Rearrange the circular buffer so that the first entry is at the beginning of
+ * the array and the entries don't wrap around its end anymore. */
+static int linearize(struct raft_log *l)
+{
+    size_t n = logNumEntries(l);
+
+    /* Slots that are referenced or holding deleted entries must not move. */
+    if (l->refs > 0 || isHolding(l)) {
+        return retireEntries(l, l->size);
+    }
+
+    /* Rotate the array left by l->front positions. */
+    reverseEntries(l->entries, 0, l->front);
+    reverseEntries(l->entries, l->front, l->size);
+    reverseEntries(l->entries, 0, l->size);
+
+    l->front = 0;
+    l->back = n;
+
+    return 0;
+}
+
 int logAcquire(struct raft_log *l,
                const raft_index index,
                struct raft_entry *entries[],
                unsigned *n)
 {
     size_t i;
-    size_t j;
+    int rv;
 
     assert(l != NULL);
     assert(index > 0);
@@ -684,119 +614,157 @@ int logAcquire(struct raft_log *l,
         return 0;
     }
 
+    /* The acquired entries are a view into the circular buffer, so if they
+     * wrap around its end we need to rearrange it first. This happens at most
+     * once every l->size appended entries. */
+    if (i >= l->back && l->back > 0) {
+        rv = linearize(l);
+        if (rv != 0) {
+            return rv;
+        }
+        i = locateEntry(l, index);
+    }
+
     if (i < l->back) {
-        /* The last entry does not wrap with respect to i, so the number of
-         * entries is simply the length of the range [i...l->back). */
         *n = (unsigned)(l->back - i);
     } else {
-        /* The last entry wraps with respect to i, so the number of entries is
-         * the sum of the lengths of the ranges [i...l->size) and [0...l->back),
-         * which is l->size - i + l->back.*/
-        *n = (unsigned)(l->size - i + l->back);
+        /* The last entry is the last slot of the array. */
+        assert(l->back == 0);
+        *n = (unsigned)(l->size - i);
     }
 
     assert(*n > 0);
 
-    *entries = raft_calloc(*n, sizeof **entries);
-    if (*entries == NULL) {
-        return RAFT_NOMEM;
-    }
-
-    for (j = 0; j < *n; j++) {
-        size_t k = (i + j) % l->size;
-        struct raft_entry *entry = &(*entries)[j];
-        *entry = l->entries[k];
-        refsIncr(l, entry->term, index + j);
-    }
+    *entries = &l->entries[i];
+    l->refs += 1;
 
     return 0;
 }
 
-/* Return true if the given batch is referenced by any entry currently in the
- * log. */
-static bool isBatchReferenced(struct raft_log *l, const void *batch)
+/* Release the payload of the entry with the given index, which must be the
+ * oldest one that was not evicted yet. Return false if the entry must stay in
+ * memory for now.
+ *
+ * The payloads of configuration entries are kept around, since they might be
+ * needed to roll back an uncommitted configuration, but they get copied out of
+ * their batch so the rest of it can be released. A batch gets released along
+ * with its last entry, since all the entries before it are gone by then. */
+static bool evictEntry(struct raft_log *l, raft_index index)
 {
-    size_t i;
+    struct raft_entry *entry = &l->entries[locateEntry(l, index)];
+    const struct raft_entry *next = NULL;
+    void *batch = entry->batch;
 
-    /* Iterate through all live entries to see if there's one
-     * belonging to the same batch. This is slightly inefficient but
-     * this code path should be taken very rarely in practice. */
-    for (i = 0; i < logNumEntries(l); i++) {
-        struct raft_entry *entry = entryAt(l, i);
-        if (entry->batch == batch) {
-            return true;
+    if (index < logLastIndex(l)) {
+        next = &l->entries[locateEntry(l, index + 1)];
+    }
+
+    if (entry->type == RAFT_CHANGE) {
+        if (batch != NULL) {
+            void *base = raft_malloc(entry->buf.len);
+            if (base == NULL) {
+                return false;
+            }
+            memcpy(base, entry->buf.base, entry->buf.len);
+            entry->buf.base = base;
+            entry->batch = NULL;
+        }
+    } else {
+        l->cache.size -= entry->buf.len;
+        if (batch == NULL && entry->buf.base != NULL) {
+            raft_free(entry->buf.base);
         }
+        entry->buf.base = NULL;
+        entry->buf.len = 0;
+        entry->batch = NULL;
+    }
+
+    if (batch != NULL && (next == NULL || next->batch != batch)) {
+        raft_free(batch);
     }
 
-    return false;
+    return true;
 }
 
-void logRelease(struct raft_log *l,
-                const raft_index index,
-                struct raft_entry entries[],
-                const unsigned n)
+/* Evict the payloads of the oldest entries up to the cache bound, until the
+ * ones left in memory fit the cache size. Nothing is evicted while entries are
+ * referenced or deleted entries are still held, since they might share the
+ * memory being released. */
+static void evict(struct raft_log *l)
 {
-    size_t i;
-    void *batch = NULL; /* Last batch whose memory was freed */
+    raft_index index;
 
-    assert(l != NULL);
-    assert((entries == NULL && n == 0) || (entries != NULL && n > 0));
+    if (l->cache.max == 0 || l->refs > 0 || l->retired != NULL ||
+        isHolding(l)) {
+        return;
+    }
 
-    for (i = 0; i < n; i++) {
-        struct raft_entry *entry = &entries[i];
-        bool unref;
-
-        unref = refsDecr(l, entry->term, index + i);
-
-        /* If there are no outstanding references to this entry, free its
-         * payload if it's not part of a batch, or check if we can free the
-         * batch itself. */
-        if (unref) {
-            if (entries[i].batch == NULL) {
-                if (entry->buf.base != NULL) {
-                    raft_free(entries[i].buf.base);
-                }
-            } else {
-                if (entry->batch != batch) {
-                    if (!isBatchReferenced(l, entry->batch)) {
-                        batch = entry->batch;
-                        raft_free(batch);
-                    }
-                }
-            }
+    index = l->cache.evicted > l->offset ? l->cache.evicted : l->offset;
+    index++;
+    while (l->cache.size > l->cache.max && index <= l->cache.bound) {
+        if (!evictEntry(l, index)) {
+            break;
         }
+        l->cache.evicted = index;
+        index++;
     }
+}
 
-    if (entries != NULL) {
-        raft_free(entries);
-    }
+void logEvict(struct raft_log *l, raft_index index)
+{
+    assert(index <= logLastIndex(l));
+    l->cache.bound = index;
+    evict(l);
 }
 
-/* Clear the log if it became empty. */
-static void clearIfEmpty(struct raft_log *l)
+bool logIsEvicted(struct raft_log *l, raft_index index)
 {
-    if (logNumEntries(l) > 0) {
-        return;
+    return index > l->offset && index <= l->cache.evicted;
+}
+
+/* Return true if the given entries array points into the given buffer. The
+ * addresses are compared as integers, since comparing pointers to different
+ * arrays is undefined behavior. */
+static bool isInBuffer(const struct raft_entry *entries,
+                       const struct raft_entry *buffer,
+                       size_t size)
+{
+    uintptr_t address = (uintptr_t)entries;
+    uintptr_t start = (uintptr_t)buffer;
+    if (buffer == NULL) {
+        return false;
     }
-    raft_free(l->entries);
-    l->entries = NULL;
-    l->size = 0;
-    l->front = 0;
-    l->back = 0;
+    return address >= start && address < start + size * sizeof *buffer;
 }
 
-/* Destroy an entry, possibly releasing the memory of its buffer. */
-static void destroyEntry(struct raft_log *l, struct raft_entry *entry)
+void logRelease(struct raft_log *l, struct raft_entry entries[], unsigned n)
 {
-    if (entry->batch == NULL) {
-        if (entry->buf.base != NULL) {
-            raft_free(entry->buf.base);
-        }
+    struct raft_log_buffer *buffer;
+
+    assert(l != NULL);
+    assert((entries == NULL && n == 0) || (entries != NULL && n > 0));
+
+    if (entries == NULL) {
+        return;
+    }
+
+    if (isInBuffer(entries, l->entries, l->size)) {
+        assert(l->refs > 0);
+        l->refs -= 1;
     } else {
-        if (!isBatchReferenced(l, entry->batch)) {
-            raft_free(entry->batch);
+        for (buffer = l->retired; buffer != NULL; buffer = buffer->next) {
+            if (isInBuffer(entries, buffer->entries, buffer->size)) {
+                break;
+            }
         }
+        assert(buffer != NULL);
+        assert(buffer->refs > 0);
+        buffer->refs -= 1;
+        releaseRetired(l);
     }
+
+    releaseIfUnreferenced(l);
+    evict(l);
 }
 
 /* Core logic of @logTruncate and @logDiscard, removing all log entries from
@@ -805,36 +773,41 @@ static void removeSuffix(struct raft_log *l,
                          const raft_index index,
                          bool destroy)
 {
-    size_t i;
     size_t n;
-    raft_index start = index;
 
     assert(l != NULL);
     assert(index > l->offset);
     assert(index <= logLastIndex(l));
 
     /* Number of entries to delete */
-    n = (size_t)(logLastIndex(l) - start) + 1;
+    n = (size_t)(logLastIndex(l) - index) + 1;
 
-    for (i = 0; i < n; i++) {
-        struct raft_entry *entry;
-        bool unref;
+    l->cache.size -= payloadSize(l, logNumEntries(l) - n, n);
+    if (l->cache.bound >= index) {
+        l->cache.bound = index - 1;
+    }
+    if (l->cache.evicted >= index) {
+        l->cache.evicted = index - 1;
+    }
 
-        if (l->back == 0) {
-            l->back = l->size - 1;
-        } else {
-            l->back--;
-        }
+    if (destroy) {
+        hold(l);
+    } else {
+        /* The discarded entries were never handed out, so if the buffer is
+         * holding deleted entries just stop tracking their slots. */
+        assert(!isHolding(l) || l->held_back == l->back);
+    }
 
-        entry = &l->entries[l->back];
-        unref = refsDecr(l, entry->term, start + n - i - 1);
+    l->back = (l->back + l->size - n) % l->size;
 
-        if (unref && destroy) {
-            destroyEntry(l, entry);
+    if (destroy) {
+        releaseIfUnreferenced(l);
+    } else {
+        if (isHolding(l)) {
+            l->held_back = l->back;
         }
+        clearIfEmpty(l);
     }
-
-    clearIfEmpty(l);
 }
 
 void logTruncate(struct raft_log *l, const raft_index index)
@@ -853,7 +826,6 @@ void logDiscard(struct raft_log *l, const raft_index index)
 /* Delete all entries up to the given index (included). */
 static void removePrefix(struct raft_log *l, const raft_index index)
 {
-    size_t i;
     size_t n;
 
     assert(l != NULL);
@@ -863,27 +835,14 @@ static void removePrefix(struct raft_log *l, const raft_index index)
     /* Number of entries to delete */
     n = (size_t)(index - indexAt(l, 0)) + 1;
 
-    for (i = 0; i < n; i++) {
-        struct raft_entry *entry;
-        bool unref;
-
-        entry = &l->entries[l->front];
+    l->cache.size -= payloadSize(l, 0, n);
 
-        if (l->front == l->size - 1) {
-            l->front = 0;
-        } else {
-            l->front++;
-        }
-        l->offset++;
+    hold(l);
 
-        unref = refsDecr(l, entry->term, l->offset);
+    l->front = (l->front + n) % l->size;
+    l->offset += n;
 
-        if (unref) {
-            destroyEntry(l, entry);
-        }
-    }
-
-    clearIfEmpty(l);
+    releaseIfUnreferenced(l);
 }
 
 void logSnapshot(struct raft_log *l, raft_index last_index, unsigned trailing)
@@ -5,9 +5,6 @@
 
 #include "../include/raft.h"
 
-/* Initial size of the entry reference count hash table. */
-#define LOG__REFS_INITIAL_SIZE 256
-
 /* Initialize an empty in-memory log of raft entries. */
 void logInit(struct raft_log *l);
 
@@ -37,6 +34,17 @@ raft_term logLastTerm(struct raft_log *l);
  * entry in the most recent snapshot). */
 raft_term logTermOf(struct raft_log *l, raft_index index);
 
+/* Get the lowest index whose entry has the same term as the entry at @index,
+ * among the ones we know the term of. The term of @index must be known. */
+raft_index logFirstIndexOfTerm(struct raft_log *l, raft_index index);
+
+/* Get the highest index not greater than @index whose entry has a term lower
+ * than or equal to @term. Return #0 if there is no such index among the ones we
+ * know the term of. */
+raft_index logLastIndexUpToTerm(struct raft_log *l,
+                                raft_term term,
+                                raft_index index);
+
 /* Get the last index of the most recent snapshot. Return #0 if there are no *
  * snapshots. */
 raft_index logSnapshotIndex(struct raft_log *l);
@@ -64,19 +72,31 @@ int logAppendConfiguration(struct raft_log *l,
                            const raft_term term,
                            const struct raft_configuration *configuration);
 
-/* Acquire an array of entries from the given index onwards. * The payload
- * memory referenced by the @buf attribute of the returned entries is guaranteed
- * to be valid until logRelease() is called. */
+/* Acquire an array of entries from the given index onwards. * The returned
+ * array is a view into the log's circular buffer, which must not be modified:
+ * both the array and the payload memory referenced by the @buf attribute of its
+ * entries are guaranteed to be valid until logRelease() is called. The cost of
+ * acquiring and releasing entries does not depend on their number, except when
+ * the entries wrap around the end of the buffer and need to be rearranged.
+ * Entries whose payload has been evicted have an empty buffer. */
 int logAcquire(struct raft_log *l,
                raft_index index,
                struct raft_entry *entries[],
                unsigned *n);
 
 /* Release a previously acquired array of entries. */
-void logRelease(struct raft_log *l,
-                raft_index index,
-                struct raft_entry entries[],
-                unsigned n);
+void logRelease(struct raft_log *l, struct raft_entry entries[], unsigned n);
+
+/* Allow the payloads of the entries up to the given index (included) to be
+ * evicted from memory, oldest first, whenever their total size exceeds the
+ * cache size. Entries must have been persisted and applied before becoming
+ * evictable, and their payloads can then only be read back from disk. */
+void logEvict(struct raft_log *l, raft_index index);
+
+/* Return true if the entry with the given index is among the evicted ones, in
+ * which case entries must not be acquired from it. The payloads of evicted
+ * configuration entries are kept in memory, but they count as evicted too. */
+bool logIsEvicted(struct raft_log *l, raft_index index);
 
 /* Delete all entries from the given index (included) onwards. If the log is
  * empty this is a no-op. If @index is lower than or equal to the index of the
@@ -3,6 +3,7 @@
 #include "../include/raft.h"
 #include "assert.h"
 #include "configuration.h"
+#include "election.h"
 #include "err.h"
 #include "log.h"
 #include "progress.h"
@@ -60,8 +61,7 @@ bool membershipUpdateCatchUpRound(struct raft *r)
     assert(r->state == RAFT_LEADER);
     assert(r->leader_state.promotee_id != 0);
 
-    server_index =
-        configurationIndexOf(&r->configuration, r->leader_state.promotee_id);
+    server_index = configurationHashIndexOf(r, r->leader_state.promotee_id);
     assert(server_index < r->configuration.n);
 
     match_index = progressMatchIndex(r, server_index);
@@ -121,6 +121,7 @@ int membershipUncommittedChange(struct raft *r,
 
     r->configuration = configuration;
     r->configuration_uncommitted_index = index;
+    configurationHashRebuild(r);
 
     return 0;
 
@@ -150,6 +151,7 @@ int membershipRollback(struct raft *r)
     raft_configuration_init(&r->configuration);
 
     rv = configurationDecode(&entry->buf, &r->configuration);
+    configurationHashRebuild(r);
     if (rv != 0) {
         return rv;
     }
@@ -177,7 +179,7 @@ int membershipLeadershipTransferStart(struct raft *r)
     struct raft_message message;
     int rv;
     assert(r->transfer->send.data == NULL);
-    server = configurationGet(&r->configuration, r->transfer->id);
+    server = configurationHashGet(r, r->transfer->id);
     assert(server != NULL);
     message.type = RAFT_IO_TIMEOUT_NOW;
     message.server_id = server->id;
@@ -186,7 +188,7 @@ int membershipLeadershipTransferStart(struct raft *r)
     message.timeout_now.last_log_index = logLastIndex(&r->log);
     message.timeout_now.last_log_term = logLastTerm(&r->log);
     r->transfer->send.data = r;
-    rv = r->io->send(r->io, &r->transfer->send, &message, NULL);
+    rv = electionSend(r, &r->transfer->send, &message, NULL);
     if (rv != 0) {
         ErrMsgTransferf(r->io->errmsg, r->errmsg, "send timeout now to %llu",
                         server->id);
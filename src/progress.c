@@ -1,8 +1,11 @@
 #include "progress.h"
 
+#include <stdlib.h>
+
 #include "assert.h"
 #include "configuration.h"
 #include "log.h"
+#include "snapshot.h"
 #include "tracing.h"
 
 /* Set to 1 to enable tracing. */
@@ -28,7 +31,102 @@ static void initProgress(struct raft_progress *p, raft_index last_index)
     p->snapshot_index = 0;
     p->last_send = 0;
     p->recent_recv = false;
+    p->reading = false;
+    p->read_round = 0;
     p->state = PROGRESS__PROBE;
+    p->snapshot = NULL;
+    p->snapshot_offset = 0;
+    p->snapshot_size = 0;
+    p->inflight = NULL;
+    p->inflight_size = 0;
+    p->inflight_front = 0;
+    p->inflight_n = 0;
+    p->inflight_bytes = 0;
+}
+
+/* Release the snapshot being sent in chunks, if any. */
+static void snapshotRelease(struct raft_progress *p)
+{
+    if (p->snapshot != NULL) {
+        snapshotDestroy(p->snapshot);
+        p->snapshot = NULL;
+    }
+    p->snapshot_offset = 0;
+    p->snapshot_size = 0;
+}
+
+/* Forget about all messages in flight, e.g. because we're going back to probe
+ * mode and we'll resend whatever was not acknowledged. */
+static void inflightReset(struct raft_progress *p)
+{
+    p->inflight_front = 0;
+    p->inflight_n = 0;
+    p->inflight_bytes = 0;
+}
+
+/* Drop from the front of the ring all messages whose entries have been
+ * acknowledged, i.e. whose last index is lower or equal than the given one. */
+static void inflightFreeTo(struct raft_progress *p, raft_index index)
+{
+    while (p->inflight_n > 0) {
+        struct raft_inflight *m = &p->inflight[p->inflight_front];
+        if (m->last_index > index) {
+            break;
+        }
+        assert(p->inflight_bytes >= m->bytes);
+        p->inflight_bytes -= m->bytes;
+        p->inflight_front = (p->inflight_front + 1) % p->inflight_size;
+        p->inflight_n--;
+    }
+    if (p->inflight_n == 0) {
+        inflightReset(p);
+    }
+}
+
+/* Make room for at least one more message in the ring, growing it if needed. */
+static int inflightEnsureCapacity(struct raft_progress *p)
+{
+    struct raft_inflight *inflight;
+    unsigned size;
+    unsigned i;
+
+    if (p->inflight_n < p->inflight_size) {
+        return 0;
+    }
+
+    size = p->inflight_size == 0 ? PROGRESS__INFLIGHT_INITIAL_SIZE
+                                 : p->inflight_size * 2;
+    inflight = raft_malloc(size * sizeof *inflight);
+    if (inflight == NULL) {
+        return RAFT_NOMEM;
+    }
+
+    /* Copy the messages in order at the beginning of the new ring. */
+    for (i = 0; i < p->inflight_n; i++) {
+        unsigned j = (p->inflight_front + i) % p->inflight_size;
+        inflight[i] = p->inflight[j];
+    }
+
+    if (p->inflight != NULL) {
+        raft_free(p->inflight);
+    }
+    p->inflight = inflight;
+    p->inflight_size = size;
+    p->inflight_front = 0;
+
+    return 0;
+}
+
+/* Allocate room in the sorted view of match indexes for n voters. */
+static int quorumResize(struct raft *r, unsigned n)
+{
+    raft_index *quorum;
+    quorum = raft_realloc(r->leader_state.quorum, (n + 1) * sizeof *quorum);
+    if (quorum == NULL) {
+        return RAFT_NOMEM;
+    }
+    r->leader_state.quorum = quorum;
+    return 0;
 }
 
 int progressBuildArray(struct raft *r)
@@ -36,10 +134,17 @@ int progressBuildArray(struct raft *r)
     struct raft_progress *progress;
     unsigned i;
     raft_index last_index = logLastIndex(&r->log);
+    int rv;
     progress = raft_malloc(r->configuration.n * sizeof *progress);
     if (progress == NULL) {
         return RAFT_NOMEM;
     }
+    r->leader_state.quorum = NULL;
+    rv = quorumResize(r, r->configuration.n);
+    if (rv != 0) {
+        raft_free(progress);
+        return rv;
+    }
     for (i = 0; i < r->configuration.n; i++) {
         initProgress(&progress[i], last_index);
         if (r->configuration.servers[i].id == r->id) {
@@ -47,6 +152,7 @@ int progressBuildArray(struct raft *r)
         }
     }
     r->leader_state.progress = progress;
+    progressRebuildQuorum(r);
     return 0;
 }
 
@@ -58,11 +164,19 @@ int progressRebuildArray(struct raft *r,
     unsigned i;
     unsigned j;
     raft_id id;
+    int rv;
 
     progress = raft_malloc(configuration->n * sizeof *progress);
     if (progress == NULL) {
         return RAFT_NOMEM;
     }
+    if (configuration->n > r->configuration.n) {
+        rv = quorumResize(r, configuration->n);
+        if (rv != 0) {
+            raft_free(progress);
+            return rv;
+        }
+    }
 
     /* First copy the progress information for the servers that exists both in
      * the current and in the new configuration. */
@@ -71,7 +185,11 @@ int progressRebuildArray(struct raft *r,
         j = configurationIndexOf(configuration, id);
         if (j == configuration->n) {
             /* This server is not present in the new configuration, so we just
-             * skip it. */
+             * release its flow control window and snapshot and skip it. */
+            if (r->leader_state.progress[i].inflight != NULL) {
+                raft_free(r->leader_state.progress[i].inflight);
+            }
+            snapshotRelease(&r->leader_state.progress[i]);
             continue;
         }
         progress[j] = r->leader_state.progress[i];
@@ -81,7 +199,7 @@ int progressRebuildArray(struct raft *r,
      * configuration, but not in the current one. */
     for (i = 0; i < configuration->n; i++) {
         id = configuration->servers[i].id;
-        j = configurationIndexOf(&r->configuration, id);
+        j = configurationHashIndexOf(r, id);
         if (j < r->configuration.n) {
             /* This server is present both in the new and in the current
              * configuration, so we have already copied its next/match index
@@ -98,6 +216,26 @@ int progressRebuildArray(struct raft *r,
     return 0;
 }
 
+void progressFreeArray(struct raft *r)
+{
+    unsigned i;
+    if (r->leader_state.progress == NULL) {
+        return;
+    }
+    for (i = 0; i < r->configuration.n; i++) {
+        struct raft_progress *p = &r->leader_state.progress[i];
+        if (p->inflight != NULL) {
+            raft_free(p->inflight);
+        }
+        snapshotRelease(p);
+    }
+    raft_free(r->leader_state.progress);
+    r->leader_state.progress = NULL;
+    raft_free(r->leader_state.quorum);
+    r->leader_state.quorum = NULL;
+    r->leader_state.n_quorum = 0;
+}
+
 bool progressIsUpToDate(struct raft *r, unsigned i)
 {
     struct raft_progress *p = &r->leader_state.progress[i];
@@ -123,17 +261,31 @@ bool progressShouldReplicate(struct raft *r, unsigned i)
 
     switch (p->state) {
         case PROGRESS__SNAPSHOT:
-            /* If we have already sent a snapshot, don't send any further entry
-             * and let's wait for the target server to reply.
-             *
-             * TODO: rollback to probe if we don't hear anything for a while. */
-            result = false;
+            /* If we have already sent a snapshot chunk, don't send any further
+             * entry and let's wait for the target server to reply. If nothing
+             * was sent for a heartbeat interval, the chunk or its result was
+             * probably lost, so send it again, which also prevents the server
+             * from starting an election. Nothing gets sent while the snapshot
+             * or the chunk to send is still being loaded. */
+            result = needs_heartbeat;
             break;
         case PROGRESS__PROBE:
             /* We send at most one message per heatbeat interval. */
             result = needs_heartbeat;
             break;
         case PROGRESS__PIPELINE:
+            /* If the flow control window is full, pause until some results
+             * come back. If none arrives for a whole heartbeat interval some
+             * messages were probably lost, so fall back to probe mode and
+             * resend from the match index. */
+            if (progressInflightIsFull(r, i)) {
+                if (needs_heartbeat) {
+                    tracef("inflight window full -> probe");
+                    progressToProbe(r, i);
+                    result = true;
+                }
+                break;
+            }
             /* In replication mode we send empty append entries messages only if
              * haven't sent anything in the last heartbeat interval. */
             result = !progressIsUpToDate(r, i) || needs_heartbeat;
@@ -152,6 +304,83 @@ raft_index progressMatchIndex(struct raft *r, unsigned i)
     return r->leader_state.progress[i].match_index;
 }
 
+/* Compare two match indexes, for sorting. */
+static int quorumCompare(const void *a, const void *b)
+{
+    raft_index index1 = *(const raft_index *)a;
+    raft_index index2 = *(const raft_index *)b;
+    if (index1 < index2) {
+        return -1;
+    }
+    return index1 > index2 ? 1 : 0;
+}
+
+void progressRebuildQuorum(struct raft *r)
+{
+    unsigned i;
+    unsigned n = 0;
+    for (i = 0; i < r->configuration.n; i++) {
+        if (r->configuration.servers[i].role == RAFT_VOTER) {
+            r->leader_state.quorum[n] = r->leader_state.progress[i].match_index;
+            n++;
+        }
+    }
+    qsort(r->leader_state.quorum, n, sizeof *r->leader_state.quorum,
+          quorumCompare);
+    r->leader_state.n_quorum = n;
+}
+
+raft_index progressQuorumIndex(struct raft *r)
+{
+    unsigned n = r->leader_state.n_quorum;
+    if (n == 0) {
+        return 0;
+    }
+    /* The view is sorted in ascending order, so this index and all the ones
+     * after it are matched by a majority. */
+    return r->leader_state.quorum[n - (n / 2 + 1)];
+}
+
+void progressSetMatchIndex(struct raft *r, unsigned i, raft_index index)
+{
+    struct raft_progress *p = &r->leader_state.progress[i];
+    raft_index *quorum = r->leader_state.quorum;
+    unsigned n = r->leader_state.n_quorum;
+    unsigned lo = 0;
+    unsigned hi = n;
+    unsigned j;
+
+    if (r->configuration.servers[i].role != RAFT_VOTER) {
+        p->match_index = index;
+        return;
+    }
+
+    /* Find the old value in the view: all voters with equal match indexes are
+     * interchangeable, so any slot holding it will do. */
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (quorum[mid] < p->match_index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    j = lo;
+    assert(j < n && quorum[j] == p->match_index);
+
+    /* Move it to its new sorted position. */
+    while (j + 1 < n && quorum[j + 1] < index) {
+        quorum[j] = quorum[j + 1];
+        j++;
+    }
+    while (j > 0 && quorum[j - 1] > index) {
+        quorum[j] = quorum[j - 1];
+        j--;
+    }
+    quorum[j] = index;
+    p->match_index = index;
+}
+
 void progressUpdateLastSend(struct raft *r, unsigned i)
 {
     r->leader_state.progress[i].last_send = r->io->time(r->io);
@@ -169,11 +398,23 @@ void progressMarkRecentRecv(struct raft *r, const unsigned i)
     r->leader_state.progress[i].recent_recv = true;
 }
 
+void progressMarkReadRound(struct raft *r,
+                           unsigned i,
+                           unsigned long long round)
+{
+    struct raft_progress *p = &r->leader_state.progress[i];
+    if (round > p->read_round) {
+        p->read_round = round;
+    }
+}
+
 void progressToSnapshot(struct raft *r, unsigned i)
 {
     struct raft_progress *p = &r->leader_state.progress[i];
     p->state = PROGRESS__SNAPSHOT;
     p->snapshot_index = logSnapshotIndex(&r->log);
+    snapshotRelease(p);
+    inflightReset(p);
 }
 
 void progressAbortSnapshot(struct raft *r, const unsigned i)
@@ -181,6 +422,53 @@ void progressAbortSnapshot(struct raft *r, const unsigned i)
     struct raft_progress *p = &r->leader_state.progress[i];
     p->snapshot_index = 0;
     p->state = PROGRESS__PROBE;
+    snapshotRelease(p);
+}
+
+struct raft_snapshot *progressSnapshot(struct raft *r, const unsigned i)
+{
+    return r->leader_state.progress[i].snapshot;
+}
+
+void progressSetSnapshot(struct raft *r,
+                         const unsigned i,
+                         struct raft_snapshot *snapshot,
+                         size_t size)
+{
+    struct raft_progress *p = &r->leader_state.progress[i];
+    assert(p->state == PROGRESS__SNAPSHOT);
+    assert(p->snapshot == NULL);
+    p->snapshot = snapshot;
+    p->snapshot_index = snapshot->index;
+    p->snapshot_offset = 0;
+    p->snapshot_size = size;
+}
+
+size_t progressSnapshotSize(struct raft *r, const unsigned i)
+{
+    return r->leader_state.progress[i].snapshot_size;
+}
+
+size_t progressSnapshotOffset(struct raft *r, const unsigned i)
+{
+    return r->leader_state.progress[i].snapshot_offset;
+}
+
+void progressSetSnapshotOffset(struct raft *r,
+                               const unsigned i,
+                               size_t offset)
+{
+    r->leader_state.progress[i].snapshot_offset = offset;
+}
+
+bool progressIsReading(struct raft *r, const unsigned i)
+{
+    return r->leader_state.progress[i].reading;
+}
+
+void progressSetReading(struct raft *r, const unsigned i, bool reading)
+{
+    r->leader_state.progress[i].reading = reading;
 }
 
 int progressState(struct raft *r, const unsigned i)
@@ -192,7 +480,9 @@ int progressState(struct raft *r, const unsigned i)
 bool progressMaybeDecrement(struct raft *r,
                             const unsigned i,
                             raft_index rejected,
-                            raft_index last_index)
+                            raft_index last_index,
+                            raft_term conflict_term,
+                            raft_index conflict_index)
 {
     struct raft_progress *p = &r->leader_state.progress[i];
 
@@ -231,6 +521,21 @@ bool progressMaybeDecrement(struct raft *r,
     }
 
     p->next_index = min(rejected, last_index + 1);
+
+    /* The follower has an entry at the rejected index, but with a different
+     * term. If we have entries of that term too, the logs can match at most up
+     * to the last of them, otherwise none of the follower's entries of that
+     * term can match ours, so skip them all in one go. */
+    if (conflict_term != 0) {
+        raft_index index;
+        index = logLastIndexUpToTerm(&r->log, conflict_term, rejected);
+        if (index > 0 && logTermOf(&r->log, index) == conflict_term) {
+            p->next_index = min(p->next_index, index + 1);
+        } else if (conflict_index > 0) {
+            p->next_index = min(p->next_index, conflict_index);
+        }
+    }
+
     p->next_index = max(p->next_index, 1);
 
     return true;
@@ -249,12 +554,13 @@ bool progressMaybeUpdate(struct raft *r, unsigned i, raft_index last_index)
     struct raft_progress *p = &r->leader_state.progress[i];
     bool updated = false;
     if (p->match_index < last_index) {
-        p->match_index = last_index;
+        progressSetMatchIndex(r, i, last_index);
         updated = true;
     }
     if (p->next_index < last_index + 1) {
         p->next_index = last_index + 1;
     }
+    inflightFreeTo(p, last_index);
     return updated;
 }
 
@@ -269,10 +575,12 @@ void progressToProbe(struct raft *r, const unsigned i)
         assert(p->snapshot_index > 0);
         p->next_index = max(p->match_index + 1, p->snapshot_index);
         p->snapshot_index = 0;
+        snapshotRelease(p);
     } else {
         p->next_index = p->match_index + 1;
     }
     p->state = PROGRESS__PROBE;
+    inflightReset(p);
 }
 
 void progressToPipeline(struct raft *r, const unsigned i)
@@ -281,6 +589,51 @@ void progressToPipeline(struct raft *r, const unsigned i)
     p->state = PROGRESS__PIPELINE;
 }
 
+bool progressInflightIsFull(struct raft *r, const unsigned i)
+{
+    struct raft_progress *p = &r->leader_state.progress[i];
+    if (p->state != PROGRESS__PIPELINE || p->inflight_n == 0) {
+        return false;
+    }
+    if (r->max_inflight > 0 && p->inflight_n >= r->max_inflight) {
+        return true;
+    }
+    if (r->max_inflight_bytes > 0 &&
+        p->inflight_bytes >= r->max_inflight_bytes) {
+        return true;
+    }
+    return false;
+}
+
+int progressInflightAdd(struct raft *r,
+                        const unsigned i,
+                        raft_index last_index,
+                        size_t bytes)
+{
+    struct raft_progress *p = &r->leader_state.progress[i];
+    struct raft_inflight *m;
+    int rv;
+
+    assert(p->state == PROGRESS__PIPELINE);
+    assert(p->inflight_n == 0 ||
+           p->inflight[(p->inflight_front + p->inflight_n - 1) %
+                       p->inflight_size]
+                   .last_index < last_index);
+
+    rv = inflightEnsureCapacity(p);
+    if (rv != 0) {
+        return rv;
+    }
+
+    m = &p->inflight[(p->inflight_front + p->inflight_n) % p->inflight_size];
+    m->last_index = last_index;
+    m->bytes = bytes;
+    p->inflight_n++;
+    p->inflight_bytes += bytes;
+
+    return 0;
+}
+
 bool progressSnapshotDone(struct raft *r, const unsigned i)
 {
     struct raft_progress *p = &r->leader_state.progress[i];
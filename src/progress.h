@@ -12,6 +12,10 @@ enum {
     PROGRESS__SNAPSHOT   /* Sending a snapshot */
 };
 
+/* Initial number of slots in the ring tracking in-flight AppendEntries
+ * messages of a server in pipeline mode. */
+#define PROGRESS__INFLIGHT_INITIAL_SIZE 16
+
 /* Create and initialize the array of progress objects used by the leader to *
  * track followers. The match index will be set to zero, and the next index to
  * the current last index plus 1. */
@@ -27,6 +31,23 @@ int progressBuildArray(struct raft *r);
 int progressRebuildArray(struct raft *r,
                          const struct raft_configuration *configuration);
 
+/* Release the progress array and the flow control windows of all servers. */
+void progressFreeArray(struct raft *r);
+
+/* Re-populate the sorted view of the match indexes of voting servers, to be
+ * called after the roles in the current configuration have changed. The view
+ * is allocated by progressBuildArray() and progressRebuildArray(), so this
+ * can't fail. */
+void progressRebuildQuorum(struct raft *r);
+
+/* Return the highest index that is known to be replicated on a majority of
+ * voting servers, or zero if there are no voting servers. */
+raft_index progressQuorumIndex(struct raft *r);
+
+/* Set the match index of the i'th server, keeping the sorted view of the match
+ * indexes of voting servers up-to-date. */
+void progressSetMatchIndex(struct raft *r, unsigned i, raft_index index);
+
 /* Whether the log of the i'th server in the configuration up-to-date with
  * ours. */
 bool progressIsUpToDate(struct raft *r, unsigned i);
@@ -60,6 +81,14 @@ bool progressResetRecentRecv(struct raft *r, unsigned i);
  * To be called whenever we receive an AppendEntries RPC result */
 void progressMarkRecentRecv(struct raft *r, unsigned i);
 
+/* Record that the i'th server has acknowledged the given leadership
+ * confirmation round.
+ *
+ * To be called whenever we receive an AppendEntries RPC result */
+void progressMarkReadRound(struct raft *r,
+                           unsigned i,
+                           unsigned long long round);
+
 /* Convert to the i'th server to snapshot mode. */
 void progressToSnapshot(struct raft *r, unsigned i);
 
@@ -74,6 +103,38 @@ void progressToPipeline(struct raft *r, unsigned i);
  * Called after sending the snapshot has failed or timed out. */
 void progressAbortSnapshot(struct raft *r, unsigned i);
 
+/* Return the snapshot being sent in chunks to the i'th server, or NULL if it's
+ * still being loaded. */
+struct raft_snapshot *progressSnapshot(struct raft *r, unsigned i);
+
+/* Set the snapshot loaded for sending it in chunks to the i'th server, which
+ * must be in snapshot mode, along with the total size of its data. The
+ * progress object takes ownership of it and releases it when leaving snapshot
+ * mode. When the snapshot is read one chunk at a time, only its metadata is
+ * loaded and it has no buffers. */
+void progressSetSnapshot(struct raft *r,
+                         unsigned i,
+                         struct raft_snapshot *snapshot,
+                         size_t size);
+
+/* Return the total size of the data of the snapshot being sent to the i'th
+ * server. */
+size_t progressSnapshotSize(struct raft *r, unsigned i);
+
+/* Return the offset of the next snapshot chunk to send to the i'th server. */
+size_t progressSnapshotOffset(struct raft *r, unsigned i);
+
+/* Update the offset of the next snapshot chunk to send to the i'th server. */
+void progressSetSnapshotOffset(struct raft *r, unsigned i, size_t offset);
+
+/* Return true if entries or snapshot data to send to the i'th server are being
+ * read from disk. At most one read per server is in flight. */
+bool progressIsReading(struct raft *r, unsigned i);
+
+/* Set whether entries or snapshot data to send to the i'th server are being
+ * read from disk. */
+void progressSetReading(struct raft *r, unsigned i, bool reading);
+
 /* Return the progress mode code for the i'th server. */
 int progressState(struct raft *r, unsigned i);
 
@@ -91,12 +152,29 @@ bool progressMaybeUpdate(struct raft *r, unsigned i, raft_index last_index);
 
 /* Return false if the given rejected index comes from an out of order
  * message. Otherwise decrease the progress next index to min(rejected,
- * last_index) and returns true. To be called when receiving an unsuccessful
- * AppendEntries RPC response. */
+ * last_index), or further back if the @conflict_term and @conflict_index hint
+ * allows to skip a whole term of mismatching entries, and returns true. To be
+ * called when receiving an unsuccessful AppendEntries RPC response. */
 bool progressMaybeDecrement(struct raft *r,
                             unsigned i,
                             raft_index rejected,
-                            raft_index last_index);
+                            raft_index last_index,
+                            raft_term conflict_term,
+                            raft_index conflict_index);
+
+/* Whether the i'th server is in pipeline mode and the number or total size of
+ * the AppendEntries messages sent to it and not yet acknowledged has reached
+ * the configured limits. */
+bool progressInflightIsFull(struct raft *r, unsigned i);
+
+/* Record that an AppendEntries message carrying entries up to @last_index, for
+ * a total of @bytes of payload, has been sent to the i'th server in pipeline
+ * mode. The message is dropped from the flow control window once a result
+ * acknowledging @last_index is received. */
+int progressInflightAdd(struct raft *r,
+                        unsigned i,
+                        raft_index last_index,
+                        size_t bytes);
 
 /* Return true if match_index is equal or higher than the snapshot_index. */
 bool progressSnapshotDone(struct raft *r, unsigned i);
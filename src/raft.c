@@ -11,18 +11,34 @@
 #include "heap.h"
 #include "log.h"
 #include "membership.h"
+#include "queue.h"
 #include "tracing.h"
 
 #define DEFAULT_ELECTION_TIMEOUT 1000 /* One second */
 #define DEFAULT_HEARTBEAT_TIMEOUT 100 /* One tenth of a second */
 #define DEFAULT_SNAPSHOT_THRESHOLD 1024
 #define DEFAULT_SNAPSHOT_TRAILING 2048
+#define DEFAULT_SNAPSHOT_CHUNK_SIZE (4 * 1024 * 1024)
 
 /* Number of milliseconds after which a server promotion will be aborted if the
  * server hasn't caught up with the logs yet. */
 #define DEFAULT_MAX_CATCH_UP_ROUNDS 10
 #define DEFAULT_MAX_CATCH_UP_ROUND_DURATION (5 * 1000)
 
+/* Limits on the number of entries and on the size of their payloads that get
+ * packed into a single AppendEntries message. */
+#define DEFAULT_MAX_APPEND_ENTRIES_COUNT 1024
+#define DEFAULT_MAX_APPEND_ENTRIES_BYTES (4 * 1024 * 1024)
+
+/* Limits on the AppendEntries messages that a leader keeps in flight to a
+ * follower in pipeline mode before waiting for results. */
+#define DEFAULT_MAX_INFLIGHT 128
+#define DEFAULT_MAX_INFLIGHT_BYTES (32 * 1024 * 1024)
+
+/* Number of milliseconds by which the leader lease is shortened to account for
+ * clock drift. */
+#define DEFAULT_LEASE_DRIFT 100
+
 int raft_init(struct raft *r,
               struct raft_io *io,
               struct raft_fsm *fsm,
@@ -47,6 +63,8 @@ int raft_init(struct raft *r,
     r->voted_for = 0;
     logInit(&r->log);
     raft_configuration_init(&r->configuration);
+    r->configuration_hash.slots = NULL;
+    r->configuration_hash.size = 0;
     r->configuration_index = 0;
     r->configuration_uncommitted_index = 0;
     r->election_timeout = DEFAULT_ELECTION_TIMEOUT;
@@ -60,11 +78,45 @@ int raft_init(struct raft *r,
     r->snapshot.threshold = DEFAULT_SNAPSHOT_THRESHOLD;
     r->snapshot.trailing = DEFAULT_SNAPSHOT_TRAILING;
     r->snapshot.put.data = NULL;
+    r->snapshot.serialize.data = NULL;
+    r->snapshot.close_cb = NULL;
+    r->snapshot.chunk_size = DEFAULT_SNAPSHOT_CHUNK_SIZE;
+    r->snapshot.chunks.index = 0;
+    r->snapshot.chunks.term = 0;
+    r->snapshot.chunks.buf.base = NULL;
+    r->snapshot.chunks.buf.len = 0;
+    r->snapshot.chunks.cap = 0;
+    r->snapshot.chunks.written = 0;
+    r->snapshot.chunks.write.data = NULL;
+    r->apply.index = 0;
+    r->apply.n = 0;
+    r->apply.entries = NULL;
+    r->apply.n_entries = 0;
+    r->apply.bufs = NULL;
+    r->apply.results = NULL;
+    r->apply.close_cb = NULL;
+    r->group_commit.enabled = false;
+    r->group_commit.window = 0;
+    r->group_commit.max_entries = 0;
+    r->group_commit.index = 0;
+    r->group_commit.pending = false;
+    r->group_commit.req.data = NULL;
+    r->lease.enabled = false;
+    r->lease.drift = DEFAULT_LEASE_DRIFT;
+    r->lease.round_start = 0;
+    r->lease.expiry = 0;
+    r->lease.n_expired = 0;
+    r->meta.pending = 0;
+    QUEUE_INIT(&r->meta.held);
     r->close_cb = NULL;
     memset(r->errmsg, 0, sizeof r->errmsg);
     r->pre_vote = false;
     r->max_catch_up_rounds = DEFAULT_MAX_CATCH_UP_ROUNDS;
     r->max_catch_up_round_duration = DEFAULT_MAX_CATCH_UP_ROUND_DURATION;
+    r->max_append_entries_count = DEFAULT_MAX_APPEND_ENTRIES_COUNT;
+    r->max_append_entries_bytes = DEFAULT_MAX_APPEND_ENTRIES_BYTES;
+    r->max_inflight = DEFAULT_MAX_INFLIGHT;
+    r->max_inflight_bytes = DEFAULT_MAX_INFLIGHT_BYTES;
     rv = r->io->init(r->io, r->id, r->address);
     if (rv != 0) {
         ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
@@ -82,9 +134,22 @@ err:
 static void ioCloseCb(struct raft_io *io)
 {
     struct raft *r = io->data;
+    /* If the FSM is still applying a batch of commands, which reference our
+     * log entries, resume once it's done. */
+    if (r->apply.n > 0) {
+        r->apply.close_cb = ioCloseCb;
+        return;
+    }
+    /* Same if the FSM is still serializing a snapshot, which we own. */
+    if (r->snapshot.serialize.data != NULL) {
+        r->snapshot.close_cb = ioCloseCb;
+        return;
+    }
     raft_free(r->address);
+    raft_free(r->snapshot.chunks.buf.base);
     logClose(&r->log);
     raft_configuration_close(&r->configuration);
+    configurationHashClose(r);
     if (r->close_cb != NULL) {
         r->close_cb(r);
     }
@@ -120,6 +185,16 @@ void raft_set_snapshot_trailing(struct raft *r, unsigned n)
     r->snapshot.trailing = n;
 }
 
+void raft_set_log_cache_size(struct raft *r, size_t size)
+{
+    r->log.cache.max = size;
+}
+
+void raft_set_snapshot_chunk_size(struct raft *r, size_t size)
+{
+    r->snapshot.chunk_size = size;
+}
+
 void raft_set_max_catch_up_rounds(struct raft *r, unsigned n)
 {
     r->max_catch_up_rounds = n;
@@ -130,6 +205,51 @@ void raft_set_max_catch_up_round_duration(struct raft *r, unsigned msecs)
     r->max_catch_up_round_duration = msecs;
 }
 
+void raft_set_max_append_entries_count(struct raft *r, unsigned n)
+{
+    r->max_append_entries_count = n;
+}
+
+void raft_set_max_append_entries_bytes(struct raft *r, size_t bytes)
+{
+    r->max_append_entries_bytes = bytes;
+}
+
+void raft_set_max_inflight_messages(struct raft *r, unsigned n)
+{
+    r->max_inflight = n;
+}
+
+void raft_set_max_inflight_bytes(struct raft *r, size_t bytes)
+{
+    r->max_inflight_bytes = bytes;
+}
+
+void raft_set_group_commit(struct raft *r, bool enabled)
+{
+    r->group_commit.enabled = enabled;
+}
+
+void raft_set_group_commit_window(struct raft *r, unsigned usecs)
+{
+    r->group_commit.window = usecs;
+}
+
+void raft_set_group_commit_max_entries(struct raft *r, unsigned n)
+{
+    r->group_commit.max_entries = n;
+}
+
+void raft_set_lease_reads(struct raft *r, bool enabled)
+{
+    r->lease.enabled = enabled;
+}
+
+void raft_set_lease_drift(struct raft *r, unsigned msecs)
+{
+    r->lease.drift = msecs;
+}
+
 void raft_set_pre_vote(struct raft *r, bool enabled)
 {
     r->pre_vote = enabled;
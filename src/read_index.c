@@ -0,0 +1,558 @@
+#include "read_index.h"
+
+#include "assert.h"
+#include "configuration.h"
+#include "election.h"
+#include "log.h"
+#include "progress.h"
+#include "queue.h"
+#include "replication.h"
+#include "tracing.h"
+
+/* Set to 1 to enable tracing. */
+#if 0
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+/* Append a barrier entry, so the leader gets an entry from its current term
+ * committed. */
+static int readIndexAppendBarrier(struct raft *r)
+{
+    raft_index index;
+    struct raft_buffer buf;
+    int rv;
+
+    buf.len = 8;
+    buf.base = raft_malloc(buf.len);
+    if (buf.base == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+
+    index = logLastIndex(&r->log) + 1;
+    tracef("read index barrier at %lld", index);
+
+    rv = logAppend(&r->log, r->current_term, RAFT_BARRIER, &buf, NULL);
+    if (rv != 0) {
+        goto err_after_buf_alloc;
+    }
+
+    rv = replicationTrigger(r, index);
+    if (rv != 0) {
+        goto err_after_log_append;
+    }
+
+    return 0;
+
+err_after_log_append:
+    logDiscard(&r->log, index);
+err_after_buf_alloc:
+    raft_free(buf.base);
+err:
+    return rv;
+}
+
+/* Return true if a majority of voters has acknowledged the last confirmation
+ * round that was sent. */
+static bool readIndexRoundIsAcked(struct raft *r)
+{
+    unsigned long long round = r->leader_state.read_round;
+    unsigned votes = 0;
+    unsigned i;
+
+    for (i = 0; i < r->configuration.n; i++) {
+        struct raft_server *server = &r->configuration.servers[i];
+        if (server->role != RAFT_VOTER) {
+            continue;
+        }
+        if (server->id == r->id ||
+            r->leader_state.progress[i].read_round >= round) {
+            votes++;
+        }
+    }
+
+    return votes > configurationVoterCount(&r->configuration) / 2;
+}
+
+/* Mark the last confirmation round as acknowledged by a majority of voters,
+ * extending the leader lease if lease reads are enabled.
+ *
+ * Voters that acknowledged the round received it after it was sent, and they
+ * won't grant their vote to another candidate until at least an election
+ * timeout has elapsed since then. */
+static void readIndexRoundAcked(struct raft *r)
+{
+    tracef("read round %llu acked", r->leader_state.read_round);
+    r->leader_state.read_acked = r->leader_state.read_round;
+
+    if (r->lease.enabled && r->election_timeout > r->lease.drift) {
+        r->lease.expiry =
+            r->lease.round_start + r->election_timeout - r->lease.drift;
+    }
+}
+
+/* Start a new confirmation round. */
+static void readIndexStartRound(struct raft *r)
+{
+    assert(r->leader_state.read_acked == r->leader_state.read_round);
+
+    r->leader_state.read_round++;
+    r->lease.round_start = r->io->time(r->io);
+    tracef("start read round %llu", r->leader_state.read_round);
+    replicationSendRound(r);
+
+    /* If we are the only voter the round is acknowledged right away. */
+    if (readIndexRoundIsAcked(r)) {
+        readIndexRoundAcked(r);
+    }
+}
+
+/* Start a new confirmation round, if none is in flight and some request is
+ * waiting for one. */
+static void readIndexMaybeStartRound(struct raft *r)
+{
+    struct raft_read_index *req;
+    queue *tail;
+
+    if (r->leader_state.read_acked < r->leader_state.read_round) {
+        return;
+    }
+    if (QUEUE_IS_EMPTY(&r->leader_state.reads)) {
+        return;
+    }
+    tail = QUEUE_TAIL(&r->leader_state.reads);
+    req = QUEUE_DATA(tail, struct raft_read_index, queue);
+    if (req->round <= r->leader_state.read_round) {
+        return;
+    }
+
+    readIndexStartRound(r);
+}
+
+static void readIndexSendCb(struct raft_io_send *req, int status)
+{
+    (void)status;
+    raft_free(req);
+}
+
+/* Send a ForwardRead or ForwardRead result message. */
+static int readIndexSend(struct raft *r, struct raft_message *message)
+{
+    struct raft_io_send *req;
+    int rv;
+
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    req->data = r;
+
+    rv = electionSend(r, req, message, readIndexSendCb);
+    if (rv != 0) {
+        raft_free(req);
+        return rv;
+    }
+
+    return 0;
+}
+
+/* Send a ForwardRead RPC to the current leader, if none is in flight and some
+ * request is waiting for one. */
+static void readIndexMaybeForward(struct raft *r)
+{
+    struct raft_message message;
+    struct raft_read_index *req;
+    queue *tail;
+    int rv;
+
+    assert(r->state == RAFT_FOLLOWER);
+
+    if (r->follower_state.read_done < r->follower_state.read_seq) {
+        return;
+    }
+    if (QUEUE_IS_EMPTY(&r->follower_state.reads)) {
+        return;
+    }
+    tail = QUEUE_TAIL(&r->follower_state.reads);
+    req = QUEUE_DATA(tail, struct raft_read_index, queue);
+    if (req->round <= r->follower_state.read_seq) {
+        return;
+    }
+
+    r->follower_state.read_seq++;
+    r->follower_state.read_start = r->io->time(r->io);
+
+    message.type = RAFT_IO_FORWARD_READ;
+    message.server_id = r->follower_state.current_leader.id;
+    message.server_address = r->follower_state.current_leader.address;
+    message.forward_read.term = r->current_term;
+    message.forward_read.seq = r->follower_state.read_seq;
+
+    tracef("forward read %llu to server %llu", r->follower_state.read_seq,
+           message.server_id);
+
+    /* If sending fails, the RPC is sent again after an election timeout. */
+    rv = readIndexSend(r, &message);
+    if (rv != 0 && rv != RAFT_NOCONNECTION) {
+        tracef("failed to send forward read: %s", raft_strerror(rv));
+    }
+}
+
+/* Queue a read request submitted to a follower, asking the leader for a read
+ * index. */
+static void readIndexForward(struct raft *r, struct raft_read_index *req)
+{
+    assert(r->state == RAFT_FOLLOWER);
+    assert(r->follower_state.current_leader.id != 0);
+
+    /* The read index is set when the leader replies. As for leaders, requests
+     * submitted while a ForwardRead RPC is in flight wait for the next one. */
+    req->index = 0;
+    req->round = r->follower_state.read_seq + 1;
+    QUEUE_PUSH(&r->follower_state.reads, &req->queue);
+
+    readIndexMaybeForward(r);
+}
+
+int readIndexSubmit(struct raft *r, struct raft_read_index *req)
+{
+    raft_index index = r->commit_index;
+    int rv;
+
+    if (r->state == RAFT_FOLLOWER) {
+        readIndexForward(r, req);
+        return 0;
+    }
+
+    assert(r->state == RAFT_LEADER);
+
+    if (logTermOf(&r->log, index) != r->current_term) {
+        if (logTermOf(&r->log, logLastIndex(&r->log)) != r->current_term) {
+            rv = readIndexAppendBarrier(r);
+            if (rv != 0) {
+                return rv;
+            }
+        }
+        index = logLastIndex(&r->log);
+    }
+
+    tracef("read index %lld", index);
+
+    /* Requests submitted while a round is in flight are served by the next
+     * one, since the leader might have been deposed before they arrived. */
+    req->index = index;
+    req->round = r->leader_state.read_round + 1;
+    QUEUE_PUSH(&r->leader_state.reads, &req->queue);
+
+    readIndexMaybeStartRound(r);
+
+    return 0;
+}
+
+void readIndexAck(struct raft *r, raft_id id, unsigned long long round)
+{
+    unsigned i;
+
+    assert(r->state == RAFT_LEADER);
+
+    i = configurationHashIndexOf(r, id);
+    if (i == r->configuration.n) {
+        return;
+    }
+
+    progressMarkReadRound(r, i, round);
+
+    if (r->leader_state.read_acked == r->leader_state.read_round ||
+        !readIndexRoundIsAcked(r)) {
+        return;
+    }
+
+    readIndexRoundAcked(r);
+
+    readIndexMaybeStartRound(r);
+    readIndexAdvance(r);
+}
+
+/* Return the queue of pending read requests for the current state. */
+static queue *readIndexQueue(struct raft *r)
+{
+    assert(r->state == RAFT_LEADER || r->state == RAFT_FOLLOWER);
+    if (r->state == RAFT_LEADER) {
+        return &r->leader_state.reads;
+    }
+    return &r->follower_state.reads;
+}
+
+/* Return true if the given pending request can be served. */
+static bool readIndexIsReady(struct raft *r, struct raft_read_index *req)
+{
+    if (r->state == RAFT_LEADER) {
+        if (req->round > r->leader_state.read_acked) {
+            return false;
+        }
+    } else if (req->index == 0) {
+        /* The leader has not yet replied with a read index. */
+        return false;
+    }
+    return req->index <= r->last_applied;
+}
+
+/* Fire the callbacks of all requests in the given queue. */
+static void readIndexFire(queue *q, int status)
+{
+    while (!QUEUE_IS_EMPTY(q)) {
+        struct raft_read_index *req;
+        queue *head;
+        head = QUEUE_HEAD(q);
+        req = QUEUE_DATA(head, struct raft_read_index, queue);
+        QUEUE_REMOVE(head);
+        if (req->cb != NULL) {
+            req->cb(req, status);
+        }
+    }
+}
+
+void readIndexAdvance(struct raft *r)
+{
+    queue *reads = readIndexQueue(r);
+    queue ready;
+
+    /* Move the requests to serve to a separate queue first, since callbacks
+     * might submit new requests or close the raft instance. Requests are
+     * served in submission order. */
+    QUEUE_INIT(&ready);
+    while (!QUEUE_IS_EMPTY(reads)) {
+        struct raft_read_index *req;
+        queue *head;
+        head = QUEUE_HEAD(reads);
+        req = QUEUE_DATA(head, struct raft_read_index, queue);
+        if (!readIndexIsReady(r, req)) {
+            break;
+        }
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&ready, head);
+    }
+
+    readIndexFire(&ready, 0);
+}
+
+void readIndexFail(struct raft *r, int status)
+{
+    queue *reads = readIndexQueue(r);
+    queue failed;
+
+    /* Any reply to a ForwardRead RPC still in flight will be ignored. */
+    if (r->state == RAFT_FOLLOWER) {
+        r->follower_state.read_done = r->follower_state.read_seq;
+    }
+
+    QUEUE_INIT(&failed);
+    while (!QUEUE_IS_EMPTY(reads)) {
+        queue *head;
+        head = QUEUE_HEAD(reads);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&failed, head);
+    }
+
+    readIndexFire(&failed, status);
+}
+
+void readIndexTickLease(struct raft *r)
+{
+    raft_time now;
+
+    assert(r->state == RAFT_LEADER);
+
+    if (!r->lease.enabled) {
+        return;
+    }
+
+    now = r->io->time(r->io);
+
+    if (r->lease.expiry != 0 && now >= r->lease.expiry) {
+        tracef("leader lease expired");
+        r->lease.expiry = 0;
+        r->lease.n_expired++;
+    }
+
+    if (r->leader_state.read_acked < r->leader_state.read_round) {
+        return;
+    }
+    if (r->leader_state.read_round > 0 &&
+        now - r->lease.round_start < r->heartbeat_timeout) {
+        return;
+    }
+
+    readIndexStartRound(r);
+}
+
+bool readIndexLeaseIsValid(struct raft *r)
+{
+    if (!r->lease.enabled || r->state != RAFT_LEADER || r->transfer != NULL) {
+        return false;
+    }
+
+    /* Until an entry from the current term is committed, the commit index
+     * might be behind the one of the previous leader. */
+    if (logTermOf(&r->log, r->commit_index) != r->current_term) {
+        return false;
+    }
+
+    return r->io->time(r->io) < r->lease.expiry;
+}
+
+/* Read request submitted by the leader on behalf of a follower. */
+struct readIndexForwarded
+{
+    struct raft_read_index req;
+    raft_id id;
+    unsigned long long seq;
+};
+
+/* Send the result of a ForwardRead RPC. */
+static int readIndexSendResult(struct raft *r,
+                               raft_id id,
+                               const char *address,
+                               unsigned long long seq,
+                               raft_index index)
+{
+    struct raft_message message;
+
+    message.type = RAFT_IO_FORWARD_READ_RESULT;
+    message.server_id = id;
+    message.server_address = address;
+    message.forward_read_result.term = r->current_term;
+    message.forward_read_result.seq = seq;
+    message.forward_read_result.index = index;
+
+    return readIndexSend(r, &message);
+}
+
+static void readIndexForwardedCb(struct raft_read_index *req, int status)
+{
+    struct readIndexForwarded *forwarded = (struct readIndexForwarded *)req;
+    struct raft *r = req->data;
+    const struct raft_server *server;
+    int rv;
+
+    /* If leadership was lost the follower will retry or give up by itself. */
+    if (status != 0) {
+        goto out;
+    }
+
+    server = configurationHashGet(r, forwarded->id);
+    if (server == NULL) {
+        goto out;
+    }
+
+    rv = readIndexSendResult(r, server->id, server->address, forwarded->seq,
+                             req->index);
+    if (rv != 0 && rv != RAFT_NOCONNECTION) {
+        tracef("failed to send forward read result: %s", raft_strerror(rv));
+    }
+
+out:
+    raft_free(forwarded);
+}
+
+int readIndexServe(struct raft *r,
+                   raft_id id,
+                   const char *address,
+                   unsigned long long seq,
+                   bool accept)
+{
+    struct readIndexForwarded *forwarded;
+    int rv;
+
+    if (!accept || r->state != RAFT_LEADER || r->transfer != NULL) {
+        goto reject;
+    }
+
+    forwarded = raft_malloc(sizeof *forwarded);
+    if (forwarded == NULL) {
+        goto reject;
+    }
+    forwarded->req.data = r;
+    forwarded->req.cb = readIndexForwardedCb;
+    forwarded->id = id;
+    forwarded->seq = seq;
+
+    rv = readIndexSubmit(r, &forwarded->req);
+    if (rv != 0) {
+        raft_free(forwarded);
+        goto reject;
+    }
+
+    return 0;
+
+reject:
+    tracef("reject forward read %llu from server %llu", seq, id);
+    return readIndexSendResult(r, id, address, seq, 0);
+}
+
+void readIndexForwardResult(struct raft *r,
+                            unsigned long long seq,
+                            raft_index index)
+{
+    queue *head;
+
+    assert(r->state == RAFT_FOLLOWER);
+
+    if (seq > r->follower_state.read_seq ||
+        seq <= r->follower_state.read_done) {
+        tracef("stale forward read result %llu -> ignore", seq);
+        return;
+    }
+
+    if (index == 0) {
+        readIndexFail(r, RAFT_NOTLEADER);
+        return;
+    }
+
+    /* The read index was computed by the leader after all requests that were
+     * waiting for this RPC, or an earlier one, had been submitted. */
+    QUEUE_FOREACH(head, &r->follower_state.reads)
+    {
+        struct raft_read_index *req;
+        req = QUEUE_DATA(head, struct raft_read_index, queue);
+        if (req->round <= seq && req->index == 0) {
+            req->index = index;
+        }
+    }
+    r->follower_state.read_done = seq;
+
+    readIndexMaybeForward(r);
+    readIndexAdvance(r);
+}
+
+void readIndexTickForward(struct raft *r)
+{
+    raft_time now = r->io->time(r->io);
+    queue *head;
+
+    assert(r->state == RAFT_FOLLOWER);
+
+    if (r->follower_state.read_done == r->follower_state.read_seq) {
+        return;
+    }
+    if (now - r->follower_state.read_start < r->election_timeout) {
+        return;
+    }
+
+    /* Give up on the ForwardRead RPC in flight, and send a new one for all
+     * requests that are still waiting for a read index. */
+    tracef("forward read %llu timed out", r->follower_state.read_seq);
+    r->follower_state.read_done = r->follower_state.read_seq;
+    QUEUE_FOREACH(head, &r->follower_state.reads)
+    {
+        struct raft_read_index *req;
+        req = QUEUE_DATA(head, struct raft_read_index, queue);
+        if (req->index == 0) {
+            req->round = r->follower_state.read_seq + 1;
+        }
+    }
+
+    readIndexMaybeForward(r);
+}
@@ -0,0 +1,64 @@
+/* Serve linearizable reads without appending entries to the log. */
+
+#ifndef READ_INDEX_H_
+#define READ_INDEX_H_
+
+#include "../include/raft.h"
+
+/* Queue the given read request, recording the index that must be applied
+ * before the request can be served, and start a new leadership confirmation
+ * round unless one is already in flight.
+ *
+ * From Section 6.4:
+ *
+ *   If the leader has not yet marked an entry from its current term committed,
+ *   it waits until it has done so.
+ *
+ * If that's the case the read index is set to the last index in our log, and a
+ * barrier entry is appended if the log has no entry from the current term.
+ *
+ * On followers the request is queued until the leader replies to a ForwardRead
+ * RPC with a read index. */
+int readIndexSubmit(struct raft *r, struct raft_read_index *req);
+
+/* Record that the server with the given ID has acknowledged the given
+ * confirmation round, possibly serving the requests waiting for it. */
+void readIndexAck(struct raft *r, raft_id id, unsigned long long round);
+
+/* Fire the callbacks of all read requests whose confirmation round was
+ * acknowledged by a majority of voters and whose read index was applied. */
+void readIndexAdvance(struct raft *r);
+
+/* Fire the callbacks of all pending read requests with the given status. */
+void readIndexFail(struct raft *r, int status);
+
+/* If lease reads are enabled, start a new confirmation round to renew the
+ * leader lease once a heartbeat timeout has elapsed since the last one, and
+ * account for the lease expiring. */
+void readIndexTickLease(struct raft *r);
+
+/* Return true if lease reads are enabled and the leader lease is valid. */
+bool readIndexLeaseIsValid(struct raft *r);
+
+/* Serve a ForwardRead RPC with the given sequence number received from the
+ * given server, replying with the read index once the leadership confirmation
+ * round completes. Reply right away with a rejection if @accept is false or
+ * we are not leader. */
+int readIndexServe(struct raft *r,
+                   raft_id id,
+                   const char *address,
+                   unsigned long long seq,
+                   bool accept);
+
+/* Set the read index of the pending requests that were waiting for the
+ * ForwardRead RPC with the given sequence number, or fail them if the leader
+ * rejected it. */
+void readIndexForwardResult(struct raft *r,
+                            unsigned long long seq,
+                            raft_index index);
+
+/* Send a new ForwardRead RPC if the one in flight did not get a reply within
+ * an election timeout. */
+void readIndexTickForward(struct raft *r);
+
+#endif /* READ_INDEX_H_ */
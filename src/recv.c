@@ -2,13 +2,18 @@
 
 #include "assert.h"
 #include "convert.h"
+#include "election.h"
 #include "entry.h"
 #include "heap.h"
 #include "log.h"
 #include "membership.h"
+#include "read_index.h"
 #include "recv_append_entries.h"
 #include "recv_append_entries_result.h"
+#include "recv_forward_read.h"
+#include "recv_forward_read_result.h"
 #include "recv_install_snapshot.h"
+#include "recv_install_snapshot_result.h"
 #include "recv_request_vote.h"
 #include "recv_request_vote_result.h"
 #include "recv_timeout_now.h"
@@ -28,7 +33,7 @@ static int recvMessage(struct raft *r, struct raft_message *message)
     int rv = 0;
 
     if (message->type < RAFT_IO_APPEND_ENTRIES ||
-        message->type > RAFT_IO_TIMEOUT_NOW) {
+        message->type > RAFT_IO_FORWARD_READ_RESULT) {
         tracef("received unknown message type type: %d", message->type);
         return 0;
     }
@@ -69,6 +74,21 @@ static int recvMessage(struct raft *r, struct raft_message *message)
             rv = recvTimeoutNow(r, message->server_id, message->server_address,
                                 &message->timeout_now);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_RESULT:
+            rv = recvInstallSnapshotResult(r, message->server_id,
+                                           message->server_address,
+                                           &message->install_snapshot_result);
+            break;
+        case RAFT_IO_FORWARD_READ:
+            rv = recvForwardRead(r, message->server_id,
+                                 message->server_address,
+                                 &message->forward_read);
+            break;
+        case RAFT_IO_FORWARD_READ_RESULT:
+            rv = recvForwardReadResult(r, message->server_id,
+                                       message->server_address,
+                                       &message->forward_read_result);
+            break;
     };
 
     if (rv != 0 && rv != RAFT_NOCONNECTION) {
@@ -127,7 +147,7 @@ int recvBumpCurrentTerm(struct raft *r, raft_term term)
     tracef("%s", msg);
 
     /* Save the new term to persistent store, resetting the vote. */
-    rv = r->io->set_term(r->io, term);
+    rv = electionSetTerm(r, term);
     if (rv != 0) {
         return rv;
     }
@@ -196,6 +216,11 @@ int recvUpdateLeader(struct raft *r, const raft_id id, const char *address)
 {
     assert(r->state == RAFT_FOLLOWER);
 
+    /* Read requests forwarded to the old leader won't be answered. */
+    if (r->follower_state.current_leader.id != id) {
+        readIndexFail(r, RAFT_LEADERSHIPLOST);
+    }
+
     r->follower_state.current_leader.id = id;
 
     /* If the address of the current leader is the same as the given one, we're
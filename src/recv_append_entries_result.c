@@ -2,6 +2,7 @@
 #include "assert.h"
 #include "configuration.h"
 #include "tracing.h"
+#include "read_index.h"
 #include "recv.h"
 #include "replication.h"
 
@@ -56,7 +57,7 @@ int recvAppendEntriesResult(struct raft *r,
     assert(result->term == r->current_term);
 
     /* Ignore responses from servers that have been removed */
-    server = configurationGet(&r->configuration, id);
+    server = configurationHashGet(r, id);
     if (server == NULL) {
         tracef("unknown server -> ignore");
         return 0;
@@ -68,6 +69,12 @@ int recvAppendEntriesResult(struct raft *r,
         return rv;
     }
 
+    /* Any response in the current term, even a rejection, confirms that the
+     * server still recognizes us as leader. */
+    if (r->state == RAFT_LEADER) {
+        readIndexAck(r, id, result->read_round);
+    }
+
     return 0;
 }
 
@@ -0,0 +1,43 @@
+#include "recv_forward_read.h"
+
+#include "assert.h"
+#include "read_index.h"
+#include "recv.h"
+#include "tracing.h"
+
+/* Set to 1 to enable tracing. */
+#if 0
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+int recvForwardRead(struct raft *r,
+                    const raft_id id,
+                    const char *address,
+                    const struct raft_forward_read *args)
+{
+    int match;
+    int rv;
+
+    assert(r != NULL);
+    assert(id > 0);
+    assert(args != NULL);
+
+    /* Possibly update our term, stepping down if it's lower. */
+    rv = recvEnsureMatchingTerms(r, args->term, &match);
+    if (rv != 0) {
+        return rv;
+    }
+
+    /* A follower with a lower term was not asking us: reject the request,
+     * letting it know about our term. */
+    if (match < 0) {
+        tracef("local term is higher -> reject");
+        return readIndexServe(r, id, address, args->seq, false);
+    }
+
+    return readIndexServe(r, id, address, args->seq, true);
+}
+
+#undef tracef
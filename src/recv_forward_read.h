@@ -0,0 +1,14 @@
+/* Receive a ForwardRead message. */
+
+#ifndef RECV_FORWARD_READ_H_
+#define RECV_FORWARD_READ_H_
+
+#include "../include/raft.h"
+
+/* Process a ForwardRead RPC from the given server. */
+int recvForwardRead(struct raft *r,
+                    raft_id id,
+                    const char *address,
+                    const struct raft_forward_read *args);
+
+#endif /* RECV_FORWARD_READ_H_ */
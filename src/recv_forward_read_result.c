@@ -0,0 +1,56 @@
+#include "recv_forward_read_result.h"
+
+#include "assert.h"
+#include "read_index.h"
+#include "recv.h"
+#include "tracing.h"
+
+/* Set to 1 to enable tracing. */
+#if 0
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+int recvForwardReadResult(struct raft *r,
+                          const raft_id id,
+                          const char *address,
+                          const struct raft_forward_read_result *result)
+{
+    int match;
+    int rv;
+
+    assert(r != NULL);
+    assert(id > 0);
+    assert(result != NULL);
+
+    (void)address;
+
+    if (r->state != RAFT_FOLLOWER) {
+        tracef("local server is not follower -> ignore");
+        return 0;
+    }
+
+    rv = recvEnsureMatchingTerms(r, result->term, &match);
+    if (rv != 0) {
+        return rv;
+    }
+
+    if (match < 0) {
+        tracef("local term is higher -> ignore ");
+        return 0;
+    }
+
+    /* Ignore results from servers other than our current leader, since
+     * pending requests are failed when the leader changes. */
+    if (r->follower_state.current_leader.id != id) {
+        tracef("result not from current leader -> ignore");
+        return 0;
+    }
+
+    readIndexForwardResult(r, result->seq, result->index);
+
+    return 0;
+}
+
+#undef tracef
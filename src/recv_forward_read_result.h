@@ -0,0 +1,14 @@
+/* Receive a ForwardRead result message. */
+
+#ifndef RECV_FORWARD_READ_RESULT_H_
+#define RECV_FORWARD_READ_RESULT_H_
+
+#include "../include/raft.h"
+
+/* Process a ForwardRead RPC result from the given server. */
+int recvForwardReadResult(struct raft *r,
+                          raft_id id,
+                          const char *address,
+                          const struct raft_forward_read_result *result);
+
+#endif /* RECV_FORWARD_READ_RESULT_H_ */
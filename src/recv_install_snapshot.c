@@ -1,7 +1,10 @@
 #include "recv_install_snapshot.h"
 
+#include <string.h>
+
 #include "assert.h"
 #include "convert.h"
+#include "election.h"
 #include "log.h"
 #include "recv.h"
 #include "replication.h"
@@ -20,6 +23,84 @@ static void installSnapshotSendCb(struct raft_io_send *req, int status)
     raft_free(req);
 }
 
+/* InstallSnapshot message received while the FSM was applying a batch of
+ * commands, processed once the batch completes. */
+struct recvDeferredInstallSnapshot
+{
+    raft_id id;
+    char *address;
+    struct raft_install_snapshot args;
+};
+
+/* Keep the given message aside until the FSM is done with the current batch,
+ * replacing any message kept earlier, since the leader has moved on. */
+static int deferInstallSnapshot(struct raft *r,
+                                const raft_id id,
+                                const char *address,
+                                struct raft_install_snapshot *args)
+{
+    struct recvDeferredInstallSnapshot *deferred;
+
+    deferred = raft_malloc(sizeof *deferred);
+    if (deferred == NULL) {
+        goto err;
+    }
+    deferred->address = raft_malloc(strlen(address) + 1);
+    if (deferred->address == NULL) {
+        goto err_after_deferred_alloc;
+    }
+    strcpy(deferred->address, address);
+    deferred->id = id;
+    deferred->args = *args;
+
+    recvInstallSnapshotDiscard(r);
+    r->follower_state.install = deferred;
+
+    return 0;
+
+err_after_deferred_alloc:
+    raft_free(deferred);
+err:
+    raft_configuration_close(&args->conf);
+    raft_free(args->data.base);
+    return RAFT_NOMEM;
+}
+
+void recvInstallSnapshotDiscard(struct raft *r)
+{
+    struct recvDeferredInstallSnapshot *deferred = r->follower_state.install;
+    if (deferred == NULL) {
+        return;
+    }
+    r->follower_state.install = NULL;
+    raft_configuration_close(&deferred->args.conf);
+    raft_free(deferred->args.data.base);
+    raft_free(deferred->address);
+    raft_free(deferred);
+}
+
+int recvInstallSnapshotResume(struct raft *r)
+{
+    struct recvDeferredInstallSnapshot *deferred = r->follower_state.install;
+    int rv;
+
+    assert(r->state == RAFT_FOLLOWER);
+    assert(r->apply.n == 0);
+
+    if (deferred == NULL) {
+        return 0;
+    }
+    r->follower_state.install = NULL;
+
+    rv = recvInstallSnapshot(r, deferred->id, deferred->address,
+                             &deferred->args);
+
+    raft_free(deferred->address);
+    raft_free(deferred);
+
+    return rv;
+}
+
 int recvInstallSnapshot(struct raft *r,
                         const raft_id id,
                         const char *address,
@@ -28,14 +109,19 @@ int recvInstallSnapshot(struct raft *r,
     struct raft_io_send *req;
     struct raft_message message;
     struct raft_append_entries_result *result = &message.append_entries_result;
+    size_t offset;
     int rv;
     int match;
+    bool install;
     bool async;
 
     assert(address != NULL);
 
     result->rejected = args->last_index;
     result->last_log_index = logLastIndex(&r->log);
+    result->read_round = 0;
+    result->conflict_term = 0;
+    result->conflict_index = 0;
 
     rv = recvEnsureMatchingTerms(r, args->term, &match);
     if (rv != 0) {
@@ -62,6 +148,34 @@ int recvInstallSnapshot(struct raft *r,
     }
     r->election_timer_start = r->io->time(r->io);
 
+    /* If the FSM is applying a batch of commands, which reference our log
+     * entries, process the request once it's done. */
+    if (r->apply.n > 0) {
+        return deferInstallSnapshot(r, id, address, args);
+    }
+
+    /* If we are taking a snapshot ourselves or installing a snapshot, ignore
+     * the request: the leader sends it again after a heartbeat timeout without
+     * a response, by which time the snapshot will most likely be stored. */
+    if (r->snapshot.pending.term != 0 || r->snapshot.put.data != NULL) {
+        raft_configuration_close(&args->conf);
+        raft_free(args->data.base);
+        return 0;
+    }
+
+    /* Snapshots sent in multiple chunks are buffered in memory, or written to
+     * disk as they arrive, until the last chunk is received. */
+    if (args->offset > 0 || !args->done) {
+        replicationSnapshotChunk(r, args, &install, &async, &offset);
+        if (async) {
+            return 0;
+        }
+        if (!install) {
+            raft_configuration_close(&args->conf);
+            return replicationSendSnapshotResult(r, args->last_index, offset);
+        }
+    }
+
     rv = replicationInstallSnapshot(r, args, &result->rejected, &async);
     if (rv != 0) {
         return rv;
@@ -93,7 +207,7 @@ reply:
     }
     req->data = r;
 
-    rv = r->io->send(r->io, req, &message, installSnapshotSendCb);
+    rv = electionSend(r, req, &message, installSnapshotSendCb);
     if (rv != 0) {
         raft_free(req);
         return rv;
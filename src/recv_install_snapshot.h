@@ -11,4 +11,13 @@ int recvInstallSnapshot(struct raft *r,
                         const char *address,
                         struct raft_install_snapshot *args);
 
+/* Process the InstallSnapshot message that was received while the FSM was
+ * applying a batch of commands, if any. Must be called once the batch has
+ * completed. */
+int recvInstallSnapshotResume(struct raft *r);
+
+/* Release the InstallSnapshot message that was received while the FSM was
+ * applying a batch of commands, if any, without processing it. */
+void recvInstallSnapshotDiscard(struct raft *r);
+
 #endif /* RECV_INSTALL_SNAPSHOT_H_ */
@@ -0,0 +1,70 @@
+#include "recv_install_snapshot_result.h"
+#include "assert.h"
+#include "configuration.h"
+#include "tracing.h"
+#include "recv.h"
+#include "replication.h"
+
+/* Set to 1 to enable tracing. */
+#if 0
+#define tracef(...) Tracef(r->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+int recvInstallSnapshotResult(
+    struct raft *r,
+    const raft_id id,
+    const char *address,
+    const struct raft_install_snapshot_result *result)
+{
+    int match;
+    const struct raft_server *server;
+    int rv;
+
+    assert(r != NULL);
+    assert(id > 0);
+    assert(address != NULL);
+    assert(result != NULL);
+
+    if (r->state != RAFT_LEADER) {
+        tracef("local server is not leader -> ignore");
+        return 0;
+    }
+
+    rv = recvEnsureMatchingTerms(r, result->term, &match);
+    if (rv != 0) {
+        return rv;
+    }
+
+    if (match < 0) {
+        tracef("local term is higher -> ignore ");
+        return 0;
+    }
+
+    /* If we have stepped down, abort here. */
+    if (match > 0) {
+        assert(r->state == RAFT_FOLLOWER);
+        return 0;
+    }
+
+    assert(result->term == r->current_term);
+
+    /* Ignore responses from servers that have been removed */
+    server = configurationHashGet(r, id);
+    if (server == NULL) {
+        tracef("unknown server -> ignore");
+        return 0;
+    }
+
+    /* Update the snapshot progress of this server, possibly sending the next
+     * chunk. */
+    rv = replicationUpdateSnapshot(r, server, result);
+    if (rv != 0) {
+        return rv;
+    }
+
+    return 0;
+}
+
+#undef tracef
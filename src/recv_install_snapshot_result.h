@@ -0,0 +1,15 @@
+/* Receive an InstallSnapshot result message. */
+
+#ifndef RECV_INSTALL_SNAPSHOT_RESULT_H_
+#define RECV_INSTALL_SNAPSHOT_RESULT_H_
+
+#include "../include/raft.h"
+
+/* Process an InstallSnapshot RPC result from the given server. */
+int recvInstallSnapshotResult(
+    struct raft *r,
+    raft_id id,
+    const char *address,
+    const struct raft_install_snapshot_result *result);
+
+#endif /* RECV_INSTALL_SNAPSHOT_RESULT_H_ */
@@ -12,18 +12,11 @@
 #define tracef(...)
 #endif
 
-static void requestVoteSendCb(struct raft_io_send *req, int status)
-{
-    (void)status;
-    raft_free(req);
-}
-
 int recvRequestVote(struct raft *r,
                     const raft_id id,
                     const char *address,
                     const struct raft_request_vote *args)
 {
-    struct raft_io_send *req;
     struct raft_message message;
     struct raft_request_vote_result *result = &message.request_vote_result;
     bool has_leader;
@@ -104,19 +97,7 @@ reply:
     message.server_id = id;
     message.server_address = address;
 
-    req = raft_malloc(sizeof *req);
-    if (req == NULL) {
-        return RAFT_NOMEM;
-    }
-    req->data = r;
-
-    rv = r->io->send(r->io, req, &message, requestVoteSendCb);
-    if (rv != 0) {
-        raft_free(req);
-        return rv;
-    }
-
-    return 0;
+    return electionSendMessage(r, &message);
 }
 
 #undef tracef
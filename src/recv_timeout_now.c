@@ -32,7 +32,7 @@ int recvTimeoutNow(struct raft *r,
     (void)address;
 
     /* Ignore the request if we are not voters. */
-    local_server = configurationGet(&r->configuration, r->id);
+    local_server = configurationHashGet(r, r->id);
     if (local_server == NULL || local_server->role != RAFT_VOTER) {
         return 0;
     }
@@ -1,8 +1,12 @@
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "assert.h"
 #include "configuration.h"
 #include "convert.h"
+#include "election.h"
+#include "entry.h"
 #ifdef __GLIBC__
 #include "error.h"
 #endif
@@ -12,6 +16,8 @@
 #include "membership.h"
 #include "progress.h"
 #include "queue.h"
+#include "read_index.h"
+#include "recv_install_snapshot.h"
 #include "replication.h"
 #include "request.h"
 #include "snapshot.h"
@@ -40,7 +46,8 @@ struct sendAppendEntries
     struct raft_io_send send;   /* Underlying I/O send request. */
     raft_index index;           /* Index of the first entry in the request. */
     struct raft_entry *entries; /* Entries referenced in the request. */
-    unsigned n;                 /* Length of the entries array. */
+    unsigned n;                 /* Number of entries in the request. */
+    unsigned n_read;            /* Length of @entries, if read from disk. */
     raft_id server_id;          /* Destination server. */
 };
 
@@ -49,7 +56,7 @@ static void sendAppendEntriesCb(struct raft_io_send *send, const int status)
 {
     struct sendAppendEntries *req = send->data;
     struct raft *r = req->raft;
-    unsigned i = configurationIndexOf(&r->configuration, req->server_id);
+    unsigned i = configurationHashIndexOf(r, req->server_id);
 
     if (r->state == RAFT_LEADER && i < r->configuration.n) {
         if (status != 0) {
@@ -72,34 +79,67 @@ static void sendAppendEntriesCb(struct raft_io_send *send, const int status)
         }
     }
 
-    /* Tell the log that we're done referencing these entries. */
-    logRelease(&r->log, req->index, req->entries, req->n);
+    /* Tell the log that we're done referencing these entries, or release them
+     * if they were read back from disk. */
+    if (req->n_read > 0) {
+        entryBatchesDestroy(req->entries, req->n_read);
+    } else {
+        logRelease(&r->log, req->entries, req->n);
+    }
     raft_free(req);
 }
 
-/* Send an AppendEntries message to the i'th server, including all log entries
- * from the given point onwards. */
-static int sendAppendEntries(struct raft *r,
-                             const unsigned i,
-                             const raft_index prev_index,
-                             const raft_term prev_term)
+/* Return how many of the given entries fit in a single AppendEntries message
+ * according to the configured limits. At least one entry is always included,
+ * regardless of its size. */
+static unsigned limitAppendEntries(const struct raft *r,
+                                   const struct raft_entry *entries,
+                                   unsigned n)
+{
+    size_t size = 0;
+    unsigned i;
+
+    if (r->max_append_entries_count > 0 && n > r->max_append_entries_count) {
+        n = r->max_append_entries_count;
+    }
+
+    if (r->max_append_entries_bytes == 0) {
+        return n;
+    }
+
+    for (i = 0; i < n; i++) {
+        size += entries[i].buf.len;
+        if (size > r->max_append_entries_bytes && i > 0) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/* Send an AppendEntries message to the i'th server, including the given log
+ * entries following @prev_index, up to the configured per-message limits. If
+ * @n_read is zero the entries were acquired from the log, otherwise they were
+ * read from disk and the request takes ownership of all @n_read of them. */
+static int sendEntries(struct raft *r,
+                       const unsigned i,
+                       const raft_index prev_index,
+                       const raft_term prev_term,
+                       struct raft_entry *entries,
+                       const unsigned n,
+                       const unsigned n_read)
 {
     struct raft_server *server = &r->configuration.servers[i];
     struct raft_message message;
     struct raft_append_entries *args = &message.append_entries;
     struct sendAppendEntries *req;
-    raft_index next_index = prev_index + 1;
     int rv;
 
     args->term = r->current_term;
     args->prev_log_index = prev_index;
     args->prev_log_term = prev_term;
-
-    /* TODO: implement a limit to the total size of the entries being sent */
-    rv = logAcquire(&r->log, next_index, &args->entries, &args->n_entries);
-    if (rv != 0) {
-        goto err;
-    }
+    args->entries = entries;
+    args->n_entries = limitAppendEntries(r, entries, n);
 
     /* From Section 3.5:
      *
@@ -111,6 +151,11 @@ static int sendAppendEntries(struct raft *r,
      */
     args->leader_commit = r->commit_index;
 
+    /* Every AppendEntries carries the current confirmation round, and followers
+     * echo it back, so any result can confirm our leadership for read
+     * requests. */
+    args->read_round = r->leader_state.read_round;
+
     tracef("send %u entries starting at %llu to server %u (last index %llu)",
            args->n_entries, args->prev_log_index, server->id,
            logLastIndex(&r->log));
@@ -122,16 +167,17 @@ static int sendAppendEntries(struct raft *r,
     req = raft_malloc(sizeof *req);
     if (req == NULL) {
         rv = RAFT_NOMEM;
-        goto err_after_entries_acquired;
+        goto err;
     }
     req->raft = r;
     req->index = args->prev_log_index + 1;
     req->entries = args->entries;
     req->n = args->n_entries;
+    req->n_read = n_read;
     req->server_id = server->id;
 
     req->send.data = req;
-    rv = r->io->send(r->io, &req->send, &message, sendAppendEntriesCb);
+    rv = electionSend(r, &req->send, &message, sendAppendEntriesCb);
     if (rv != 0) {
         goto err_after_req_alloc;
     }
@@ -139,89 +185,316 @@ static int sendAppendEntries(struct raft *r,
     if (progressState(r, i) == PROGRESS__PIPELINE) {
         /* Optimitiscally update progress. */
         progressOptimisticNextIndex(r, i, req->index + req->n);
+        /* Account the entries in the flow control window. If we can't track
+         * them, fall back to probe mode, which doesn't need the window. */
+        if (req->n > 0) {
+            size_t bytes = 0;
+            unsigned j;
+            for (j = 0; j < req->n; j++) {
+                bytes += req->entries[j].buf.len;
+            }
+            rv = progressInflightAdd(r, i, req->index + req->n - 1, bytes);
+            if (rv != 0) {
+                progressToProbe(r, i);
+            }
+        }
     }
 
     return 0;
 
 err_after_req_alloc:
     raft_free(req);
-err_after_entries_acquired:
-    logRelease(&r->log, next_index, args->entries, args->n_entries);
 err:
     assert(rv != 0);
     return rv;
 }
 
+/* Context of a request to read back from disk entries evicted from the log, in
+ * order to send them to a server. */
+struct readEntries
+{
+    struct raft *raft;        /* Instance reading the entries. */
+    struct raft_io_read read; /* Underlying I/O read request. */
+    raft_term term;           /* Term in which the request was submitted. */
+    raft_index index;         /* Index of the first entry to read. */
+    raft_id server_id;        /* Destination server. */
+};
+
+static void sendPipelinedChunks(struct raft *r, const unsigned i);
+
+static void readEntriesCb(struct raft_io_read *read,
+                          struct raft_entry entries[],
+                          unsigned n,
+                          int status)
+{
+    struct readEntries *req = read->data;
+    struct raft *r = req->raft;
+    raft_index prev_index = req->index - 1;
+    raft_term prev_term = 0;
+    unsigned i;
+    unsigned j;
+    int rv;
+
+    /* Probably we're not leader anymore, or the server was removed in the
+     * meantime. */
+    if (r->state != RAFT_LEADER || r->current_term != req->term) {
+        goto out;
+    }
+    i = configurationHashIndexOf(r, req->server_id);
+    if (i == r->configuration.n) {
+        goto out;
+    }
+    progressSetReading(r, i, false);
+
+    /* Something happened in the meantime, e.g. the server rejected or
+     * acknowledged other entries, or the log was compacted. The next
+     * replication round will start over from the current progress. */
+    if (progressState(r, i) == PROGRESS__SNAPSHOT ||
+        progressNextIndex(r, i) != req->index) {
+        goto out;
+    }
+    if (prev_index > 0) {
+        prev_term = logTermOf(&r->log, prev_index);
+        if (prev_term == 0) {
+            goto out;
+        }
+    }
+
+    /* Only send the entries that still match the ones in our log. */
+    for (j = 0; j < n; j++) {
+        if (entries[j].term != logTermOf(&r->log, req->index + j)) {
+            break;
+        }
+    }
+
+    if (status != 0 || j == 0) {
+        /* If reading fails the server might not get any message until the next
+         * attempt, so send it a heartbeat to prevent it from starting an
+         * election in the meantime. */
+        tracef("read entries from %llu: %s", req->index, raft_strerror(status));
+        sendEntries(r, i, prev_index, prev_term, NULL, 0, 0);
+        goto out;
+    }
+
+    rv = sendEntries(r, i, prev_index, prev_term, entries, j, n);
+    if (rv != 0) {
+        goto out;
+    }
+    raft_free(req);
+    sendPipelinedChunks(r, i);
+    return;
+
+out:
+    entryBatchesDestroy(entries, n);
+    raft_free(req);
+}
+
+/* Read back from disk the entries to send to the i'th server, starting from the
+ * given index, since their payloads were evicted from the log. At most one read
+ * per server is in flight, and the entries are sent once it completes. */
+static int readEntries(struct raft *r, const unsigned i, const raft_index index)
+{
+    struct raft_server *server = &r->configuration.servers[i];
+    struct readEntries *req;
+    unsigned n = r->max_append_entries_count;
+    int rv;
+
+    assert(r->io->version >= 4 && r->io->read != NULL);
+
+    if (n == 0) {
+        n = UINT_MAX;
+    }
+
+    if (progressIsReading(r, i)) {
+        return 0;
+    }
+
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    req->raft = r;
+    req->term = r->current_term;
+    req->index = index;
+    req->server_id = server->id;
+    req->read.data = req;
+
+    rv = r->io->read(r->io, &req->read, index, n, readEntriesCb);
+    if (rv != 0) {
+        raft_free(req);
+        return rv;
+    }
+    progressSetReading(r, i, true);
+
+    return 0;
+}
+
+/* Send to the i'th server a single AppendEntries message, including log
+ * entries following @prev_index up to the configured per-message limits. */
+static int sendAppendEntriesChunk(struct raft *r,
+                                  const unsigned i,
+                                  const raft_index prev_index,
+                                  const raft_term prev_term)
+{
+    struct raft_entry *entries;
+    unsigned n;
+    int rv;
+
+    if (logIsEvicted(&r->log, prev_index + 1)) {
+        return readEntries(r, i, prev_index + 1);
+    }
+
+    rv = logAcquire(&r->log, prev_index + 1, &entries, &n);
+    if (rv != 0) {
+        return rv;
+    }
+
+    rv = sendEntries(r, i, prev_index, prev_term, entries, n, 0);
+    if (rv != 0) {
+        logRelease(&r->log, entries, n);
+        return rv;
+    }
+
+    return 0;
+}
+
+/* In pipeline mode the next index of the i'th server has been optimistically
+ * advanced past the chunk just sent, so keep sending the following chunks
+ * right away, until the server is up to date or its flow control window is
+ * full, rather than waiting for a result or for the next heartbeat. */
+static void sendPipelinedChunks(struct raft *r, const unsigned i)
+{
+    raft_index next_index;
+    raft_index prev_index;
+    raft_term prev_term;
+    int rv;
+
+    while (progressState(r, i) == PROGRESS__PIPELINE &&
+           !progressIsUpToDate(r, i) && !progressInflightIsFull(r, i)) {
+        next_index = progressNextIndex(r, i);
+        prev_index = next_index - 1;
+        prev_term = logTermOf(&r->log, prev_index);
+        if (prev_term == 0) {
+            break;
+        }
+        rv = sendAppendEntriesChunk(r, i, prev_index, prev_term);
+        if (rv != 0) {
+            tracef("send chunk at %llu: %s", next_index, raft_strerror(rv));
+            break;
+        }
+        /* Entries being read back from disk are sent once the read
+         * completes. */
+        if (progressNextIndex(r, i) == next_index) {
+            break;
+        }
+    }
+}
+
+/* Send an AppendEntries message to the i'th server, including log entries from
+ * the given point onwards, up to the configured per-message limits. A follower
+ * that is far behind is fed in chunks: in pipeline mode all of them are sent
+ * back to back, within the limits of the flow control window, while in probe
+ * mode the next chunk is sent once the previous one is acknowledged. */
+static int sendAppendEntries(struct raft *r,
+                             const unsigned i,
+                             const raft_index prev_index,
+                             const raft_term prev_term)
+{
+    int rv;
+
+    rv = sendAppendEntriesChunk(r, i, prev_index, prev_term);
+    if (rv != 0) {
+        return rv;
+    }
+
+    sendPipelinedChunks(r, i);
+
+    return 0;
+}
+
 /* Context of a RAFT_IO_INSTALL_SNAPSHOT request that was submitted with
  * raft_io_>send(). */
 struct sendInstallSnapshot
+{
+    struct raft_io_send send;       /* Underlying I/O send request. */
+    struct raft_configuration conf; /* Snapshot configuration. */
+    struct raft_buffer chunk;       /* Snapshot data chunk being sent. */
+};
+
+/* Context of a snapshot_get request submitted to load the snapshot to send. */
+struct getSnapshot
 {
     struct raft *raft;               /* Instance sending the snapshot. */
     struct raft_io_snapshot_get get; /* Snapshot get request. */
-    struct raft_io_send send;        /* Underlying I/O send request. */
-    struct raft_snapshot *snapshot;  /* Snapshot to send. */
     raft_id server_id;               /* Destination server. */
 };
 
+/* Context of a snapshot_read request submitted to read the next chunk of the
+ * snapshot to send. */
+struct readSnapshot
+{
+    struct raft *raft;                 /* Instance sending the snapshot. */
+    struct raft_io_snapshot_read read; /* Underlying I/O read request. */
+    raft_term term;                    /* Term of the submission. */
+    raft_id server_id;                 /* Destination server. */
+    size_t offset;                     /* Offset of the chunk to read. */
+};
+
+/* Whether the I/O implementation reads and writes snapshots one chunk at a
+ * time. */
+static bool ioHasSnapshotChunks(struct raft *r)
+{
+    return r->io->version >= 5 && r->io->snapshot_read != NULL &&
+           r->io->snapshot_write != NULL;
+}
+
 static void sendInstallSnapshotCb(struct raft_io_send *send, int status)
 {
     struct sendInstallSnapshot *req = send->data;
-    struct raft *r = req->raft;
-    const struct raft_server *server;
-
-    server = configurationGet(&r->configuration, req->server_id);
 
-    if (status != 0) {
-        tracef("send install snapshot: %s", raft_strerror(status));
-        if (r->state == RAFT_LEADER && server != NULL) {
-            unsigned i;
-            i = configurationIndexOf(&r->configuration, req->server_id);
-            progressAbortSnapshot(r, i);
-        }
-    }
+    /* If sending failed, the chunk will be sent again once the progress of the
+     * server notices that it was not acknowledged. */
+    (void)status;
 
-    snapshotClose(req->snapshot);
-    raft_free(req->snapshot);
+    raft_configuration_close(&req->conf);
+    raft_free(req->chunk.base);
     raft_free(req);
 }
 
-static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
-                              struct raft_snapshot *snapshot,
-                              int status)
+/* Send to the i'th server the given chunk of data of the snapshot recorded in
+ * its progress, starting at the offset currently recorded there too. The
+ * request takes ownership of the chunk, which is released on failure. */
+static int sendSnapshotData(struct raft *r,
+                            const unsigned i,
+                            struct raft_buffer chunk)
 {
-    struct sendInstallSnapshot *req = get->data;
-    struct raft *r = req->raft;
+    struct raft_server *server = &r->configuration.servers[i];
+    struct raft_snapshot *snapshot = progressSnapshot(r, i);
+    size_t offset = progressSnapshotOffset(r, i);
     struct raft_message message;
     struct raft_install_snapshot *args = &message.install_snapshot;
-    const struct raft_server *server = NULL;
-    bool progress_state_is_snapshot = false;
-    unsigned i = 0;
+    struct sendInstallSnapshot *req;
     int rv;
 
-    if (status != 0) {
-        tracef("get snapshot %s", raft_strerror(status));
-        goto abort;
-    }
-    if (r->state != RAFT_LEADER) {
-        goto abort_with_snapshot;
-    }
+    assert(progressState(r, i) == PROGRESS__SNAPSHOT);
+    assert(snapshot != NULL);
+    assert(offset + chunk.len <= progressSnapshotSize(r, i));
 
-    server = configurationGet(&r->configuration, req->server_id);
-
-    if (server == NULL) {
-        /* Probably the server was removed in the meantime. */
-        goto abort_with_snapshot;
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
     }
+    req->send.data = req;
 
-    i = configurationIndexOf(&r->configuration, req->server_id);
-    progress_state_is_snapshot = progressState(r, i) == PROGRESS__SNAPSHOT;
-
-    if (!progress_state_is_snapshot) {
-        /* Something happened in the meantime. */
-        goto abort_with_snapshot;
+    /* The progress object owns the snapshot and might release it before the
+     * send request completes, so give the request its own copy of the
+     * configuration. */
+    rv = configurationCopy(&snapshot->configuration, &req->conf);
+    if (rv != 0) {
+        goto err_after_req_alloc;
     }
-
-    assert(snapshot->n_bufs == 1);
+    req->chunk = chunk;
 
     message.type = RAFT_IO_INSTALL_SNAPSHOT;
     message.server_id = server->id;
@@ -231,44 +504,296 @@ static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
     args->last_index = snapshot->index;
     args->last_term = snapshot->term;
     args->conf_index = snapshot->configuration_index;
-    args->conf = snapshot->configuration;
-    args->data = snapshot->bufs[0];
+    args->conf = req->conf;
+    args->data = req->chunk;
+    args->offset = offset;
+    args->done = offset + chunk.len == progressSnapshotSize(r, i);
 
-    req->snapshot = snapshot;
-    req->send.data = req;
+    tracef("sending snapshot with last index %llu to %u (offset %zu)",
+           snapshot->index, server->id, offset);
 
-    tracef("sending snapshot with last index %llu to %u", snapshot->index,
-           server->id);
-
-    rv = r->io->send(r->io, &req->send, &message, sendInstallSnapshotCb);
+    rv = electionSend(r, &req->send, &message, sendInstallSnapshotCb);
     if (rv != 0) {
-        goto abort_with_snapshot;
+        goto err_after_conf_copy;
     }
 
-    goto out;
+    progressUpdateLastSend(r, i);
 
-abort_with_snapshot:
-    snapshotClose(snapshot);
-    raft_free(snapshot);
-abort:
-    if (r->state == RAFT_LEADER && server != NULL &&
-        progress_state_is_snapshot) {
+    return 0;
+
+err_after_conf_copy:
+    raft_configuration_close(&req->conf);
+err_after_req_alloc:
+    raft_free(req);
+err:
+    raft_free(chunk.base);
+    assert(rv != 0);
+    return rv;
+}
+
+/* Return the size of the snapshot chunk to send to the i'th server. */
+static size_t snapshotChunkLen(struct raft *r, const unsigned i)
+{
+    size_t size = progressSnapshotSize(r, i);
+    size_t offset = progressSnapshotOffset(r, i);
+    size_t len;
+
+    assert(offset <= size);
+    len = size - offset;
+    if (r->snapshot.chunk_size > 0 && len > r->snapshot.chunk_size) {
+        len = r->snapshot.chunk_size;
+    }
+
+    return len;
+}
+
+/* Copy the chunk to send to the i'th server out of the buffers of the snapshot
+ * loaded in its progress. The chunk might span several buffers. */
+static int snapshotCopyChunk(struct raft *r,
+                             const unsigned i,
+                             struct raft_buffer *chunk)
+{
+    struct raft_snapshot *snapshot = progressSnapshot(r, i);
+    size_t offset = progressSnapshotOffset(r, i);
+    size_t len = snapshotChunkLen(r, i);
+    uint8_t *cursor;
+    unsigned j;
+
+    chunk->len = len;
+    chunk->base = NULL;
+    if (len == 0) {
+        return 0;
+    }
+    chunk->base = raft_malloc(len);
+    if (chunk->base == NULL) {
+        return RAFT_NOMEM;
+    }
+
+    cursor = chunk->base;
+    for (j = 0; j < snapshot->n_bufs && len > 0; j++) {
+        const struct raft_buffer *buf = &snapshot->bufs[j];
+        size_t n;
+        if (offset >= buf->len) {
+            offset -= buf->len;
+            continue;
+        }
+        n = buf->len - offset;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(cursor, (const uint8_t *)buf->base + offset, n);
+        cursor += n;
+        len -= n;
+        offset = 0;
+    }
+    assert(len == 0);
+
+    return 0;
+}
+
+static int readSnapshotChunk(struct raft *r, const unsigned i);
+
+static void readSnapshotChunkCb(struct raft_io_snapshot_read *read,
+                                struct raft_snapshot *snapshot,
+                                size_t size,
+                                int status)
+{
+    struct readSnapshot *req = read->data;
+    struct raft *r = req->raft;
+    struct raft_snapshot *current;
+    struct raft_buffer chunk;
+    unsigned i;
+
+    /* Probably we're not leader anymore, or the server was removed in the
+     * meantime. */
+    if (r->state != RAFT_LEADER || r->current_term != req->term) {
+        goto out;
+    }
+    i = configurationHashIndexOf(r, req->server_id);
+    if (i == r->configuration.n) {
+        goto out;
+    }
+    progressSetReading(r, i, false);
+    if (progressState(r, i) != PROGRESS__SNAPSHOT) {
+        goto out;
+    }
+
+    if (status != 0) {
+        tracef("read snapshot chunk at %zu: %s", req->offset,
+               raft_strerror(status));
+        progressAbortSnapshot(r, i);
+        goto out;
+    }
+
+    /* Only the metadata of the snapshot is kept around, the chunk is handed
+     * over to the send request. */
+    chunk = snapshot->bufs[0];
+    raft_free(snapshot->bufs);
+    snapshot->bufs = NULL;
+    snapshot->n_bufs = 0;
+
+    current = progressSnapshot(r, i);
+    if (current == NULL) {
+        progressSetSnapshot(r, i, snapshot, size);
+        snapshot = NULL;
+    } else if (current->index != snapshot->index) {
+        /* A new snapshot replaced the one being sent, start over with it at
+         * the next replication round. */
+        raft_free(chunk.base);
         progressAbortSnapshot(r, i);
+        goto out;
+    }
+
+    /* The server acknowledged another chunk in the meantime, read the one it
+     * expects now. */
+    if (req->offset != progressSnapshotOffset(r, i)) {
+        raft_free(chunk.base);
+        readSnapshotChunk(r, i);
+        goto out;
+    }
+
+    /* If sending fails, the chunk will be read and sent again later. */
+    sendSnapshotData(r, i, chunk);
+
+out:
+    if (snapshot != NULL) {
+        snapshotDestroy(snapshot);
     }
     raft_free(req);
+}
+
+/* Read from disk the snapshot chunk to send to the i'th server, starting at the
+ * offset currently recorded in its progress, and send it once the read
+ * completes. At most one read per server is in flight. */
+static int readSnapshotChunk(struct raft *r, const unsigned i)
+{
+    struct raft_server *server = &r->configuration.servers[i];
+    struct readSnapshot *req;
+    size_t len = r->snapshot.chunk_size > 0 ? r->snapshot.chunk_size : SIZE_MAX;
+    int rv;
+
+    if (progressIsReading(r, i)) {
+        return 0;
+    }
+
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    req->raft = r;
+    req->term = r->current_term;
+    req->server_id = server->id;
+    req->offset = progressSnapshotOffset(r, i);
+    req->read.data = req;
+
+    rv = r->io->snapshot_read(r->io, &req->read, req->offset, len,
+                              readSnapshotChunkCb);
+    if (rv != 0) {
+        raft_free(req);
+        return rv;
+    }
+    progressSetReading(r, i, true);
+
+    return 0;
+}
+
+/* Send to the i'th server the snapshot chunk starting at the offset currently
+ * recorded in its progress. */
+static int sendSnapshotChunk(struct raft *r, const unsigned i)
+{
+    struct raft_buffer chunk;
+    int rv;
+
+    assert(progressState(r, i) == PROGRESS__SNAPSHOT);
+
+    if (ioHasSnapshotChunks(r)) {
+        return readSnapshotChunk(r, i);
+    }
+
+    /* The snapshot is still being loaded, the first chunk will be sent once
+     * it's done. */
+    if (progressSnapshot(r, i) == NULL) {
+        return 0;
+    }
+
+    rv = snapshotCopyChunk(r, i, &chunk);
+    if (rv != 0) {
+        return rv;
+    }
+
+    return sendSnapshotData(r, i, chunk);
+}
+
+static void sendSnapshotGetCb(struct raft_io_snapshot_get *get,
+                              struct raft_snapshot *snapshot,
+                              int status)
+{
+    struct getSnapshot *req = get->data;
+    struct raft *r = req->raft;
+    const struct raft_server *server = NULL;
+    size_t size;
+    unsigned i = 0;
+    unsigned j;
+
+    if (r->state == RAFT_LEADER) {
+        server = configurationHashGet(r, req->server_id);
+    }
+    if (server != NULL) {
+        i = configurationHashIndexOf(r, req->server_id);
+        /* Something happened in the meantime, e.g. the snapshot was aborted
+         * or another load request completed first. */
+        if (progressState(r, i) != PROGRESS__SNAPSHOT ||
+            progressSnapshot(r, i) != NULL) {
+            server = NULL;
+        }
+    }
+
+    if (status != 0) {
+        tracef("get snapshot %s", raft_strerror(status));
+        if (server != NULL) {
+            progressAbortSnapshot(r, i);
+        }
+        goto out;
+    }
+
+    if (server == NULL) {
+        /* Probably the server was removed in the meantime, or we're not leader
+         * anymore. */
+        snapshotDestroy(snapshot);
+        goto out;
+    }
+
+    size = 0;
+    for (j = 0; j < snapshot->n_bufs; j++) {
+        size += snapshot->bufs[j].len;
+    }
+    progressSetSnapshot(r, i, snapshot, size);
+
+    /* If sending the first chunk fails, it will be retried later. */
+    sendSnapshotChunk(r, i);
+
 out:
-    return;
+    raft_free(req);
 }
 
 /* Send the latest snapshot to the i'th server */
 static int sendSnapshot(struct raft *r, const unsigned i)
 {
     struct raft_server *server = &r->configuration.servers[i];
-    struct sendInstallSnapshot *request;
+    struct getSnapshot *request;
     int rv;
 
     progressToSnapshot(r, i);
 
+    /* If possible, read the snapshot and send it one chunk at a time. */
+    if (ioHasSnapshotChunks(r)) {
+        rv = readSnapshotChunk(r, i);
+        if (rv != 0) {
+            goto err;
+        }
+        return 0;
+    }
+
     request = raft_malloc(sizeof *request);
     if (request == NULL) {
         rv = RAFT_NOMEM;
@@ -278,9 +803,9 @@ static int sendSnapshot(struct raft *r, const unsigned i)
     request->server_id = server->id;
     request->get.data = request;
 
-    /* TODO: make sure that the I/O implementation really returns the latest
-     * snapshot *at this time* and not any snapshot that might be stored at a
-     * later point. Otherwise the progress snapshot_index would be wrong. */
+    /* Otherwise the snapshot is loaded once and then sent in chunks. The
+     * progress snapshot_index is updated with the index of the loaded
+     * snapshot. */
     rv = r->io->snapshot_get(r->io, &request->get, sendSnapshotGetCb);
     if (rv != 0) {
         goto err_after_req_alloc;
@@ -296,7 +821,9 @@ err:
     return rv;
 }
 
-int replicationProgress(struct raft *r, unsigned i)
+/* Send to the i'th server the next AppendEntries request or snapshot chunk,
+ * regardless of when we sent the last one. */
+static int sendProgress(struct raft *r, unsigned i)
 {
     struct raft_server *server = &r->configuration.servers[i];
     raft_index snapshot_index = logSnapshotIndex(&r->log);
@@ -308,8 +835,10 @@ int replicationProgress(struct raft *r, unsigned i)
     assert(server->id != r->id);
     assert(next_index >= 1);
 
-    if (!progressShouldReplicate(r, i)) {
-        return 0;
+    /* If we're in the middle of sending a snapshot, resend the chunk that
+     * was not acknowledged. */
+    if (progressState(r, i) == PROGRESS__SNAPSHOT) {
+        return sendSnapshotChunk(r, i);
     }
 
     /* From Section 3.5:
@@ -355,6 +884,14 @@ send_snapshot:
     return sendSnapshot(r, i);
 }
 
+int replicationProgress(struct raft *r, unsigned i)
+{
+    if (!progressShouldReplicate(r, i)) {
+        return 0;
+    }
+    return sendProgress(r, i);
+}
+
 /* Possibly trigger I/O requests for newly appended log entries or heartbeats.
  *
  * This function loops through all followers and triggers replication on them.
@@ -394,6 +931,41 @@ int replicationHeartbeat(struct raft *r)
     return triggerAll(r);
 }
 
+void replicationSendRound(struct raft *r)
+{
+    unsigned i;
+    int rv;
+
+    assert(r->state == RAFT_LEADER);
+
+    for (i = 0; i < r->configuration.n; i++) {
+        struct raft_server *server = &r->configuration.servers[i];
+        raft_index prev_index;
+        raft_term prev_term;
+        if (server->id == r->id || server->role != RAFT_VOTER) {
+            continue;
+        }
+        /* Servers receiving a snapshot, or whose flow control window is full,
+         * will get the round with the next message sent to them. */
+        if (progressState(r, i) == PROGRESS__SNAPSHOT ||
+            (progressState(r, i) == PROGRESS__PIPELINE &&
+             progressInflightIsFull(r, i))) {
+            continue;
+        }
+        prev_index = progressNextIndex(r, i) - 1;
+        prev_term = logTermOf(&r->log, prev_index);
+        if (prev_index > 0 && prev_term == 0) {
+            continue; /* A snapshot must be sent first. */
+        }
+        rv = sendAppendEntries(r, i, prev_index, prev_term);
+        if (rv != 0 && rv != RAFT_NOCONNECTION) {
+            /* This is not a critical failure, let's just log it. */
+            tracef("failed to send append entries to server %u: %s (%d)",
+                   server->id, raft_strerror(rv), rv);
+        }
+    }
+}
+
 /* Context for a write log entries request that was submitted by a leader. */
 struct appendLeader
 {
@@ -436,7 +1008,13 @@ static size_t updateLastStored(struct raft *r,
     return i;
 }
 
-/* Get the request matching the given index and type, if any. */
+/* Get the request matching the given index and type, if any.
+ *
+ * Requests are pushed to the queue as their entries get appended, so the queue
+ * is sorted by index. Entries are applied in index order too, so the request
+ * being looked up is almost always at the head of the queue. The only other
+ * lookups are for entries that were just appended, which are near the tail, so
+ * search backward from there in that case. */
 static struct request *getRequest(struct raft *r,
                                   const raft_index index,
                                   int type)
@@ -447,16 +1025,71 @@ static struct request *getRequest(struct raft *r,
     if (r->state != RAFT_LEADER) {
         return NULL;
     }
-    QUEUE_FOREACH(head, &r->leader_state.requests)
-    {
-        req = QUEUE_DATA(head, struct request, queue);
-        if (req->index == index) {
-            assert(req->type == type);
-            QUEUE_REMOVE(head);
-            return req;
+    if (QUEUE_IS_EMPTY(&r->leader_state.requests)) {
+        return NULL;
+    }
+
+    head = QUEUE_HEAD(&r->leader_state.requests);
+    req = QUEUE_DATA(head, struct request, queue);
+    if (req->index > index) {
+        return NULL;
+    }
+    if (req->index < index) {
+        head = QUEUE_TAIL(&r->leader_state.requests);
+        while (head != &r->leader_state.requests) {
+            req = QUEUE_DATA(head, struct request, queue);
+            if (req->index <= index) {
+                break;
+            }
+            head = QUEUE_PREV(head);
+        }
+        if (req->index != index) {
+            return NULL;
+        }
+    }
+
+    assert(req->type == type);
+    QUEUE_REMOVE(head);
+    return req;
+}
+
+/* Fail all client requests for entries from the given index onward. */
+static void failRequests(struct raft *r, raft_index index, int status)
+{
+    queue *head = QUEUE_TAIL(&r->leader_state.requests);
+
+    /* The queue is sorted by index, so the requests to fail are at its tail:
+     * find the first one, then fail them in order. */
+    while (head != &r->leader_state.requests) {
+        struct request *req = QUEUE_DATA(head, struct request, queue);
+        if (req->index < index) {
+            break;
+        }
+        head = QUEUE_PREV(head);
+    }
+    head = QUEUE_NEXT(head);
+
+    while (head != &r->leader_state.requests) {
+        struct request *req = QUEUE_DATA(head, struct request, queue);
+        head = QUEUE_NEXT(head);
+        QUEUE_REMOVE(&req->queue);
+        switch (req->type) {
+            case RAFT_COMMAND: {
+                struct raft_apply *apply = (struct raft_apply *)req;
+                if (apply->cb != NULL) {
+                    apply->cb(apply, status, NULL);
+                }
+                break;
+            }
+            case RAFT_BARRIER: {
+                struct raft_barrier *barrier = (struct raft_barrier *)req;
+                if (barrier->cb != NULL) {
+                    barrier->cb(barrier, status);
+                }
+                break;
+            }
         }
     }
-    return NULL;
 }
 
 /* Invoked once a disk write request for new entries has been completed. */
@@ -464,7 +1097,7 @@ static void appendLeaderCb(struct raft_io_append *req, int status)
 {
     struct appendLeader *request = req->data;
     struct raft *r = request->raft;
-    size_t server_index;
+    unsigned server_index;
     int rv;
 
     tracef("leader: written %u entries starting at %lld: status %d", request->n,
@@ -474,14 +1107,15 @@ static void appendLeaderCb(struct raft_io_append *req, int status)
      * entries in the first place, truncate our log too (since we have appended
      * these entries to it) and fire the request callback. */
     if (status != 0) {
-        struct raft_apply *apply;
         ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
-        apply =
-            (struct raft_apply *)getRequest(r, request->index, RAFT_COMMAND);
-        if (apply != NULL) {
-            if (apply->cb != NULL) {
-                apply->cb(apply, status, NULL);
+        if (r->state == RAFT_LEADER) {
+            /* With group commit the write covers the entries of several
+             * requests, and entries appended after it get truncated too,
+             * including deferred ones, so fail all of them. */
+            if (r->group_commit.index >= request->index) {
+                r->group_commit.index = 0;
             }
+            failRequests(r, request->index, status);
         }
         goto out;
     }
@@ -495,7 +1129,7 @@ static void appendLeaderCb(struct raft_io_append *req, int status)
     }
 
     /* If Check if we have reached a quorum. */
-    server_index = configurationIndexOf(&r->configuration, r->id);
+    server_index = configurationHashIndexOf(r, r->id);
 
     /* Only update the next index if we are part of the current
      * configuration. The only case where this is not true is when we were
@@ -508,7 +1142,7 @@ static void appendLeaderCb(struct raft_io_append *req, int status)
      *   replicates log entries but does not count itself in majorities.
      */
     if (server_index < r->configuration.n) {
-        r->leader_state.progress[server_index].match_index = r->last_stored;
+        progressSetMatchIndex(r, server_index, r->last_stored);
     } else {
         const struct raft_entry *entry = logGet(&r->log, r->last_stored);
         assert(entry->type == RAFT_CHANGE);
@@ -524,7 +1158,7 @@ static void appendLeaderCb(struct raft_io_append *req, int status)
 
 out:
     /* Tell the log that we're done referencing these entries. */
-    logRelease(&r->log, request->index, request->entries, request->n);
+    logRelease(&r->log, request->entries, request->n);
     if (status != 0) {
         logTruncate(&r->log, request->index);
     }
@@ -566,33 +1200,133 @@ static int appendLeader(struct raft *r, raft_index index)
     request->n = n;
     request->req.data = request;
 
-    rv = r->io->append(r->io, &request->req, entries, n, appendLeaderCb);
-    if (rv != 0) {
-        ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
-        goto err_after_request_alloc;
+    rv = r->io->append(r->io, &request->req, entries, n, appendLeaderCb);
+    if (rv != 0) {
+        ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
+        goto err_after_request_alloc;
+    }
+
+    return 0;
+
+err_after_request_alloc:
+    raft_free(request);
+err_after_entries_acquired:
+    logRelease(&r->log, entries, n);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+/* Submit the disk write and the AppendEntries messages for the entries from
+ * the given index onward, along with any entry whose submission was deferred
+ * by group commit. */
+static int replicationFlush(struct raft *r, raft_index index)
+{
+    raft_index deferred = r->group_commit.index;
+    int rv;
+
+    if (deferred != 0) {
+        assert(deferred <= index);
+        index = deferred;
+        r->group_commit.index = 0;
+    }
+
+    rv = appendLeader(r, index);
+    if (rv != 0) {
+        /* Leave deferred entries in place, they will be submitted along with
+         * the next ones. */
+        r->group_commit.index = deferred;
+        return rv;
+    }
+
+    return triggerAll(r);
+}
+
+/* Invoked once the group commit window of the leader has expired. */
+static void groupCommitCb(struct raft_io_defer *req, int status)
+{
+    struct raft *r = req->data;
+    raft_index index = r->group_commit.index;
+    int rv;
+
+    r->group_commit.pending = false;
+
+    if (index == 0) {
+        return;
+    }
+
+    /* Deferred entries are flushed or dropped when stepping down. */
+    assert(r->state == RAFT_LEADER);
+    (void)status;
+
+    tracef("leader: group commit of entries from %lld", index);
+
+    rv = replicationFlush(r, index);
+    if (rv != 0 && r->group_commit.index != 0) {
+        /* The disk write could not be submitted: behave as if it failed. */
+        r->group_commit.index = 0;
+        failRequests(r, index, rv);
+        logTruncate(&r->log, index);
+    }
+}
+
+/* Defer the submission of the entries from the given index onward, which have
+ * just been appended to the in-memory log. */
+static int groupCommit(struct raft *r, raft_index index)
+{
+    raft_index first;
+    unsigned max = r->group_commit.max_entries;
+    int rv;
+
+    first = r->group_commit.index != 0 ? r->group_commit.index : index;
+    if (max > 0 && logLastIndex(&r->log) - first + 1 >= max) {
+        return replicationFlush(r, index);
+    }
+
+    if (!r->group_commit.pending) {
+        r->group_commit.req.data = r;
+        rv = r->io->defer(r->io, &r->group_commit.req, r->group_commit.window,
+                          groupCommitCb);
+        if (rv != 0) {
+            ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
+            return rv;
+        }
+        r->group_commit.pending = true;
     }
 
-    return 0;
+    r->group_commit.index = first;
 
-err_after_request_alloc:
-    raft_free(request);
-err_after_entries_acquired:
-    logRelease(&r->log, index, entries, n);
-err:
-    assert(rv != 0);
-    return rv;
+    return 0;
 }
 
 int replicationTrigger(struct raft *r, raft_index index)
 {
+    if (r->group_commit.enabled && r->io->version >= 2 &&
+        r->io->defer != NULL) {
+        return groupCommit(r, index);
+    }
+    return replicationFlush(r, index);
+}
+
+void replicationFlushDeferred(struct raft *r, bool persist)
+{
+    raft_index index = r->group_commit.index;
     int rv;
 
+    if (index == 0) {
+        return;
+    }
+    assert(r->state == RAFT_LEADER);
+    r->group_commit.index = 0;
+
+    if (!persist) {
+        return;
+    }
+
     rv = appendLeader(r, index);
     if (rv != 0) {
-        return rv;
+        logTruncate(&r->log, index);
     }
-
-    return triggerAll(r);
 }
 
 /* Helper to be invoked after a promotion of a non-voting server has been
@@ -613,8 +1347,7 @@ static int triggerActualPromotion(struct raft *r)
     assert(r->state == RAFT_LEADER);
     assert(r->leader_state.promotee_id != 0);
 
-    server_index =
-        configurationIndexOf(&r->configuration, r->leader_state.promotee_id);
+    server_index = configurationHashIndexOf(r, r->leader_state.promotee_id);
     assert(server_index < r->configuration.n);
 
     server = &r->configuration.servers[server_index];
@@ -624,6 +1357,7 @@ static int triggerActualPromotion(struct raft *r)
     /* Update our current configuration. */
     old_role = server->role;
     server->role = RAFT_VOTER;
+    progressRebuildQuorum(r);
 
     /* Index of the entry being appended. */
     index = logLastIndex(&r->log) + 1;
@@ -650,11 +1384,56 @@ err_after_log_append:
 
 err:
     server->role = old_role;
+    progressRebuildQuorum(r);
 
     assert(rv != 0);
     return rv;
 }
 
+int replicationUpdateSnapshot(
+    struct raft *r,
+    const struct raft_server *server,
+    const struct raft_install_snapshot_result *result)
+{
+    struct raft_snapshot *snapshot;
+    unsigned i;
+
+    i = configurationHashIndexOf(r, server->id);
+
+    assert(r->state == RAFT_LEADER);
+    assert(i < r->configuration.n);
+
+    progressMarkRecentRecv(r, i);
+
+    /* Ignore results about snapshots that we are not sending anymore. */
+    if (progressState(r, i) != PROGRESS__SNAPSHOT) {
+        return 0;
+    }
+    snapshot = progressSnapshot(r, i);
+    if (snapshot == NULL || snapshot->index != result->last_index ||
+        result->offset > progressSnapshotSize(r, i)) {
+        return 0;
+    }
+
+    /* If the server did not get past the chunk that we sent last, this is a
+     * duplicate result: either the chunk is still in flight or it was lost,
+     * in which case it will be sent again after a while. A lower offset means
+     * that the server has lost the data it had received, e.g. because it was
+     * restarted, so we rewind and send again from there. */
+    if (result->offset == progressSnapshotOffset(r, i)) {
+        return 0;
+    }
+
+    progressSetSnapshotOffset(r, i, result->offset);
+
+    /* Send the next chunk, ignoring errors. */
+    tracef("snapshot offset %zu -> send next chunk to %u", result->offset,
+           server->id);
+    sendSnapshotChunk(r, i);
+
+    return 0;
+}
+
 int replicationUpdate(struct raft *r,
                       const struct raft_server *server,
                       const struct raft_append_entries_result *result)
@@ -664,7 +1443,7 @@ int replicationUpdate(struct raft *r,
     unsigned i;
     int rv;
 
-    i = configurationIndexOf(&r->configuration, server->id);
+    i = configurationHashIndexOf(r, server->id);
 
     assert(r->state == RAFT_LEADER);
     assert(i < r->configuration.n);
@@ -681,13 +1460,21 @@ int replicationUpdate(struct raft *r,
      *     decrement nextIndex and retry.
      */
     if (result->rejected > 0) {
+        raft_index next_index = progressNextIndex(r, i);
         bool retry;
-        retry = progressMaybeDecrement(r, i, result->rejected,
-                                       result->last_log_index);
+        retry = progressMaybeDecrement(
+            r, i, result->rejected, result->last_log_index,
+            result->conflict_term, result->conflict_index);
         if (retry) {
-            /* Retry, ignoring errors. */
+            /* Retry, ignoring errors. If we moved back, the follower has just
+             * answered our last probe, so there's no point in waiting for the
+             * next heartbeat before sending the next one. */
             tracef("log mismatch -> send old entries to %u", server->id);
-            replicationProgress(r, i);
+            if (progressNextIndex(r, i) < next_index) {
+                sendProgress(r, i);
+            } else {
+                replicationProgress(r, i);
+            }
         }
         return 0;
     }
@@ -754,7 +1541,7 @@ int replicationUpdate(struct raft *r,
 
     /* Get again the server index since it might have been removed from the
      * configuration. */
-    i = configurationIndexOf(&r->configuration, server->id);
+    i = configurationHashIndexOf(r, server->id);
 
     if (i < r->configuration.n) {
         /* If we are transfering leadership to this follower, check if its log
@@ -803,7 +1590,7 @@ static void sendAppendEntriesResult(
     }
     req->data = r;
 
-    rv = r->io->send(r->io, req, &message, sendAppendEntriesResultCb);
+    rv = electionSend(r, req, &message, sendAppendEntriesResultCb);
     if (rv != 0) {
         raft_free(req);
     }
@@ -834,6 +1621,9 @@ static void appendFollowerCb(struct raft_io_append *req, int status)
     assert(args->n_entries > 0);
 
     result.term = r->current_term;
+    result.read_round = args->read_round;
+    result.conflict_term = 0;
+    result.conflict_index = 0;
     if (status != 0) {
         if (r->state != RAFT_FOLLOWER) {
             tracef("local server is not follower -> ignore I/O failure");
@@ -900,8 +1690,7 @@ respond:
     sendAppendEntriesResult(r, &result);
 
 out:
-    logRelease(&r->log, request->index, request->args.entries,
-               request->args.n_entries);
+    logRelease(&r->log, request->args.entries, request->args.n_entries);
 
     raft_free(request);
 }
@@ -1103,111 +1892,475 @@ int replicationAppend(struct raft *r,
     for (j = 0; j < n; j++) {
         struct raft_entry *entry = &args->entries[i + j];
 
-        rv = logAppend(&r->log, entry->term, entry->type, &entry->buf,
-                       entry->batch);
-        if (rv != 0) {
-            /* TODO: we should revert any changes we made to the log */
-            goto err_after_request_alloc;
-        }
+        rv = logAppend(&r->log, entry->term, entry->type, &entry->buf,
+                       entry->batch);
+        if (rv != 0) {
+            /* TODO: we should revert any changes we made to the log */
+            goto err_after_request_alloc;
+        }
+    }
+
+    /* Acquire the relevant entries from the log. */
+    rv = logAcquire(&r->log, request->index, &request->args.entries,
+                    &request->args.n_entries);
+    if (rv != 0) {
+        goto err_after_request_alloc;
+    }
+
+    assert(request->args.n_entries == n);
+
+    request->req.data = request;
+    rv = r->io->append(r->io, &request->req, request->args.entries,
+                       request->args.n_entries, appendFollowerCb);
+    if (rv != 0) {
+        ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
+        goto err_after_acquire_entries;
+    }
+
+    raft_free(args->entries);
+
+    return 0;
+
+err_after_acquire_entries:
+    logRelease(&r->log, request->args.entries, request->args.n_entries);
+
+err_after_request_alloc:
+    raft_free(request);
+
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+struct recvInstallSnapshot
+{
+    struct raft *raft;
+    struct raft_snapshot snapshot;
+};
+
+/* Restore the given snapshot, which was stored with the given status, and
+ * report the outcome to the leader. Ownership of the snapshot data and
+ * configuration is taken. */
+static void installSnapshotDone(struct raft *r,
+                                struct raft_snapshot *snapshot,
+                                int status)
+{
+    struct raft_append_entries_result result;
+    int rv;
+
+    result.term = r->current_term;
+    result.read_round = 0;
+    result.conflict_term = 0;
+    result.conflict_index = 0;
+
+    /* If we are shutting down, let's discard the result. TODO: what about other
+     * states? */
+    if (r->state == RAFT_UNAVAILABLE) {
+        goto discard;
+    }
+
+    if (status != 0) {
+        result.rejected = snapshot->index;
+        tracef("save snapshot %llu: %s", snapshot->index,
+               raft_strerror(status));
+        goto discard;
+    }
+
+    /* From Figure 5.3:
+     *
+     *   7. Discard the entire log
+     *   8. Reset state machine using snapshot contents (and load lastConfig
+     *      as cluster configuration).
+     */
+    rv = snapshotRestore(r, snapshot);
+    if (rv != 0) {
+        result.rejected = snapshot->index;
+        tracef("restore snapshot %llu: %s", snapshot->index,
+               raft_strerror(status));
+        goto discard;
+    }
+
+    tracef("restored snapshot with last index %llu", snapshot->index);
+
+    if (r->state == RAFT_FOLLOWER) {
+        readIndexAdvance(r);
+    }
+
+    result.rejected = 0;
+
+    goto respond;
+
+discard:
+    /* In case of error we must also free the snapshot data buffer and free the
+     * configuration. */
+    snapshotClose(snapshot);
+
+respond:
+    if (r->state != RAFT_UNAVAILABLE) {
+        result.last_log_index = r->last_stored;
+        sendAppendEntriesResult(r, &result);
+    }
+}
+
+static void installSnapshotCb(struct raft_io_snapshot_put *req, int status)
+{
+    struct recvInstallSnapshot *request = req->data;
+    struct raft *r = request->raft;
+
+    r->snapshot.put.data = NULL;
+    installSnapshotDone(r, &request->snapshot, status);
+    raft_free(request);
+}
+
+/* Whether our log already contains all entries of the snapshot with the given
+ * last index and term. */
+static bool snapshotIsCovered(struct raft *r,
+                              raft_index last_index,
+                              raft_term last_term)
+{
+    raft_term local_term;
+
+    if (r->log.snapshot.last_index >= last_index) {
+        return true;
+    }
+
+    local_term = logTermOf(&r->log, last_index);
+    return local_term != 0 && local_term >= last_term;
+}
+
+/* Discard the snapshot chunks received so far. */
+static void snapshotChunksReset(struct raft *r)
+{
+    raft_free(r->snapshot.chunks.buf.base);
+    r->snapshot.chunks.index = 0;
+    r->snapshot.chunks.term = 0;
+    r->snapshot.chunks.buf.base = NULL;
+    r->snapshot.chunks.buf.len = 0;
+    r->snapshot.chunks.cap = 0;
+    r->snapshot.chunks.written = 0;
+}
+
+/* Append the given chunk to the snapshot data received so far. */
+static int snapshotChunksAppend(struct raft *r, struct raft_buffer *chunk)
+{
+    struct raft_buffer *buf = &r->snapshot.chunks.buf;
+    size_t len = buf->len + chunk->len;
+    void *base;
+
+    /* Take over the memory of the first chunk, to avoid a copy. */
+    if (buf->base == NULL) {
+        *buf = *chunk;
+        r->snapshot.chunks.cap = chunk->len;
+        chunk->base = NULL;
+        chunk->len = 0;
+        return 0;
+    }
+
+    if (len > r->snapshot.chunks.cap) {
+        size_t cap = r->snapshot.chunks.cap * 2;
+        if (cap < len) {
+            cap = len;
+        }
+        base = raft_realloc(buf->base, cap);
+        if (base == NULL) {
+            return RAFT_NOMEM;
+        }
+        buf->base = base;
+        r->snapshot.chunks.cap = cap;
+    }
+
+    memcpy((char *)buf->base + buf->len, chunk->base, chunk->len);
+    buf->len = len;
+
+    raft_free(chunk->base);
+    chunk->base = NULL;
+    chunk->len = 0;
+
+    return 0;
+}
+
+int replicationSendSnapshotResult(struct raft *r,
+                                  raft_index last_index,
+                                  size_t offset)
+{
+    struct raft_message message;
+    struct raft_install_snapshot_result *result =
+        &message.install_snapshot_result;
+    struct raft_io_send *req;
+    int rv;
+
+    result->term = r->current_term;
+    result->last_index = last_index;
+    result->offset = offset;
+
+    message.type = RAFT_IO_INSTALL_SNAPSHOT_RESULT;
+    message.server_id = r->follower_state.current_leader.id;
+    message.server_address = r->follower_state.current_leader.address;
+
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        return RAFT_NOMEM;
+    }
+    req->data = r;
+
+    rv = electionSend(r, req, &message, sendAppendEntriesResultCb);
+    if (rv != 0) {
+        raft_free(req);
+        return rv;
+    }
+
+    return 0;
+}
+
+/* Context of a snapshot_write request submitted to store a chunk of a snapshot
+ * being received. */
+struct writeSnapshot
+{
+    struct raft *raft;               /* Instance receiving the snapshot. */
+    struct raft_snapshot snapshot;   /* Metadata of the snapshot. */
+    struct raft_buffer chunk;        /* Chunk being written. */
+    bool done;                       /* Whether this is the last chunk. */
+    struct raft_io_snapshot_get get; /* Load the snapshot once stored. */
+};
+
+static void installSnapshotGetCb(struct raft_io_snapshot_get *get,
+                                 struct raft_snapshot *snapshot,
+                                 int status)
+{
+    struct writeSnapshot *req = get->data;
+    struct raft *r = req->raft;
+
+    r->snapshot.put.data = NULL;
+
+    if (status == 0 && snapshot->index != req->snapshot.index) {
+        snapshotDestroy(snapshot);
+        status = RAFT_CORRUPT;
+    }
+    if (status != 0) {
+        installSnapshotDone(r, &req->snapshot, status);
+        goto out;
+    }
+
+    snapshotClose(&req->snapshot);
+    installSnapshotDone(r, snapshot, 0);
+    raft_free(snapshot);
+
+out:
+    raft_free(req);
+}
+
+static void writeSnapshotChunkCb(struct raft_io_snapshot_write *write,
+                                 int status)
+{
+    struct writeSnapshot *req = write->data;
+    struct raft *r = req->raft;
+    size_t len = req->chunk.len;
+    int rv;
+
+    r->snapshot.chunks.write.data = NULL;
+    raft_free(req->chunk.base);
+
+    /* Once the last chunk is written, the snapshot is stored: load it back to
+     * restore it. */
+    if (req->done) {
+        if (status == 0 && r->state == RAFT_UNAVAILABLE) {
+            status = RAFT_CANCELED;
+        }
+        if (status == 0) {
+            req->get.data = req;
+            status = r->io->snapshot_get(r->io, &req->get,
+                                         installSnapshotGetCb);
+            if (status == 0) {
+                return;
+            }
+        }
+        r->snapshot.put.data = NULL;
+        installSnapshotDone(r, &req->snapshot, status);
+        goto out;
+    }
+
+    snapshotClose(&req->snapshot);
+
+    /* Ignore the outcome if the snapshot being received has changed. */
+    if (r->state != RAFT_FOLLOWER ||
+        req->snapshot.index != r->snapshot.chunks.index ||
+        req->snapshot.term != r->snapshot.chunks.term) {
+        goto out;
+    }
+
+    if (status == 0) {
+        r->snapshot.chunks.written += len;
+    } else {
+        tracef("write snapshot chunk: %s", raft_strerror(status));
+    }
+
+    /* Tell the leader where to resume from. */
+    rv = replicationSendSnapshotResult(r, r->snapshot.chunks.index,
+                                       r->snapshot.chunks.written);
+    if (rv != 0) {
+        tracef("send snapshot result: %s", raft_strerror(rv));
+    }
+
+out:
+    raft_free(req);
+}
+
+/* Write to disk a chunk of a snapshot that the leader is sending in multiple
+ * InstallSnapshot messages, see replicationSnapshotChunk(). */
+static void snapshotChunkWrite(struct raft *r,
+                               struct raft_install_snapshot *args,
+                               bool *async,
+                               size_t *offset)
+{
+    struct writeSnapshot *req;
+    int rv;
+
+    /* Chunks are written one at a time. The leader will send this one again
+     * if we don't acknowledge it. */
+    if (r->snapshot.chunks.write.data != NULL) {
+        raft_configuration_close(&args->conf);
+        raft_free(args->data.base);
+        args->data.base = NULL;
+        args->data.len = 0;
+        *async = true;
+        return;
+    }
+
+    /* If this chunk belongs to a different snapshot than the one we have been
+     * receiving, start over. */
+    if (args->last_index != r->snapshot.chunks.index ||
+        args->last_term != r->snapshot.chunks.term) {
+        snapshotChunksReset(r);
+        r->snapshot.chunks.index = args->last_index;
+        r->snapshot.chunks.term = args->last_term;
     }
 
-    /* Acquire the relevant entries from the log. */
-    rv = logAcquire(&r->log, request->index, &request->args.entries,
-                    &request->args.n_entries);
-    if (rv != 0) {
-        goto err_after_request_alloc;
+    /* Drop chunks that don't start where the data written so far ends. */
+    if (args->offset != r->snapshot.chunks.written) {
+        tracef("drop snapshot chunk at offset %zu (have %zu)", args->offset,
+               r->snapshot.chunks.written);
+        goto drop;
     }
 
-    assert(request->args.n_entries == n);
+    req = raft_malloc(sizeof *req);
+    if (req == NULL) {
+        goto drop;
+    }
+    req->raft = r;
+    req->snapshot.term = args->last_term;
+    req->snapshot.index = args->last_index;
+    req->snapshot.configuration_index = args->conf_index;
+    req->snapshot.bufs = NULL;
+    req->snapshot.n_bufs = 0;
+    req->chunk = args->data;
+    req->done = args->done;
+    if (req->done) {
+        req->snapshot.configuration = args->conf;
+    } else {
+        configurationInit(&req->snapshot.configuration);
+    }
 
-    request->req.data = request;
-    rv = r->io->append(r->io, &request->req, request->args.entries,
-                       request->args.n_entries, appendFollowerCb);
+    r->snapshot.chunks.write.data = req;
+    rv = r->io->snapshot_write(r->io, &r->snapshot.chunks.write,
+                               &req->snapshot, args->offset, &req->chunk,
+                               req->done, writeSnapshotChunkCb);
     if (rv != 0) {
-        ErrMsgTransfer(r->io->errmsg, r->errmsg, "io");
-        goto err_after_acquire_entries;
+        r->snapshot.chunks.write.data = NULL;
+        raft_free(req);
+        goto drop;
     }
 
-    raft_free(args->entries);
-
-    return 0;
-
-err_after_acquire_entries:
-    logRelease(&r->log, request->index, request->args.entries,
-               request->args.n_entries);
+    if (req->done) {
+        /* Like replicationInstallSnapshot() does, preemptively update our
+         * in-memory state. */
+        logRestore(&r->log, args->last_index, args->last_term);
+        r->last_stored = 0;
+        r->snapshot.put.data = req;
+        snapshotChunksReset(r);
+    } else {
+        raft_configuration_close(&args->conf);
+    }
 
-err_after_request_alloc:
-    raft_free(request);
+    args->data.base = NULL;
+    args->data.len = 0;
+    *async = true;
+    return;
 
-err:
-    assert(rv != 0);
-    return rv;
+drop:
+    raft_free(args->data.base);
+    args->data.base = NULL;
+    args->data.len = 0;
+    *offset = r->snapshot.chunks.written;
 }
 
-struct recvInstallSnapshot
-{
-    struct raft *raft;
-    struct raft_snapshot snapshot;
-};
-
-static void installSnapshotCb(struct raft_io_snapshot_put *req, int status)
+void replicationSnapshotChunk(struct raft *r,
+                              struct raft_install_snapshot *args,
+                              bool *install,
+                              bool *async,
+                              size_t *offset)
 {
-    struct recvInstallSnapshot *request = req->data;
-    struct raft *r = request->raft;
-    struct raft_snapshot *snapshot = &request->snapshot;
-    struct raft_append_entries_result result;
+    struct raft_buffer *buf = &r->snapshot.chunks.buf;
     int rv;
 
-    r->snapshot.put.data = NULL;
+    assert(r->state == RAFT_FOLLOWER);
 
-    result.term = r->current_term;
+    *install = false;
+    *async = false;
 
-    /* If we are shutting down, let's discard the result. TODO: what about other
-     * states? */
-    if (r->state == RAFT_UNAVAILABLE) {
-        goto discard;
+    /* If we already have the snapshot, let replicationInstallSnapshot() treat
+     * the message as a no-op. */
+    if (snapshotIsCovered(r, args->last_index, args->last_term)) {
+        snapshotChunksReset(r);
+        *install = true;
+        return;
     }
 
-    if (status != 0) {
-        result.rejected = snapshot->index;
-        tracef("save snapshot %llu: %s", snapshot->index,
-               raft_strerror(status));
-        goto discard;
+    if (ioHasSnapshotChunks(r)) {
+        snapshotChunkWrite(r, args, async, offset);
+        return;
     }
 
-    /* From Figure 5.3:
-     *
-     *   7. Discard the entire log
-     *   8. Reset state machine using snapshot contents (and load lastConfig
-     *      as cluster configuration).
-     */
-    rv = snapshotRestore(r, snapshot);
-    if (rv != 0) {
-        result.rejected = snapshot->index;
-        tracef("restore snapshot %llu: %s", snapshot->index,
-               raft_strerror(status));
-        goto discard;
+    /* If this chunk belongs to a different snapshot than the one we have been
+     * receiving, start over. */
+    if (args->last_index != r->snapshot.chunks.index ||
+        args->last_term != r->snapshot.chunks.term) {
+        snapshotChunksReset(r);
+        r->snapshot.chunks.index = args->last_index;
+        r->snapshot.chunks.term = args->last_term;
     }
 
-    tracef("restored snapshot with last index %llu", snapshot->index);
-
-    result.rejected = 0;
-
-    goto respond;
+    /* Drop chunks that don't start where the data received so far ends, and
+     * tell the leader where to resume from. */
+    if (args->offset != buf->len) {
+        tracef("drop snapshot chunk at offset %zu (have %zu)", args->offset,
+               buf->len);
+        goto drop;
+    }
 
-discard:
-    /* In case of error we must also free the snapshot data buffer and free the
-     * configuration. */
-    raft_free(snapshot->bufs[0].base);
-    raft_configuration_close(&snapshot->configuration);
+    rv = snapshotChunksAppend(r, &args->data);
+    if (rv != 0) {
+        /* The leader will eventually send the chunk again. */
+        goto drop;
+    }
 
-respond:
-    if (r->state != RAFT_UNAVAILABLE) {
-        result.last_log_index = r->last_stored;
-        sendAppendEntriesResult(r, &result);
+    if (!args->done) {
+        *offset = buf->len;
+        return;
     }
 
-    raft_free(request);
+    /* We have the whole snapshot, hand it over to the caller. */
+    args->data = *buf;
+    args->offset = 0;
+    buf->base = NULL;
+    snapshotChunksReset(r);
+    *install = true;
+    return;
+
+drop:
+    raft_free(args->data.base);
+    args->data.base = NULL;
+    args->data.len = 0;
+    *offset = buf->len;
 }
 
 int replicationInstallSnapshot(struct raft *r,
@@ -1217,31 +2370,17 @@ int replicationInstallSnapshot(struct raft *r,
 {
     struct recvInstallSnapshot *request;
     struct raft_snapshot *snapshot;
-    raft_term local_term;
     int rv;
 
     assert(r->state == RAFT_FOLLOWER);
+    assert(r->snapshot.pending.term == 0 && r->snapshot.put.data == NULL);
 
     *rejected = args->last_index;
     *async = false;
 
-    /* If we are taking a snapshot ourselves or installing a snapshot, ignore
-     * the request, the leader will weventually retry. TODO: we should do
-     * something smarter. */
-    if (r->snapshot.pending.term != 0 || r->snapshot.put.data != NULL) {
-        *async = true;
-        return 0;
-    }
-
-    /* If our last snapshot is more up-to-date, this is a no-op */
-    if (r->log.snapshot.last_index >= args->last_index) {
-        *rejected = 0;
-        return 0;
-    }
-
-    /* If we already have all entries in the snapshot, this is a no-op */
-    local_term = logTermOf(&r->log, args->last_index);
-    if (local_term != 0 && local_term >= args->last_term) {
+    /* If our last snapshot is more up-to-date or we already have all entries
+     * in the snapshot, this is a no-op */
+    if (snapshotIsCovered(r, args->last_index, args->last_term)) {
         *rejected = 0;
         return 0;
     }
@@ -1354,7 +2493,7 @@ static void applyChange(struct raft *r, const raft_index index)
          *   In this approach, a leader that is removed from the configuration
          *   steps down once the Cnew entry is committed.
          */
-        server = configurationGet(&r->configuration, r->id);
+        server = configurationHashGet(r, r->id);
         if (server == NULL) {
             convertToFollower(r);
         }
@@ -1407,10 +2546,84 @@ out:
     r->snapshot.pending.term = 0;
 }
 
+/* Whether the FSM takes snapshots in two steps, freezing its state on the loop
+ * thread and serializing it on another one. */
+static bool fsmHasSnapshotSerialize(struct raft *r)
+{
+    return r->fsm->version >= 3 && r->fsm->snapshot_freeze != NULL &&
+           r->fsm->snapshot_serialize != NULL;
+}
+
+/* Release the content and configuration of the pending snapshot. */
+static void takeSnapshotAbort(struct raft *r, bool free_bufs)
+{
+    struct raft_snapshot *snapshot = &r->snapshot.pending;
+    unsigned i;
+
+    if (free_bufs) {
+        for (i = 0; i < snapshot->n_bufs; i++) {
+            raft_free(snapshot->bufs[i].base);
+        }
+        raft_free(snapshot->bufs);
+    }
+    raft_configuration_close(&snapshot->configuration);
+    r->snapshot.pending.term = 0;
+}
+
+/* Store the pending snapshot, whose content was filled by the FSM. */
+static int takeSnapshotPut(struct raft *r)
+{
+    int rv;
+
+    assert(r->snapshot.put.data == NULL);
+    r->snapshot.put.data = r;
+    rv = r->io->snapshot_put(r->io, r->snapshot.trailing, &r->snapshot.put,
+                             &r->snapshot.pending, takeSnapshotCb);
+    if (rv != 0) {
+        r->snapshot.put.data = NULL;
+        return rv;
+    }
+
+    return 0;
+}
+
+static void takeSnapshotSerializeCb(struct raft_fsm_snapshot *req, int status)
+{
+    struct raft *r = req->data;
+    raft_io_close_cb close_cb;
+    int rv;
+
+    r->snapshot.serialize.data = NULL;
+
+    /* If we are closing, drop the snapshot and finish now. */
+    if (r->state == RAFT_UNAVAILABLE) {
+        takeSnapshotAbort(r, status == 0);
+        close_cb = r->snapshot.close_cb;
+        if (close_cb != NULL) {
+            r->snapshot.close_cb = NULL;
+            close_cb(r->io);
+        }
+        return;
+    }
+
+    if (status != 0) {
+        tracef("serialize snapshot %lld: %s", r->snapshot.pending.index,
+               raft_strerror(status));
+        takeSnapshotAbort(r, false);
+        return;
+    }
+
+    rv = takeSnapshotPut(r);
+    if (rv != 0) {
+        tracef("store snapshot %lld: %s", r->snapshot.pending.index,
+               raft_strerror(rv));
+        takeSnapshotAbort(r, true);
+    }
+}
+
 static int takeSnapshot(struct raft *r)
 {
     struct raft_snapshot *snapshot;
-    unsigned i;
     int rv;
 
     tracef("take snapshot at %lld", r->last_applied);
@@ -1426,37 +2639,204 @@ static int takeSnapshot(struct raft *r)
 
     snapshot->configuration_index = r->configuration_index;
 
+    /* If the FSM supports it, freeze its state right away and let it encode
+     * the snapshot in the background, without blocking the loop. */
+    if (fsmHasSnapshotSerialize(r)) {
+        rv = r->fsm->snapshot_freeze(r->fsm);
+        if (rv != 0) {
+            goto abort_after_fsm_error;
+        }
+        assert(r->snapshot.serialize.data == NULL);
+        r->snapshot.serialize.data = r;
+        rv = r->fsm->snapshot_serialize(r->fsm, &r->snapshot.serialize,
+                                        &snapshot->bufs, &snapshot->n_bufs,
+                                        takeSnapshotSerializeCb);
+        if (rv != 0) {
+            r->snapshot.serialize.data = NULL;
+            goto abort_after_fsm_error;
+        }
+        return 0;
+    }
+
     rv = r->fsm->snapshot(r->fsm, &snapshot->bufs, &snapshot->n_bufs);
     if (rv != 0) {
-        /* Ignore transient errors. We'll retry next time. */
-        if (rv == RAFT_BUSY) {
-            rv = 0;
-        }
-        goto abort_after_config_copy;
+        goto abort_after_fsm_error;
     }
 
-    assert(r->snapshot.put.data == NULL);
-    r->snapshot.put.data = r;
-    rv = r->io->snapshot_put(r->io, r->snapshot.trailing, &r->snapshot.put,
-                             snapshot, takeSnapshotCb);
+    rv = takeSnapshotPut(r);
     if (rv != 0) {
-        goto abort_after_fsm_snapshot;
+        takeSnapshotAbort(r, true);
+        return rv;
     }
 
     return 0;
 
-abort_after_fsm_snapshot:
-    for (i = 0; i < snapshot->n_bufs; i++) {
-        raft_free(snapshot->bufs[i].base);
+abort_after_fsm_error:
+    /* Ignore transient errors. We'll retry next time. */
+    if (rv == RAFT_BUSY) {
+        rv = 0;
     }
-    raft_free(snapshot->bufs);
-abort_after_config_copy:
-    raft_configuration_close(&snapshot->configuration);
+    takeSnapshotAbort(r, false);
+    return rv;
 abort:
     r->snapshot.pending.term = 0;
     return rv;
 }
 
+/* Whether the FSM applies commands asynchronously in batches. */
+static bool fsmHasApplyBatch(struct raft *r)
+{
+    return r->fsm->version >= 2 && r->fsm->apply_batch != NULL;
+}
+
+/* Release the resources of the batch of commands submitted to the FSM. */
+static void applyBatchReset(struct raft *r)
+{
+    logRelease(&r->log, r->apply.entries, r->apply.n_entries);
+    raft_free(r->apply.bufs);
+    raft_free(r->apply.results);
+    r->apply.index = 0;
+    r->apply.n = 0;
+    r->apply.entries = NULL;
+    r->apply.n_entries = 0;
+    r->apply.bufs = NULL;
+    r->apply.results = NULL;
+}
+
+static void applyBatchCb(struct raft_fsm_apply *req, int status)
+{
+    struct raft *r = req->data;
+    raft_io_close_cb close_cb;
+    unsigned i;
+    int rv;
+
+    assert(r->apply.n > 0);
+
+    if (status != 0) {
+        tracef("apply batch at %lld: %s", r->apply.index,
+               raft_strerror(status));
+    } else if (r->state != RAFT_UNAVAILABLE) {
+        for (i = 0; i < r->apply.n; i++) {
+            raft_index index = r->apply.index + i;
+            struct raft_apply *apply;
+            apply = (struct raft_apply *)getRequest(r, index, RAFT_COMMAND);
+            if (apply != NULL && apply->cb != NULL) {
+                apply->cb(apply, 0, r->apply.results[i]);
+            }
+            r->last_applied = index;
+        }
+    }
+
+    applyBatchReset(r);
+
+    /* If we are closing, finish now. */
+    if (r->state == RAFT_UNAVAILABLE) {
+        close_cb = r->apply.close_cb;
+        if (close_cb != NULL) {
+            r->apply.close_cb = NULL;
+            close_cb(r->io);
+        }
+        return;
+    }
+
+    /* Serve the read requests that were waiting for this batch. */
+    if (status == 0 &&
+        (r->state == RAFT_LEADER || r->state == RAFT_FOLLOWER)) {
+        readIndexAdvance(r);
+    }
+
+    /* Install the snapshot that the leader sent while the batch was being
+     * applied, if any. The commands it covers don't need to be applied. */
+    if (r->state == RAFT_FOLLOWER && r->follower_state.install != NULL) {
+        rv = recvInstallSnapshotResume(r);
+        if (rv != 0) {
+            tracef("install deferred snapshot: %s", raft_strerror(rv));
+            convertToUnavailable(r);
+        }
+        return;
+    }
+
+    /* Apply whatever was committed in the meantime, or take a snapshot if
+     * everything has been applied and the threshold is reached. If the batch
+     * failed, it will be submitted again at the next tick. */
+    if (status == 0 &&
+        (r->state == RAFT_LEADER || r->state == RAFT_FOLLOWER)) {
+        rv = replicationApply(r);
+        if (rv == 0 && r->apply.n == 0 && shouldTakeSnapshot(r)) {
+            rv = takeSnapshot(r);
+        }
+        if (rv != 0) {
+            tracef("apply committed entries: %s", raft_strerror(rv));
+            convertToUnavailable(r);
+        }
+    }
+}
+
+/* Submit to the FSM a batch with the consecutive committed RAFT_COMMAND entries
+ * starting at the given index. */
+static int applyCommandBatch(struct raft *r, const raft_index index)
+{
+    struct raft_entry *entries;
+    unsigned n_entries;
+    unsigned n;
+    unsigned i;
+    int rv;
+
+    assert(r->apply.n == 0);
+
+    rv = logAcquire(&r->log, index, &entries, &n_entries);
+    if (rv != 0) {
+        goto err;
+    }
+
+    n = 0;
+    while (n < n_entries && index + n <= r->commit_index &&
+           entries[n].type == RAFT_COMMAND) {
+        n++;
+    }
+    assert(n > 0);
+
+    r->apply.bufs = raft_malloc(n * sizeof *r->apply.bufs);
+    if (r->apply.bufs == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_acquire;
+    }
+    r->apply.results = raft_malloc(n * sizeof *r->apply.results);
+    if (r->apply.results == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_bufs_alloc;
+    }
+    for (i = 0; i < n; i++) {
+        r->apply.bufs[i] = entries[i].buf;
+        r->apply.results[i] = NULL;
+    }
+
+    /* The callback might fire right away, so fill the batch first. */
+    r->apply.req.data = r;
+    r->apply.index = index;
+    r->apply.n = n;
+    r->apply.entries = entries;
+    r->apply.n_entries = n_entries;
+
+    rv = r->fsm->apply_batch(r->fsm, &r->apply.req, index, r->apply.bufs,
+                             r->apply.results, n, applyBatchCb);
+    if (rv != 0) {
+        applyBatchReset(r);
+        goto err;
+    }
+
+    return 0;
+
+err_after_bufs_alloc:
+    raft_free(r->apply.bufs);
+    r->apply.bufs = NULL;
+err_after_acquire:
+    logRelease(&r->log, entries, n_entries);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
 int replicationApply(struct raft *r)
 {
     raft_index index;
@@ -1470,6 +2850,12 @@ int replicationApply(struct raft *r)
         return 0;
     }
 
+    /* If the FSM is still applying a batch of commands, we'll resume once
+     * it's done. */
+    if (r->apply.n > 0) {
+        return 0;
+    }
+
     for (index = r->last_applied + 1; index <= r->commit_index; index++) {
         const struct raft_entry *entry = logGet(&r->log, index);
 
@@ -1478,6 +2864,15 @@ int replicationApply(struct raft *r)
 
         switch (entry->type) {
             case RAFT_COMMAND:
+                if (fsmHasApplyBatch(r)) {
+                    /* The rest of the entries will be applied when the FSM
+                     * completes the batch. */
+                    rv = applyCommandBatch(r, index);
+                    if (rv == 0) {
+                        return 0;
+                    }
+                    break;
+                }
                 rv = applyCommand(r, index, &entry->buf);
                 break;
             case RAFT_BARRIER:
@@ -1500,6 +2895,16 @@ int replicationApply(struct raft *r)
         r->last_applied = index;
     }
 
+    if (r->state == RAFT_LEADER || r->state == RAFT_FOLLOWER) {
+        readIndexAdvance(r);
+    }
+
+    /* Entries that have been both persisted and applied are not needed in
+     * memory anymore, if they can be read back from disk. */
+    if (r->io->version >= 4 && r->io->read != NULL) {
+        logEvict(&r->log, min(r->last_applied, r->last_stored));
+    }
+
     if (shouldTakeSnapshot(r)) {
         rv = takeSnapshot(r);
     }
@@ -1509,9 +2914,6 @@ int replicationApply(struct raft *r)
 
 void replicationQuorum(struct raft *r, const raft_index index)
 {
-    size_t votes = 0;
-    size_t i;
-
     assert(r->state == RAFT_LEADER);
 
     if (index <= r->commit_index) {
@@ -1526,17 +2928,7 @@ void replicationQuorum(struct raft *r, const raft_index index)
     // assert(logTermOf(&r->log, index) > 0);
     assert(logTermOf(&r->log, index) <= r->current_term);
 
-    for (i = 0; i < r->configuration.n; i++) {
-        struct raft_server *server = &r->configuration.servers[i];
-        if (server->role != RAFT_VOTER) {
-            continue;
-        }
-        if (r->leader_state.progress[i].match_index >= index) {
-            votes++;
-        }
-    }
-
-    if (votes > configurationVoterCount(&r->configuration) / 2) {
+    if (progressQuorumIndex(r) >= index) {
         r->commit_index = index;
         tracef("new commit index %llu", r->commit_index);
     }
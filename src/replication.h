@@ -9,11 +9,22 @@
  * was sent in the last heartbeat interval. */
 int replicationHeartbeat(struct raft *r);
 
+/* Send an AppendEntries RPC message right away to all voting followers that
+ * can take one, regardless of when the last one was sent, so that they
+ * acknowledge the current leadership confirmation round. */
+void replicationSendRound(struct raft *r);
+
 /* Start a local disk write for entries from the given index onwards, and
  * trigger replication against all followers, typically sending AppendEntries
- * RPC messages with outstanding log entries. */
+ * RPC messages with outstanding log entries. With group commit enabled, both
+ * are deferred and done at once for all entries appended in the meantime. */
 int replicationTrigger(struct raft *r, raft_index index);
 
+/* Submit the disk write of new entries whose submission was deferred by group
+ * commit, without sending them to followers, or just drop them if @persist is
+ * false. Invoked when the leader steps down. */
+void replicationFlushDeferred(struct raft *r, bool persist);
+
 /* Possibly send an AppendEntries or an InstallSnapshot RPC message to the
  * server with the given index.
  *
@@ -53,6 +64,15 @@ int replicationUpdate(struct raft *r,
                       const struct raft_server *server,
                       const struct raft_append_entries_result *result);
 
+/* Update the progress of a snapshot being sent in chunks to the given server
+ * using the given InstallSnapshot RPC result, possibly sending the next chunk.
+ *
+ * It must be called only by leaders. */
+int replicationUpdateSnapshot(
+    struct raft *r,
+    const struct raft_server *server,
+    const struct raft_install_snapshot_result *result);
+
 /* Append the log entries in the given request if the Log Matching Property is
  * satisfied.
  *
@@ -71,6 +91,33 @@ int replicationAppend(struct raft *r,
                       raft_index *rejected,
                       bool *async);
 
+/* Buffer in memory a chunk of a snapshot that the leader is sending in multiple
+ * InstallSnapshot messages, or write it to disk if the I/O implementation
+ * supports it.
+ *
+ * If the install output parameter is set to true, @args should be passed to
+ * replicationInstallSnapshot(): it has been updated to hold the whole snapshot
+ * data if this was the last chunk, or left untouched if we already have the
+ * snapshot. If the async output parameter is set to true, the chunk data and
+ * the configuration have been consumed and the leader will be told the outcome
+ * once the chunk is written, or never if it was dropped because another one is
+ * being written. Otherwise the chunk data has been consumed and the offset
+ * output parameter is set to the amount of data received so far, which should
+ * be reported back to the leader.
+ *
+ * It must be called only by followers. */
+void replicationSnapshotChunk(struct raft *r,
+                              struct raft_install_snapshot *args,
+                              bool *install,
+                              bool *async,
+                              size_t *offset);
+
+/* Tell the current leader how much data we have received of the snapshot with
+ * the given last index that it is sending in chunks. */
+int replicationSendSnapshotResult(struct raft *r,
+                                  raft_index last_index,
+                                  size_t offset);
+
 int replicationInstallSnapshot(struct raft *r,
                                const struct raft_install_snapshot *args,
                                raft_index *rejected,
@@ -33,6 +33,7 @@ static int restoreMostRecentConfiguration(struct raft *r,
     raft_configuration_close(&r->configuration);
     r->configuration = configuration;
     r->configuration_index = index;
+    configurationHashRebuild(r);
     return 0;
 }
 
@@ -110,7 +111,7 @@ static int maybeSelfElect(struct raft *r)
 {
     const struct raft_server *server;
     int rv;
-    server = configurationGet(&r->configuration, r->id);
+    server = configurationHashGet(r, r->id);
     if (server == NULL || server->role != RAFT_VOTER ||
         configurationVoterCount(&r->configuration) > 1) {
         return 0;
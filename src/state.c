@@ -42,3 +42,8 @@ raft_index raft_last_applied(struct raft *r)
 {
     return r->last_applied;
 }
+
+unsigned long long raft_lease_expirations(struct raft *r)
+{
+    return r->lease.n_expired;
+}
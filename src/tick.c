@@ -5,6 +5,7 @@
 #include "election.h"
 #include "membership.h"
 #include "progress.h"
+#include "read_index.h"
 #include "replication.h"
 #include "tracing.h"
 
@@ -24,7 +25,10 @@ static int tickFollower(struct raft *r)
     assert(r != NULL);
     assert(r->state == RAFT_FOLLOWER);
 
-    server = configurationGet(&r->configuration, r->id);
+    server = configurationHashGet(r, r->id);
+
+    /* Possibly retry forwarding read requests to the leader. */
+    readIndexTickForward(r);
 
     /* If we have been removed from the configuration, or maybe we didn't
      * receive one yet, just stay follower. */
@@ -129,6 +133,10 @@ static int tickLeader(struct raft *r)
         r->election_timer_start = r->io->time(r->io);
     }
 
+    /* Possibly renew the leader lease. This goes first, since the messages of
+     * a new confirmation round also count as heartbeats. */
+    readIndexTickLease(r);
+
     /* Possibly send heartbeats.
      *
      * From Figure 3.1:
@@ -138,6 +146,10 @@ static int tickLeader(struct raft *r)
      */
     replicationHeartbeat(r);
 
+    /* Serve read requests whose round was acknowledged right away, for example
+     * because we are the only voter. */
+    readIndexAdvance(r);
+
     /* If a server is being promoted, increment the timer of the current
      * round or abort the promotion.
      *
@@ -160,7 +172,7 @@ static int tickLeader(struct raft *r)
         /* If a promotion is in progress, we expect that our configuration
          * contains an entry for the server being promoted, and that the server
          * is not yet considered as voting. */
-        server_index = configurationIndexOf(&r->configuration, id);
+        server_index = configurationHashIndexOf(r, id);
         assert(server_index < r->configuration.n);
         assert(r->configuration.servers[server_index].role != RAFT_VOTER);
 
@@ -190,6 +202,21 @@ static int tickLeader(struct raft *r)
     return 0;
 }
 
+/* Submit again the committed commands that the FSM failed to apply, if any.
+ * Nothing is submitted while a batch is in flight or a snapshot is being
+ * stored. */
+static int tickApply(struct raft *r)
+{
+    if (r->state != RAFT_FOLLOWER && r->state != RAFT_LEADER) {
+        return 0;
+    }
+    if (r->last_applied == r->commit_index || r->apply.n > 0 ||
+        r->snapshot.put.data != NULL) {
+        return 0;
+    }
+    return replicationApply(r);
+}
+
 static int tick(struct raft *r)
 {
     int rv = -1;
@@ -202,6 +229,11 @@ static int tick(struct raft *r)
         return 0;
     }
 
+    rv = tickApply(r);
+    if (rv != 0) {
+        return rv;
+    }
+
     switch (r->state) {
         case RAFT_FOLLOWER:
             rv = tickFollower(r);
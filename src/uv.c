@@ -10,6 +10,7 @@
 #include "../include/raft.h"
 #include "assert.h"
 #include "byte.h"
+#include "compress.h"
 #include "configuration.h"
 #include "entry.h"
 #include "heap.h"
@@ -31,6 +32,9 @@
  * TODO: implement an exponential backoff instead.  */
 #define CONNECT_RETRY_DELAY 1000
 
+/* Default minimum size of AppendEntries payloads to compress. */
+#define COMPRESSION_THRESHOLD 4096
+
 /* Implementation of raft_io->config. */
 static int uvInit(struct raft_io *io, raft_id id, const char *address)
 {
@@ -47,7 +51,8 @@ static int uvInit(struct raft_io *io, raft_id id, const char *address)
     }
 
     /* Proble file system capabilities */
-    rv = UvFsProbeCapabilities(uv->dir, &direct_io, &uv->async_io, io->errmsg);
+    rv = UvFsProbeCapabilities(uv->dir, &direct_io, &uv->async_io,
+                               &uv->uring_io, io->errmsg);
     if (rv != 0) {
         return rv;
     }
@@ -60,17 +65,34 @@ static int uvInit(struct raft_io *io, raft_id id, const char *address)
     }
     uv->metadata = metadata;
 
-    rv = uv->transport->init(uv->transport, id, address);
-    if (rv != 0) {
-        ErrMsgTransfer(uv->transport->errmsg, io->errmsg, "transport");
-        return rv;
+    /* Groups attached to a host share its transport. */
+    if (uv->host != NULL) {
+        if (id != uv->host->id) {
+            ErrMsgPrintf(io->errmsg, "server ID %llu doesn't match host %llu",
+                         id, uv->host->id);
+            return RAFT_INVALID;
+        }
+    } else {
+        rv = uv->transport->init(uv->transport, id, address);
+        if (rv != 0) {
+            ErrMsgTransfer(uv->transport->errmsg, io->errmsg, "transport");
+            return rv;
+        }
+        uv->transport->data = uv;
     }
-    uv->transport->data = uv;
 
     rv = uv_timer_init(uv->loop, &uv->timer);
     assert(rv == 0); /* This should never fail */
     uv->timer.data = uv;
 
+    rv = uv_idle_init(uv->loop, &uv->defer_idle);
+    assert(rv == 0); /* This should never fail */
+    uv->defer_idle.data = uv;
+
+    rv = uv_timer_init(uv->loop, &uv->defer_timer);
+    assert(rv == 0); /* This should never fail */
+    uv->defer_timer.data = uv;
+
     return 0;
 }
 
@@ -96,6 +118,9 @@ static int uvStart(struct raft_io *io,
     uv->state = UV__ACTIVE;
     uv->tick_cb = tick_cb;
     uv->recv_cb = recv_cb;
+    if (uv->host != NULL) {
+        return UvHostAttach(uv, msecs);
+    }
     rv = UvRecvStart(uv);
     if (rv != 0) {
         return rv;
@@ -105,18 +130,75 @@ static int uvStart(struct raft_io *io,
     return 0;
 }
 
+/* Fire the callback of the pending deferred request. */
+static void uvDeferFire(struct uv *uv, int status)
+{
+    struct raft_io_defer *req = uv->defer;
+    assert(req != NULL);
+    uv->defer = NULL;
+    req->cb(req, status);
+}
+
+static void uvDeferIdleCb(uv_idle_t *idle)
+{
+    struct uv *uv = idle->data;
+    int rv;
+    rv = uv_idle_stop(idle);
+    assert(rv == 0);
+    uvDeferFire(uv, 0);
+}
+
+static void uvDeferTimerCb(uv_timer_t *timer)
+{
+    struct uv *uv = timer->data;
+    uvDeferFire(uv, 0);
+}
+
+/* Implementation of raft_io->defer.
+ *
+ * Idle handles run before the loop polls for I/O, like the prepare handles
+ * used to flush batches of outbound messages, so messages sent by the callback
+ * still go out in the same iteration. Timers have millisecond resolution. */
+static int uvDefer(struct raft_io *io,
+                   struct raft_io_defer *req,
+                   unsigned usecs,
+                   raft_io_defer_cb cb)
+{
+    struct uv *uv;
+    int rv;
+    uv = io->impl;
+    assert(!uv->closing);
+    assert(uv->defer == NULL);
+    req->cb = cb;
+    if (usecs == 0) {
+        rv = uv_idle_start(&uv->defer_idle, uvDeferIdleCb);
+    } else {
+        rv = uv_timer_start(&uv->defer_timer, uvDeferTimerCb,
+                            (usecs + 999) / 1000, 0);
+    }
+    assert(rv == 0);
+    uv->defer = req;
+    return 0;
+}
+
 void uvMaybeFireCloseCb(struct uv *uv)
 {
     if (!uv->closing) {
         return;
     }
 
-    if (uv->transport->data != NULL) {
+    if (uv->host == NULL && uv->transport->data != NULL) {
+        return;
+    }
+    if (uv->host_sends > 0 || uv->wal_writes > 0) {
         return;
     }
     if (uv->timer.data != NULL) {
         return;
     }
+    if (uv->defer_idle.data != NULL || uv->defer_timer.data != NULL) {
+        return;
+    }
     if (!QUEUE_IS_EMPTY(&uv->append_segments)) {
         return;
     }
@@ -132,12 +214,24 @@ void uvMaybeFireCloseCb(struct uv *uv)
     if (uv->barrier != NULL) {
         return;
     }
+    if (uv->metadata_inflight != NULL || uv->metadata_idle.data != NULL) {
+        return;
+    }
     if (uv->snapshot_put_work.data != NULL) {
         return;
     }
     if (!QUEUE_IS_EMPTY(&uv->snapshot_get_reqs)) {
         return;
     }
+    if (!QUEUE_IS_EMPTY(&uv->read_reqs)) {
+        return;
+    }
+    if (!QUEUE_IS_EMPTY(&uv->snapshot_read_reqs)) {
+        return;
+    }
+    if (uv->snapshot_write != NULL) {
+        return;
+    }
     if (!QUEUE_IS_EMPTY(&uv->aborting)) {
         return;
     }
@@ -157,6 +251,14 @@ static void uvTickTimerCloseCb(uv_handle_t *handle)
     uvMaybeFireCloseCb(uv);
 }
 
+static void uvDeferCloseCb(uv_handle_t *handle)
+{
+    struct uv *uv = handle->data;
+    assert(uv->closing);
+    handle->data = NULL;
+    uvMaybeFireCloseCb(uv);
+}
+
 static void uvTransportCloseCb(struct raft_uv_transport *transport)
 {
     struct uv *uv = transport->data;
@@ -171,17 +273,30 @@ static void uvClose(struct raft_io *io, raft_io_close_cb cb)
     struct uv *uv;
     uv = io->impl;
     assert(!uv->closing);
+    /* Detach from the host before flagging the instance as closing, since
+     * the callbacks of canceled send requests fire synchronously. */
+    if (uv->host != NULL) {
+        UvHostDetach(uv);
+    }
     uv->close_cb = cb;
     uv->closing = true;
     UvSendClose(uv);
     UvRecvClose(uv);
     uvAppendClose(uv);
-    if (uv->transport->data != NULL) {
+    if (uv->host == NULL && uv->transport->data != NULL) {
         uv->transport->close(uv->transport, uvTransportCloseCb);
     }
     if (uv->timer.data != NULL) {
         uv_close((uv_handle_t *)&uv->timer, uvTickTimerCloseCb);
     }
+    if (uv->defer != NULL) {
+        uvDeferFire(uv, RAFT_CANCELED);
+    }
+    if (uv->defer_idle.data != NULL) {
+        uv_close((uv_handle_t *)&uv->defer_idle, uvDeferCloseCb);
+        uv_close((uv_handle_t *)&uv->defer_timer, uvDeferCloseCb);
+    }
+    uvMetadataClose(uv);
     uvMaybeFireCloseCb(uv);
 }
 
@@ -348,6 +463,19 @@ static int uvLoadSnapshotAndEntries(struct uv *uv,
         }
     }
 
+    /* Groups using the shared write-ahead log of their host have no
+     * segments. */
+    if (uv->wal != NULL) {
+        if (segments != NULL) {
+            raft_free(segments);
+            segments = NULL;
+        }
+        rv = UvWalLoad(uv, *snapshot, start_index, entries, n);
+        if (rv != 0) {
+            goto err;
+        }
+    }
+
     /* Read data from segments, closing any open segments. */
     if (segments != NULL) {
         raft_index last_index;
@@ -464,6 +592,32 @@ static int uvSetVote(struct raft_io *io, const raft_id server_id)
     return 0;
 }
 
+/* Implementation of raft_io->async_set_term. */
+static int uvAsyncSetTerm(struct raft_io *io,
+                          struct raft_io_set_meta *req,
+                          const raft_term term,
+                          raft_io_set_meta_cb cb)
+{
+    struct uv *uv;
+    uv = io->impl;
+    /* The version gets bumped when the write actually starts. */
+    uv->metadata.term = term;
+    uv->metadata.voted_for = 0;
+    return uvMetadataSubmit(uv, req, cb);
+}
+
+/* Implementation of raft_io->async_set_vote. */
+static int uvAsyncSetVote(struct raft_io *io,
+                          struct raft_io_set_meta *req,
+                          const raft_id server_id,
+                          raft_io_set_meta_cb cb)
+{
+    struct uv *uv;
+    uv = io->impl;
+    uv->metadata.voted_for = server_id;
+    return uvMetadataSubmit(uv, req, cb);
+}
+
 /* Implementation of raft_io->bootstrap. */
 static int uvBootstrap(struct raft_io *io,
                        const struct raft_configuration *configuration)
@@ -546,7 +700,9 @@ static int uvRandom(struct raft_io *io, int min, int max)
     return min + (abs(rand()) % (max - min));
 }
 
-int raft_uv_init(struct raft_io *io,
+/* Allocate and initialize the uv object of the given raft_io instance, which
+ * uses the given transport. */
+static int uvNew(struct raft_io *io,
                  struct uv_loop_s *loop,
                  const char *dir,
                  struct raft_uv_transport *transport)
@@ -582,18 +738,30 @@ int raft_uv_init(struct raft_io *io,
     uv->loop = loop;
     strcpy(uv->dir, dir);
     uv->transport = transport;
-    uv->transport->data = NULL;
     uv->tracer = &NoopTracer;
     uv->id = 0; /* Set by raft_io->config() */
     uv->state = UV__PRISTINE;
     uv->errored = false;
     uv->direct_io = false;
     uv->async_io = false;
+    uv->uring_io = false;
     uv->segment_size = UV__MAX_SEGMENT_SIZE;
     uv->block_size = 0;
+    uv->max_concurrent_writes = 1;
     QUEUE_INIT(&uv->clients);
     QUEUE_INIT(&uv->servers);
     uv->connect_retry_delay = CONNECT_RETRY_DELAY;
+    uv->send_batching = false;
+    uv->snapshot_compression = COMPRESSION_NONE;
+    uv->message_compression = false;
+    uv->compression_threshold = COMPRESSION_THRESHOLD;
+    uv->bytes_saved = 0;
+    uv->host = NULL;
+    uv->group = 0;
+    uv->host_sends = 0;
+    uv->group_recv_cb = NULL;
+    uv->wal = NULL;
+    uv->wal_writes = 0;
     uv->prepare_inflight = NULL;
     QUEUE_INIT(&uv->prepare_reqs);
     QUEUE_INIT(&uv->prepare_pool);
@@ -602,21 +770,31 @@ int raft_uv_init(struct raft_io *io,
     QUEUE_INIT(&uv->append_segments);
     QUEUE_INIT(&uv->append_pending_reqs);
     QUEUE_INIT(&uv->append_writing_reqs);
+    QUEUE_INIT(&uv->append_writes);
     uv->barrier = NULL;
     QUEUE_INIT(&uv->finalize_reqs);
     uv->finalize_work.data = NULL;
     uv->truncate_work.data = NULL;
     QUEUE_INIT(&uv->snapshot_get_reqs);
+    QUEUE_INIT(&uv->read_reqs);
+    QUEUE_INIT(&uv->snapshot_read_reqs);
+    uv->snapshot_write = NULL;
     uv->snapshot_put_work.data = NULL;
+    QUEUE_INIT(&uv->metadata_reqs);
+    uv->metadata_inflight = NULL;
+    uv->metadata_idle.data = NULL;
     uv->timer.data = NULL;
     uv->tick_cb = NULL; /* Set by raft_io->start() */
+    uv->defer_idle.data = NULL;
+    uv->defer_timer.data = NULL;
+    uv->defer = NULL;
     uv->recv_cb = NULL; /* Set by raft_io->start() */
     QUEUE_INIT(&uv->aborting);
     uv->closing = false;
     uv->close_cb = NULL;
 
     /* Set the raft_io implementation. */
-    io->version = 1; /* future-proof'ing */
+    io->version = 5; /* future-proof'ing */
     io->impl = uv;
     io->init = uvInit;
     io->close = uvClose;
@@ -633,6 +811,12 @@ int raft_uv_init(struct raft_io *io,
     io->snapshot_get = UvSnapshotGet;
     io->time = uvTime;
     io->random = uvRandom;
+    io->defer = uvDefer;
+    io->async_set_term = uvAsyncSetTerm;
+    io->async_set_vote = uvAsyncSetVote;
+    io->read = UvRead;
+    io->snapshot_read = UvSnapshotRead;
+    io->snapshot_write = UvSnapshotWrite;
 
     return 0;
 
@@ -644,6 +828,55 @@ err:
     return rv;
 }
 
+int raft_uv_init(struct raft_io *io,
+                 struct uv_loop_s *loop,
+                 const char *dir,
+                 struct raft_uv_transport *transport)
+{
+    int rv;
+    rv = uvNew(io, loop, dir, transport);
+    if (rv != 0) {
+        return rv;
+    }
+    transport->data = NULL;
+    return 0;
+}
+
+int raft_uv_init_group(struct raft_io *io,
+                       struct raft_uv_host *host,
+                       const char *dir,
+                       unsigned long long group)
+{
+    struct UvHost *h;
+    struct uv *uv;
+    int rv;
+
+    assert(host != NULL);
+    assert(host->impl != NULL);
+    h = host->impl;
+
+    if (group == 0 || group >= (1ULL << (64 - UV__GROUP_SHIFT))) {
+        ErrMsgPrintf(io->errmsg, "invalid group ID %llu", group);
+        return RAFT_INVALID;
+    }
+
+    rv = uvNew(io, h->loop, dir, h->transport);
+    if (rv != 0) {
+        return rv;
+    }
+    uv = io->impl;
+    uv->host = h;
+    uv->group = group;
+    uv->wal = h->wal;
+
+    /* Entries of groups sharing the host's log are not stored in segments. */
+    if (uv->wal != NULL) {
+        io->read = NULL;
+    }
+
+    return 0;
+}
+
 void raft_uv_close(struct raft_io *io)
 {
     struct uv *uv;
@@ -665,6 +898,14 @@ void raft_uv_set_block_size(struct raft_io *io, size_t size)
     uv->block_size = size;
 }
 
+void raft_uv_set_max_concurrent_writes(struct raft_io *io, unsigned n)
+{
+    struct uv *uv;
+    uv = io->impl;
+    assert(n > 0);
+    uv->max_concurrent_writes = n;
+}
+
 void raft_uv_set_connect_retry_delay(struct raft_io *io, unsigned msecs)
 {
     struct uv *uv;
@@ -672,6 +913,53 @@ void raft_uv_set_connect_retry_delay(struct raft_io *io, unsigned msecs)
     uv->connect_retry_delay = msecs;
 }
 
+void raft_uv_set_send_batching(struct raft_io *io, bool batching)
+{
+    struct uv *uv;
+    uv = io->impl;
+    uv->send_batching = batching;
+}
+
+int raft_uv_set_snapshot_compression(struct raft_io *io, bool compressed)
+{
+    struct uv *uv;
+    uv = io->impl;
+    if (!compressed) {
+        uv->snapshot_compression = COMPRESSION_NONE;
+        return 0;
+    }
+    if (!compressionIsAvailable(COMPRESSION_DEFLATE)) {
+        return RAFT_INVALID;
+    }
+    uv->snapshot_compression = COMPRESSION_DEFLATE;
+    return 0;
+}
+
+int raft_uv_set_message_compression(struct raft_io *io, bool enabled)
+{
+    struct uv *uv;
+    uv = io->impl;
+    if (enabled && !compressionIsAvailable(COMPRESSION_DEFLATE)) {
+        return RAFT_INVALID;
+    }
+    uv->message_compression = enabled;
+    return 0;
+}
+
+void raft_uv_set_message_compression_threshold(struct raft_io *io, size_t size)
+{
+    struct uv *uv;
+    uv = io->impl;
+    uv->compression_threshold = size;
+}
+
+unsigned long long raft_uv_message_compression_saved(struct raft_io *io)
+{
+    struct uv *uv;
+    uv = io->impl;
+    return uv->bytes_saved;
+}
+
 void raft_uv_set_tracer(struct raft_io *io, struct raft_tracer *tracer)
 {
     struct uv *uv;
@@ -4,6 +4,7 @@
 #define UV_H_
 
 #include "../include/raft.h"
+#include "../include/raft/uv.h"
 #include "err.h"
 #include "queue.h"
 #include "tracing.h"
@@ -13,6 +14,10 @@
 /* 8 Megabytes */
 #define UV__MAX_SEGMENT_SIZE (8 * 1024 * 1024)
 
+/* Maximum number of threads used to read and check closed segments at
+ * startup. */
+#define UV__MAX_SEGMENT_LOADERS 8
+
 /* Template string for closed segment filenames: start index (inclusive), end
  * index (inclusive). */
 #define UV__CLOSED_TEMPLATE "%016llu-%016llu"
@@ -31,6 +36,10 @@
  * index, creation timestamp (milliseconds since epoch). */
 #define UV__SNAPSHOT_META_TEMPLATE UV__SNAPSHOT_TEMPLATE ".meta"
 
+/* Filename of the data of a snapshot being received in chunks, which gets
+ * renamed after the snapshot template once the last chunk is written. */
+#define UV__SNAPSHOT_PARTIAL "snapshot-partial"
+
 /* State codes. */
 enum {
     UV__PRISTINE, /* Metadata cache populated and I/O capabilities probed */
@@ -49,6 +58,15 @@ struct uvMetadata
     raft_id voted_for;          /* Server ID of last vote, or 0 */
 };
 
+struct uv;
+struct UvHost;
+
+/* Invoked by the network instance of a host for messages tagged with a group
+ * ID. */
+typedef void (*uvGroupRecvCb)(struct uv *uv,
+                              unsigned long long group,
+                              struct raft_message *message);
+
 /* Hold state of a libuv-based raft_io implementation. */
 struct uv
 {
@@ -62,11 +80,24 @@ struct uv
     bool errored;                        /* If a disk I/O error was hit */
     bool direct_io;                      /* Whether direct I/O is supported */
     bool async_io;                       /* Whether async I/O is supported */
+    bool uring_io;                       /* Whether io_uring is supported */
     size_t segment_size;                 /* Initial size of open segments. */
     size_t block_size;                   /* Block size of the data dir */
+    unsigned max_concurrent_writes;      /* Writes in flight per segment */
     queue clients;                       /* Outbound connections */
     queue servers;                       /* Inbound connections */
     unsigned connect_retry_delay;        /* Client connection retry delay */
+    bool send_batching;                  /* Coalesce outbound messages */
+    unsigned snapshot_compression;       /* Codec for snapshot data */
+    bool message_compression;            /* Compress AppendEntries payloads */
+    size_t compression_threshold;        /* Minimum payload to compress */
+    unsigned long long bytes_saved;      /* Saved by compressing payloads */
+    struct UvHost *host;                 /* Host we're attached to, if any */
+    unsigned long long group;            /* Group ID if attached, or 0 */
+    unsigned host_sends;                 /* Sends submitted to the host */
+    uvGroupRecvCb group_recv_cb;         /* Dispatch tagged messages */
+    struct UvWal *wal;                   /* Shared log of the host, if any */
+    unsigned wal_writes;                 /* Requests submitted to the log */
     void *prepare_inflight;              /* Segment being prepared */
     queue prepare_reqs;                  /* Pending prepare requests. */
     queue prepare_pool;                  /* Prepared open segments */
@@ -75,16 +106,26 @@ struct uv
     queue append_segments;               /* Open segments in use. */
     queue append_pending_reqs;           /* Pending append requests. */
     queue append_writing_reqs;           /* Append requests in flight */
+    queue append_writes;                 /* Writes in flight, in order */
     struct UvBarrier *barrier;           /* Inflight barrier request */
     queue finalize_reqs;                 /* Segments waiting to be closed */
     struct uv_work_s finalize_work;      /* Resize and rename segments */
     struct uv_work_s truncate_work;      /* Execute truncate log requests */
     queue snapshot_get_reqs;             /* Inflight get snapshot requests */
+    queue read_reqs;                     /* Inflight read entries requests */
+    queue snapshot_read_reqs;            /* Inflight snapshot chunk reads */
+    void *snapshot_write;                /* Inflight snapshot chunk write */
     struct uv_work_s snapshot_put_work;  /* Execute snapshot put requests */
     struct uvMetadata metadata;          /* Cache of metadata on disk */
+    queue metadata_reqs;                 /* Pending async metadata updates */
+    void *metadata_inflight;             /* Metadata write in flight */
+    struct uv_prepare_s metadata_idle;   /* Coalesce metadata updates */
     struct uv_timer_s timer;             /* Timer for periodic ticks */
     raft_io_tick_cb tick_cb;             /* Invoked when the timer expires */
     raft_io_recv_cb recv_cb;             /* Invoked when upon RPC messages */
+    struct uv_idle_s defer_idle;         /* Run deferred request right away */
+    struct uv_timer_s defer_timer;       /* Run deferred request later */
+    struct raft_io_defer *defer;         /* Pending deferred request */
     queue aborting;                      /* Cleanups upon errors or shutdown */
     bool closing;                        /* True if we are closing */
     raft_io_close_cb close_cb;           /* Invoked when finishing closing */
@@ -102,6 +143,16 @@ int uvMetadataLoad(const char *dir, struct uvMetadata *metadata, char *errmsg);
  * otherwise write metadata2). */
 int uvMetadataStore(struct uv *uv, const struct uvMetadata *metadata);
 
+/* Submit a request to asynchronously store the cached metadata. All requests
+ * submitted during the same loop iteration are covered by a single write in
+ * the threadpool, and at most one write is in flight at any time. */
+int uvMetadataSubmit(struct uv *uv,
+                     struct raft_io_set_meta *req,
+                     raft_io_set_meta_cb cb);
+
+/* Cancel all metadata requests that are not in flight yet. */
+void uvMetadataClose(struct uv *uv);
+
 /* Metadata about a segment file. */
 struct uvSegmentInfo
 {
@@ -142,11 +193,13 @@ int uvSegmentKeepTrailing(struct uv *uv,
                           size_t trailing,
                           char *errmsg);
 
-/* Load all entries contained in the given closed segment. */
+/* Load all entries contained in the given closed segment. Safe to call from a
+ * worker thread, as long as @errmsg is not shared. */
 int uvSegmentLoadClosed(struct uv *uv,
                         struct uvSegmentInfo *segment,
                         struct raft_entry *entries[],
-                        size_t *n);
+                        size_t *n,
+                        char *errmsg);
 
 /* Load raft entries from the given segments. The @start_index is the expected
  * index of the first entry of the first segment. */
@@ -177,9 +230,9 @@ void uvSegmentBufferInit(struct uvSegmentBuffer *b, size_t block_size);
 /* Release all memory used by the buffer. */
 void uvSegmentBufferClose(struct uvSegmentBuffer *b);
 
-/* Encode the format version at the very beginning of the buffer. This function
- * must be called when the buffer is empty. */
-int uvSegmentBufferFormat(struct uvSegmentBuffer *b);
+/* Encode the given format version at the very beginning of the buffer. This
+ * function must be called when the buffer is empty. */
+int uvSegmentBufferFormat(struct uvSegmentBuffer *b, uint64_t format);
 
 /* Extend the segment's buffer by encoding the given entries.
  *
@@ -189,6 +242,14 @@ int uvSegmentBufferAppend(struct uvSegmentBuffer *b,
                           const struct raft_entry entries[],
                           unsigned n_entries);
 
+/* Size of the smallest padding record. */
+#define UV__SEGMENT_PADDING_MIN 24
+
+/* Fill the unused memory of the last block of the buffer with a padding record,
+ * so that the next write can start at the following block. A whole extra block
+ * is used if there is no room for the record. */
+int uvSegmentBufferPad(struct uvSegmentBuffer *b);
+
 /* After all entries to write have been encoded, finalize the buffer by zeroing
  * the unused memory of the last block. The out parameter will point to the
  * memory to write. */
@@ -261,6 +322,29 @@ int UvSnapshotGet(struct raft_io *io,
                   struct raft_io_snapshot_get *req,
                   raft_io_snapshot_get_cb cb);
 
+/* Implementation of raft_io->snapshot_read (defined in uv_snapshot.c). */
+int UvSnapshotRead(struct raft_io *io,
+                   struct raft_io_snapshot_read *req,
+                   size_t offset,
+                   size_t len,
+                   raft_io_snapshot_read_cb cb);
+
+/* Implementation of raft_io->snapshot_write (defined in uv_snapshot.c). */
+int UvSnapshotWrite(struct raft_io *io,
+                    struct raft_io_snapshot_write *req,
+                    const struct raft_snapshot *snapshot,
+                    size_t offset,
+                    const struct raft_buffer *chunk,
+                    bool done,
+                    raft_io_snapshot_write_cb cb);
+
+/* Implementation of raft_io->read (defined in uv_read.c). */
+int UvRead(struct raft_io *io,
+           struct raft_io_read *req,
+           raft_index index,
+           unsigned n,
+           raft_io_read_cb cb);
+
 /* Return a list of all snapshots and segments found in the data directory. Both
  * snapshots and segments are ordered by filename (closed segments come before
  * open ones). */
@@ -361,6 +445,17 @@ int UvSend(struct raft_io *io,
            const struct raft_message *message,
            raft_io_send_cb cb);
 
+/* Like UvSend, but tag the message with the given group ID, unless it's 0. */
+int UvSendGroup(struct uv *uv,
+                struct raft_io_send *req,
+                const struct raft_message *message,
+                unsigned long long group,
+                raft_io_send_cb cb);
+
+/* Fail with RAFT_CANCELED all send requests whose data field matches @data and
+ * that are still waiting for a connection to be established. */
+void UvSendCancel(struct uv *uv, const void *data);
+
 /* Stop all clients by closing the outbound stream handles and canceling all
  * pending send requests.  */
 void UvSendClose(struct uv *uv);
@@ -374,4 +469,86 @@ void UvRecvClose(struct uv *uv);
 
 void uvMaybeFireCloseCb(struct uv *uv);
 
+/* State of a host shared by several raft groups (defined in uv_host.c). */
+struct UvHost
+{
+    struct raft_uv_host *host;           /* Public object */
+    struct uv_loop_s *loop;              /* Event loop */
+    struct raft_uv_transport *transport; /* Shared transport */
+    raft_id id;                          /* Server ID, set when starting */
+    struct raft_io io;                   /* Network instance of the host */
+    struct uv **groups;                  /* Attached groups, sorted by ID */
+    unsigned n_groups;                   /* Number of attached groups */
+    unsigned cap_groups;                 /* Capacity of the groups array */
+    struct uv_timer_s timer;             /* Tick all attached groups */
+    bool io_closed;                      /* The network instance is closed */
+    bool timer_closed;                   /* The tick timer is closed */
+    struct UvWal *wal;                   /* Shared write-ahead log, if any */
+    bool wal_closed;                     /* The shared log is closed */
+    raft_uv_host_close_cb close_cb;      /* Invoked when finishing closing */
+};
+
+/* Attach the given group to its host, starting the host tick timer with the
+ * given interval if this is the first group. */
+int UvHostAttach(struct uv *uv, unsigned msecs);
+
+/* Detach the given group from its host, if it was attached, canceling all its
+ * send requests still waiting for a connection. */
+void UvHostDetach(struct uv *uv);
+
+/* Send the given message of a group through the network instance of its
+ * host. */
+int UvHostSend(struct uv *uv,
+               struct raft_io_send *req,
+               const struct raft_message *message,
+               raft_io_send_cb cb);
+
+/* Shared write-ahead log of a host (defined in uv_wal.c). */
+struct UvWal;
+
+typedef void (*UvWalCloseCb)(void *data);
+
+/* Open the shared write-ahead log stored in the given directory, scanning all
+ * its files to index the records of each group and truncating a torn write at
+ * the end of the last file. */
+int UvWalOpen(struct uv_loop_s *loop,
+              const char *dir,
+              size_t segment_size,
+              struct UvWal **wal,
+              char *errmsg);
+
+/* Close the log, invoking the given callback once all writes in flight have
+ * completed and all memory has been released. */
+void UvWalClose(struct UvWal *wal, UvWalCloseCb cb, void *data);
+
+/* Append entries of the given group to the log. The entries are written and
+ * synced together with all other requests submitted in the same loop
+ * iteration. */
+int UvWalAppend(struct uv *uv,
+                struct raft_io_append *req,
+                const struct raft_entry entries[],
+                unsigned n,
+                raft_io_append_cb cb);
+
+/* Delete all entries of the given group from the given index onwards. */
+int UvWalTruncate(struct uv *uv, raft_index index);
+
+/* Synchronously write a single entry of the given group with the given index,
+ * used when bootstrapping or recovering. */
+int UvWalWriteSync(struct uv *uv,
+                   raft_index index,
+                   const struct raft_entry *entry);
+
+/* Load all entries of the given group. If a snapshot is given, return no
+ * entries if they are all behind it. */
+int UvWalLoad(struct uv *uv,
+              const struct raft_snapshot *snapshot,
+              raft_index *start_index,
+              struct raft_entry **entries,
+              size_t *n);
+
+/* Release all entries of the given group before the given index, removing the
+ * files which hold no unreleased entry of any group. */
+void UvWalRelease(struct uv *uv, raft_index retain);
+
 #endif /* UV_H_ */
@@ -16,9 +16,10 @@
  *   the entries in the request, then request a new open segment to be prepared,
  *   queue the request and link it to the newly requested segment.
  *
- * - Wait for any pending write against the current segment to complete, and
- *   also for the prepare request if we asked for a new segment. Also wait for
- *   any in progress barrier to be removed.
+ * - Wait for any pending write against the current segment to complete (or
+ *   just for a free slot, if several concurrent writes are allowed), and also
+ *   for the prepare request if we asked for a new segment. Also wait for any in
+ *   progress barrier to be removed.
  *
  * - Submit a write request for the entries in this append request. The write
  *   request might contain other append requests targeted to the current segment
@@ -26,8 +27,14 @@
  *   segment to be prepared, or for the previous write to complete or for a
  *   barrier to be removed.
  *
- * - Wait for the write request to finish and fire the append request's
- *   callback.
+ * - Wait for the write request to finish, as well as all write requests that
+ *   were submitted before it, and fire the append request's callback.
+ *
+ * When more than one write can be in flight against the same segment, each
+ * write starts at a new block and the leftover space of its last block is
+ * filled with a padding record, so concurrent writes never touch the same
+ * block. The first write of a segment, which carries the format version, is
+ * still performed alone.
  *
  * Possible failure modes are:
  *
@@ -45,14 +52,15 @@ struct uvAliveSegment
     struct uv *uv;                  /* Our writer */
     struct uvPrepare prepare;       /* Prepare segment file request */
     struct UvWriter writer;         /* Writer to perform async I/O */
-    struct UvWriterReq write;       /* Write request */
     unsigned long long counter;     /* Open segment counter */
     raft_index first_index;         /* Index of the first entry written */
     raft_index pending_last_index;  /* Index of the last entry written */
     size_t size;                    /* Total number of bytes used */
     unsigned next_block;            /* Next segment block to write */
     struct uvSegmentBuffer pending; /* Buffer for data yet to be written */
-    uv_buf_t buf;                   /* Write buffer for current write */
+    unsigned max_writes;            /* Maximum number of writes in flight */
+    unsigned n_writes;              /* Number of writes in flight */
+    int status;                     /* Error that left a hole, if any */
     raft_index last_index;          /* Last entry actually written */
     size_t written;                 /* Number of bytes actually written */
     queue queue;                    /* Segment queue */
@@ -60,6 +68,22 @@ struct uvAliveSegment
     bool finalize;                  /* Finalize the segment after writing */
 };
 
+/* A write request against an open segment, fulfilling the append requests at
+ * the head of the writing queue. */
+struct uvAliveSegmentWrite
+{
+    struct uvAliveSegment *segment; /* Segment being written */
+    struct UvWriterReq req;         /* Write request */
+    struct uvSegmentBuffer buf;     /* Own data, with concurrent writes */
+    uv_buf_t data;                  /* Memory being written */
+    size_t offset;                  /* File offset of the write */
+    raft_index last_index;          /* Index of the last entry written */
+    size_t written;                 /* Bytes used once the write is done */
+    unsigned n_reqs;                /* Number of append requests fulfilled */
+    int status;                     /* Result of the write, -1 if in flight */
+    queue queue;                    /* Link in uv->append_writes */
+};
+
 struct uvAppend
 {
     struct raft_io_append *req;       /* User request */
@@ -125,11 +149,23 @@ static void uvAppendFinishRequestsInQueue(struct uv *uv, queue *q, int status)
     }
 }
 
-/* Flush the append requests in the writing queue, firing their callbacks with
- * the given status. */
-static void uvAppendFinishWritingRequests(struct uv *uv, int status)
+/* Flush the first @n append requests in the writing queue, firing their
+ * callbacks with the given status. */
+static void uvAppendFinishWritingRequests(struct uv *uv,
+                                          unsigned n,
+                                          int status)
 {
-    uvAppendFinishRequestsInQueue(uv, &uv->append_writing_reqs, status);
+    queue q;
+    unsigned i;
+    QUEUE_INIT(&q);
+    for (i = 0; i < n; i++) {
+        queue *head;
+        assert(!QUEUE_IS_EMPTY(&uv->append_writing_reqs));
+        head = QUEUE_HEAD(&uv->append_writing_reqs);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&q, head);
+    }
+    uvAppendFinishRequestsInQueue(uv, &q, status);
 }
 
 /* Flush the append requests in the pending queue, firing their callbacks with
@@ -161,9 +197,11 @@ static int uvAliveSegmentEncodeEntriesToWriteBuf(struct uvAliveSegment *segment,
     assert(append->segment == segment);
 
     /* If this is the very first write to the segment, we need to include the
-     * format version */
+     * format version. Padding records are only understood by the newer one. */
     if (segment->pending.n == 0 && segment->next_block == 0) {
-        rv = uvSegmentBufferFormat(&segment->pending);
+        uint64_t format = segment->max_writes > 1 ? UV__DISK_FORMAT_PADDED
+                                                  : UV__DISK_FORMAT;
+        rv = uvSegmentBufferFormat(&segment->pending, format);
         if (rv != 0) {
             return rv;
         }
@@ -179,32 +217,16 @@ static int uvAliveSegmentEncodeEntriesToWriteBuf(struct uvAliveSegment *segment,
     return 0;
 }
 
-static int uvAppendMaybeStart(struct uv *uv);
-static void uvAliveSegmentWriteCb(struct UvWriterReq *write, const int status)
+/* Update the segment's write markers after a write performed with no other
+ * write in flight, so the leftover space of the last block can be used by the
+ * next write. */
+static void uvAliveSegmentAdvance(struct uvAliveSegment *s,
+                                  struct uvAliveSegmentWrite *w)
 {
-    struct uvAliveSegment *s = write->data;
     struct uv *uv = s->uv;
     unsigned n_blocks;
-    int rv;
-
-    assert(uv->state != UV__CLOSED);
-
-    assert(s->buf.len % uv->block_size == 0);
-    assert(s->buf.len >= uv->block_size);
-
-    /* Check if the write was successful. */
-    if (status != 0) {
-        Tracef(uv->tracer, "write: %s", uv->io->errmsg);
-        uv->errored = true;
-        goto out;
-    }
-
-    s->written = s->next_block * uv->block_size + s->pending.n;
-    s->last_index = s->pending_last_index;
 
-    /* Update our write markers.
-     *
-     * We have four cases:
+    /* We have four cases:
      *
      * - The data fit completely in the leftover space of the first block that
      *   we wrote and there is more space left. In this case we just keep the
@@ -228,8 +250,8 @@ static void uvAliveSegmentWriteCb(struct UvWriterReq *write, const int status)
      *   case we advance the current block counter, reset the first buffer and
      *   set the scheduled marker to 0.
      */
-    n_blocks =
-        (unsigned)(s->buf.len / uv->block_size); /* Number of blocks written. */
+    /* Number of blocks written. */
+    n_blocks = (unsigned)(w->data.len / uv->block_size);
     if (s->pending.n < uv->block_size) {
         /* Nothing to do */
         assert(n_blocks == 1);
@@ -239,7 +261,7 @@ static void uvAliveSegmentWriteCb(struct UvWriterReq *write, const int status)
         uvSegmentBufferReset(&s->pending, 0);
     } else {
         assert(s->pending.n > uv->block_size);
-        assert(s->buf.len > uv->block_size);
+        assert(w->data.len > uv->block_size);
 
         if (s->pending.n % uv->block_size > 0) {
             s->next_block += n_blocks - 1;
@@ -249,18 +271,85 @@ static void uvAliveSegmentWriteCb(struct UvWriterReq *write, const int status)
             uvSegmentBufferReset(&s->pending, 0);
         }
     }
+}
+
+/* Process a completed write whose preceding writes have all completed too, and
+ * fire the callbacks of the append requests that it fulfilled. */
+static void uvAliveSegmentWriteFinish(struct uvAliveSegmentWrite *w)
+{
+    struct uvAliveSegment *s = w->segment;
+    struct uv *uv = s->uv;
+    unsigned n_reqs = w->n_reqs;
+    int status = w->status;
+
+    assert(w->data.len % uv->block_size == 0);
+    assert(w->data.len >= uv->block_size);
+
+    /* A write completing after a failed one would leave a hole behind it, and
+     * its entries would be lost when loading the segment. */
+    if (status == 0 && s->status != 0) {
+        status = s->status;
+    }
+
+    /* Check if the write was successful. */
+    if (status != 0) {
+        Tracef(uv->tracer, "write: %s", uv->io->errmsg);
+        uv->errored = true;
+        if (s->max_writes > 1) {
+            /* Let new requests target a new segment. */
+            s->status = status;
+            s->finalize = true;
+        }
+    } else {
+        s->written = w->written;
+        s->last_index = w->last_index;
+        if (s->max_writes == 1) {
+            uvAliveSegmentAdvance(s, w);
+        }
+    }
+
+    assert(s->n_writes > 0);
+    s->n_writes--;
+    uvSegmentBufferClose(&w->buf);
+    HeapFree(w);
 
-out:
     /* Fire the callbacks of all requests that were fulfilled with this
      * write. */
-    uvAppendFinishWritingRequests(uv, status);
+    uvAppendFinishWritingRequests(uv, n_reqs, status);
+}
+
+static int uvAppendMaybeStart(struct uv *uv);
+static void uvAliveSegmentWriteCb(struct UvWriterReq *req, const int status)
+{
+    struct uvAliveSegmentWrite *w = req->data;
+    struct uvAliveSegment *s = w->segment;
+    struct uv *uv = s->uv;
+    int rv;
+
+    assert(uv->state != UV__CLOSED);
+
+    w->status = status;
+
+    /* Writes might complete out of order, but append requests are completed in
+     * the order they were submitted. */
+    while (!QUEUE_IS_EMPTY(&uv->append_writes)) {
+        queue *head = QUEUE_HEAD(&uv->append_writes);
+        w = QUEUE_DATA(head, struct uvAliveSegmentWrite, queue);
+        if (w->status == -1) {
+            break;
+        }
+        QUEUE_REMOVE(head);
+        uvAliveSegmentWriteFinish(w);
+    }
 
     /* During the closing sequence we should have already canceled all pending
      * request. */
     if (uv->closing) {
         assert(QUEUE_IS_EMPTY(&uv->append_pending_reqs));
-        assert(s->finalize);
-        uvAliveSegmentFinalize(s);
+        if (s->n_writes == 0) {
+            assert(s->finalize);
+            uvAliveSegmentFinalize(s);
+        }
         return;
     }
 
@@ -274,27 +363,76 @@ out:
 }
 
 /* Submit a file write request to append the entries encoded in the write buffer
- * of the given segment. */
-static int uvAliveSegmentWrite(struct uvAliveSegment *s)
+ * of the given segment, fulfilling the last @n_reqs append requests that were
+ * moved to the writing queue. */
+static int uvAliveSegmentWrite(struct uvAliveSegment *s, unsigned n_reqs)
 {
+    struct uv *uv = s->uv;
+    struct uvAliveSegmentWrite *w;
     int rv;
+
     assert(s->counter != 0);
     assert(s->pending.n > 0);
-    uvSegmentBufferFinalize(&s->pending, &s->buf);
-    rv = UvWriterSubmit(&s->writer, &s->write, &s->buf, 1,
-                        s->next_block * s->uv->block_size,
+    assert(s->n_writes < s->max_writes);
+
+    w = HeapMalloc(sizeof *w);
+    if (w == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    w->segment = s;
+    w->req.data = w;
+    w->offset = s->next_block * uv->block_size;
+    w->last_index = s->pending_last_index;
+    w->n_reqs = n_reqs;
+    w->status = -1;
+
+    if (s->max_writes == 1) {
+        /* Write directly from the segment's buffer, whose last block will be
+         * retained for the next write. */
+        uvSegmentBufferInit(&w->buf, uv->block_size);
+        uvSegmentBufferFinalize(&s->pending, &w->data);
+        w->written = w->offset + s->pending.n;
+    } else {
+        /* Take over the segment's buffer and pad it up to the next block, so
+         * the next write can be submitted right away. */
+        w->buf = s->pending;
+        uvSegmentBufferInit(&s->pending, uv->block_size);
+        rv = uvSegmentBufferPad(&w->buf);
+        if (rv != 0) {
+            goto err_after_alloc;
+        }
+        uvSegmentBufferFinalize(&w->buf, &w->data);
+        w->written = w->offset + w->buf.n;
+    }
+
+    rv = UvWriterSubmit(&s->writer, &w->req, &w->data, 1, w->offset,
                         uvAliveSegmentWriteCb);
     if (rv != 0) {
-        return rv;
+        goto err_after_alloc;
+    }
+
+    if (s->max_writes > 1) {
+        s->next_block += (unsigned)(w->data.len / uv->block_size);
     }
+    s->n_writes++;
+    QUEUE_PUSH(&uv->append_writes, &w->queue);
+
     return 0;
+
+err_after_alloc:
+    uvSegmentBufferClose(&w->buf);
+    HeapFree(w);
+err:
+    assert(rv != 0);
+    return rv;
 }
 
 /* Start writing all pending append requests for the current segment, unless we
- * are already writing, or the segment itself has not yet been prepared or we
- * are blocked on a barrier. If there are no more requests targeted at the
- * current segment, make sure it's marked to be finalize and try with the next
- * segment. */
+ * have already as many writes in flight as the segment allows, or the segment
+ * itself has not yet been prepared or we are blocked on a barrier. If there are
+ * no more requests targeted at the current segment, make sure it's marked to be
+ * finalize and try with the next segment. */
 static int uvAppendMaybeStart(struct uv *uv)
 {
     struct uvAliveSegment *segment;
@@ -307,11 +445,6 @@ static int uvAppendMaybeStart(struct uv *uv)
     assert(!uv->closing);
     assert(!QUEUE_IS_EMPTY(&uv->append_pending_reqs));
 
-    /* If we are already writing, let's wait. */
-    if (!QUEUE_IS_EMPTY(&uv->append_writing_reqs)) {
-        return 0;
-    }
-
 start:
     segment = uvGetCurrentAliveSegment(uv);
     assert(segment != NULL);
@@ -320,6 +453,15 @@ start:
         return 0;
     }
 
+    /* If we can't have more writes in flight, let's wait. The same if the
+     * first write, which contains the format version, is still in flight: a
+     * segment whose header is missing can't be told apart from a corrupted
+     * one. */
+    if (segment->n_writes >= segment->max_writes ||
+        (segment->n_writes > 0 && segment->written == 0)) {
+        return 0;
+    }
+
     /* If there's a barrier in progress, and it's not waiting for this segment
      * to be finalized, let's wait. */
     if (uv->barrier != NULL && segment->barrier != uv->barrier) {
@@ -360,6 +502,10 @@ start:
      * that case we need to wait for it). Otherwise it must mean we have
      * exhausted the queue of pending append requests. */
     if (n_reqs == 0) {
+        /* Wait for the writes in flight before finalizing the segment. */
+        if (segment->n_writes > 0) {
+            return 0;
+        }
         assert(QUEUE_IS_EMPTY(&uv->append_writing_reqs));
         if (segment->finalize) {
             uvAliveSegmentFinalize(segment);
@@ -377,7 +523,7 @@ start:
         QUEUE_PUSH(&uv->append_writing_reqs, head);
     }
 
-    rv = uvAliveSegmentWrite(segment);
+    rv = uvAliveSegmentWrite(segment, n_reqs);
     if (rv != 0) {
         goto err;
     }
@@ -399,7 +545,8 @@ static int uvAliveSegmentReady(struct uv *uv,
 {
     int rv;
     rv = UvWriterInit(&segment->writer, uv->loop, fd, uv->direct_io,
-                      uv->async_io, 1, uv->io->errmsg);
+                      uv->async_io, uv->uring_io, segment->max_writes,
+                      uv->io->errmsg);
     if (rv != 0) {
         ErrMsgWrapf(uv->io->errmsg, "setup writer for open-%llu", counter);
         return rv;
@@ -463,7 +610,6 @@ static void uvAliveSegmentInit(struct uvAliveSegment *s, struct uv *uv)
     s->uv = uv;
     s->prepare.data = s;
     s->writer.data = s;
-    s->write.data = s;
     s->counter = 0;
     s->first_index = uv->append_next_index;
     s->pending_last_index = s->first_index - 1;
@@ -471,6 +617,9 @@ static void uvAliveSegmentInit(struct uvAliveSegment *s, struct uv *uv)
     s->size = sizeof(uint64_t) /* Format version */;
     s->next_block = 0;
     uvSegmentBufferInit(&s->pending, uv->block_size);
+    s->max_writes = uv->max_concurrent_writes;
+    s->n_writes = 0;
+    s->status = 0;
     s->written = 0;
     s->barrier = NULL;
     s->finalize = false;
@@ -541,6 +690,17 @@ static bool uvAliveSegmentHasEnoughSpareCapacity(struct uvAliveSegment *s,
     return s->size + size <= s->uv->segment_size;
 }
 
+/* Return the number of bytes that the segment might use to store a batch of
+ * @size bytes. With concurrent writes the batch might end up in a write of its
+ * own, taking some padding and possibly a whole extra block. */
+static size_t uvAliveSegmentWriteSize(struct uvAliveSegment *s, size_t size)
+{
+    if (s->max_writes > 1) {
+        size += s->uv->block_size + UV__SEGMENT_PADDING_MIN;
+    }
+    return size;
+}
+
 /* Add @size bytes to the number of bytes that the segment will hold. The actual
  * write will happen when the previous write completes, if any. */
 static void uvAliveSegmentReserveSegmentCapacity(struct uvAliveSegment *s,
@@ -584,7 +744,8 @@ static int uvAppendEnqueueRequest(struct uv *uv, struct uvAppend *append)
     if (segment == NULL || segment->finalize) {
         fits = false;
     } else {
-        fits = uvAliveSegmentHasEnoughSpareCapacity(segment, size);
+        fits = uvAliveSegmentHasEnoughSpareCapacity(
+            segment, uvAliveSegmentWriteSize(segment, size));
         if (!fits) {
             segment->finalize = true; /* Finalize when all writes are done */
         }
@@ -600,7 +761,8 @@ static int uvAppendEnqueueRequest(struct uv *uv, struct uvAppend *append)
     }
 
     segment = uvGetLastAliveSegment(uv); /* Get the last added segment */
-    uvAliveSegmentReserveSegmentCapacity(segment, size);
+    uvAliveSegmentReserveSegmentCapacity(
+        segment, uvAliveSegmentWriteSize(segment, size));
 
     append->segment = segment;
     QUEUE_PUSH(&uv->append_pending_reqs, &append->queue);
@@ -626,6 +788,10 @@ int UvAppend(struct raft_io *io,
     uv = io->impl;
     assert(!uv->closing);
 
+    if (uv->wal != NULL) {
+        return UvWalAppend(uv, req, entries, n, cb);
+    }
+
     append = HeapMalloc(sizeof *append);
     if (append == NULL) {
         rv = RAFT_NOMEM;
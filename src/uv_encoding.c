@@ -1,5 +1,6 @@
 #include "uv_encoding.h"
 
+#include <limits.h>
 #include <string.h>
 
 #include "../include/raft/uv.h"
@@ -36,24 +37,36 @@ static size_t sizeofRequestVoteResult(void)
 static size_t sizeofAppendEntries(const struct raft_append_entries *p)
 {
     return sizeof(uint64_t) + /* Leader's term. */
-           sizeof(uint64_t) + /* Leader ID */
            sizeof(uint64_t) + /* Previous log entry index */
            sizeof(uint64_t) + /* Previous log entry term */
            sizeof(uint64_t) + /* Leader's commit index */
            sizeof(uint64_t) + /* Number of entries in the batch */
-           16 * p->n_entries /* One header per entry */;
+           16 * p->n_entries + /* One header per entry */
+           sizeof(uint64_t) /* Read round, formerly unused */;
 }
 
-static size_t sizeofAppendEntriesResult(void)
+static size_t sizeofAppendEntriesResultV0(void)
 {
     return sizeof(uint64_t) + /* Term. */
            sizeof(uint64_t) + /* Success. */
            sizeof(uint64_t) /* Last log index. */;
 }
 
-static size_t sizeofInstallSnapshot(const struct raft_install_snapshot *p)
+static size_t sizeofAppendEntriesResultV1(void)
+{
+    return sizeofAppendEntriesResultV0() +
+           sizeof(uint64_t) /* Read round. */;
+}
+
+static size_t sizeofAppendEntriesResult(void)
+{
+    return sizeofAppendEntriesResultV1() +
+           sizeof(uint64_t) + /* Conflict term. */
+           sizeof(uint64_t) /* Conflict index. */;
+}
+
+static size_t sizeofInstallSnapshotV1(size_t conf_size)
 {
-    size_t conf_size = configurationEncodedSize(&p->conf);
     return sizeof(uint64_t) + /* Leader's term. */
            sizeof(uint64_t) + /* Leader ID */
            sizeof(uint64_t) + /* Snapshot's last index */
@@ -64,6 +77,21 @@ static size_t sizeofInstallSnapshot(const struct raft_install_snapshot *p)
            sizeof(uint64_t);  /* Length of snapshot data */
 }
 
+static size_t sizeofInstallSnapshot(const struct raft_install_snapshot *p)
+{
+    size_t conf_size = configurationEncodedSize(&p->conf);
+    return sizeofInstallSnapshotV1(conf_size) +
+           sizeof(uint64_t) + /* Offset of the data chunk */
+           sizeof(uint64_t) /* Flags */;
+}
+
+static size_t sizeofInstallSnapshotResult(void)
+{
+    return sizeof(uint64_t) + /* Term. */
+           sizeof(uint64_t) + /* Snapshot's last index. */
+           sizeof(uint64_t) /* Offset. */;
+}
+
 static size_t sizeofTimeoutNow(void)
 {
     return sizeof(uint64_t) + /* Term. */
@@ -71,6 +99,19 @@ static size_t sizeofTimeoutNow(void)
            sizeof(uint64_t) /* Last log term. */;
 }
 
+static size_t sizeofForwardRead(void)
+{
+    return sizeof(uint64_t) + /* Term. */
+           sizeof(uint64_t) /* Sequence number. */;
+}
+
+static size_t sizeofForwardReadResult(void)
+{
+    return sizeof(uint64_t) + /* Term. */
+           sizeof(uint64_t) + /* Sequence number. */
+           sizeof(uint64_t) /* Read index. */;
+}
+
 size_t uvSizeofBatchHeader(size_t n)
 {
     return 8 + /* Number of entries in the batch, little endian */
@@ -117,6 +158,9 @@ static void encodeAppendEntries(const struct raft_append_entries *p, void *buf)
     bytePut64(&cursor, p->leader_commit);  /* Commit index. */
 
     uvEncodeBatchHeader(p->entries, p->n_entries, cursor);
+    cursor = (uint8_t *)cursor + uvSizeofBatchHeader(p->n_entries);
+
+    bytePut64(&cursor, p->read_round); /* Read round. */
 }
 
 static void encodeAppendEntriesResult(
@@ -128,6 +172,9 @@ static void encodeAppendEntriesResult(
     bytePut64(&cursor, p->term);
     bytePut64(&cursor, p->rejected);
     bytePut64(&cursor, p->last_log_index);
+    bytePut64(&cursor, p->read_round);
+    bytePut64(&cursor, p->conflict_term);
+    bytePut64(&cursor, p->conflict_index);
 }
 
 static void encodeInstallSnapshot(const struct raft_install_snapshot *p,
@@ -135,6 +182,11 @@ static void encodeInstallSnapshot(const struct raft_install_snapshot *p,
 {
     void *cursor;
     size_t conf_size = configurationEncodedSize(&p->conf);
+    uint64_t flags = 0;
+
+    if (p->done) {
+        flags |= 1 << 0;
+    }
 
     cursor = buf;
 
@@ -146,6 +198,20 @@ static void encodeInstallSnapshot(const struct raft_install_snapshot *p,
     configurationEncodeToBuf(&p->conf, cursor);
     cursor = (uint8_t *)cursor + conf_size;
     bytePut64(&cursor, p->data.len); /* Snapshot data size. */
+    bytePut64(&cursor, 0);           /* Unused. */
+    bytePut64(&cursor, p->offset);   /* Offset of the data chunk. */
+    bytePut64(&cursor, flags);
+}
+
+static void encodeInstallSnapshotResult(
+    const struct raft_install_snapshot_result *p,
+    void *buf)
+{
+    void *cursor = buf;
+
+    bytePut64(&cursor, p->term);
+    bytePut64(&cursor, p->last_index);
+    bytePut64(&cursor, p->offset);
 }
 
 static void encodeTimeoutNow(const struct raft_timeout_now *p, void *buf)
@@ -157,49 +223,70 @@ static void encodeTimeoutNow(const struct raft_timeout_now *p, void *buf)
     bytePut64(&cursor, p->last_log_term);
 }
 
-int uvEncodeMessage(const struct raft_message *message,
-                    uv_buf_t **bufs,
-                    unsigned *n_bufs)
+static void encodeForwardRead(const struct raft_forward_read *p, void *buf)
 {
-    uv_buf_t header;
-    void *cursor;
+    void *cursor = buf;
 
-    /* Figure out the length of the header for this request and allocate a
-     * buffer for it. */
-    header.len = RAFT_IO_UV__PREAMBLE_SIZE;
+    bytePut64(&cursor, p->term);
+    bytePut64(&cursor, p->seq);
+}
+
+static void encodeForwardReadResult(const struct raft_forward_read_result *p,
+                                    void *buf)
+{
+    void *cursor = buf;
+
+    bytePut64(&cursor, p->term);
+    bytePut64(&cursor, p->seq);
+    bytePut64(&cursor, p->index);
+}
+
+size_t uvSizeofMessageHeader(const struct raft_message *message)
+{
+    size_t size = RAFT_IO_UV__PREAMBLE_SIZE;
     switch (message->type) {
         case RAFT_IO_REQUEST_VOTE:
-            header.len += sizeofRequestVote();
+            size += sizeofRequestVote();
             break;
         case RAFT_IO_REQUEST_VOTE_RESULT:
-            header.len += sizeofRequestVoteResult();
+            size += sizeofRequestVoteResult();
             break;
         case RAFT_IO_APPEND_ENTRIES:
-            header.len += sizeofAppendEntries(&message->append_entries);
+            size += sizeofAppendEntries(&message->append_entries);
             break;
         case RAFT_IO_APPEND_ENTRIES_RESULT:
-            header.len += sizeofAppendEntriesResult();
+            size += sizeofAppendEntriesResult();
             break;
         case RAFT_IO_INSTALL_SNAPSHOT:
-            header.len += sizeofInstallSnapshot(&message->install_snapshot);
+            size += sizeofInstallSnapshot(&message->install_snapshot);
             break;
         case RAFT_IO_TIMEOUT_NOW:
-            header.len += sizeofTimeoutNow();
+            size += sizeofTimeoutNow();
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT_RESULT:
+            size += sizeofInstallSnapshotResult();
+            break;
+        case RAFT_IO_FORWARD_READ:
+            size += sizeofForwardRead();
+            break;
+        case RAFT_IO_FORWARD_READ_RESULT:
+            size += sizeofForwardReadResult();
             break;
         default:
-            return RAFT_MALFORMED;
+            return 0;
     };
+    return size;
+}
 
-    header.base = raft_malloc(header.len);
-    if (header.base == NULL) {
-        goto oom;
-    }
-
-    cursor = header.base;
+void uvEncodeMessageHeader(const struct raft_message *message,
+                           size_t size,
+                           void *buf)
+{
+    void *cursor = buf;
 
     /* Encode the request preamble, with message type and message size. */
     bytePut64(&cursor, message->type);
-    bytePut64(&cursor, header.len - RAFT_IO_UV__PREAMBLE_SIZE);
+    bytePut64(&cursor, size - RAFT_IO_UV__PREAMBLE_SIZE);
 
     /* Encode the request header. */
     switch (message->type) {
@@ -221,41 +308,83 @@ int uvEncodeMessage(const struct raft_message *message,
         case RAFT_IO_TIMEOUT_NOW:
             encodeTimeoutNow(&message->timeout_now, cursor);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_RESULT:
+            encodeInstallSnapshotResult(&message->install_snapshot_result,
+                                        cursor);
+            break;
+        case RAFT_IO_FORWARD_READ:
+            encodeForwardRead(&message->forward_read, cursor);
+            break;
+        case RAFT_IO_FORWARD_READ_RESULT:
+            encodeForwardReadResult(&message->forward_read_result, cursor);
+            break;
     };
+}
+
+unsigned uvSizeofMessagePayload(const struct raft_message *message)
+{
+    switch (message->type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            /* For AppendEntries request we also send the entries payload. */
+            return message->append_entries.n_entries;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            /* For InstallSnapshot request we also send the snapshot
+             * payload. */
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-    *n_bufs = 1;
+void uvEncodeMessagePayload(const struct raft_message *message, uv_buf_t *bufs)
+{
+    unsigned i;
 
-    /* For AppendEntries request we also send the entries payload. */
-    if (message->type == RAFT_IO_APPEND_ENTRIES) {
-        *n_bufs += message->append_entries.n_entries;
+    switch (message->type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            for (i = 0; i < message->append_entries.n_entries; i++) {
+                const struct raft_entry *entry =
+                    &message->append_entries.entries[i];
+                bufs[i].base = entry->buf.base;
+                bufs[i].len = entry->buf.len;
+            }
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            bufs[0].base = message->install_snapshot.data.base;
+            bufs[0].len = message->install_snapshot.data.len;
+            break;
     }
+}
 
-    /* For InstallSnapshot request we also send the snapshot payload. */
-    if (message->type == RAFT_IO_INSTALL_SNAPSHOT) {
-        *n_bufs += 1;
+int uvEncodeMessage(const struct raft_message *message,
+                    uv_buf_t **bufs,
+                    unsigned *n_bufs)
+{
+    uv_buf_t header;
+
+    /* Figure out the length of the header for this request and allocate a
+     * buffer for it. */
+    header.len = uvSizeofMessageHeader(message);
+    if (header.len == 0) {
+        return RAFT_MALFORMED;
     }
 
+    header.base = raft_malloc(header.len);
+    if (header.base == NULL) {
+        goto oom;
+    }
+
+    uvEncodeMessageHeader(message, header.len, header.base);
+
+    *n_bufs = 1 + uvSizeofMessagePayload(message);
+
     *bufs = raft_calloc(*n_bufs, sizeof **bufs);
     if (*bufs == NULL) {
         goto oom_after_header_alloc;
     }
 
     (*bufs)[0] = header;
-
-    if (message->type == RAFT_IO_APPEND_ENTRIES) {
-        unsigned i;
-        for (i = 0; i < message->append_entries.n_entries; i++) {
-            const struct raft_entry *entry =
-                &message->append_entries.entries[i];
-            (*bufs)[i + 1].base = entry->buf.base;
-            (*bufs)[i + 1].len = entry->buf.len;
-        }
-    }
-
-    if (message->type == RAFT_IO_INSTALL_SNAPSHOT) {
-        (*bufs)[1].base = message->install_snapshot.data.base;
-        (*bufs)[1].len = message->install_snapshot.data.len;
-    }
+    uvEncodeMessagePayload(message, &(*bufs)[1]);
 
     return 0;
 
@@ -266,6 +395,30 @@ oom:
     return RAFT_NOMEM;
 }
 
+void uvEncodeMessageGroup(void *buf, unsigned long long group)
+{
+    const void *type = buf;
+    void *cursor = buf;
+    bytePut64(&cursor, byteGet64(&type) | group << UV__GROUP_SHIFT);
+}
+
+void uvEncodeAppendEntriesCompression(void *buf,
+                                      size_t size,
+                                      unsigned codec,
+                                      size_t len)
+{
+    void *cursor;
+
+    /* Update the message size in the preamble. */
+    cursor = (uint8_t *)buf + sizeof(uint64_t);
+    bytePut64(&cursor, size + UV__COMPRESSION_TRAILER_SIZE -
+                           RAFT_IO_UV__PREAMBLE_SIZE);
+
+    cursor = (uint8_t *)buf + size;
+    bytePut64(&cursor, codec);
+    bytePut64(&cursor, len);
+}
+
 void uvEncodeBatchHeader(const struct raft_entry *entries,
                          unsigned n,
                          void *buf)
@@ -325,12 +478,38 @@ static void decodeRequestVoteResult(const uv_buf_t *buf,
     p->vote_granted = byteGet64(&cursor);
 }
 
+int uvDecodeBatchHeaderInto(const void *batch,
+                            struct raft_entry *entries,
+                            unsigned n)
+{
+    const void *cursor = (const uint8_t *)batch + sizeof(uint64_t);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        struct raft_entry *entry = &entries[i];
+
+        entry->term = byteGet64(&cursor);
+        entry->type = byteGet8(&cursor);
+
+        if (entry->type != RAFT_COMMAND && entry->type != RAFT_BARRIER &&
+            entry->type != RAFT_CHANGE) {
+            return RAFT_MALFORMED;
+        }
+
+        cursor = (uint8_t *)cursor + 3; /* Unused */
+
+        /* Size of the log entry data, little endian. */
+        entry->buf.len = byteGet32(&cursor);
+    }
+
+    return 0;
+}
+
 int uvDecodeBatchHeader(const void *batch,
                         struct raft_entry **entries,
                         unsigned *n)
 {
     const void *cursor = batch;
-    size_t i;
     int rv;
 
     *n = (unsigned)byteGet64(&cursor);
@@ -347,28 +526,15 @@ int uvDecodeBatchHeader(const void *batch,
         goto err;
     }
 
-    for (i = 0; i < *n; i++) {
-        struct raft_entry *entry = &(*entries)[i];
-
-        entry->term = byteGet64(&cursor);
-        entry->type = byteGet8(&cursor);
-
-        if (entry->type != RAFT_COMMAND && entry->type != RAFT_BARRIER &&
-            entry->type != RAFT_CHANGE) {
-            rv = RAFT_MALFORMED;
-            goto err_after_alloc;
-        }
-
-        cursor = (uint8_t *)cursor + 3; /* Unused */
-
-        /* Size of the log entry data, little endian. */
-        entry->buf.len = byteGet32(&cursor);
+    rv = uvDecodeBatchHeaderInto(batch, *entries, *n);
+    if (rv != 0) {
+        goto err_after_alloc;
     }
 
     return 0;
 
 err_after_alloc:
-    raft_free(entries);
+    raft_free(*entries);
 
 err:
     assert(rv != 0);
@@ -396,6 +562,40 @@ static int decodeAppendEntries(const uv_buf_t *buf,
     if (rv != 0) {
         return rv;
     }
+    cursor = (const uint8_t *)cursor + uvSizeofBatchHeader(args->n_entries);
+
+    args->read_round = byteGet64(&cursor);
+
+    return 0;
+}
+
+int uvDecodeAppendEntriesCompression(const uv_buf_t *header,
+                                     const struct raft_append_entries *p,
+                                     unsigned *codec,
+                                     size_t *len)
+{
+    size_t size = sizeofAppendEntries(p);
+    const void *cursor;
+    uint64_t value;
+
+    *codec = 0;
+    *len = 0;
+
+    /* Headers without the trailer carry an uncompressed payload. */
+    if (header->len < size + UV__COMPRESSION_TRAILER_SIZE) {
+        return 0;
+    }
+
+    cursor = (const uint8_t *)header->base + size;
+    value = byteGet64(&cursor);
+    if (value == 0 || value > UINT_MAX) {
+        return RAFT_MALFORMED;
+    }
+    *codec = (unsigned)value;
+    *len = (size_t)byteGet64(&cursor);
+    if (*len == 0) {
+        return RAFT_MALFORMED;
+    }
 
     return 0;
 }
@@ -410,6 +610,18 @@ static void decodeAppendEntriesResult(const uv_buf_t *buf,
     p->term = byteGet64(&cursor);
     p->rejected = byteGet64(&cursor);
     p->last_log_index = byteGet64(&cursor);
+    if (buf->len >= sizeofAppendEntriesResultV1()) {
+        p->read_round = byteGet64(&cursor);
+    } else {
+        p->read_round = 0;
+    }
+    if (buf->len >= sizeofAppendEntriesResult()) {
+        p->conflict_term = byteGet64(&cursor);
+        p->conflict_index = byteGet64(&cursor);
+    } else {
+        p->conflict_term = 0;
+        p->conflict_index = 0;
+    }
 }
 
 static int decodeInstallSnapshot(const uv_buf_t *buf,
@@ -438,9 +650,35 @@ static int decodeInstallSnapshot(const uv_buf_t *buf,
     cursor = (uint8_t *)cursor + conf.len;
     args->data.len = (size_t)byteGet64(&cursor);
 
+    /* Support for legacy install snapshot that always carries the whole
+     * snapshot data. */
+    if (buf->len == sizeofInstallSnapshotV1(conf.len)) {
+        args->offset = 0;
+        args->done = true;
+    } else {
+        uint64_t flags;
+        byteGet64(&cursor); /* Unused. */
+        args->offset = (size_t)byteGet64(&cursor);
+        flags = byteGet64(&cursor);
+        args->done = (bool)(flags & 1 << 0);
+    }
+
     return 0;
 }
 
+static void decodeInstallSnapshotResult(
+    const uv_buf_t *buf,
+    struct raft_install_snapshot_result *p)
+{
+    const void *cursor;
+
+    cursor = buf->base;
+
+    p->term = byteGet64(&cursor);
+    p->last_index = byteGet64(&cursor);
+    p->offset = (size_t)byteGet64(&cursor);
+}
+
 static void decodeTimeoutNow(const uv_buf_t *buf, struct raft_timeout_now *p)
 {
     const void *cursor;
@@ -452,6 +690,28 @@ static void decodeTimeoutNow(const uv_buf_t *buf, struct raft_timeout_now *p)
     p->last_log_term = byteGet64(&cursor);
 }
 
+static void decodeForwardRead(const uv_buf_t *buf, struct raft_forward_read *p)
+{
+    const void *cursor;
+
+    cursor = buf->base;
+
+    p->term = byteGet64(&cursor);
+    p->seq = byteGet64(&cursor);
+}
+
+static void decodeForwardReadResult(const uv_buf_t *buf,
+                                    struct raft_forward_read_result *p)
+{
+    const void *cursor;
+
+    cursor = buf->base;
+
+    p->term = byteGet64(&cursor);
+    p->seq = byteGet64(&cursor);
+    p->index = byteGet64(&cursor);
+}
+
 int uvDecodeMessage(const unsigned long type,
                     const uv_buf_t *header,
                     struct raft_message *message,
@@ -489,6 +749,16 @@ int uvDecodeMessage(const unsigned long type,
         case RAFT_IO_TIMEOUT_NOW:
             decodeTimeoutNow(header, &message->timeout_now);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_RESULT:
+            decodeInstallSnapshotResult(header,
+                                        &message->install_snapshot_result);
+            break;
+        case RAFT_IO_FORWARD_READ:
+            decodeForwardRead(header, &message->forward_read);
+            break;
+        case RAFT_IO_FORWARD_READ_RESULT:
+            decodeForwardReadResult(header, &message->forward_read_result);
+            break;
         default:
             rv = RAFT_IOERR;
             break;
@@ -10,10 +10,64 @@
 /* Current disk format version. */
 #define UV__DISK_FORMAT 1
 
+/* Format version of segments that might contain padding records, which are
+ * written when several writes against an open segment are kept in flight. */
+#define UV__DISK_FORMAT_PADDED 2
+
+/* Format version of snapshot metadata files recording the codec used to
+ * compress the snapshot data, along with its decompressed length. */
+#define UV__DISK_FORMAT_COMPRESSED 3
+
 int uvEncodeMessage(const struct raft_message *message,
                     uv_buf_t **bufs,
                     unsigned *n_bufs);
 
+/* Return the size of the preamble and header of the given message, or 0 if the
+ * message type is unknown. */
+size_t uvSizeofMessageHeader(const struct raft_message *message);
+
+/* Encode the preamble and header of the given message into @buf, which must be
+ * at least @size bytes long, as returned by uvSizeofMessageHeader(). */
+void uvEncodeMessageHeader(const struct raft_message *message,
+                           size_t size,
+                           void *buf);
+
+/* Return the number of payload buffers that follow the header of the given
+ * message. */
+unsigned uvSizeofMessagePayload(const struct raft_message *message);
+
+/* Fill @bufs with the payload buffers of the given message, which must have
+ * room for uvSizeofMessagePayload() items. */
+void uvEncodeMessagePayload(const struct raft_message *message,
+                            uv_buf_t *bufs);
+
+/* Messages of raft groups attached to a host carry the group ID in the upper
+ * bits of the message type word of their preamble. */
+#define UV__GROUP_SHIFT 16
+
+/* Tag the message whose preamble is encoded in @buf with the given group ID. */
+void uvEncodeMessageGroup(void *buf, unsigned long long group);
+
+/* Size of the trailer appended to the header of an AppendEntries message whose
+ * entries payload is compressed, containing the codec and the compressed
+ * payload length. */
+#define UV__COMPRESSION_TRAILER_SIZE (2 * sizeof(uint64_t))
+
+/* Append the compression trailer to the AppendEntries header of @size bytes in
+ * @buf, which must have room for UV__COMPRESSION_TRAILER_SIZE more bytes, and
+ * update the header size recorded in its preamble. */
+void uvEncodeAppendEntriesCompression(void *buf,
+                                      size_t size,
+                                      unsigned codec,
+                                      size_t len);
+
+/* Decode the compression trailer of the given AppendEntries header, if any.
+ * If the payload is not compressed, @codec is set to zero. */
+int uvDecodeAppendEntriesCompression(const uv_buf_t *header,
+                                     const struct raft_append_entries *p,
+                                     unsigned *codec,
+                                     size_t *len);
+
 int uvDecodeMessage(unsigned long type,
                     const uv_buf_t *header,
                     struct raft_message *message,
@@ -23,6 +77,12 @@ int uvDecodeBatchHeader(const void *batch,
                         struct raft_entry **entries,
                         unsigned *n);
 
+/* Decode the header of a batch of @n entries into the given array, which must
+ * have room for at least @n entries. */
+int uvDecodeBatchHeaderInto(const void *batch,
+                            struct raft_entry *entries,
+                            unsigned n);
+
 void uvDecodeEntriesBatch(uint8_t *batch,
                           size_t offset,
                           struct raft_entry *entries,
@@ -1,7 +1,9 @@
 #include "uv_fs.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/vfs.h>
 #include <unistd.h>
 
@@ -447,6 +449,114 @@ err:
     return rv;
 }
 
+int UvFsReadFileAt(const char *dir,
+                   const char *filename,
+                   off_t offset,
+                   struct raft_buffer *buf,
+                   char *errmsg)
+{
+    uv_file fd;
+    size_t n;
+    ssize_t rv2;
+    int rv;
+
+    rv = uvFsOpenFile(dir, filename, O_RDONLY, 0, &fd, errmsg);
+    if (rv != 0) {
+        goto err;
+    }
+
+    n = 0;
+    while (n < buf->len) {
+        rv2 = pread(fd, (char *)buf->base + n, buf->len - n,
+                    offset + (off_t)n);
+        if (rv2 == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            UvOsErrMsg(errmsg, "read", -errno);
+            rv = RAFT_IOERR;
+            goto err_after_open;
+        }
+        if (rv2 == 0) {
+            break;
+        }
+        n += (size_t)rv2;
+    }
+    buf->len = n;
+
+    UvOsClose(fd);
+
+    return 0;
+
+err_after_open:
+    UvOsClose(fd);
+err:
+    return rv;
+}
+
+int UvFsWriteFileAt(const char *dir,
+                    const char *filename,
+                    off_t offset,
+                    const struct raft_buffer *buf,
+                    char *errmsg)
+{
+    struct stat sb;
+    uv_file fd;
+    int flags = UV_FS_O_WRONLY | UV_FS_O_CREAT;
+    int rv;
+
+    rv = uvFsOpenFile(dir, filename, flags, S_IRUSR | S_IWUSR, &fd, errmsg);
+    if (rv != 0) {
+        goto err;
+    }
+    rv = fstat(fd, &sb);
+    if (rv == -1) {
+        UvOsErrMsg(errmsg, "fstat", -errno);
+        rv = RAFT_IOERR;
+        goto err_after_open;
+    }
+    if (sb.st_size < offset) {
+        ErrMsgPrintf(errmsg, "file is %jd bytes, can't write at offset %jd",
+                     (intmax_t)sb.st_size, (intmax_t)offset);
+        rv = RAFT_IOERR;
+        goto err_after_open;
+    }
+    rv = UvOsTruncate(fd, offset);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "truncate", rv);
+        rv = RAFT_IOERR;
+        goto err_after_open;
+    }
+    rv = UvOsWrite(fd, (const uv_buf_t *)buf, 1, offset);
+    if (rv != (int)buf->len) {
+        if (rv < 0) {
+            UvOsErrMsg(errmsg, "write", rv);
+        } else {
+            ErrMsgPrintf(errmsg, "short write: %d only bytes written", rv);
+        }
+        rv = RAFT_IOERR;
+        goto err_after_open;
+    }
+    rv = UvOsFsync(fd);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "fsync", rv);
+        rv = RAFT_IOERR;
+        goto err_after_open;
+    }
+    rv = UvOsClose(fd);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "close", rv);
+        return RAFT_IOERR;
+    }
+
+    return 0;
+
+err_after_open:
+    UvOsClose(fd);
+err:
+    return rv;
+}
+
 int UvFsRemoveFile(const char *dir, const char *filename, char *errmsg)
 {
     char path[UV__PATH_SZ];
@@ -506,6 +616,27 @@ err:
     return RAFT_IOERR;
 }
 
+int UvFsRenameFile(const char *dir,
+                   const char *filename1,
+                   const char *filename2,
+                   char *errmsg)
+{
+    char path1[UV__PATH_SZ];
+    char path2[UV__PATH_SZ];
+    int rv;
+
+    UvOsJoin(dir, filename1, path1);
+    UvOsJoin(dir, filename2, path2);
+
+    rv = UvOsRename(path1, path2);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "rename", rv);
+        return RAFT_IOERR;
+    }
+
+    return 0;
+}
+
 /* Check if direct I/O is possible on the given fd. */
 static int probeDirectIO(int fd, size_t *size, char *errmsg)
 {
@@ -668,12 +799,91 @@ static int probeAsyncIO(int fd, size_t size, bool *ok, char *errmsg)
 }
 #endif /* RWF_NOWAIT */
 
+#if defined(UV__HAVE_IO_URING)
+/* Check if writes can be performed through io_uring on the given fd, using the
+ * same registered file and eventfd setup as UvWriter. */
+static int probeUringIO(int fd, size_t size, bool *ok, char *errmsg)
+{
+    struct UvOsUring ring;    /* io_uring instance */
+    struct io_uring_sqe *sqe; /* Submission entry of the probe write */
+    struct io_uring_cqe *cqe; /* Completion entry of the probe write */
+    uv_buf_t buf;             /* Buffer to use for the probe write */
+    int event_fd;
+    int rv;
+
+    *ok = false;
+
+    /* The kernel might be too old, or io_uring might have been disabled (e.g.
+     * by a seccomp policy): in that case just report it as not available. */
+    rv = UvOsUringInit(&ring, 1);
+    if (rv != 0) {
+        return 0;
+    }
+
+    rv = UvOsUringRegister(&ring, IORING_REGISTER_FILES, &fd, 1);
+    if (rv != 0) {
+        goto out;
+    }
+
+    event_fd = UvOsEventfd(0, UV_FS_O_NONBLOCK);
+    if (event_fd < 0) {
+        /* UNTESTED: should fail only with ENOMEM */
+        UvOsErrMsg(errmsg, "eventfd", event_fd);
+        UvOsUringClose(&ring);
+        return RAFT_IOERR;
+    }
+    rv = UvOsUringRegister(&ring, IORING_REGISTER_EVENTFD, &event_fd, 1);
+    if (rv != 0) {
+        goto out_after_event_fd;
+    }
+
+    /* Allocate the write buffer */
+    buf.len = size;
+    buf.base = raft_aligned_alloc(size, size);
+    if (buf.base == NULL) {
+        ErrMsgOom(errmsg);
+        UvOsClose(event_fd);
+        UvOsUringClose(&ring);
+        return RAFT_NOMEM;
+    }
+    memset(buf.base, 0, size);
+
+    sqe = UvOsUringGetSqe(&ring);
+    assert(sqe != NULL);
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (uint64_t)(uintptr_t)&buf;
+    sqe->len = 1;
+    sqe->off = 0;
+
+    /* Submit the write and wait for it to complete. */
+    rv = UvOsUringSubmit(&ring, 1);
+    if (rv == 0) {
+        cqe = UvOsUringPeekCqe(&ring);
+        assert(cqe != NULL);
+        /* Older kernels fail with EINVAL if the opcode is unknown. */
+        *ok = cqe->res == (int)size;
+        UvOsUringCqeSeen(&ring);
+    }
+
+    raft_aligned_free(size, buf.base);
+
+out_after_event_fd:
+    UvOsClose(event_fd);
+out:
+    UvOsUringClose(&ring);
+    return 0;
+}
+#endif /* UV__HAVE_IO_URING */
+
 #define UV__FS_PROBE_FILE ".probe"
 #define UV__FS_PROBE_FILE_SIZE 4096
 
 int UvFsProbeCapabilities(const char *dir,
                           size_t *direct,
                           bool *async,
+                          bool *uring,
                           char *errmsg)
 {
     int fd; /* File descriptor of the probe file */
@@ -705,17 +915,27 @@ int UvFsProbeCapabilities(const char *dir,
      * I/O, because io_submit might potentially block. */
     if (*direct == 0) {
         *async = false;
-        goto out;
+    } else {
+        rv = probeAsyncIO(fd, *direct, async, errmsg);
+        if (rv != 0) {
+            goto err_after_file_open;
+        }
     }
-    rv = probeAsyncIO(fd, *direct, async, errmsg);
+#endif /* RWF_NOWAIT */
+
+#if !defined(UV__HAVE_IO_URING)
+    *uring = false;
+#else
+    /* Unlike io_submit, io_uring_enter never blocks on buffered writes, since
+     * the kernel offloads them to its own workers, so there's no need for
+     * direct I/O. */
+    rv = probeUringIO(fd, *direct != 0 ? *direct : UV__FS_PROBE_FILE_SIZE,
+                      uring, errmsg);
     if (rv != 0) {
         goto err_after_file_open;
     }
-#endif /* RWF_NOWAIT */
+#endif /* UV__HAVE_IO_URING */
 
-#if defined(RWF_NOWAIT)
-out:
-#endif /* RWF_NOWAIT */
     close(fd);
     return 0;
 
@@ -87,6 +87,24 @@ int UvFsReadFileInto(const char *dir,
                      struct raft_buffer *buf,
                      char *errmsg);
 
+/* Read at most buf->len bytes from the given file into buf->base, starting at
+ * the given offset. Set buf->len to the number of bytes actually read, which is
+ * less than requested only if the end of the file was reached. */
+int UvFsReadFileAt(const char *dir,
+                   const char *filename,
+                   off_t offset,
+                   struct raft_buffer *buf,
+                   char *errmsg);
+
+/* Write the given buffer at the given offset of a file, creating the file if
+ * needed and truncating it to the given offset first, then sync it. Fail if the
+ * file is shorter than the offset. */
+int UvFsWriteFileAt(const char *dir,
+                    const char *filename,
+                    off_t offset,
+                    const struct raft_buffer *buf,
+                    char *errmsg);
+
 /* Synchronously remove a file, calling the unlink() system call. */
 int UvFsRemoveFile(const char *dir, const char *filename, char *errmsg);
 
@@ -97,6 +115,12 @@ int UvFsTruncateAndRenameFile(const char *dir,
                               const char *filename2,
                               char *errmsg);
 
+/* Synchronously rename a file. */
+int UvFsRenameFile(const char *dir,
+                   const char *filename1,
+                   const char *filename2,
+                   char *errmsg);
+
 /* Return information about the I/O capabilities of the underlying file
  * system.
  *
@@ -104,10 +128,14 @@ int UvFsTruncateAndRenameFile(const char *dir,
  * to the block size to use for direct I/O otherwise.
  *
  * The @async parameter will be set to true if fully asynchronous I/O is
- * possible using the KAIO API. */
+ * possible using the KAIO API.
+ *
+ * The @uring parameter will be set to true if writes can be performed using the
+ * io_uring API, which is then preferred over KAIO. */
 int UvFsProbeCapabilities(const char *dir,
                           size_t *direct,
                           bool *async,
+                          bool *uring,
                           char *errmsg);
 
 #endif /* UV_FS_H_ */
@@ -0,0 +1,384 @@
+#include <string.h>
+
+#include "../include/raft/uv.h"
+#include "assert.h"
+#include "configuration.h"
+#include "entry.h"
+#include "heap.h"
+#include "uv.h"
+
+/* A host owns a @raft_io instance of its own, which we call the network
+ * instance. It has no data directory and is only ever used to send and
+ * receive messages over the shared transport, with send batching always
+ * enabled.
+ *
+ * Messages sent by an attached group are handed to the network instance,
+ * which tags them with the group ID and writes them out using the single
+ * connection it holds for each peer node. Since batching is enabled, all
+ * messages sent to the same node during a loop iteration, by any group, go out
+ * with a single write.
+ *
+ * Messages received by the network instance are dispatched to the group whose
+ * ID matches their tag, looking it up by binary search in the array of
+ * attached groups. Messages for groups which are not attached, for example
+ * because they have not been started yet or are being closed, are dropped.
+ *
+ * A single timer ticks all attached groups, so the heartbeats they send out
+ * are aligned and end up in the same writes.
+ *
+ * If a shared write-ahead log is set, the entries of all groups are stored in
+ * it instead of in their own segments (see uv_wal.c). */
+
+/* Initial capacity of the array of attached groups. */
+#define UV__HOST_INITIAL_CAP 8
+
+/* Wraps a send request submitted by a group. */
+struct uvHostSend
+{
+    struct raft_io_send req;   /* Request submitted to the network instance */
+    struct raft_io_send *user; /* Request submitted by the group */
+};
+
+/* Return the position of the group with the given ID in the array of attached
+ * groups, or the position where it should be inserted. */
+static unsigned uvHostSearch(struct UvHost *h, unsigned long long group)
+{
+    unsigned lo = 0;
+    unsigned hi = h->n_groups;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (h->groups[mid]->group < group) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Return the attached group with the given ID, if any. */
+static struct uv *uvHostFind(struct UvHost *h, unsigned long long group)
+{
+    unsigned i = uvHostSearch(h, group);
+    if (i < h->n_groups && h->groups[i]->group == group) {
+        return h->groups[i];
+    }
+    return NULL;
+}
+
+/* Release the memory of a message that no group will consume. */
+static void uvHostDiscard(struct raft_message *message)
+{
+    switch (message->type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            entryBatchesDestroy(message->append_entries.entries,
+                                message->append_entries.n_entries);
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            configurationClose(&message->install_snapshot.conf);
+            raft_free(message->install_snapshot.data.base);
+            break;
+    }
+}
+
+/* Dispatch a message received by the network instance. */
+static void uvHostRecvCb(struct uv *net,
+                         unsigned long long group,
+                         struct raft_message *message)
+{
+    struct UvHost *h = net->io->data;
+    struct uv *uv = uvHostFind(h, group);
+    if (uv == NULL) {
+        Tracef(net->tracer, "drop message for unknown group %llu", group);
+        uvHostDiscard(message);
+        return;
+    }
+    uv->recv_cb(uv->io, message);
+}
+
+/* Tick all attached groups. */
+static void uvHostTimerCb(uv_timer_t *timer)
+{
+    struct UvHost *h = timer->data;
+    unsigned i = 0;
+    while (i < h->n_groups) {
+        struct uv *uv = h->groups[i];
+        if (uv->tick_cb != NULL) {
+            uv->tick_cb(uv->io);
+        }
+        /* The tick callback might have closed a group, shifting the ones that
+         * follow it. */
+        if (i < h->n_groups && h->groups[i] == uv) {
+            i++;
+        }
+    }
+}
+
+int UvHostAttach(struct uv *uv, unsigned msecs)
+{
+    struct UvHost *h = uv->host;
+    unsigned i;
+    int rv;
+
+    i = uvHostSearch(h, uv->group);
+    if (i < h->n_groups && h->groups[i]->group == uv->group) {
+        ErrMsgPrintf(uv->io->errmsg, "group %llu is already attached",
+                     uv->group);
+        return RAFT_DUPLICATEID;
+    }
+
+    if (h->n_groups == h->cap_groups) {
+        unsigned cap = h->cap_groups == 0 ? UV__HOST_INITIAL_CAP
+                                          : h->cap_groups * 2;
+        struct uv **groups = HeapRealloc(h->groups, cap * sizeof *groups);
+        if (groups == NULL) {
+            ErrMsgOom(uv->io->errmsg);
+            return RAFT_NOMEM;
+        }
+        h->groups = groups;
+        h->cap_groups = cap;
+    }
+
+    memmove(&h->groups[i + 1], &h->groups[i],
+            (h->n_groups - i) * sizeof *h->groups);
+    h->groups[i] = uv;
+    h->n_groups++;
+
+    if (h->n_groups == 1) {
+        rv = uv_timer_start(&h->timer, uvHostTimerCb, msecs, msecs);
+        assert(rv == 0);
+    }
+
+    return 0;
+}
+
+void UvHostDetach(struct uv *uv)
+{
+    struct UvHost *h = uv->host;
+    unsigned i;
+    int rv;
+
+    i = uvHostSearch(h, uv->group);
+    if (i == h->n_groups || h->groups[i] != uv) {
+        return;
+    }
+
+    h->n_groups--;
+    memmove(&h->groups[i], &h->groups[i + 1],
+            (h->n_groups - i) * sizeof *h->groups);
+
+    if (h->n_groups == 0) {
+        rv = uv_timer_stop(&h->timer);
+        assert(rv == 0);
+    }
+
+    UvSendCancel(h->io.impl, uv);
+}
+
+static void uvHostSendCb(struct raft_io_send *req, int status)
+{
+    struct uvHostSend *send = (struct uvHostSend *)req;
+    struct raft_io_send *user = send->user;
+    struct uv *uv = req->data;
+
+    HeapFree(send);
+    uv->host_sends--;
+
+    if (user->cb != NULL) {
+        user->cb(user, status);
+    }
+
+    uvMaybeFireCloseCb(uv);
+}
+
+int UvHostSend(struct uv *uv,
+               struct raft_io_send *req,
+               const struct raft_message *message,
+               raft_io_send_cb cb)
+{
+    struct UvHost *h = uv->host;
+    struct uvHostSend *send;
+    int rv;
+
+    assert(!uv->closing);
+
+    send = HeapMalloc(sizeof *send);
+    if (send == NULL) {
+        return RAFT_NOMEM;
+    }
+    send->req.data = uv;
+    send->user = req;
+    req->cb = cb;
+
+    rv = UvSendGroup(h->io.impl, &send->req, message, uv->group, uvHostSendCb);
+    if (rv != 0) {
+        HeapFree(send);
+        return rv;
+    }
+    uv->host_sends++;
+
+    return 0;
+}
+
+int raft_uv_host_init(struct raft_uv_host *host,
+                      struct uv_loop_s *loop,
+                      struct raft_uv_transport *transport)
+{
+    struct UvHost *h;
+    struct uv *net;
+    int rv;
+
+    assert(host != NULL);
+    assert(loop != NULL);
+    assert(transport != NULL);
+
+    h = HeapMalloc(sizeof *h);
+    if (h == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+
+    h->host = host;
+    h->loop = loop;
+    h->transport = transport;
+    h->id = 0;
+    h->groups = NULL;
+    h->n_groups = 0;
+    h->cap_groups = 0;
+    h->io_closed = false;
+    h->timer_closed = false;
+    h->wal = NULL;
+    h->wal_closed = true;
+    h->close_cb = NULL;
+
+    h->io.data = h;
+    rv = raft_uv_init(&h->io, loop, "", transport);
+    if (rv != 0) {
+        goto err_after_alloc;
+    }
+    net = h->io.impl;
+    net->send_batching = true;
+    net->group_recv_cb = uvHostRecvCb;
+
+    rv = uv_timer_init(loop, &h->timer);
+    assert(rv == 0); /* This should never fail */
+    h->timer.data = h;
+
+    host->impl = h;
+
+    return 0;
+
+err_after_alloc:
+    HeapFree(h);
+err:
+    assert(rv != 0);
+    if (rv == RAFT_NOMEM) {
+        ErrMsgOom(host->errmsg);
+    }
+    return rv;
+}
+
+int raft_uv_host_start(struct raft_uv_host *host,
+                       raft_id id,
+                       const char *address)
+{
+    struct UvHost *h = host->impl;
+    struct uv *net = h->io.impl;
+    int rv;
+
+    assert(net->state == UV__PRISTINE);
+
+    rv = h->transport->init(h->transport, id, address);
+    if (rv != 0) {
+        ErrMsgTransfer(h->transport->errmsg, host->errmsg, "transport");
+        return rv;
+    }
+    h->transport->data = net;
+    h->id = id;
+    net->id = id;
+    net->state = UV__ACTIVE;
+
+    rv = UvRecvStart(net);
+    if (rv != 0) {
+        ErrMsgTransfer(h->transport->errmsg, host->errmsg, "listen");
+        return rv;
+    }
+
+    return 0;
+}
+
+int raft_uv_host_set_wal(struct raft_uv_host *host, const char *dir)
+{
+    struct UvHost *h = host->impl;
+    struct uv *net = h->io.impl;
+    int rv;
+
+    assert(h->wal == NULL);
+
+    rv = UvWalOpen(h->loop, dir, net->segment_size, &h->wal, host->errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+    h->wal_closed = false;
+
+    return 0;
+}
+
+struct raft_io *raft_uv_host_io(struct raft_uv_host *host)
+{
+    struct UvHost *h = host->impl;
+    return &h->io;
+}
+
+static void uvHostMaybeFireCloseCb(struct UvHost *h)
+{
+    struct raft_uv_host *host = h->host;
+    raft_uv_host_close_cb cb = h->close_cb;
+
+    if (!h->io_closed || !h->timer_closed || !h->wal_closed) {
+        return;
+    }
+
+    raft_uv_close(&h->io);
+    HeapFree(h->groups);
+    HeapFree(h);
+    host->impl = NULL;
+
+    if (cb != NULL) {
+        cb(host);
+    }
+}
+
+static void uvHostIoCloseCb(struct raft_io *io)
+{
+    struct UvHost *h = io->data;
+    h->io_closed = true;
+    uvHostMaybeFireCloseCb(h);
+}
+
+static void uvHostWalCloseCb(void *data)
+{
+    struct UvHost *h = data;
+    h->wal = NULL;
+    h->wal_closed = true;
+    uvHostMaybeFireCloseCb(h);
+}
+
+static void uvHostTimerCloseCb(uv_handle_t *handle)
+{
+    struct UvHost *h = handle->data;
+    h->timer_closed = true;
+    uvHostMaybeFireCloseCb(h);
+}
+
+void raft_uv_host_close(struct raft_uv_host *host, raft_uv_host_close_cb cb)
+{
+    struct UvHost *h = host->impl;
+    assert(h->n_groups == 0);
+    h->close_cb = cb;
+    h->io.close(&h->io, uvHostIoCloseCb);
+    uv_close((struct uv_handle_s *)&h->timer, uvHostTimerCloseCb);
+    if (h->wal != NULL) {
+        UvWalClose(h->wal, uvHostWalCloseCb, h);
+    }
+}
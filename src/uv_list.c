@@ -10,7 +10,7 @@
 #endif
 
 static const char *uvListIgnored[] = {".", "..", "metadata1", "metadata2",
-                                      NULL};
+                                      UV__SNAPSHOT_PARTIAL, NULL};
 
 /* Return true if the given filename should be ignored. */
 static bool uvListShouldIgnore(const char *filename)
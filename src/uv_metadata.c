@@ -1,5 +1,7 @@
 #include "assert.h"
 #include "byte.h"
+#include "heap.h"
+#include "queue.h"
 #include "uv.h"
 #include "uv_encoding.h"
 
@@ -171,7 +173,12 @@ static unsigned short uvMetadataFileIndex(unsigned long long version)
     return version % 2 == 1 ? 1 : 2;
 }
 
-int uvMetadataStore(struct uv *uv, const struct uvMetadata *metadata)
+/* Write the metadata file associated with the version of the given metadata.
+ * This doesn't touch the uv instance, so it's safe to call it from the
+ * threadpool. */
+static int uvMetadataWrite(const char *dir,
+                           const struct uvMetadata *metadata,
+                           char *errmsg)
 {
     char filename[METADATA_FILENAME_SIZE];  /* Filename of the metadata file */
     uint8_t content[METADATA_CONTENT_SIZE]; /* Content of metadata file */
@@ -191,11 +198,206 @@ int uvMetadataStore(struct uv *uv, const struct uvMetadata *metadata)
     /* Write the metadata file, creating it if it does not exist. */
     buf.base = content;
     buf.len = sizeof content;
-    rv = UvFsMakeOrOverwriteFile(uv->dir, filename, &buf, uv->io->errmsg);
+    rv = UvFsMakeOrOverwriteFile(dir, filename, &buf, errmsg);
     if (rv != 0) {
-        ErrMsgWrapf(uv->io->errmsg, "persist %s", filename);
+        ErrMsgWrapf(errmsg, "persist %s", filename);
         return rv;
     }
 
     return 0;
 }
+
+int uvMetadataStore(struct uv *uv, const struct uvMetadata *metadata)
+{
+    /* Synchronous writes can't race with an asynchronous one. */
+    assert(uv->metadata_inflight == NULL);
+    assert(QUEUE_IS_EMPTY(&uv->metadata_reqs));
+    return uvMetadataWrite(uv->dir, metadata, uv->io->errmsg);
+}
+
+/* Pending asynchronous metadata request. */
+struct uvMetadataReq
+{
+    struct raft_io_set_meta *req; /* User request */
+    queue queue;                  /* Link in the pending or write queue */
+};
+
+/* Write of the metadata executed in the threadpool, covering all requests
+ * submitted before it started. */
+struct uvMetadataWriteReq
+{
+    struct uv *uv;                     /* Owning instance */
+    struct uvMetadata metadata;        /* Snapshot of the metadata to write */
+    queue reqs;                        /* Requests covered by this write */
+    struct uv_work_s work;             /* Threadpool work handle */
+    int status;                        /* Result of the write */
+    char errmsg[RAFT_ERRMSG_BUF_SIZE]; /* Error details */
+};
+
+/* Move all requests from a queue to another. */
+static void uvMetadataMoveReqs(queue *from, queue *to)
+{
+    while (!QUEUE_IS_EMPTY(from)) {
+        queue *head;
+        head = QUEUE_HEAD(from);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(to, head);
+    }
+}
+
+/* Fire the callbacks of all requests in the given queue. */
+static void uvMetadataFireReqs(queue *reqs, int status)
+{
+    while (!QUEUE_IS_EMPTY(reqs)) {
+        struct uvMetadataReq *req;
+        queue *head;
+        head = QUEUE_HEAD(reqs);
+        QUEUE_REMOVE(head);
+        req = QUEUE_DATA(head, struct uvMetadataReq, queue);
+        req->req->cb(req->req, status);
+        HeapFree(req);
+    }
+}
+
+static void uvMetadataWorkCb(uv_work_t *work)
+{
+    struct uvMetadataWriteReq *write = work->data;
+    write->status =
+        uvMetadataWrite(write->uv->dir, &write->metadata, write->errmsg);
+}
+
+static void uvMetadataStart(struct uv *uv);
+
+static void uvMetadataAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uvMetadataWriteReq *write = work->data;
+    struct uv *uv = write->uv;
+    assert(status == 0); /* We don't cancel worker requests */
+    assert(uv->metadata_inflight == write);
+    uv->metadata_inflight = NULL;
+
+    if (write->status != 0) {
+        uv->errored = true;
+        ErrMsgTransfer(write->errmsg, uv->io->errmsg, "write metadata");
+    }
+    uvMetadataFireReqs(&write->reqs, write->status);
+    HeapFree(write);
+
+    /* Requests submitted while this write was in flight were not started by
+     * the prepare callback, start them now. */
+    if (!uv->closing && !QUEUE_IS_EMPTY(&uv->metadata_reqs)) {
+        uvMetadataStart(uv);
+    }
+
+    uvMaybeFireCloseCb(uv);
+}
+
+/* Start writing the cached metadata, covering all pending requests. */
+static void uvMetadataStart(struct uv *uv)
+{
+    struct uvMetadataWriteReq *write;
+    int rv;
+
+    assert(uv->metadata_inflight == NULL);
+    assert(!QUEUE_IS_EMPTY(&uv->metadata_reqs));
+
+    write = HeapMalloc(sizeof *write);
+    if (write == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    write->uv = uv;
+    write->work.data = write;
+    write->status = 0;
+
+    /* Bump the version for each write, so successive writes alternate between
+     * the two metadata files and never overwrite the last durable one. */
+    uv->metadata.version++;
+    write->metadata = uv->metadata;
+
+    QUEUE_INIT(&write->reqs);
+    uvMetadataMoveReqs(&uv->metadata_reqs, &write->reqs);
+
+    rv = uv_queue_work(uv->loop, &write->work, uvMetadataWorkCb,
+                       uvMetadataAfterWorkCb);
+    if (rv != 0) {
+        /* UNTESTED: with the current libuv implementation this can't fail. */
+        uvMetadataMoveReqs(&write->reqs, &uv->metadata_reqs);
+        HeapFree(write);
+        rv = RAFT_IOERR;
+        goto err;
+    }
+    uv->metadata_inflight = write;
+
+    return;
+
+err:
+    assert(rv != 0);
+    uvMetadataFireReqs(&uv->metadata_reqs, rv);
+}
+
+static void uvMetadataIdleCb(uv_prepare_t *handle)
+{
+    struct uv *uv = handle->data;
+    uv_prepare_stop(handle);
+    if (uv->metadata_inflight != NULL || QUEUE_IS_EMPTY(&uv->metadata_reqs)) {
+        return;
+    }
+    uvMetadataStart(uv);
+}
+
+int uvMetadataSubmit(struct uv *uv,
+                     struct raft_io_set_meta *req,
+                     raft_io_set_meta_cb cb)
+{
+    struct uvMetadataReq *r;
+    int rv;
+
+    assert(!uv->closing);
+
+    if (uv->metadata_idle.data == NULL) {
+        rv = uv_prepare_init(uv->loop, &uv->metadata_idle);
+        if (rv != 0) {
+            /* UNTESTED: with the current libuv implementation this can't
+             * fail. */
+            ErrMsgPrintf(uv->io->errmsg, "uv_prepare_init: %s",
+                         uv_strerror(rv));
+            return RAFT_IOERR;
+        }
+        uv->metadata_idle.data = uv;
+    }
+
+    r = HeapMalloc(sizeof *r);
+    if (r == NULL) {
+        ErrMsgOom(uv->io->errmsg);
+        return RAFT_NOMEM;
+    }
+    r->req = req;
+    req->cb = cb;
+    QUEUE_PUSH(&uv->metadata_reqs, &r->queue);
+
+    /* Wait until the end of the current loop iteration, so all updates
+     * submitted in the meantime are covered by the same write. */
+    if (uv->metadata_inflight == NULL) {
+        uv_prepare_start(&uv->metadata_idle, uvMetadataIdleCb);
+    }
+
+    return 0;
+}
+
+static void uvMetadataIdleCloseCb(uv_handle_t *handle)
+{
+    struct uv *uv = handle->data;
+    assert(uv->closing);
+    handle->data = NULL;
+    uvMaybeFireCloseCb(uv);
+}
+
+void uvMetadataClose(struct uv *uv)
+{
+    assert(uv->closing);
+    uvMetadataFireReqs(&uv->metadata_reqs, RAFT_CANCELED);
+    if (uv->metadata_idle.data != NULL) {
+        uv_close((uv_handle_t *)&uv->metadata_idle, uvMetadataIdleCloseCb);
+    }
+}
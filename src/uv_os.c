@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/vfs.h>
@@ -225,3 +226,159 @@ int UvOsSetDirectIo(uv_file fd)
     }
     return 0;
 }
+
+#if defined(UV__HAVE_IO_URING)
+
+/* Map a region of the io_uring instance at the given offset. */
+static int uvOsUringMap(int fd, size_t size, off_t offset, void **ptr)
+{
+    *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, offset);
+    if (*ptr == MAP_FAILED) {
+        *ptr = NULL;
+        return -errno;
+    }
+    return 0;
+}
+
+int UvOsUringInit(struct UvOsUring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    uint8_t *sq;
+    uint8_t *cq;
+    int rv;
+
+    memset(ring, 0, sizeof *ring);
+    memset(&params, 0, sizeof params);
+
+    rv = io_uring_setup(entries, &params);
+    if (rv == -1) {
+        return -errno;
+    }
+    ring->fd = rv;
+    ring->entries = params.sq_entries;
+
+    ring->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes +
+                         params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    rv = uvOsUringMap(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING,
+                      &ring->sq_ring);
+    if (rv != 0) {
+        goto err;
+    }
+    rv = uvOsUringMap(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING,
+                      &ring->cq_ring);
+    if (rv != 0) {
+        goto err;
+    }
+    rv = uvOsUringMap(ring->fd, ring->sqes_size, IORING_OFF_SQES,
+                      (void **)&ring->sqes);
+    if (rv != 0) {
+        goto err;
+    }
+
+    sq = ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 0;
+
+err:
+    UvOsUringClose(ring);
+    return rv;
+}
+
+void UvOsUringClose(struct UvOsUring *ring)
+{
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+int UvOsUringRegister(struct UvOsUring *ring,
+                      unsigned opcode,
+                      const void *arg,
+                      unsigned nr_args)
+{
+    int rv;
+    rv = io_uring_register(ring->fd, opcode, arg, nr_args);
+    if (rv == -1) {
+        return -errno;
+    }
+    return 0;
+}
+
+struct io_uring_sqe *UvOsUringGetSqe(struct UvOsUring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    unsigned index;
+    struct io_uring_sqe *sqe;
+    if (tail - head >= ring->entries) {
+        return NULL;
+    }
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    ring->sq_array[index] = index;
+    return sqe;
+}
+
+int UvOsUringSubmit(struct UvOsUring *ring, unsigned wait)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int rv;
+
+    /* Publish the entry filled by the caller. */
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    do {
+        rv = io_uring_enter(ring->fd, 1, wait, flags, NULL);
+    } while (rv == -1 && errno == EINTR);
+
+    if (rv == -1) {
+        rv = -errno;
+        /* The kernel didn't consume the entry, take it back. */
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        return rv;
+    }
+    assert(rv == 1);
+    return 0;
+}
+
+struct io_uring_cqe *UvOsUringPeekCqe(struct UvOsUring *ring)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void UvOsUringCqeSeen(struct UvOsUring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* UV__HAVE_IO_URING */
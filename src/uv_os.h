@@ -9,6 +9,16 @@
 #include <sys/types.h>
 #include <uv.h>
 
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+/* Whether the io_uring API can be used. Registering an eventfd to get notified
+ * about completions requires Linux 5.2 headers. */
+#if HAVE_LINUX_IO_URING_H && HAVE_DECL_IORING_REGISTER_EVENTFD
+#define UV__HAVE_IO_URING
+#endif
+
 /* For backward compat with older libuv */
 #if !defined(UV_FS_O_RDONLY)
 #define UV_FS_O_RDONLY O_RDONLY
@@ -116,6 +126,59 @@ int UvOsIoGetevents(aio_context_t ctx,
 int UvOsEventfd(unsigned int initval, int flags);
 int UvOsSetDirectIo(uv_file fd);
 
+#if defined(UV__HAVE_IO_URING)
+
+/* Minimal io_uring instance, with its submission and completion rings mapped
+ * in memory. Only a single thread is supposed to submit requests and reap
+ * completions. */
+struct UvOsUring
+{
+    int fd;                    /* Ring file descriptor */
+    unsigned entries;          /* Number of submission queue entries */
+    void *sq_ring;             /* Mapped submission queue ring */
+    size_t sq_ring_size;       /* Size of the sq_ring mapping */
+    void *cq_ring;             /* Mapped completion queue ring */
+    size_t cq_ring_size;       /* Size of the cq_ring mapping */
+    struct io_uring_sqe *sqes; /* Mapped submission queue entries */
+    size_t sqes_size;          /* Size of the sqes mapping */
+    unsigned *sq_head;         /* Consumed by the kernel up to here */
+    unsigned *sq_tail;         /* Produced by us up to here */
+    unsigned *sq_mask;         /* Mask to apply to sq_head and sq_tail */
+    unsigned *sq_array;        /* Indexes into the sqes array */
+    unsigned *cq_head;         /* Consumed by us up to here */
+    unsigned *cq_tail;         /* Produced by the kernel up to here */
+    unsigned *cq_mask;         /* Mask to apply to cq_head and cq_tail */
+    struct io_uring_cqe *cqes; /* Completion queue entries */
+};
+
+/* Create a new io_uring instance and map its rings. */
+int UvOsUringInit(struct UvOsUring *ring, unsigned entries);
+
+/* Unmap the rings and close the io_uring instance. */
+void UvOsUringClose(struct UvOsUring *ring);
+
+/* Portable io_uring_register() */
+int UvOsUringRegister(struct UvOsUring *ring,
+                      unsigned opcode,
+                      const void *arg,
+                      unsigned nr_args);
+
+/* Return the next free submission queue entry, zeroed, or NULL if the
+ * submission queue is full. */
+struct io_uring_sqe *UvOsUringGetSqe(struct UvOsUring *ring);
+
+/* Submit the entry previously returned by UvOsUringGetSqe, possibly waiting for
+ * @wait completions to be available. */
+int UvOsUringSubmit(struct UvOsUring *ring, unsigned wait);
+
+/* Return the oldest unseen completion queue entry, or NULL if there's none. */
+struct io_uring_cqe *UvOsUringPeekCqe(struct UvOsUring *ring);
+
+/* Mark the completion entry returned by UvOsUringPeekCqe as consumed. */
+void UvOsUringCqeSeen(struct UvOsUring *ring);
+
+#endif /* UV__HAVE_IO_URING */
+
 /* Format an error message caused by a failed system call or stdlib function. */
 #define UvOsErrMsg(ERRMSG, SYSCALL, ERRNUM)              \
     {                                                    \
@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "assert.h"
+#include "entry.h"
+#include "heap.h"
+#include "uv.h"
+
+#if 0
+#define tracef(...) Tracef(c->uv->tracer, __VA_ARGS__)
+#else
+#define tracef(...)
+#endif
+
+/* Track a read entries request. */
+struct uvRead
+{
+    struct uv *uv;
+    struct raft_io_read *req;
+    raft_index index;            /* Index of the first entry to read */
+    unsigned n;                  /* Maximum number of entries to read */
+    struct raft_entry *entries;  /* Entries read, sharing a single batch */
+    unsigned n_entries;          /* Number of entries read */
+    uv_work_t work;
+    int status;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    queue queue;
+};
+
+/* Load the closed segment containing the requested index and keep only the
+ * requested range of its entries. Entries still sitting in open segments are
+ * not available and yield RAFT_NOTFOUND. */
+static void uvReadWorkCb(uv_work_t *work)
+{
+    struct uvRead *read = work->data;
+    struct uv *uv = read->uv;
+    struct uvSnapshotInfo *snapshots;
+    struct uvSegmentInfo *segments;
+    struct uvSegmentInfo *segment;
+    size_t n_snapshots;
+    size_t n_segments;
+    struct raft_entry *entries;
+    size_t n;
+    size_t offset;
+    size_t i;
+    int rv;
+
+    rv = UvList(uv, &snapshots, &n_snapshots, &segments, &n_segments,
+                read->errmsg);
+    if (rv != 0) {
+        goto err;
+    }
+    if (snapshots != NULL) {
+        HeapFree(snapshots);
+    }
+
+    segment = NULL;
+    for (i = 0; i < n_segments; i++) {
+        if (segments[i].is_open) {
+            continue;
+        }
+        if (read->index >= segments[i].first_index &&
+            read->index <= segments[i].end_index) {
+            segment = &segments[i];
+            break;
+        }
+    }
+    if (segment == NULL) {
+        ErrMsgPrintf(read->errmsg, "no closed segment contains entry %llu",
+                     read->index);
+        rv = RAFT_NOTFOUND;
+        goto err_after_list;
+    }
+
+    rv = uvSegmentLoadClosed(uv, segment, &entries, &n, read->errmsg);
+    if (rv != 0) {
+        ErrMsgWrapf(read->errmsg, "load closed segment %s", segment->filename);
+        goto err_after_list;
+    }
+
+    /* Move the requested range to the front of the array. All entries share
+     * the same batch, so the ones left past the range need no cleanup. */
+    offset = (size_t)(read->index - segment->first_index);
+    assert(offset < n);
+    n -= offset;
+    if (n > read->n) {
+        n = read->n;
+    }
+    memmove(entries, &entries[offset], n * sizeof *entries);
+
+    HeapFree(segments);
+
+    read->entries = entries;
+    read->n_entries = (unsigned)n;
+    read->status = 0;
+    return;
+
+err_after_list:
+    HeapFree(segments);
+err:
+    assert(rv != 0);
+    read->status = rv;
+}
+
+static void uvReadAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uvRead *read = work->data;
+    struct raft_io_read *req = read->req;
+    struct uv *uv = read->uv;
+    struct raft_entry *entries = read->entries;
+    unsigned n = read->n_entries;
+    int req_status = read->status;
+    assert(status == 0);
+
+    QUEUE_REMOVE(&read->queue);
+    HeapFree(read);
+
+    if (uv->closing) {
+        entryBatchesDestroy(entries, n);
+        entries = NULL;
+        n = 0;
+        req_status = RAFT_CANCELED;
+    }
+
+    req->cb(req, entries, n, req_status);
+    uvMaybeFireCloseCb(uv);
+}
+
+int UvRead(struct raft_io *io,
+           struct raft_io_read *req,
+           raft_index index,
+           unsigned n,
+           raft_io_read_cb cb)
+{
+    struct uv *uv;
+    struct uvRead *read;
+    int rv;
+
+    uv = io->impl;
+    assert(!uv->closing);
+    assert(index > 0);
+    assert(n > 0);
+
+    read = HeapMalloc(sizeof *read);
+    if (read == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    read->uv = uv;
+    read->req = req;
+    read->index = index;
+    read->n = n;
+    read->entries = NULL;
+    read->n_entries = 0;
+    read->status = 0;
+    read->work.data = read;
+    req->cb = cb;
+
+    QUEUE_PUSH(&uv->read_reqs, &read->queue);
+    rv = uv_queue_work(uv->loop, &read->work, uvReadWorkCb, uvReadAfterWorkCb);
+    if (rv != 0) {
+        QUEUE_REMOVE(&read->queue);
+        tracef("read entries: %s", uv_strerror(rv));
+        rv = RAFT_IOERR;
+        goto err_after_req_alloc;
+    }
+
+    return 0;
+
+err_after_req_alloc:
+    HeapFree(read);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+#undef tracef
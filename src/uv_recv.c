@@ -3,6 +3,7 @@
 #include "../include/raft/uv.h"
 #include "assert.h"
 #include "byte.h"
+#include "compress.h"
 #include "configuration.h"
 #include "err.h"
 #include "heap.h"
@@ -21,18 +22,32 @@
  *   transport invokes our accept callback.
  *
  * - A new server object is created and added to the servers array. It starts
- *   reading from the stream handle of the new connection.
+ *   reading from the stream handle of the new connection into a per-connection
+ *   receive buffer.
  *
- * - The RPC message preamble is read, which contains the message type and the
- *   message length.
+ * - The RPC message preamble is parsed, which contains the message type and
+ *   the message length.
  *
- * - The RPC message header is read, whose content depends on the message type.
+ * - The RPC message header is parsed, whose content depends on the message
+ *   type.
  *
  * - Optionally, the RPC message payload is read (for AppendEntries requests).
+ *   If the AppendEntries header says that the payload is compressed, it gets
+ *   decompressed once fully read.
  *
  * - The recv callback passed to raft_io->start() gets fired with the received
  *   message.
  *
+ * A single read from the socket typically contains several messages (e.g. a
+ * burst of heartbeats or AppendEntries results), so after each read we parse
+ * as many complete messages as are available in the receive buffer. Preambles
+ * and headers are decoded in place, without allocating memory. Payloads are
+ * always copied into a dedicated buffer, since their ownership is transfered
+ * to the user. Payloads larger than UV__SERVER_MAX_COPY bytes (and headers
+ * that don't fit in the receive buffer) are not accumulated in the receive
+ * buffer: a dedicated buffer is allocated as soon as their first bytes are
+ * seen and the rest is read directly into it.
+ *
  * Possible failure modes are:
  *
  * - The peer server disconnects. In this case the read callback will fire with
@@ -43,16 +58,28 @@
  *   handle and act like above.
  */
 
+/* Size of the per-connection receive buffer. */
+#define UV__SERVER_BUF_SIZE (64 * 1024)
+
+/* Payloads up to this size are accumulated in the receive buffer and then
+ * copied, larger ones are read directly into their own buffer. */
+#define UV__SERVER_MAX_COPY (16 * 1024)
+
 struct uvServer
 {
     struct uv *uv;               /* libuv I/O implementation object */
     raft_id id;                  /* ID of the remote server */
     char *address;               /* Address of the other server */
     struct uv_stream_s *stream;  /* Connection handle */
-    uv_buf_t buf;                /* Sliding buffer for reading incoming data */
+    char *rbuf;                  /* Receive buffer for incoming data */
+    size_t rbuf_start;           /* Offset of the first unparsed byte */
+    size_t rbuf_end;             /* Offset past the last received byte */
+    uv_buf_t buf;                /* Sliding buffer for reading directly */
     uint64_t preamble[2];        /* Static buffer with the request preamble */
-    uv_buf_t header;             /* Dynamic buffer with the request header */
+    uv_buf_t header;             /* Dynamic buffer with a large header */
     uv_buf_t payload;            /* Dynamic buffer with the request payload */
+    unsigned codec;              /* Codec of a compressed payload */
+    size_t decompressed_len;     /* Length of the payload once decompressed */
     struct raft_message message; /* The message being received */
     queue queue;                 /* Servers queue */
 };
@@ -72,6 +99,13 @@ static int uvServerInit(struct uvServer *s,
         return RAFT_NOMEM;
     }
     strcpy(s->address, address);
+    s->rbuf = HeapMalloc(UV__SERVER_BUF_SIZE);
+    if (s->rbuf == NULL) {
+        HeapFree(s->address);
+        return RAFT_NOMEM;
+    }
+    s->rbuf_start = 0;
+    s->rbuf_end = 0;
     s->stream = stream;
     s->stream->data = s;
     s->buf.base = NULL;
@@ -83,6 +117,8 @@ static int uvServerInit(struct uvServer *s,
     s->message.type = 0;
     s->payload.base = NULL;
     s->payload.len = 0;
+    s->codec = COMPRESSION_NONE;
+    s->decompressed_len = 0;
     QUEUE_PUSH(&uv->servers, &s->queue);
     return 0;
 }
@@ -92,8 +128,11 @@ static void uvServerDestroy(struct uvServer *s)
     QUEUE_REMOVE(&s->queue);
 
     if (s->header.base != NULL) {
-        /* This means we were interrupted while reading the header. */
+        /* This means we were interrupted while reading a large header. */
         HeapFree(s->header.base);
+    }
+    if (s->payload.len > 0) {
+        /* This means we were interrupted after having decoded the header. */
         switch (s->message.type) {
             case RAFT_IO_APPEND_ENTRIES:
                 HeapFree(s->message.append_entries.entries);
@@ -107,10 +146,25 @@ static void uvServerDestroy(struct uvServer *s)
         /* This means we were interrupted while reading the payload. */
         HeapFree(s->payload.base);
     }
+    HeapFree(s->rbuf);
     HeapFree(s->address);
     HeapFree(s->stream);
 }
 
+/* Move any unparsed data to the beginning of the receive buffer. */
+static void uvServerCompact(struct uvServer *s)
+{
+    size_t n = s->rbuf_end - s->rbuf_start;
+    if (s->rbuf_start == 0) {
+        return;
+    }
+    if (n > 0) {
+        memmove(s->rbuf, s->rbuf + s->rbuf_start, n);
+    }
+    s->rbuf_start = 0;
+    s->rbuf_end = n;
+}
+
 /* Invoked to initialize the read buffer for the next asynchronous read on the
  * socket. */
 static void uvServerAllocCb(uv_handle_t *handle,
@@ -122,51 +176,19 @@ static void uvServerAllocCb(uv_handle_t *handle,
 
     assert(!s->uv->closing);
 
-    /* If this is the first read of the preamble, or of the header, or of the
-     * payload, then initialize the read buffer, according to the chunk of data
-     * that we expect next. */
-    if (s->buf.len == 0) {
-        assert(s->buf.base == NULL);
-
-        /* Check if we expect the preamble. */
-        if (s->header.len == 0) {
-            assert(s->preamble[0] == 0);
-            assert(s->preamble[1] == 0);
-            s->buf.base = (char *)s->preamble;
-            s->buf.len = sizeof s->preamble;
-            goto out;
-        }
-
-        /* Check if we expect the header. */
-        if (s->payload.len == 0) {
-            assert(s->header.len > 0);
-            assert(s->header.base == NULL);
-            s->header.base = HeapMalloc(s->header.len);
-            if (s->header.base == NULL) {
-                /* Setting all buffer fields to 0 will make read_cb fail with
-                 * ENOBUFS. */
-                memset(buf, 0, sizeof *buf);
-                return;
-            }
-            s->buf = s->header;
-            goto out;
-        }
-
-        /* If we get here we should be expecting the payload. */
-        assert(s->payload.len > 0);
-        s->payload.base = HeapMalloc(s->payload.len);
-        if (s->payload.base == NULL) {
-            /* Setting all buffer fields to 0 will make read_cb fail with
-             * ENOBUFS. */
-            memset(buf, 0, sizeof *buf);
-            return;
-        }
-
-        s->buf = s->payload;
+    /* If we're in the middle of a large header or payload, read the rest of it
+     * directly into its dedicated buffer. */
+    if (s->buf.len > 0) {
+        *buf = s->buf;
+        return;
     }
 
-out:
-    *buf = s->buf;
+    /* Otherwise read as much as possible into the free tail of the receive
+     * buffer. */
+    uvServerCompact(s);
+    assert(s->rbuf_end < UV__SERVER_BUF_SIZE);
+    buf->base = s->rbuf + s->rbuf_end;
+    buf->len = UV__SERVER_BUF_SIZE - s->rbuf_end;
 }
 
 /* Callback invoked afer the stream handle of this server connection has been
@@ -191,7 +213,13 @@ static void uvServerAbort(struct uvServer *s)
 /* Invoke the receive callback. */
 static void uvFireRecvCb(struct uvServer *s)
 {
-    s->uv->recv_cb(s->uv->io, &s->message);
+    unsigned long long group = byteFlip64(s->preamble[0]) >> UV__GROUP_SHIFT;
+
+    if (group != 0) {
+        s->uv->group_recv_cb(s->uv, group, &s->message);
+    } else {
+        s->uv->recv_cb(s->uv->io, &s->message);
+    }
 
     /* Reset our state as we'll start reading a new message. We don't need to
      * release the payload buffer, since ownership was transfered to the
@@ -203,106 +231,291 @@ static void uvFireRecvCb(struct uvServer *s)
     s->header.len = 0;
     s->payload.base = NULL;
     s->payload.len = 0;
+    s->codec = COMPRESSION_NONE;
+    s->decompressed_len = 0;
 }
 
-/* Callback invoked when data has been read from the socket. */
-static void uvServerReadCb(uv_stream_t *stream,
-                           ssize_t nread,
-                           const uv_buf_t *buf)
+/* Decode the message header contained in the given buffer, and fire the recv
+ * callback if the message has no payload. */
+static int uvServerDecodeHeader(struct uvServer *s, const uv_buf_t *header)
 {
-    struct uvServer *s = stream->data;
+    uint64_t type;
     int rv;
 
-    (void)buf;
+    type = byteFlip64(s->preamble[0]);
 
-    assert(!s->uv->closing);
+    /* Messages tagged with a group ID can only be dispatched by a host, which
+     * in turn only accepts tagged messages. */
+    if ((type >> UV__GROUP_SHIFT != 0) != (s->uv->group_recv_cb != NULL)) {
+        Tracef(s->uv->tracer, "unexpected group %llu",
+               (unsigned long long)(type >> UV__GROUP_SHIFT));
+        return RAFT_MALFORMED;
+    }
+    type &= (1 << UV__GROUP_SHIFT) - 1;
 
-    /* If the read was successful, let's check if we have received all the data
-     * we expected. */
-    if (nread > 0) {
-        size_t n = (size_t)nread;
+    rv = uvDecodeMessage((unsigned long)type, header, &s->message,
+                         &s->payload.len);
+    if (rv != 0) {
+        Tracef(s->uv->tracer, "decode message: %s", errCodeToString(rv));
+        /* An AppendEntries header that failed to decode has no entries
+         * array, while a snapshot configuration might be partially filled. */
+        if (s->message.type == RAFT_IO_INSTALL_SNAPSHOT) {
+            configurationClose(&s->message.install_snapshot.conf);
+        }
+        s->payload.len = 0;
+        return rv;
+    }
 
-        /* We shouldn't have read more data than the pending amount. */
-        assert(n <= s->buf.len);
+    if (s->message.type == RAFT_IO_APPEND_ENTRIES) {
+        size_t len;
+        rv = uvDecodeAppendEntriesCompression(
+            header, &s->message.append_entries, &s->codec, &len);
+        if (rv == 0 && s->codec != COMPRESSION_NONE && s->payload.len == 0) {
+            rv = RAFT_MALFORMED;
+        }
+        if (rv != 0) {
+            Tracef(s->uv->tracer, "decode compression: %s",
+                   errCodeToString(rv));
+            HeapFree(s->message.append_entries.entries);
+            s->codec = COMPRESSION_NONE;
+            s->payload.len = 0;
+            return rv;
+        }
+        if (s->codec != COMPRESSION_NONE) {
+            s->decompressed_len = s->payload.len;
+            s->payload.len = len;
+        }
+    }
 
-        /* Advance the read window */
-        s->buf.base += n;
-        s->buf.len -= n;
+    s->message.server_id = s->id;
+    s->message.server_address = s->address;
 
-        /* If there's more data to read in order to fill the current
-         * read buffer, just return, we'll be invoked again. */
-        if (s->buf.len > 0) {
-            return;
+    /* If the message has no payload, we're done. */
+    if (s->payload.len == 0) {
+        uvFireRecvCb(s);
+    }
+
+    return 0;
+}
+
+/* Replace the fully received compressed payload with its decompressed
+ * content. */
+static int uvServerDecompressPayload(struct uvServer *s)
+{
+    struct raft_buffer compressed;
+    struct raft_buffer decompressed;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    int rv;
+
+    compressed.base = s->payload.base;
+    compressed.len = s->payload.len;
+    rv = compressionDecode(s->codec, &compressed, s->decompressed_len,
+                           &decompressed, errmsg);
+    if (rv != 0) {
+        Tracef(s->uv->tracer, "decompress payload: %s", errmsg);
+        return rv;
+    }
+    HeapFree(s->payload.base);
+    s->payload.base = decompressed.base;
+    s->payload.len = decompressed.len;
+    s->codec = COMPRESSION_NONE;
+
+    return 0;
+}
+
+/* Attach the fully received payload to the message and fire the recv
+ * callback. */
+static int uvServerFinishPayload(struct uvServer *s)
+{
+    int rv;
+
+    assert(s->payload.base != NULL);
+    assert(s->payload.len > 0);
+
+    if (s->codec != COMPRESSION_NONE) {
+        rv = uvServerDecompressPayload(s);
+        if (rv != 0) {
+            return rv;
         }
+    }
+
+    switch (s->message.type) {
+        case RAFT_IO_APPEND_ENTRIES:
+            uvDecodeEntriesBatch((uint8_t *)s->payload.base, 0,
+                                 s->message.append_entries.entries,
+                                 s->message.append_entries.n_entries);
+            break;
+        case RAFT_IO_INSTALL_SNAPSHOT:
+            s->message.install_snapshot.data.base = s->payload.base;
+            break;
+        default:
+            /* We should never have read a payload in the first place */
+            assert(0);
+    }
+
+    uvFireRecvCb(s);
+
+    return 0;
+}
 
+/* Parse as many complete messages as possible out of the receive buffer,
+ * firing the recv callback for each of them. */
+static int uvServerParse(struct uvServer *s)
+{
+    int rv;
+
+    assert(s->buf.len == 0);
+
+    /* Stop as soon as the connection gets closed, possibly by the recv
+     * callback itself. */
+    while (!uv_is_closing((struct uv_handle_s *)s->stream)) {
+        size_t avail = s->rbuf_end - s->rbuf_start;
+        char *cursor = s->rbuf + s->rbuf_start;
+        size_t n;
+
+        /* Check if we expect the preamble. */
         if (s->header.len == 0) {
-            /* If the header buffer is not set, it means that we've just
-             * completed reading the preamble. */
-            assert(s->header.base == NULL);
+            if (avail < sizeof s->preamble) {
+                break;
+            }
+            memcpy(s->preamble, cursor, sizeof s->preamble);
+            s->rbuf_start += sizeof s->preamble;
 
             s->header.len = (size_t)byteFlip64(s->preamble[1]);
 
             /* The length of the header must be greater than zero. */
             if (s->header.len == 0) {
                 Tracef(s->uv->tracer, "message has zero length");
-                goto abort;
+                return RAFT_MALFORMED;
             }
-        } else if (s->payload.len == 0) {
-            /* If the payload buffer is not set, it means we just completed
-             * reading the message header. */
-            uint64_t type;
+            continue;
+        }
+
+        /* Check if we expect the header. */
+        if (s->payload.len == 0) {
+            uv_buf_t header;
+            assert(s->header.base == NULL);
 
-            assert(s->header.base != NULL);
+            if (avail < s->header.len) {
+                /* Wait for the rest of the header to arrive, unless it would
+                 * not fit in the receive buffer. */
+                if (s->header.len <= UV__SERVER_BUF_SIZE) {
+                    break;
+                }
+                s->header.base = HeapMalloc(s->header.len);
+                if (s->header.base == NULL) {
+                    return RAFT_NOMEM;
+                }
+                memcpy(s->header.base, cursor, avail);
+                s->rbuf_start = 0;
+                s->rbuf_end = 0;
+                s->buf.base = s->header.base + avail;
+                s->buf.len = s->header.len - avail;
+                break;
+            }
 
-            type = byteFlip64(s->preamble[0]);
-            assert(type > 0);
+            /* The header decoders expect word-aligned data. */
+            if ((uintptr_t)cursor % sizeof(uint64_t) != 0) {
+                uvServerCompact(s);
+                cursor = s->rbuf;
+            }
 
-            rv = uvDecodeMessage((unsigned long)type, &s->header, &s->message,
-                                 &s->payload.len);
+            header.base = cursor;
+            header.len = s->header.len;
+            s->rbuf_start += header.len;
+            rv = uvServerDecodeHeader(s, &header);
             if (rv != 0) {
-                Tracef(s->uv->tracer, "decode message: %s",
-                       errCodeToString(rv));
-                goto abort;
+                return rv;
             }
+            continue;
+        }
+
+        /* If we get here we should be expecting the payload. Small payloads
+         * are accumulated in the receive buffer before being copied. */
+        assert(s->payload.base == NULL);
+        if (avail < s->payload.len && s->payload.len <= UV__SERVER_MAX_COPY) {
+            break;
+        }
+
+        s->payload.base = HeapMalloc(s->payload.len);
+        if (s->payload.base == NULL) {
+            return RAFT_NOMEM;
+        }
+
+        n = avail < s->payload.len ? avail : s->payload.len;
+        memcpy(s->payload.base, cursor, n);
+        s->rbuf_start += n;
 
-            s->message.server_id = s->id;
-            s->message.server_address = s->address;
+        if (n < s->payload.len) {
+            s->rbuf_start = 0;
+            s->rbuf_end = 0;
+            s->buf.base = s->payload.base + n;
+            s->buf.len = s->payload.len - n;
+            break;
+        }
+
+        rv = uvServerFinishPayload(s);
+        if (rv != 0) {
+            return rv;
+        }
+    }
+
+    return 0;
+}
+
+/* Callback invoked when data has been read from the socket. */
+static void uvServerReadCb(uv_stream_t *stream,
+                           ssize_t nread,
+                           const uv_buf_t *buf)
+{
+    struct uvServer *s = stream->data;
+    int rv;
+
+    (void)buf;
+
+    assert(!s->uv->closing);
+
+    /* If the read was successful, parse all the data we have received. */
+    if (nread > 0) {
+        size_t n = (size_t)nread;
+
+        if (s->buf.len > 0) {
+            /* We were reading a large header or payload directly into its
+             * own buffer: we shouldn't have read more data than the pending
+             * amount. */
+            assert(n <= s->buf.len);
+
+            /* Advance the read window */
+            s->buf.base += n;
+            s->buf.len -= n;
+
+            /* If there's more data to read in order to fill the current read
+             * buffer, just return, we'll be invoked again. */
+            if (s->buf.len > 0) {
+                return;
+            }
+            s->buf.base = NULL;
 
-            /* If the message has no payload, we're done. */
             if (s->payload.len == 0) {
-                uvFireRecvCb(s);
+                rv = uvServerDecodeHeader(s, &s->header);
+                if (rv != 0) {
+                    goto abort;
+                }
+            } else {
+                rv = uvServerFinishPayload(s);
+                if (rv != 0) {
+                    goto abort;
+                }
             }
         } else {
-            /* If we get here it means that we've just completed reading the
-             * payload. TODO: avoid converting from uv_buf_t */
-            struct raft_buffer payload;
-            assert(s->payload.base != NULL);
-            assert(s->payload.len > 0);
-
-            switch (s->message.type) {
-                case RAFT_IO_APPEND_ENTRIES:
-                    payload.base = s->payload.base;
-                    payload.len = s->payload.len;
-                    uvDecodeEntriesBatch(payload.base, 0,
-                                         s->message.append_entries.entries,
-                                         s->message.append_entries.n_entries);
-                    break;
-                case RAFT_IO_INSTALL_SNAPSHOT:
-                    s->message.install_snapshot.data.base = s->payload.base;
-                    break;
-                default:
-                    /* We should never have read a payload in the first place */
-                    assert(0);
-            }
-
-            uvFireRecvCb(s);
+            assert(s->rbuf_end + n <= UV__SERVER_BUF_SIZE);
+            s->rbuf_end += n;
         }
 
-        /* Mark that we're done with this chunk. When the alloc callback will
-         * trigger again it will notice that it needs to change the read
-         * buffer. */
-        assert(s->buf.len == 0);
-        s->buf.base = NULL;
+        rv = uvServerParse(s);
+        if (rv != 0) {
+            goto abort;
+        }
 
         return;
     }
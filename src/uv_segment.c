@@ -200,26 +200,69 @@ static int uvConsumeContent(const struct raft_buffer *content,
     return 0;
 }
 
-/* Load a single batch of entries from a segment.
+/* Check a padding record whose preamble has just been read, and consume the
+ * rest of it. */
+static int uvCheckPadding(const struct raft_buffer *content,
+                          size_t *offset,
+                          size_t start,
+                          void *checksums,
+                          void *batch,
+                          char *errmsg)
+{
+    uint64_t len;
+    uint32_t crc1;
+    uint32_t crc2;
+    char cause[RAFT_ERRMSG_BUF_SIZE];
+    int rv;
+
+    rv = uvConsumeContent(content, offset, sizeof(uint64_t), NULL, cause);
+    if (rv != 0) {
+        ErrMsgTransfer(cause, errmsg, "read padding");
+        return RAFT_IOERR;
+    }
+
+    crc1 = byteFlip32(((uint32_t *)checksums)[0]);
+    crc2 = byteCrc32(batch, sizeof(uint64_t) * 2, 0);
+    if (crc1 != crc2) {
+        ErrMsgPrintf(errmsg, "header checksum mismatch");
+        return RAFT_CORRUPT;
+    }
+
+    len = byteFlip64(((uint64_t *)batch)[1]);
+    if (len < UV__SEGMENT_PADDING_MIN || len % sizeof(uint64_t) != 0 ||
+        len > content->len - start) {
+        ErrMsgPrintf(errmsg, "invalid padding length %ju", len);
+        return RAFT_CORRUPT;
+    }
+    *offset = start + (size_t)len;
+
+    return 0;
+}
+
+/* Check the integrity of a single batch of entries in a segment, without
+ * decoding it.
  *
- * Set @last to #true if the loaded batch is the last one. */
-static int uvLoadEntriesBatch(struct uv *uv,
-                              const struct raft_buffer *content,
-                              struct raft_entry **entries,
-                              unsigned *n_entries,
-                              size_t *offset, /* Offset of last batch */
-                              bool *last)
+ * On success @offset is advanced past the end of the batch, @n is set to the
+ * number of entries in the batch and @header points to the batch header.
+ * Padding records are consumed too, in which case @n is set to 0. This doesn't
+ * allocate any memory, so it's safe to call from a worker thread. */
+static int uvCheckEntriesBatch(const struct raft_buffer *content,
+                               size_t *offset,
+                               unsigned *n,
+                               void **header,
+                               char *errmsg)
 {
-    void *checksums;           /* CRC32 checksums */
-    void *batch;               /* Entries batch */
-    unsigned long n;           /* Number of entries in the batch */
-    unsigned max_n;            /* Maximum number of entries we expect */
-    unsigned i;                /* Iterate through the entries */
-    struct raft_buffer header; /* Batch header */
-    struct raft_buffer data;   /* Batch data */
-    uint32_t crc1;             /* Target checksum */
-    uint32_t crc2;             /* Actual checksum */
-    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    void *checksums;   /* CRC32 checksums */
+    void *batch;       /* Entries batch */
+    unsigned long m;   /* Number of entries in the batch */
+    unsigned max_n;    /* Maximum number of entries we expect */
+    unsigned i;        /* Iterate through the entries */
+    size_t header_len; /* Size of the batch header */
+    size_t data_len;   /* Size of the batch data */
+    void *data;        /* Batch data */
+    uint32_t crc1;     /* Target checksum */
+    uint32_t crc2;     /* Actual checksum */
+    char cause[RAFT_ERRMSG_BUF_SIZE];
     size_t start;
     int rv;
 
@@ -228,25 +271,29 @@ static int uvLoadEntriesBatch(struct uv *uv,
 
     /* Read the checksums. */
     rv = uvConsumeContent(content, offset, sizeof(uint32_t) * 2, &checksums,
-                          errmsg);
+                          cause);
     if (rv != 0) {
-        ErrMsgTransfer(errmsg, uv->io->errmsg, "read preamble");
+        ErrMsgTransfer(cause, errmsg, "read preamble");
         return RAFT_IOERR;
     }
 
     /* Read the first 8 bytes of the batch, which contains the number of entries
      * in the batch. */
-    rv = uvConsumeContent(content, offset, sizeof(uint64_t), &batch, errmsg);
+    rv = uvConsumeContent(content, offset, sizeof(uint64_t), &batch, cause);
     if (rv != 0) {
-        ErrMsgTransfer(errmsg, uv->io->errmsg, "read preamble");
+        ErrMsgTransfer(cause, errmsg, "read preamble");
         return RAFT_IOERR;
     }
 
-    n = (size_t)byteFlip64(*(uint64_t *)batch);
-    if (n == 0) {
-        ErrMsgPrintf(uv->io->errmsg, "entries count in preamble is zero");
-        rv = RAFT_CORRUPT;
-        goto err;
+    m = (size_t)byteFlip64(*(uint64_t *)batch);
+    if (m == 0) {
+        rv = uvCheckPadding(content, offset, start, checksums, batch, errmsg);
+        if (rv != 0) {
+            goto err;
+        }
+        *n = 0;
+        *header = batch;
+        return 0;
     }
 
     /* Very optimistic upper bound of the number of entries we should
@@ -255,198 +302,527 @@ static int uvLoadEntriesBatch(struct uv *uv,
      * and payload). */
     max_n = UV__MAX_SEGMENT_SIZE / (sizeof(uint64_t) * 4);
 
-    if (n > max_n) {
-        ErrMsgPrintf(uv->io->errmsg,
-                     "entries count %lu in preamble is too high", n);
+    if (m > max_n) {
+        ErrMsgPrintf(errmsg, "entries count %lu in preamble is too high", m);
         rv = RAFT_CORRUPT;
         goto err;
     }
 
     /* Consume the batch header, excluding the first 8 bytes containing the
      * number of entries, which we have already read. */
-    header.len = uvSizeofBatchHeader(n);
-    header.base = batch;
-
-    rv = uvConsumeContent(content, offset,
-                          uvSizeofBatchHeader(n) - sizeof(uint64_t), NULL,
-                          errmsg);
+    header_len = uvSizeofBatchHeader(m);
+    rv = uvConsumeContent(content, offset, header_len - sizeof(uint64_t), NULL,
+                          cause);
     if (rv != 0) {
-        ErrMsgTransfer(errmsg, uv->io->errmsg, "read header");
+        ErrMsgTransfer(cause, errmsg, "read header");
         rv = RAFT_IOERR;
         goto err;
     }
 
     /* Check batch header integrity. */
     crc1 = byteFlip32(((uint32_t *)checksums)[0]);
-    crc2 = byteCrc32(header.base, header.len, 0);
+    crc2 = byteCrc32(batch, header_len, 0);
     if (crc1 != crc2) {
-        ErrMsgPrintf(uv->io->errmsg, "header checksum mismatch");
+        ErrMsgPrintf(errmsg, "header checksum mismatch");
         rv = RAFT_CORRUPT;
         goto err;
     }
 
-    /* Decode the batch header, allocating the entries array. */
-    rv = uvDecodeBatchHeader(header.base, entries, n_entries);
-    if (rv != 0) {
-        goto err;
+    /* Calculate the total size of the batch data. Each entry takes two words
+     * in the header, the size of its data being in the upper half of the
+     * second one. */
+    data_len = 0;
+    for (i = 0; i < m; i++) {
+        uint32_t *size = (uint32_t *)((uint8_t *)batch + sizeof(uint64_t) +
+                                      i * sizeof(uint64_t) * 2 +
+                                      sizeof(uint64_t) + sizeof(uint32_t));
+        data_len += byteFlip32(*size);
     }
 
-    /* Calculate the total size of the batch data */
-    data.len = 0;
-    for (i = 0; i < n; i++) {
-        data.len += (*entries)[i].buf.len;
-    }
-    data.base = (uint8_t *)content->base + *offset;
-
     /* Consume the batch data */
-    rv = uvConsumeContent(content, offset, data.len, NULL, errmsg);
+    rv = uvConsumeContent(content, offset, data_len, &data, cause);
     if (rv != 0) {
-        ErrMsgTransfer(errmsg, uv->io->errmsg, "read data");
+        ErrMsgTransfer(cause, errmsg, "read data");
         rv = RAFT_IOERR;
-        goto err_after_header_decode;
+        goto err;
     }
 
     /* Check batch data integrity. */
     crc1 = byteFlip32(((uint32_t *)checksums)[1]);
-    crc2 = byteCrc32(data.base, data.len, 0);
+    crc2 = byteCrc32(data, data_len, 0);
     if (crc1 != crc2) {
-        ErrMsgPrintf(uv->io->errmsg, "data checksum mismatch");
+        ErrMsgPrintf(errmsg, "data checksum mismatch");
         rv = RAFT_CORRUPT;
-        goto err_after_header_decode;
+        goto err;
     }
 
-    uvDecodeEntriesBatch(content->base, *offset - data.len, *entries,
-                         *n_entries);
-
-    *last = *offset == content->len;
+    *n = (unsigned)m;
+    *header = batch;
 
     return 0;
 
-err_after_header_decode:
-    HeapFree(*entries);
 err:
-    *entries = NULL;
-    *n_entries = 0;
     assert(rv != 0);
     *offset = start;
     return rv;
 }
 
-/* Append to @entries2 all entries in @entries1. */
-static int extendEntries(const struct raft_entry *entries1,
-                         const size_t n_entries1,
-                         struct raft_entry **entries2,
-                         size_t *n_entries2)
+/* Decode a batch of entries previously checked with uvCheckEntriesBatch(),
+ * filling the given @entries array, which must have room for @n entries. */
+static int uvDecodeEntriesBatchAt(const struct raft_buffer *content,
+                                  void *header,
+                                  unsigned n,
+                                  struct raft_entry *entries)
 {
-    struct raft_entry *entries; /* To re-allocate the given entries */
-    size_t i;
+    size_t offset;
+    int rv;
+
+    rv = uvDecodeBatchHeaderInto(header, entries, n);
+    if (rv != 0) {
+        return rv;
+    }
+
+    offset = (size_t)((uint8_t *)header - (uint8_t *)content->base);
+    offset += uvSizeofBatchHeader(n);
+    uvDecodeEntriesBatch(content->base, offset, entries, n);
+
+    return 0;
+}
+
+/* Make sure that the given entries array has room for at least @n entries,
+ * growing it geometrically so that appending batch after batch doesn't cost
+ * a reallocation each time. */
+static int uvEnsureEntriesCapacity(struct raft_entry **entries,
+                                   size_t *cap,
+                                   size_t n)
+{
+    struct raft_entry *new_entries;
+    size_t new_cap;
+
+    if (n <= *cap) {
+        return 0;
+    }
 
-    entries =
-        raft_realloc(*entries2, (*n_entries2 + n_entries1) * sizeof *entries);
-    if (entries == NULL) {
+    new_cap = *cap * 2;
+    if (new_cap < n) {
+        new_cap = n;
+    }
+
+    new_entries = raft_realloc(*entries, new_cap * sizeof *new_entries);
+    if (new_entries == NULL) {
         return RAFT_NOMEM;
     }
 
-    for (i = 0; i < n_entries1; i++) {
-        entries[*n_entries2 + i] = entries1[i];
+    *entries = new_entries;
+    *cap = new_cap;
+
+    return 0;
+}
+
+/* Load a single batch of entries from a segment, appending them to the given
+ * entries array.
+ *
+ * Set @last to #true if the loaded batch is the last one. */
+static int uvLoadEntriesBatch(struct uv *uv,
+                              const struct raft_buffer *content,
+                              struct raft_entry **entries,
+                              size_t *n_entries,
+                              size_t *cap,
+                              size_t *offset, /* Offset of last batch */
+                              bool *last)
+{
+    void *header;
+    unsigned n;
+    size_t start;
+    int rv;
+
+    start = *offset;
+
+    rv = uvCheckEntriesBatch(content, offset, &n, &header, uv->io->errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+
+    if (n == 0) { /* Padding */
+        *last = *offset == content->len;
+        return 0;
+    }
+
+    rv = uvEnsureEntriesCapacity(entries, cap, *n_entries + n);
+    if (rv != 0) {
+        goto err;
     }
 
-    *entries2 = entries;
-    *n_entries2 += n_entries1;
+    rv = uvDecodeEntriesBatchAt(content, header, n, &(*entries)[*n_entries]);
+    if (rv != 0) {
+        goto err;
+    }
+    *n_entries += n;
+
+    *last = *offset == content->len;
 
     return 0;
+
+err:
+    assert(rv != 0);
+    *offset = start;
+    return rv;
 }
 
-int uvSegmentLoadClosed(struct uv *uv,
-                        struct uvSegmentInfo *info,
-                        struct raft_entry *entries[],
-                        size_t *n)
+/* State of a closed segment being loaded. */
+struct uvSegmentLoad
 {
-    bool empty;                     /* Whether the file is empty */
-    uint64_t format;                /* Format version */
-    bool last;                      /* Whether the last batch was reached */
-    struct raft_entry *tmp_entries; /* Entries in current batch */
-    struct raft_buffer buf;         /* Segment file content */
-    size_t offset;                  /* Content read cursor */
-    unsigned tmp_n;                 /* Number of entries in current batch */
-    unsigned expected_n; /* Number of entries that we expect to find */
-    int i;
+    struct uvSegmentInfo *info;        /* Segment being loaded */
+    struct raft_buffer buf;            /* Segment file content */
+    unsigned n;                        /* Number of entries in the segment */
+    int status;                        /* Error code, or 0 */
+    char errmsg[RAFT_ERRMSG_BUF_SIZE]; /* Error message, if status != 0 */
+};
+
+/* Allocate the buffer that will hold the content of the given closed segment.
+ *
+ * Errors are saved in the @status and @errmsg fields of @load, so they can be
+ * reported in segment order along with the ones found while checking. */
+static void uvPrepareClosedSegment(struct uv *uv,
+                                   struct uvSegmentInfo *info,
+                                   struct uvSegmentLoad *load)
+{
+    off_t size;
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
     int rv;
 
-    expected_n = (unsigned)(info->end_index - info->first_index + 1);
+    load->info = info;
+    load->buf.base = NULL;
+    load->buf.len = 0;
+    load->n = 0;
+    load->status = 0;
 
-    /* If the segment is completely empty, just bail out. */
-    rv = UvFsFileIsEmpty(uv->dir, info->filename, &empty, errmsg);
+    rv = UvFsFileSize(uv->dir, info->filename, &size, errmsg);
     if (rv != 0) {
         tracef("stat %s: %s", info->filename, errmsg);
-        rv = RAFT_IOERR;
-        goto err;
+        ErrMsgTransfer(errmsg, load->errmsg, "stat");
+        load->status = RAFT_IOERR;
+        return;
     }
-    if (empty) {
-        ErrMsgPrintf(uv->io->errmsg, "file is empty");
-        rv = RAFT_CORRUPT;
-        goto err;
+
+    /* If the segment is completely empty, just bail out. */
+    if (size == 0) {
+        ErrMsgPrintf(load->errmsg, "file is empty");
+        load->status = RAFT_CORRUPT;
+        return;
     }
 
-    /* Open the segment file. */
-    rv = uvReadSegmentFile(uv, info->filename, &buf, &format);
+    load->buf.len = (size_t)size;
+    load->buf.base = HeapMalloc(load->buf.len);
+    if (load->buf.base == NULL) {
+        ErrMsgOom(load->errmsg);
+        load->status = RAFT_NOMEM;
+        return;
+    }
+}
+
+/* Read the content of a closed segment and check the integrity of all its
+ * batches, counting its entries.
+ *
+ * Only the given @load object is touched and no memory is allocated, so this
+ * can run in a worker thread. */
+static void uvCheckClosedSegment(const char *dir, struct uvSegmentLoad *load)
+{
+    struct uvSegmentInfo *info = load->info;
+    uint64_t format;   /* Format version */
+    bool last = false; /* Whether the last batch was reached */
+    size_t offset;     /* Content read cursor */
+    size_t n = 0;      /* Number of entries found */
+    unsigned expected_n;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    unsigned i;
+    int rv;
+
+    assert(load->status == 0);
+
+    expected_n = (unsigned)(info->end_index - info->first_index + 1);
+
+    rv = UvFsReadFileInto(dir, info->filename, &load->buf, errmsg);
     if (rv != 0) {
-        goto err;
+        ErrMsgTransfer(errmsg, load->errmsg, "read file");
+        rv = RAFT_IOERR;
+        goto out;
     }
-    if (format != UV__DISK_FORMAT) {
-        ErrMsgPrintf(uv->io->errmsg, "unexpected format version %ju", format);
-        rv = RAFT_CORRUPT;
-        goto err_after_read;
+    if (load->buf.len < sizeof format) {
+        ErrMsgPrintf(load->errmsg, "file has only %zu bytes", load->buf.len);
+        rv = RAFT_IOERR;
+        goto out;
     }
 
-    /* Load all batches in the segment. */
-    *entries = NULL;
-    *n = 0;
+    format = byteFlip64(*(uint64_t *)load->buf.base);
+    if (format != UV__DISK_FORMAT && format != UV__DISK_FORMAT_PADDED) {
+        ErrMsgPrintf(load->errmsg, "unexpected format version %ju", format);
+        rv = RAFT_CORRUPT;
+        goto out;
+    }
 
-    last = false;
     offset = sizeof format;
     for (i = 1; !last; i++) {
-        rv = uvLoadEntriesBatch(uv, &buf, &tmp_entries, &tmp_n, &offset, &last);
+        unsigned batch_n;
+        void *header;
+        rv = uvCheckEntriesBatch(&load->buf, &offset, &batch_n, &header,
+                                 load->errmsg);
         if (rv != 0) {
-            ErrMsgWrapf(uv->io->errmsg, "entries batch %u starting at byte %zu",
+            ErrMsgWrapf(load->errmsg, "entries batch %u starting at byte %zu",
                         i, offset);
-            goto err_after_read;
+            goto out;
         }
-        rv = extendEntries(tmp_entries, tmp_n, entries, n);
-        if (rv != 0) {
-            goto err_after_batch_load;
-        }
-        raft_free(tmp_entries);
+        n += batch_n;
+        last = offset == load->buf.len;
     }
 
-    if (*n != expected_n) {
-        ErrMsgPrintf(uv->io->errmsg, "found %zu entries (expected %u)", *n,
+    if (n != expected_n) {
+        ErrMsgPrintf(load->errmsg, "found %zu entries (expected %u)", n,
                      expected_n);
         rv = RAFT_CORRUPT;
-        goto err_after_extend_entries;
+        goto out;
     }
 
-    assert(i > 1);  /* At least one batch was loaded. */
-    assert(*n > 0); /* At least one entry was loaded. */
+    load->n = (unsigned)n;
+
+out:
+    load->status = rv;
+}
+
+/* Decode all entries of a closed segment successfully checked with
+ * uvCheckClosedSegment() into the given array, which must have room for all of
+ * them. */
+static int uvDecodeClosedSegment(struct uvSegmentLoad *load,
+                                 struct raft_entry *entries,
+                                 char *errmsg)
+{
+    size_t offset = sizeof(uint64_t); /* Skip the format version */
+    size_t n = 0;
+    unsigned i;
+    int rv;
+
+    for (i = 1; offset < load->buf.len; i++) {
+        uint8_t *header;
+        unsigned batch_n;
+        unsigned j;
+
+        /* Skip the checksums. */
+        header = (uint8_t *)load->buf.base + offset + sizeof(uint32_t) * 2;
+        batch_n = (unsigned)byteFlip64(*(uint64_t *)header);
+        assert(n + batch_n <= load->n);
+
+        /* Skip padding records. */
+        if (batch_n == 0) {
+            offset += (size_t)byteFlip64(((uint64_t *)header)[1]);
+            continue;
+        }
+
+        rv = uvDecodeEntriesBatchAt(&load->buf, header, batch_n, &entries[n]);
+        if (rv != 0) {
+            ErrMsgPrintf(errmsg, "entries batch %u starting at byte %zu: %s", i,
+                         offset, errCodeToString(rv));
+            return rv;
+        }
+
+        offset = (size_t)(header - (uint8_t *)load->buf.base);
+        offset += uvSizeofBatchHeader(batch_n);
+        for (j = 0; j < batch_n; j++) {
+            offset += entries[n + j].buf.len;
+        }
+        n += batch_n;
+    }
+
+    assert(n == load->n);
 
     return 0;
+}
+
+int uvSegmentLoadClosed(struct uv *uv,
+                        struct uvSegmentInfo *info,
+                        struct raft_entry *entries[],
+                        size_t *n,
+                        char *errmsg)
+{
+    struct uvSegmentLoad load;
+    int rv;
 
-err_after_batch_load:
-    raft_free(tmp_entries[0].batch);
-    raft_free(tmp_entries);
+    uvPrepareClosedSegment(uv, info, &load);
+    if (load.status == 0) {
+        uvCheckClosedSegment(uv->dir, &load);
+    }
+    if (load.status != 0) {
+        ErrMsgPrintf(errmsg, "%s", load.errmsg);
+        rv = load.status;
+        goto err_after_prepare;
+    }
 
-err_after_extend_entries:
-    if (*entries != NULL) {
-        HeapFree(*entries);
+    *entries = raft_malloc(load.n * sizeof **entries);
+    if (*entries == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_prepare;
     }
 
-err_after_read:
-    HeapFree(buf.base);
+    rv = uvDecodeClosedSegment(&load, *entries, errmsg);
+    if (rv != 0) {
+        goto err_after_entries_alloc;
+    }
 
-err:
+    *n = load.n;
+
+    return 0;
+
+err_after_entries_alloc:
+    raft_free(*entries);
+err_after_prepare:
+    if (load.buf.base != NULL) {
+        HeapFree(load.buf.base);
+    }
     assert(rv != 0);
+    return rv;
+}
+
+/* Worker thread checking a share of the closed segments being loaded. */
+struct uvSegmentLoader
+{
+    const char *dir;             /* Data directory */
+    struct uvSegmentLoad *loads; /* All segments being loaded */
+    size_t n;                    /* Number of segments being loaded */
+    size_t first;                /* Index of the first segment to check */
+    size_t stride;               /* Distance between checked segments */
+    uv_thread_t thread;          /* Worker thread */
+    bool started;                /* Whether the thread was started */
+};
+
+static void uvSegmentLoaderWork(void *arg)
+{
+    struct uvSegmentLoader *l = arg;
+    size_t i;
+    for (i = l->first; i < l->n; i += l->stride) {
+        if (l->loads[i].status == 0) {
+            uvCheckClosedSegment(l->dir, &l->loads[i]);
+        }
+    }
+}
+
+/* Return the number of threads to use to check the given number of closed
+ * segments. */
+static unsigned uvSegmentLoadersCount(size_t n)
+{
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned count = UV__MAX_SEGMENT_LOADERS;
+    if (n_cpus > 0 && (unsigned long)n_cpus < count) {
+        count = (unsigned)n_cpus;
+    }
+    if (n < count) {
+        count = (unsigned)n;
+    }
+    return count;
+}
+
+/* Load the given closed segments, which must form a contiguous sequence,
+ * appending their entries to the given array.
+ *
+ * Buffers for all segments are allocated upfront in the calling thread, then
+ * reading the files and checking their integrity, which is where most of the
+ * time goes, is spread across a pool of worker threads. Finally entries get
+ * decoded in the calling thread, straight into their final position. */
+static int uvLoadClosedSegments(struct uv *uv,
+                                struct uvSegmentInfo *infos,
+                                size_t n_infos,
+                                struct raft_entry **entries,
+                                size_t *n_entries,
+                                size_t *cap)
+{
+    struct uvSegmentLoader loaders[UV__MAX_SEGMENT_LOADERS];
+    struct uvSegmentLoad *loads;
+    unsigned n_loaders;
+    size_t n;
+    size_t i;
+    unsigned j;
+    int rv;
+
+    loads = raft_malloc(n_infos * sizeof *loads);
+    if (loads == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+
+    for (i = 0; i < n_infos; i++) {
+        tracef("load segment %s", infos[i].filename);
+        uvPrepareClosedSegment(uv, &infos[i], &loads[i]);
+    }
+
+    n_loaders = uvSegmentLoadersCount(n_infos);
+    for (j = 0; j < n_loaders; j++) {
+        struct uvSegmentLoader *l = &loaders[j];
+        l->dir = uv->dir;
+        l->loads = loads;
+        l->n = n_infos;
+        l->first = j;
+        l->stride = n_loaders;
+        l->started = false;
+        if (j > 0) {
+            rv = uv_thread_create(&l->thread, uvSegmentLoaderWork, l);
+            l->started = rv == 0;
+        }
+    }
+
+    /* The calling thread acts as the first worker, and also takes care of the
+     * share of any worker thread that could not be started. */
+    for (j = 0; j < n_loaders; j++) {
+        if (!loaders[j].started) {
+            uvSegmentLoaderWork(&loaders[j]);
+        }
+    }
+    for (j = 0; j < n_loaders; j++) {
+        if (loaders[j].started) {
+            uv_thread_join(&loaders[j].thread);
+        }
+    }
+
+    /* Report the first error, in segment order. */
+    n = 0;
+    for (i = 0; i < n_infos; i++) {
+        if (loads[i].status != 0) {
+            ErrMsgTransferf(loads[i].errmsg, uv->io->errmsg,
+                            "load closed segment %s", infos[i].filename);
+            rv = loads[i].status;
+            goto err_after_loads_alloc;
+        }
+        n += loads[i].n;
+    }
+
+    rv = uvEnsureEntriesCapacity(entries, cap, *n_entries + n);
+    if (rv != 0) {
+        goto err_after_loads_alloc;
+    }
+
+    for (i = 0; i < n_infos; i++) {
+        char errmsg[RAFT_ERRMSG_BUF_SIZE];
+        rv = uvDecodeClosedSegment(&loads[i], &(*entries)[*n_entries], errmsg);
+        if (rv != 0) {
+            ErrMsgTransferf(errmsg, uv->io->errmsg, "load closed segment %s",
+                            infos[i].filename);
+            goto err_after_loads_alloc;
+        }
+        /* From now on the buffer is owned by the decoded entries. */
+        *n_entries += loads[i].n;
+        loads[i].buf.base = NULL;
+    }
+
+    raft_free(loads);
+
+    return 0;
 
+err_after_loads_alloc:
+    for (i = 0; i < n_infos; i++) {
+        if (loads[i].buf.base != NULL) {
+            HeapFree(loads[i].buf.base);
+        }
+    }
+    raft_free(loads);
+err:
+    assert(rv != 0);
     return rv;
 }
 
@@ -466,24 +842,25 @@ static bool uvContentHasOnlyTrailingZeros(const struct raft_buffer *buf,
     return true;
 }
 
-/* Load all entries contained in an open segment. */
+/* Load all entries contained in an open segment, appending them to the given
+ * entries array. */
 static int uvLoadOpenSegment(struct uv *uv,
                              struct uvSegmentInfo *info,
                              struct raft_entry *entries[],
                              size_t *n,
+                             size_t *cap,
                              raft_index *next_index)
 {
-    raft_index first_index;         /* Index of first entry in segment */
-    bool all_zeros;                 /* Whether the file is zero'ed */
-    bool empty;                     /* Whether the segment file is empty */
-    bool remove = false;            /* Whether to remove this segment */
-    bool last = false;              /* Whether the last batch was reached */
-    uint64_t format;                /* Format version */
-    size_t n_batches = 0;           /* Number of loaded batches */
-    struct raft_entry *tmp_entries; /* Entries in current batch */
-    struct raft_buffer buf;         /* Segment file content */
-    size_t offset;                  /* Content read cursor */
-    unsigned tmp_n_entries;         /* Number of entries in current batch */
+    raft_index first_index; /* Index of first entry in segment */
+    bool all_zeros;         /* Whether the file is zero'ed */
+    bool empty;             /* Whether the segment file is empty */
+    bool remove = false;    /* Whether to remove this segment */
+    bool last = false;      /* Whether the last batch was reached */
+    uint64_t format;        /* Format version */
+    size_t n_batches = 0;   /* Number of loaded batches */
+    size_t n_start = *n;    /* Number of entries before this segment */
+    struct raft_buffer buf; /* Segment file content */
+    size_t offset;          /* Content read cursor */
     int i;
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
     int rv;
@@ -512,7 +889,7 @@ static int uvLoadOpenSegment(struct uv *uv,
     /* Check that the format is the expected one, or perhaps 0, indicating that
      * the segment was allocated but never written. */
     offset = sizeof format;
-    if (format != UV__DISK_FORMAT) {
+    if (format != UV__DISK_FORMAT && format != UV__DISK_FORMAT_PADDED) {
         if (format == 0) {
             all_zeros = uvContentHasOnlyTrailingZeros(&buf, offset);
             if (all_zeros) {
@@ -531,8 +908,8 @@ static int uvLoadOpenSegment(struct uv *uv,
 
     /* Load all batches in the segment. */
     for (i = 1; !last; i++) {
-        rv = uvLoadEntriesBatch(uv, &buf, &tmp_entries, &tmp_n_entries, &offset,
-                                &last);
+        size_t n_before = *n;
+        rv = uvLoadEntriesBatch(uv, &buf, entries, n, cap, &offset, &last);
         if (rv != 0) {
             /* If this isn't a decoding error, just bail out. */
             if (rv != RAFT_CORRUPT) {
@@ -559,15 +936,10 @@ static int uvLoadOpenSegment(struct uv *uv,
             break;
         }
 
-        rv = extendEntries(tmp_entries, tmp_n_entries, entries, n);
-        if (rv != 0) {
-            goto err_after_batch_load;
+        if (*n > n_before) {
+            n_batches++;
         }
-
-        raft_free(tmp_entries);
-
-        n_batches++;
-        *next_index += tmp_n_entries;
+        *next_index += *n - n_before;
     }
 
     if (n_batches == 0) {
@@ -583,7 +955,7 @@ done:
         if (rv != 0) {
             tracef("unlink %s: %s", info->filename, errmsg);
             rv = RAFT_IOERR;
-            goto err_after_read;
+            goto err;
         }
     } else {
         char filename[UV__FILENAME_LEN];
@@ -611,11 +983,9 @@ done:
 
     return 0;
 
-err_after_batch_load:
-    raft_free(tmp_entries[0].batch);
-    raft_free(tmp_entries);
-
 err_after_read:
+    /* Forget about any entry referencing the buffer we're releasing. */
+    *n = n_start;
     HeapFree(buf.base);
 
 err:
@@ -678,7 +1048,7 @@ void uvSegmentBufferClose(struct uvSegmentBuffer *b)
     }
 }
 
-int uvSegmentBufferFormat(struct uvSegmentBuffer *b)
+int uvSegmentBufferFormat(struct uvSegmentBuffer *b, uint64_t format)
 {
     int rv;
     void *cursor;
@@ -691,7 +1061,7 @@ int uvSegmentBufferFormat(struct uvSegmentBuffer *b)
     }
     b->n = n;
     cursor = b->arena.base;
-    bytePut64(&cursor, UV__DISK_FORMAT);
+    bytePut64(&cursor, format);
     return 0;
 }
 
@@ -752,6 +1122,45 @@ int uvSegmentBufferAppend(struct uvSegmentBuffer *b,
     return 0;
 }
 
+int uvSegmentBufferPad(struct uvSegmentBuffer *b)
+{
+    size_t tail = b->n % b->block_size;
+    size_t len;
+    void *crc1_p;
+    void *header;
+    void *cursor;
+    int rv;
+
+    if (tail == 0) {
+        return 0;
+    }
+
+    len = b->block_size - tail;
+    if (len < UV__SEGMENT_PADDING_MIN) {
+        len += b->block_size;
+    }
+
+    rv = uvEnsureSegmentBufferIsLargeEnough(b, b->n + len);
+    if (rv != 0) {
+        return rv;
+    }
+    cursor = b->arena.base + b->n;
+    memset(cursor, 0, len);
+
+    /* A padding record looks like a batch with no entries, whose header holds
+     * the total size of the record. */
+    crc1_p = cursor;
+    bytePut32(&cursor, 0);
+    bytePut32(&cursor, 0);
+    header = cursor;
+    bytePut64(&cursor, 0);
+    bytePut64(&cursor, len);
+    bytePut32(&crc1_p, byteCrc32(header, sizeof(uint64_t) * 2, 0));
+    b->n += len;
+
+    return 0;
+}
+
 void uvSegmentBufferFinalize(struct uvSegmentBuffer *b, uv_buf_t *out)
 {
     unsigned n_blocks;
@@ -795,9 +1204,9 @@ int uvSegmentLoadAll(struct uv *uv,
                      struct raft_entry **entries,
                      size_t *n_entries)
 {
-    raft_index next_index;          /* Next entry to load from disk */
-    struct raft_entry *tmp_entries; /* Entries in current segment */
-    size_t tmp_n;                   /* Number of entries in current segment */
+    raft_index next_index; /* Next entry to load from disk */
+    size_t n_closed;       /* Number of contiguous closed segments */
+    size_t cap = 0;        /* Capacity of the entries array */
     size_t i;
     int rv;
 
@@ -809,48 +1218,52 @@ int uvSegmentLoadAll(struct uv *uv,
 
     next_index = start_index;
 
-    for (i = 0; i < n_infos; i++) {
+    /* Closed segments sort before open ones. Find how many of them form a
+     * contiguous sequence, since those can be loaded all at once. A gap gets
+     * reported below, after the segments preceding it have been loaded. */
+    for (n_closed = 0; n_closed < n_infos; n_closed++) {
+        struct uvSegmentInfo *info = &infos[n_closed];
+        if (info->is_open) {
+            break;
+        }
+        assert(info->first_index >= start_index);
+        assert(info->first_index <= info->end_index);
+        if (info->first_index != next_index) {
+            break;
+        }
+        next_index = info->end_index + 1;
+    }
+
+    if (n_closed > 0) {
+        rv = uvLoadClosedSegments(uv, infos, n_closed, entries, n_entries,
+                                  &cap);
+        if (rv != 0) {
+            goto err;
+        }
+    }
+
+    for (i = n_closed; i < n_infos; i++) {
         struct uvSegmentInfo *info = &infos[i];
 
         tracef("load segment %s", info->filename);
 
         if (info->is_open) {
-            rv = uvLoadOpenSegment(uv, info, entries, n_entries, &next_index);
+            rv = uvLoadOpenSegment(uv, info, entries, n_entries, &cap,
+                                   &next_index);
             ErrMsgWrapf(uv->io->errmsg, "load open segment %s", info->filename);
             if (rv != 0) {
                 goto err;
             }
         } else {
-            assert(info->first_index >= start_index);
-            assert(info->first_index <= info->end_index);
-
             /* Check that the start index encoded in the name of the segment
              * matches what we expect and there are no gaps in the sequence. */
-            if (info->first_index != next_index) {
-                ErrMsgPrintf(uv->io->errmsg,
-                             "unexpected closed segment %s: first index should "
-                             "have been %llu",
-                             info->filename, next_index);
-                rv = RAFT_CORRUPT;
-                goto err;
-            }
-
-            rv = uvSegmentLoadClosed(uv, info, &tmp_entries, &tmp_n);
-            if (rv != 0) {
-                ErrMsgWrapf(uv->io->errmsg, "load closed segment %s",
-                            info->filename);
-                goto err;
-            }
-
-            assert(tmp_n > 0);
-            rv = extendEntries(tmp_entries, tmp_n, entries, n_entries);
-            if (rv != 0) {
-                /* TODO: release memory of entries in tmp_entries */
-                goto err;
-            }
-
-            raft_free(tmp_entries);
-            next_index += tmp_n;
+            assert(info->first_index != next_index);
+            ErrMsgPrintf(uv->io->errmsg,
+                         "unexpected closed segment %s: first index should "
+                         "have been %llu",
+                         info->filename, next_index);
+            rv = RAFT_CORRUPT;
+            goto err;
         }
     }
 
@@ -911,7 +1324,7 @@ static int uvWriteClosedSegment(struct uv *uv,
 
     uvSegmentBufferInit(&buf, uv->block_size);
 
-    rv = uvSegmentBufferFormat(&buf);
+    rv = uvSegmentBufferFormat(&buf, UV__DISK_FORMAT);
     if (rv != 0) {
         return rv;
     }
@@ -962,6 +1375,19 @@ int uvSegmentCreateClosedWithConfiguration(
         goto err;
     }
 
+    /* Groups using the shared write-ahead log of their host have no
+     * segments. */
+    if (uv->wal != NULL) {
+        struct raft_entry entry;
+        entry.term = 1;
+        entry.type = RAFT_CHANGE;
+        entry.buf = buf;
+        entry.batch = NULL;
+        rv = UvWalWriteSync(uv, index, &entry);
+        raft_free(buf.base);
+        return rv;
+    }
+
     /* Write the file */
     rv = uvWriteClosedSegment(uv, index, index, &buf);
     if (rv != 0) {
@@ -1002,7 +1428,7 @@ int uvSegmentTruncate(struct uv *uv,
     tracef("truncate %llu-%llu at %llu", segment->first_index,
            segment->end_index, index);
 
-    rv = uvSegmentLoadClosed(uv, segment, &entries, &n);
+    rv = uvSegmentLoadClosed(uv, segment, &entries, &n, uv->io->errmsg);
     if (rv != 0) {
         ErrMsgWrapf(uv->io->errmsg, "load closed segment %s",
                     segment->filename);
@@ -1015,7 +1441,7 @@ int uvSegmentTruncate(struct uv *uv,
 
     uvSegmentBufferInit(&buf, uv->block_size);
 
-    rv = uvSegmentBufferFormat(&buf);
+    rv = uvSegmentBufferFormat(&buf, UV__DISK_FORMAT);
     if (rv != 0) {
         goto out_after_buffer_init;
     }
@@ -2,6 +2,8 @@
 
 #include "../include/raft/uv.h"
 #include "assert.h"
+#include "byte.h"
+#include "compress.h"
 #include "heap.h"
 #include "uv.h"
 #include "uv_encoding.h"
@@ -35,11 +37,46 @@
  * - The write request fails (either synchronously or asynchronously). In this
  *   case we fire the request callback with an error, close the connection
  *   stream, and start a re-connection attempt.
+ *
+ * If send batching is enabled and the uvClient is connected, the message is
+ * not written right away. Its header is instead encoded into the arena of the
+ * uvClient's current batch, and its payload buffers are appended to the
+ * batch's buffer list. All messages batched during a loop iteration are then
+ * written out with a single vectored write by the uvClient's prepare handle,
+ * which runs right before the loop polls for I/O.
+ *
+ * If message compression is enabled and the other server accepted it when
+ * connecting, large AppendEntries payloads are compressed before being
+ * written, bypassing batching. Payloads larger than UV__SEND_OFFLOAD_SIZE are
+ * compressed in the thread pool: while that happens the request sits in the
+ * uvClient's compressing queue, along with all requests sent after it, so
+ * messages are still written out in the order they were sent.
  */
 
 /* Maximum number of requests that can be buffered.  */
 #define UV__CLIENT_MAX_PENDING 3
 
+/* Initial capacity of the header arena and of the buffer list of a batch. */
+#define UV__BATCH_INITIAL_ARENA_SIZE 1024
+#define UV__BATCH_INITIAL_N_BUFS 16
+
+/* Payloads at least this large are compressed in the thread pool. */
+#define UV__SEND_OFFLOAD_SIZE (256 * 1024)
+
+/* Messages to the same server to be written out with a single write. */
+struct uvSendBatch
+{
+    struct uvClient *client; /* Client connected to the target server */
+    char *arena;             /* Encoded headers of all batched messages */
+    size_t arena_len;        /* Number of arena bytes in use */
+    size_t arena_cap;        /* Size of the arena */
+    uv_buf_t *bufs;          /* Headers and payloads of batched messages */
+    unsigned n_bufs;         /* Number of buffers in use */
+    unsigned cap_bufs;       /* Capacity of the buffer list */
+    uv_write_t write;        /* Stream write request */
+    queue sends;             /* Batched send requests */
+};
+
 struct uvClient
 {
     struct uv *uv;                  /* libuv I/O implementation object */
@@ -51,6 +88,12 @@ struct uvClient
     raft_id id;                     /* ID of the other server */
     char *address;                  /* Address of the other server */
     queue pending;                  /* Pending send message requests */
+    struct uv_prepare_s prepare;    /* Flush the current batch */
+    struct uvSendBatch *batch;      /* Messages to flush on next prepare */
+    struct uvSendBatch *spare;      /* Flushed batch kept around for reuse */
+    unsigned codec;                 /* Codec accepted by the other server */
+    queue compressing;              /* Requests waiting for compression */
+    unsigned n_compressing;         /* Compression work items in flight */
     queue queue;                    /* Clients queue */
     bool closing;                   /* True after calling uvClientAbort */
 };
@@ -62,8 +105,14 @@ struct uvSend
     struct raft_io_send *req; /* Uer request */
     uv_buf_t *bufs;           /* Encoded raft RPC message to send */
     unsigned n_bufs;          /* Number of buffers */
+    size_t offset;            /* Offset of the header in the batch arena */
+    unsigned index;           /* Index of the header in the batch buffers */
+    unsigned codec;           /* Codec used to compress the payload */
+    uv_buf_t compressed;      /* Compressed payload, if any */
+    struct uv_work_s work;    /* Compress the payload in the thread pool */
+    bool ready;               /* False while the payload is being compressed */
     uv_write_t write;         /* Stream write request */
-    queue queue;              /* Pending send requests queue */
+    queue queue;              /* Pending, batched or compressing queue */
 };
 
 /* Free all memory used by the given send request object, including the object
@@ -78,9 +127,99 @@ static void uvSendDestroy(struct uvSend *s)
         /* Release the buffers array. */
         HeapFree(s->bufs);
     }
+    if (s->compressed.base != NULL) {
+        HeapFree(s->compressed.base);
+    }
     HeapFree(s);
 }
 
+/* Free all memory used by the given batch, including the object itself. */
+static void uvSendBatchDestroy(struct uvSendBatch *b)
+{
+    assert(QUEUE_IS_EMPTY(&b->sends));
+    HeapFree(b->arena);
+    HeapFree(b->bufs);
+    HeapFree(b);
+}
+
+/* Make sure that the given batch has room for @size more bytes in its arena and
+ * for @n more buffers. */
+static int uvSendBatchReserve(struct uvSendBatch *b, size_t size, unsigned n)
+{
+    if (b->arena_len + size > b->arena_cap) {
+        size_t cap = b->arena_cap;
+        char *arena;
+        if (cap == 0) {
+            cap = UV__BATCH_INITIAL_ARENA_SIZE;
+        }
+        while (cap < b->arena_len + size) {
+            cap *= 2;
+        }
+        arena = HeapRealloc(b->arena, cap);
+        if (arena == NULL) {
+            return RAFT_NOMEM;
+        }
+        b->arena = arena;
+        b->arena_cap = cap;
+    }
+    if (b->n_bufs + n > b->cap_bufs) {
+        unsigned cap = b->cap_bufs;
+        uv_buf_t *bufs;
+        if (cap == 0) {
+            cap = UV__BATCH_INITIAL_N_BUFS;
+        }
+        while (cap < b->n_bufs + n) {
+            cap *= 2;
+        }
+        bufs = HeapRealloc(b->bufs, cap * sizeof *bufs);
+        if (bufs == NULL) {
+            return RAFT_NOMEM;
+        }
+        b->bufs = bufs;
+        b->cap_bufs = cap;
+    }
+    return 0;
+}
+
+/* Fire the callbacks of all requests in the given batch with the given status.
+ * The batch is then either kept around for reuse or released. */
+static void uvSendBatchFinish(struct uvSendBatch *b, int status)
+{
+    struct uvClient *c = b->client;
+    queue sends;
+
+    /* Detach the requests first, since their callbacks might batch new
+     * messages. */
+    QUEUE_INIT(&sends);
+    while (!QUEUE_IS_EMPTY(&b->sends)) {
+        queue *head = QUEUE_HEAD(&b->sends);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&sends, head);
+    }
+
+    b->arena_len = 0;
+    b->n_bufs = 0;
+    if (c->spare == NULL && !c->closing) {
+        c->spare = b;
+    } else {
+        uvSendBatchDestroy(b);
+    }
+
+    while (!QUEUE_IS_EMPTY(&sends)) {
+        queue *head;
+        struct uvSend *send;
+        struct raft_io_send *req;
+        head = QUEUE_HEAD(&sends);
+        send = QUEUE_DATA(head, struct uvSend, queue);
+        QUEUE_REMOVE(head);
+        req = send->req;
+        uvSendDestroy(send);
+        if (req->cb != NULL) {
+            req->cb(req, status);
+        }
+    }
+}
+
 /* Initialize a new client associated with the given server. */
 static int uvClientInit(struct uvClient *c,
                         struct uv *uv,
@@ -101,8 +240,16 @@ static int uvClientInit(struct uvClient *c,
     }
     rv = uv_timer_init(c->uv->loop, &c->timer);
     assert(rv == 0);
+    rv = uv_prepare_init(c->uv->loop, &c->prepare);
+    assert(rv == 0);
+    c->prepare.data = c;
     strcpy(c->address, address);
     QUEUE_INIT(&c->pending);
+    c->batch = NULL;
+    c->spare = NULL;
+    c->codec = COMPRESSION_NONE;
+    QUEUE_INIT(&c->compressing);
+    c->n_compressing = 0;
     c->closing = false;
     QUEUE_PUSH(&uv->clients, &c->queue);
     return 0;
@@ -125,6 +272,21 @@ static void uvClientMaybeDestroy(struct uvClient *c)
     if (c->old_stream != NULL) {
         return;
     }
+    if (c->prepare.data != NULL) {
+        return;
+    }
+    if (c->n_compressing > 0) {
+        return;
+    }
+
+    if (c->batch != NULL) {
+        uvSendBatchFinish(c->batch, RAFT_CANCELED);
+        c->batch = NULL;
+    }
+    if (c->spare != NULL) {
+        uvSendBatchDestroy(c->spare);
+        c->spare = NULL;
+    }
 
     while (!QUEUE_IS_EMPTY(&c->pending)) {
         queue *head;
@@ -140,6 +302,20 @@ static void uvClientMaybeDestroy(struct uvClient *c)
         }
     }
 
+    while (!QUEUE_IS_EMPTY(&c->compressing)) {
+        queue *head;
+        struct uvSend *send;
+        struct raft_io_send *req;
+        head = QUEUE_HEAD(&c->compressing);
+        send = QUEUE_DATA(head, struct uvSend, queue);
+        QUEUE_REMOVE(head);
+        req = send->req;
+        uvSendDestroy(send);
+        if (req->cb != NULL) {
+            req->cb(req, RAFT_CANCELED);
+        }
+    }
+
     QUEUE_REMOVE(&c->queue);
 
     assert(c->address != NULL);
@@ -174,15 +350,14 @@ static void uvClientDisconnect(struct uvClient *c)
     assert(c->old_stream == NULL);
     c->old_stream = c->stream;
     c->stream = NULL;
+    c->codec = COMPRESSION_NONE;
     uv_close((struct uv_handle_s *)c->old_stream, uvClientDisconnectCloseCb);
 }
 
-/* Invoked once an encoded RPC message has been written out. */
-static void uvSendWriteCb(struct uv_write_s *write, const int status)
+/* Handle the completion of a write on the client's stream, returning the
+ * status that should be passed to the callbacks of the written requests. */
+static int uvClientWriteStatus(struct uvClient *c, const int status)
 {
-    struct uvSend *send = write->data;
-    struct uvClient *c = send->client;
-    struct raft_io_send *req = send->req;
     int cb_status = 0;
 
     /* If the write failed and we're not currently closing, let's consider the
@@ -200,6 +375,19 @@ static void uvSendWriteCb(struct uv_write_s *write, const int status)
         }
     }
 
+    return cb_status;
+}
+
+/* Invoked once an encoded RPC message has been written out. */
+static void uvSendWriteCb(struct uv_write_s *write, const int status)
+{
+    struct uvSend *send = write->data;
+    struct uvClient *c = send->client;
+    struct raft_io_send *req = send->req;
+    int cb_status;
+
+    cb_status = uvClientWriteStatus(c, status);
+
     uvSendDestroy(send);
 
     if (req->cb != NULL) {
@@ -207,6 +395,9 @@ static void uvSendWriteCb(struct uv_write_s *write, const int status)
     }
 }
 
+/* Forward declaration. */
+static void uvClientFlush(struct uvClient *c);
+
 static int uvClientSend(struct uvClient *c, struct uvSend *send)
 {
     int rv;
@@ -220,6 +411,11 @@ static int uvClientSend(struct uvClient *c, struct uvSend *send)
         return 0;
     }
 
+    /* Messages batched earlier must be written out first. */
+    if (c->batch != NULL) {
+        uvClientFlush(c);
+    }
+
     tracef("connection available -> write message");
     send->write.data = send;
     rv = uv_write(&send->write, c->stream, send->bufs, send->n_bufs,
@@ -233,6 +429,322 @@ static int uvClientSend(struct uvClient *c, struct uvSend *send)
     return 0;
 }
 
+/* Invoked once all messages of a batch have been written out. */
+static void uvSendBatchWriteCb(struct uv_write_s *write, const int status)
+{
+    struct uvSendBatch *b = write->data;
+    uvSendBatchFinish(b, uvClientWriteStatus(b->client, status));
+}
+
+/* Write out all messages batched during the current loop iteration. */
+static void uvClientFlush(struct uvClient *c)
+{
+    struct uvSendBatch *b = c->batch;
+    queue *head;
+    int rv;
+
+    rv = uv_prepare_stop(&c->prepare);
+    assert(rv == 0);
+
+    assert(b != NULL);
+    assert(!QUEUE_IS_EMPTY(&b->sends));
+    c->batch = NULL;
+
+    /* The connection might have been lost after the messages were batched. */
+    if (c->stream == NULL) {
+        tracef("connection lost -> fail batched messages");
+        uvSendBatchFinish(b, RAFT_NOCONNECTION);
+        return;
+    }
+
+    /* Now that the arena won't grow anymore, point the header buffers to it. */
+    QUEUE_FOREACH(head, &b->sends)
+    {
+        struct uvSend *send = QUEUE_DATA(head, struct uvSend, queue);
+        b->bufs[send->index].base = b->arena + send->offset;
+    }
+
+    tracef("write %u batched buffers", b->n_bufs);
+    b->write.data = b;
+    rv = uv_write(&b->write, c->stream, b->bufs, b->n_bufs, uvSendBatchWriteCb);
+    if (rv != 0) {
+        tracef("write batch failed -> rv %d", rv);
+        uvSendBatchFinish(b, RAFT_IOERR);
+    }
+}
+
+static void uvClientPrepareCb(struct uv_prepare_s *prepare)
+{
+    struct uvClient *c = prepare->data;
+    uvClientFlush(c);
+}
+
+/* Add the given message to the client's current batch, which will be written
+ * out before the loop polls for I/O again. */
+static int uvClientBatch(struct uvClient *c,
+                         struct uvSend *send,
+                         const struct raft_message *message,
+                         unsigned long long group)
+{
+    struct uvSendBatch *b;
+    size_t size;
+    unsigned n;
+    int rv;
+
+    assert(!c->closing);
+    assert(c->stream != NULL);
+
+    size = uvSizeofMessageHeader(message);
+    if (size == 0) {
+        return RAFT_MALFORMED;
+    }
+    n = 1 + uvSizeofMessagePayload(message);
+
+    if (c->batch == NULL) {
+        if (c->spare != NULL) {
+            c->batch = c->spare;
+            c->spare = NULL;
+        } else {
+            c->batch = HeapMalloc(sizeof *c->batch);
+            if (c->batch == NULL) {
+                return RAFT_NOMEM;
+            }
+            c->batch->client = c;
+            c->batch->arena = NULL;
+            c->batch->arena_len = 0;
+            c->batch->arena_cap = 0;
+            c->batch->bufs = NULL;
+            c->batch->n_bufs = 0;
+            c->batch->cap_bufs = 0;
+            QUEUE_INIT(&c->batch->sends);
+        }
+    }
+    b = c->batch;
+
+    rv = uvSendBatchReserve(b, bytePad64(size), n);
+    if (rv != 0) {
+        /* Don't leave an empty batch behind, flushing it would fail. */
+        if (QUEUE_IS_EMPTY(&b->sends)) {
+            assert(c->spare == NULL);
+            c->spare = b;
+            c->batch = NULL;
+        }
+        return rv;
+    }
+
+    /* The header base is set when flushing, since the arena might still be
+     * reallocated. */
+    send->client = c;
+    send->offset = b->arena_len;
+    send->index = b->n_bufs;
+    uvEncodeMessageHeader(message, size, b->arena + send->offset);
+    if (group != 0) {
+        uvEncodeMessageGroup(b->arena + send->offset, group);
+    }
+    b->arena_len += bytePad64(size);
+    b->bufs[send->index].base = NULL;
+    b->bufs[send->index].len = size;
+    uvEncodeMessagePayload(message, &b->bufs[send->index + 1]);
+    b->n_bufs += n;
+
+    if (QUEUE_IS_EMPTY(&b->sends)) {
+        rv = uv_prepare_start(&c->prepare, uvClientPrepareCb);
+        assert(rv == 0);
+    }
+    QUEUE_PUSH(&b->sends, &send->queue);
+
+    return 0;
+}
+
+/* Return true if the payload of the given message should be compressed before
+ * being sent to the given client. */
+static bool uvClientShouldCompress(const struct uvClient *c,
+                                   const struct raft_message *message)
+{
+    const struct raft_append_entries *p = &message->append_entries;
+    size_t size = 0;
+    unsigned i;
+
+    if (!c->uv->message_compression || c->codec == COMPRESSION_NONE) {
+        return false;
+    }
+    if (message->type != RAFT_IO_APPEND_ENTRIES) {
+        return false;
+    }
+    for (i = 0; i < p->n_entries; i++) {
+        size += p->entries[i].buf.len;
+    }
+
+    return size > 0 && size >= c->uv->compression_threshold;
+}
+
+/* Return the total size of the payload buffers of the given request. */
+static size_t uvSendPayloadSize(const struct uvSend *send)
+{
+    size_t size = 0;
+    unsigned i;
+    for (i = 1; i < send->n_bufs; i++) {
+        size += send->bufs[i].len;
+    }
+    return size;
+}
+
+/* Compress the payload buffers of the given request. Since this might run in
+ * the thread pool, failures are not reported: the payload is just left
+ * uncompressed. */
+static void uvSendCompress(struct uvSend *send)
+{
+    struct raft_buffer *bufs;
+    struct raft_buffer compressed;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    unsigned n = send->n_bufs - 1;
+    unsigned i;
+    int rv;
+
+    assert(n > 0);
+
+    bufs = HeapMalloc(n * sizeof *bufs);
+    if (bufs == NULL) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        bufs[i].base = send->bufs[i + 1].base;
+        bufs[i].len = send->bufs[i + 1].len;
+    }
+    rv = compressionEncode(send->codec, bufs, n, &compressed, errmsg);
+    HeapFree(bufs);
+    if (rv != 0) {
+        return;
+    }
+    send->compressed.base = compressed.base;
+    send->compressed.len = compressed.len;
+}
+
+/* Replace the payload buffers of the given request with its compressed
+ * payload, unless compression failed or didn't make it smaller. */
+static void uvSendUseCompressed(struct uvSend *send)
+{
+    struct uv *uv = send->client->uv;
+    size_t size = uvSendPayloadSize(send);
+    char *header;
+
+    if (send->compressed.base == NULL) {
+        return;
+    }
+    if (send->compressed.len >= size) {
+        goto discard;
+    }
+
+    header = HeapRealloc(send->bufs[0].base,
+                         send->bufs[0].len + UV__COMPRESSION_TRAILER_SIZE);
+    if (header == NULL) {
+        goto discard;
+    }
+    uvEncodeAppendEntriesCompression(header, send->bufs[0].len, send->codec,
+                                     send->compressed.len);
+    send->bufs[0].base = header;
+    send->bufs[0].len += UV__COMPRESSION_TRAILER_SIZE;
+    send->bufs[1] = send->compressed;
+    send->n_bufs = 2;
+
+    uv->bytes_saved += size - send->compressed.len;
+    return;
+
+discard:
+    HeapFree(send->compressed.base);
+    send->compressed.base = NULL;
+    send->compressed.len = 0;
+}
+
+/* Write out, in order, the requests at the head of the compressing queue whose
+ * payload is ready. */
+static void uvClientSendCompressed(struct uvClient *c)
+{
+    int rv;
+    while (!c->closing && !QUEUE_IS_EMPTY(&c->compressing)) {
+        queue *head;
+        struct uvSend *send;
+        struct raft_io_send *req;
+        head = QUEUE_HEAD(&c->compressing);
+        send = QUEUE_DATA(head, struct uvSend, queue);
+        if (!send->ready) {
+            break;
+        }
+        QUEUE_REMOVE(head);
+        rv = uvClientSend(c, send);
+        if (rv != 0) {
+            req = send->req;
+            uvSendDestroy(send);
+            if (req->cb != NULL) {
+                req->cb(req, rv);
+            }
+        }
+    }
+}
+
+static void uvSendWorkCb(uv_work_t *work)
+{
+    struct uvSend *send = work->data;
+    uvSendCompress(send);
+}
+
+static void uvSendAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uvSend *send = work->data;
+    struct uvClient *c = send->client;
+
+    assert(status == 0);
+
+    c->n_compressing--;
+    uvSendUseCompressed(send);
+    send->ready = true;
+
+    if (c->closing) {
+        uvClientMaybeDestroy(c);
+        return;
+    }
+
+    uvClientSendCompressed(c);
+}
+
+/* Compress the payload of the given request and write it out once all requests
+ * sent before it have been written. Large payloads are compressed in the
+ * thread pool. */
+static int uvClientCompress(struct uvClient *c, struct uvSend *send)
+{
+    int rv;
+
+    assert(!c->closing);
+    assert(c->codec != COMPRESSION_NONE);
+
+    send->client = c;
+    send->codec = c->codec;
+
+    if (uvSendPayloadSize(send) >= UV__SEND_OFFLOAD_SIZE) {
+        send->ready = false;
+        send->work.data = send;
+        rv = uv_queue_work(c->uv->loop, &send->work, uvSendWorkCb,
+                           uvSendAfterWorkCb);
+        if (rv == 0) {
+            c->n_compressing++;
+            QUEUE_PUSH(&c->compressing, &send->queue);
+            return 0;
+        }
+        /* UNTESTED: fall back to compressing the payload right away. */
+        send->ready = true;
+    }
+
+    uvSendCompress(send);
+    uvSendUseCompressed(send);
+
+    if (!QUEUE_IS_EMPTY(&c->compressing)) {
+        QUEUE_PUSH(&c->compressing, &send->queue);
+        return 0;
+    }
+
+    return uvClientSend(c, send);
+}
+
 /* Try to execute all send requests that were blocked in the queue waiting for a
  * connection. */
 static void uvClientSendPending(struct uvClient *c)
@@ -308,6 +820,7 @@ static void uvClientConnectCb(struct raft_uv_connect *req,
     if (status == 0) {
         assert(stream != NULL);
         c->stream = stream;
+        c->codec = req->codec;
         c->n_connect_attempt = 0;
         c->stream->data = c;
         uvClientSendPending(c);
@@ -354,6 +867,11 @@ static void uvClientConnect(struct uvClient *c)
     c->n_connect_attempt++;
 
     c->connect.data = c;
+    c->connect.codecs = 0;
+    c->connect.codec = COMPRESSION_NONE;
+    if (c->uv->message_compression) {
+        c->connect.codecs = 1U << COMPRESSION_DEFLATE;
+    }
     rv = c->uv->transport->connect(c->uv->transport, &c->connect, c->id,
                                    c->address, uvClientConnectCb);
     if (rv != 0) {
@@ -374,6 +892,15 @@ static void uvClientTimerCloseCb(struct uv_handle_s *handle)
     uvClientMaybeDestroy(c);
 }
 
+/* Invoked once the prepare handle of a client has been closed. */
+static void uvClientPrepareCloseCb(struct uv_handle_s *handle)
+{
+    struct uvClient *c = handle->data;
+    assert(handle == (struct uv_handle_s *)&c->prepare);
+    c->prepare.data = NULL;
+    uvClientMaybeDestroy(c);
+}
+
 /* Start shutting down a client since the raft_io instance has been closed. */
 static void uvClientAbort(struct uvClient *c)
 {
@@ -401,9 +928,27 @@ static void uvClientAbort(struct uvClient *c)
     /* Closing the timer implicitely stop it, so the timeout callback won't be
      * fired. */
     uv_close((struct uv_handle_s *)&c->timer, uvClientTimerCloseCb);
+
+    /* Messages that were batched but not yet written out will be canceled
+     * once the client gets destroyed. */
+    uv_close((struct uv_handle_s *)&c->prepare, uvClientPrepareCloseCb);
     c->closing = true;
 }
 
+/* Find the client object associated with the given server, if any. */
+static struct uvClient *uvFindClient(struct uv *uv, const raft_id id)
+{
+    queue *head;
+    QUEUE_FOREACH(head, &uv->clients)
+    {
+        struct uvClient *client = QUEUE_DATA(head, struct uvClient, queue);
+        if (client->id == id) {
+            return client;
+        }
+    }
+    return NULL;
+}
+
 /* Find the client object associated with the given server, or create one if
  * there's none yet. */
 static int uvGetClient(struct uv *uv,
@@ -411,16 +956,11 @@ static int uvGetClient(struct uv *uv,
                        const char *address,
                        struct uvClient **client)
 {
-    queue *head;
     int rv;
 
     /* Check if we already have a client object for this peer server. */
-    QUEUE_FOREACH(head, &uv->clients)
-    {
-        *client = QUEUE_DATA(head, struct uvClient, queue);
-        if ((*client)->id != id) {
-            continue;
-        }
+    *client = uvFindClient(uv, id);
+    if (*client != NULL) {
         /* TODO: handle a change in the address */
         /* assert(strcmp((*client)->address, address) == 0); */
         return 0;
@@ -456,6 +996,18 @@ int UvSend(struct raft_io *io,
            raft_io_send_cb cb)
 {
     struct uv *uv = io->impl;
+    if (uv->host != NULL) {
+        return UvHostSend(uv, req, message, cb);
+    }
+    return UvSendGroup(uv, req, message, 0, cb);
+}
+
+int UvSendGroup(struct uv *uv,
+                struct raft_io_send *req,
+                const struct raft_message *message,
+                unsigned long long group,
+                raft_io_send_cb cb)
+{
     struct uvSend *send;
     struct uvClient *client;
     int rv;
@@ -469,13 +1021,37 @@ int UvSend(struct raft_io *io,
         goto err;
     }
     send->req = req;
+    send->bufs = NULL;
+    send->compressed.base = NULL;
+    send->compressed.len = 0;
+    send->ready = true;
     req->cb = cb;
 
+    /* If batching is enabled and we are already connected to the target
+     * server, let the client write out the message together with the others
+     * sent in this loop iteration, unless it needs to be compressed or must
+     * wait for a message being compressed. */
+    if (uv->send_batching) {
+        client = uvFindClient(uv, message->server_id);
+        if (client != NULL && client->stream != NULL &&
+            QUEUE_IS_EMPTY(&client->compressing) &&
+            !uvClientShouldCompress(client, message)) {
+            rv = uvClientBatch(client, send, message, group);
+            if (rv != 0) {
+                goto err_after_send_alloc;
+            }
+            return 0;
+        }
+    }
+
     rv = uvEncodeMessage(message, &send->bufs, &send->n_bufs);
     if (rv != 0) {
         send->bufs = NULL;
         goto err_after_send_alloc;
     }
+    if (group != 0) {
+        uvEncodeMessageGroup(send->bufs[0].base, group);
+    }
 
     /* Get a client object connected to the target server, creating it if it
      * doesn't exist yet. */
@@ -484,7 +1060,16 @@ int UvSend(struct raft_io *io,
         goto err_after_send_alloc;
     }
 
-    rv = uvClientSend(client, send);
+    if (uvClientShouldCompress(client, message)) {
+        rv = uvClientCompress(client, send);
+    } else if (!QUEUE_IS_EMPTY(&client->compressing)) {
+        /* Wait for the messages sent before this one to be compressed. */
+        send->client = client;
+        QUEUE_PUSH(&client->compressing, &send->queue);
+        rv = 0;
+    } else {
+        rv = uvClientSend(client, send);
+    }
     if (rv != 0) {
         goto err_after_send_alloc;
     }
@@ -498,6 +1083,44 @@ err:
     return rv;
 }
 
+void UvSendCancel(struct uv *uv, const void *data)
+{
+    queue canceled;
+    queue *head;
+    queue *next;
+
+    /* Detach the requests first, since their callbacks might send new
+     * messages. */
+    QUEUE_INIT(&canceled);
+    QUEUE_FOREACH(head, &uv->clients)
+    {
+        struct uvClient *c = QUEUE_DATA(head, struct uvClient, queue);
+        queue *item = QUEUE_HEAD(&c->pending);
+        while (item != &c->pending) {
+            struct uvSend *send = QUEUE_DATA(item, struct uvSend, queue);
+            next = QUEUE_NEXT(item);
+            if (send->req->data == data) {
+                QUEUE_REMOVE(item);
+                QUEUE_PUSH(&canceled, item);
+            }
+            item = next;
+        }
+    }
+
+    while (!QUEUE_IS_EMPTY(&canceled)) {
+        struct uvSend *send;
+        struct raft_io_send *req;
+        head = QUEUE_HEAD(&canceled);
+        send = QUEUE_DATA(head, struct uvSend, queue);
+        QUEUE_REMOVE(head);
+        req = send->req;
+        uvSendDestroy(send);
+        if (req->cb != NULL) {
+            req->cb(req, RAFT_CANCELED);
+        }
+    }
+}
+
 void UvSendClose(struct uv *uv)
 {
     assert(uv->closing);
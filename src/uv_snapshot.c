@@ -5,6 +5,7 @@
 #include "array.h"
 #include "assert.h"
 #include "byte.h"
+#include "compress.h"
 #include "configuration.h"
 #include "heap.h"
 #include "uv.h"
@@ -137,16 +138,21 @@ void UvSnapshotSort(struct uvSnapshotInfo *infos, size_t n_infos)
 }
 
 /* Parse the metadata file of a snapshot and populate the metadata portion of
- * the given snapshot object accordingly. */
+ * the given snapshot object accordingly. Also return the codec used to compress
+ * the snapshot data and the length of the data once decompressed. */
 static int uvSnapshotLoadMeta(struct uv *uv,
                               struct uvSnapshotInfo *info,
                               struct raft_snapshot *snapshot,
+                              unsigned *codec,
+                              size_t *len,
                               char *errmsg)
 {
     uint64_t header[1 + /* Format version */
                     1 + /* CRC checksum */
                     1 + /* Configuration index */
                     1 /* Configuration length */];
+    uint64_t compression[1 + /* Codec */
+                         1 /* Decompressed data length */];
     struct raft_buffer buf;
     uint64_t format;
     uint32_t crc1;
@@ -173,12 +179,27 @@ static int uvSnapshotLoadMeta(struct uv *uv,
     }
 
     format = byteFlip64(header[0]);
-    if (format != UV__DISK_FORMAT) {
+    if (format != UV__DISK_FORMAT && format != UV__DISK_FORMAT_COMPRESSED) {
         tracef("load %s: unsupported format %ju", info->filename, format);
         rv = RAFT_MALFORMED;
         goto err_after_open;
     }
 
+    *codec = COMPRESSION_NONE;
+    *len = 0;
+    if (format == UV__DISK_FORMAT_COMPRESSED) {
+        buf.base = compression;
+        buf.len = sizeof compression;
+        rv = UvFsReadInto(fd, &buf, errmsg);
+        if (rv != 0) {
+            tracef("read %s: %s", info->filename, errmsg);
+            rv = RAFT_IOERR;
+            goto err_after_open;
+        }
+        *codec = (unsigned)byteFlip64(compression[0]);
+        *len = (size_t)byteFlip64(compression[1]);
+    }
+
     crc1 = (uint32_t)byteFlip64(header[1]);
 
     snapshot->configuration_index = byteFlip64(header[2]);
@@ -208,6 +229,9 @@ static int uvSnapshotLoadMeta(struct uv *uv,
     }
 
     crc2 = byteCrc32(header + 2, sizeof header - sizeof(uint64_t) * 2, 0);
+    if (format == UV__DISK_FORMAT_COMPRESSED) {
+        crc2 = byteCrc32(compression, sizeof compression, crc2);
+    }
     crc2 = byteCrc32(buf.base, buf.len, crc2);
 
     if (crc1 != crc2) {
@@ -239,14 +263,17 @@ err:
 }
 
 /* Load the snapshot data file and populate the data portion of the given
- * snapshot object accordingly. */
+ * snapshot object accordingly, decompressing it if needed. */
 static int uvSnapshotLoadData(struct uv *uv,
                               struct uvSnapshotInfo *info,
                               struct raft_snapshot *snapshot,
+                              unsigned codec,
+                              size_t len,
                               char *errmsg)
 {
     char filename[UV__FILENAME_LEN];
     struct raft_buffer buf;
+    struct raft_buffer compressed;
     int rv;
 
     uvSnapshotFilenameOf(info, filename);
@@ -257,6 +284,16 @@ static int uvSnapshotLoadData(struct uv *uv,
         goto err;
     }
 
+    if (codec != COMPRESSION_NONE) {
+        compressed = buf;
+        rv = compressionDecode(codec, &compressed, len, &buf, errmsg);
+        HeapFree(compressed.base);
+        if (rv != 0) {
+            ErrMsgWrapf(errmsg, "decompress %s", filename);
+            goto err;
+        }
+    }
+
     snapshot->bufs = HeapMalloc(sizeof *snapshot->bufs);
     snapshot->n_bufs = 1;
     if (snapshot->bufs == NULL) {
@@ -280,12 +317,14 @@ int UvSnapshotLoad(struct uv *uv,
                    struct raft_snapshot *snapshot,
                    char *errmsg)
 {
+    unsigned codec;
+    size_t len;
     int rv;
-    rv = uvSnapshotLoadMeta(uv, meta, snapshot, errmsg);
+    rv = uvSnapshotLoadMeta(uv, meta, snapshot, &codec, &len, errmsg);
     if (rv != 0) {
         return rv;
     }
-    rv = uvSnapshotLoadData(uv, meta, snapshot, errmsg);
+    rv = uvSnapshotLoadData(uv, meta, snapshot, codec, len, errmsg);
     if (rv != 0) {
         return rv;
     }
@@ -301,9 +340,13 @@ struct uvSnapshotPut
     struct
     {
         unsigned long long timestamp;
-        uint64_t header[4];         /* Format, CRC, configuration index/len */
+        uint64_t header[6];         /* Format, CRC, configuration index/len,
+                                     * codec, decompressed data length */
         struct raft_buffer bufs[2]; /* Preamble and configuration */
     } meta;
+    unsigned codec;          /* Codec used to compress the data */
+    struct raft_buffer data; /* Compressed data, if any */
+    bool staged;             /* Data already written by UvSnapshotWrite() */
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
     int status;
     struct UvBarrier barrier;
@@ -399,8 +442,23 @@ static void uvSnapshotPutWorkCb(uv_work_t *work)
     char metadata[UV__FILENAME_LEN];
     char snapshot[UV__FILENAME_LEN];
     char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    struct raft_buffer *bufs = put->snapshot->bufs;
+    unsigned n_bufs = put->snapshot->n_bufs;
     int rv;
 
+    /* Compress the data here, rather than on the loop thread. */
+    if (put->codec != COMPRESSION_NONE) {
+        rv = compressionEncode(put->codec, bufs, n_bufs, &put->data,
+                               put->errmsg);
+        if (rv != 0) {
+            ErrMsgWrapf(put->errmsg, "compress snapshot");
+            put->status = rv;
+            return;
+        }
+        bufs = &put->data;
+        n_bufs = 1;
+    }
+
     sprintf(metadata, UV__SNAPSHOT_META_TEMPLATE, put->snapshot->term,
             put->snapshot->index, put->meta.timestamp);
 
@@ -414,8 +472,12 @@ static void uvSnapshotPutWorkCb(uv_work_t *work)
     sprintf(snapshot, UV__SNAPSHOT_TEMPLATE, put->snapshot->term,
             put->snapshot->index, put->meta.timestamp);
 
-    rv = UvFsMakeFile(uv->dir, snapshot, put->snapshot->bufs,
-                      put->snapshot->n_bufs, put->errmsg);
+    if (put->staged) {
+        rv = UvFsRenameFile(uv->dir, UV__SNAPSHOT_PARTIAL, snapshot,
+                            put->errmsg);
+    } else {
+        rv = UvFsMakeFile(uv->dir, snapshot, bufs, n_bufs, put->errmsg);
+    }
     if (rv != 0) {
         ErrMsgWrapf(put->errmsg, "write %s", snapshot);
         UvFsRemoveFile(uv->dir, metadata, errmsg);
@@ -451,6 +513,9 @@ static void uvSnapshotPutFinish(struct uvSnapshotPut *put)
     struct uv *uv = put->uv;
     assert(uv->snapshot_put_work.data == NULL);
     HeapFree(put->meta.bufs[1].base);
+    if (put->data.base != NULL) {
+        HeapFree(put->data.base);
+    }
     HeapFree(put);
     req->cb(req, status);
 }
@@ -460,12 +525,20 @@ static void uvSnapshotPutAfterWorkCb(uv_work_t *work, int status)
     struct uvSnapshotPut *put = work->data;
     struct uv *uv = put->uv;
     bool is_install = put->trailing == 0;
+    raft_index index = put->snapshot->index;
+    size_t trailing = put->trailing;
+    bool ok = put->status == 0;
     assert(status == 0);
     uv->snapshot_put_work.data = NULL;
     uvSnapshotPutFinish(put);
     if (is_install) {
         UvUnblock(uv);
     }
+    /* Let the shared write-ahead log drop the entries we don't need anymore,
+     * like uvRemoveOldSegmentsAndSnapshots() does with segments. */
+    if (ok && uv->wal != NULL && !uv->closing) {
+        UvWalRelease(uv, index >= trailing ? index - trailing + 1 : 0);
+    }
     uvMaybeFireCloseCb(uv);
 }
 
@@ -506,19 +579,21 @@ static void uvSnapshotPutBarrierCb(struct UvBarrier *barrier)
     uvSnapshotPutStart(put);
 }
 
-int UvSnapshotPut(struct raft_io *io,
-                  unsigned trailing,
-                  struct raft_io_snapshot_put *req,
-                  const struct raft_snapshot *snapshot,
-                  raft_io_snapshot_put_cb cb)
+/* Submit a put request. If @staged is true, the data of the snapshot is the one
+ * written so far by UvSnapshotWrite() and the buffers of @snapshot are
+ * ignored. */
+static int uvSnapshotPutSubmit(struct uv *uv,
+                               unsigned trailing,
+                               struct raft_io_snapshot_put *req,
+                               const struct raft_snapshot *snapshot,
+                               bool staged,
+                               raft_io_snapshot_put_cb cb)
 {
-    struct uv *uv;
     struct uvSnapshotPut *put;
     void *cursor;
     unsigned crc;
     int rv;
 
-    uv = io->impl;
     assert(!uv->closing);
     assert(uv->snapshot_put_work.data == NULL);
 
@@ -535,12 +610,21 @@ int UvSnapshotPut(struct raft_io *io,
     put->meta.timestamp = uv_now(uv->loop);
     put->trailing = trailing;
     put->barrier.data = put;
+    put->codec = staged ? COMPRESSION_NONE : uv->snapshot_compression;
+    put->data.base = NULL;
+    put->data.len = 0;
+    put->staged = staged;
 
     req->cb = cb;
 
-    /* Prepare the buffers for the metadata file. */
+    /* Prepare the buffers for the metadata file. The codec and decompressed
+     * data length are recorded only if the data gets compressed, so
+     * uncompressed snapshots can still be read by older versions. */
     put->meta.bufs[0].base = put->meta.header;
-    put->meta.bufs[0].len = sizeof put->meta.header;
+    put->meta.bufs[0].len = sizeof(uint64_t) * 4;
+    if (put->codec != COMPRESSION_NONE) {
+        put->meta.bufs[0].len += sizeof(uint64_t) * 2;
+    }
 
     rv = configurationEncode(&snapshot->configuration, &put->meta.bufs[1]);
     if (rv != 0) {
@@ -548,12 +632,27 @@ int UvSnapshotPut(struct raft_io *io,
     }
 
     cursor = put->meta.header;
-    bytePut64(&cursor, UV__DISK_FORMAT);
-    bytePut64(&cursor, 0);
-    bytePut64(&cursor, snapshot->configuration_index);
-    bytePut64(&cursor, put->meta.bufs[1].len);
+    if (put->codec != COMPRESSION_NONE) {
+        size_t len = 0;
+        unsigned i;
+        for (i = 0; i < snapshot->n_bufs; i++) {
+            len += snapshot->bufs[i].len;
+        }
+        bytePut64(&cursor, UV__DISK_FORMAT_COMPRESSED);
+        bytePut64(&cursor, 0);
+        bytePut64(&cursor, snapshot->configuration_index);
+        bytePut64(&cursor, put->meta.bufs[1].len);
+        bytePut64(&cursor, put->codec);
+        bytePut64(&cursor, len);
+    } else {
+        bytePut64(&cursor, UV__DISK_FORMAT);
+        bytePut64(&cursor, 0);
+        bytePut64(&cursor, snapshot->configuration_index);
+        bytePut64(&cursor, put->meta.bufs[1].len);
+    }
 
-    crc = byteCrc32(&put->meta.header[2], sizeof(uint64_t) * 2, 0);
+    crc = byteCrc32(&put->meta.header[2],
+                    put->meta.bufs[0].len - sizeof(uint64_t) * 2, 0);
     crc = byteCrc32(put->meta.bufs[1].base, put->meta.bufs[1].len, crc);
 
     cursor = &put->meta.header[1];
@@ -563,6 +662,14 @@ int UvSnapshotPut(struct raft_io *io,
      * snapshot. Submit a barrier request setting the next append index to the
      * snapshot's last index + 1. */
     if (trailing == 0) {
+        /* The shared write-ahead log has no segments to remove, so record
+         * that all entries of this group are gone. */
+        if (uv->wal != NULL) {
+            rv = UvWalTruncate(uv, 1);
+            if (rv != 0) {
+                goto err_after_configuration_encode;
+            }
+        }
         rv = UvBarrier(uv, snapshot->index + 1, &put->barrier,
                        uvSnapshotPutBarrierCb);
         if (rv != 0) {
@@ -583,6 +690,16 @@ err:
     return rv;
 }
 
+int UvSnapshotPut(struct raft_io *io,
+                  unsigned trailing,
+                  struct raft_io_snapshot_put *req,
+                  const struct raft_snapshot *snapshot,
+                  raft_io_snapshot_put_cb cb)
+{
+    struct uv *uv = io->impl;
+    return uvSnapshotPutSubmit(uv, trailing, req, snapshot, false, cb);
+}
+
 static void uvSnapshotGetWorkCb(uv_work_t *work)
 {
     struct uvSnapshotGet *get = work->data;
@@ -676,4 +793,358 @@ err:
     return rv;
 }
 
+/* Track a snapshot_read request. */
+struct uvSnapshotRead
+{
+    struct uv *uv;
+    struct raft_io_snapshot_read *req;
+    size_t offset;                  /* Offset of the data to read */
+    size_t len;                     /* Maximum number of bytes to read */
+    struct raft_snapshot *snapshot; /* Metadata and data read */
+    size_t size;                    /* Total size of the snapshot data */
+    struct uv_work_s work;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    int status;
+    queue queue;
+};
+
+/* Read the requested range of the data of the given snapshot into @buf.
+ * Compressed data can't be read at an arbitrary offset, so it gets loaded and
+ * decompressed in full, and only the requested range is kept. */
+static int uvSnapshotReadData(struct uv *uv,
+                              struct uvSnapshotRead *read,
+                              struct uvSnapshotInfo *info,
+                              unsigned codec,
+                              size_t len,
+                              struct raft_buffer *buf)
+{
+    char filename[UV__FILENAME_LEN];
+    struct raft_snapshot snapshot;
+    struct raft_buffer *data;
+    off_t size;
+    int rv;
+
+    if (codec != COMPRESSION_NONE) {
+        rv = uvSnapshotLoadData(uv, info, &snapshot, codec, len, read->errmsg);
+        if (rv != 0) {
+            return rv;
+        }
+        data = &snapshot.bufs[0];
+        read->size = data->len;
+        buf->len = 0;
+        if (read->offset < data->len) {
+            buf->len = data->len - read->offset;
+        }
+        if (buf->len > read->len) {
+            buf->len = read->len;
+        }
+        buf->base = HeapMalloc(buf->len > 0 ? buf->len : 1);
+        if (buf->base == NULL) {
+            rv = RAFT_NOMEM;
+        } else if (buf->len > 0) {
+            memcpy(buf->base, (char *)data->base + read->offset, buf->len);
+        }
+        HeapFree(data->base);
+        HeapFree(snapshot.bufs);
+        return rv;
+    }
+
+    uvSnapshotFilenameOf(info, filename);
+    rv = UvFsFileSize(uv->dir, filename, &size, read->errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+    read->size = (size_t)size;
+    buf->len = 0;
+    if (read->offset < read->size) {
+        buf->len = read->size - read->offset;
+    }
+    if (buf->len > read->len) {
+        buf->len = read->len;
+    }
+    buf->base = HeapMalloc(buf->len > 0 ? buf->len : 1);
+    if (buf->base == NULL) {
+        return RAFT_NOMEM;
+    }
+    rv = UvFsReadFileAt(uv->dir, filename, (off_t)read->offset, buf,
+                        read->errmsg);
+    if (rv != 0) {
+        HeapFree(buf->base);
+        return rv;
+    }
+
+    return 0;
+}
+
+static void uvSnapshotReadWorkCb(uv_work_t *work)
+{
+    struct uvSnapshotRead *read = work->data;
+    struct uv *uv = read->uv;
+    struct raft_snapshot *snapshot = read->snapshot;
+    struct uvSnapshotInfo *snapshots;
+    struct uvSnapshotInfo *info;
+    struct uvSegmentInfo *segments;
+    size_t n_snapshots;
+    size_t n_segments;
+    struct raft_buffer buf;
+    unsigned codec;
+    size_t len;
+    int rv;
+
+    rv = UvList(uv, &snapshots, &n_snapshots, &segments, &n_segments,
+                read->errmsg);
+    if (rv != 0) {
+        goto err;
+    }
+    if (segments != NULL) {
+        HeapFree(segments);
+    }
+    if (snapshots == NULL) {
+        ErrMsgPrintf(read->errmsg, "no snapshot found");
+        rv = RAFT_NOTFOUND;
+        goto err;
+    }
+    info = &snapshots[n_snapshots - 1];
+
+    rv = uvSnapshotLoadMeta(uv, info, snapshot, &codec, &len, read->errmsg);
+    if (rv != 0) {
+        goto err_after_list;
+    }
+
+    rv = uvSnapshotReadData(uv, read, info, codec, len, &buf);
+    if (rv != 0) {
+        goto err_after_load_meta;
+    }
+
+    snapshot->bufs = HeapMalloc(sizeof *snapshot->bufs);
+    if (snapshot->bufs == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_read_data;
+    }
+    snapshot->bufs[0] = buf;
+    snapshot->n_bufs = 1;
+
+    HeapFree(snapshots);
+    read->status = 0;
+    return;
+
+err_after_read_data:
+    HeapFree(buf.base);
+err_after_load_meta:
+    configurationClose(&snapshot->configuration);
+err_after_list:
+    HeapFree(snapshots);
+err:
+    assert(rv != 0);
+    read->status = rv;
+}
+
+static void uvSnapshotReadAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uvSnapshotRead *read = work->data;
+    struct raft_io_snapshot_read *req = read->req;
+    struct uv *uv = read->uv;
+    struct raft_snapshot *snapshot = read->snapshot;
+    size_t size = read->size;
+    int req_status = read->status;
+    assert(status == 0);
+
+    QUEUE_REMOVE(&read->queue);
+    HeapFree(read);
+
+    if (req_status == 0 && uv->closing) {
+        configurationClose(&snapshot->configuration);
+        HeapFree(snapshot->bufs[0].base);
+        HeapFree(snapshot->bufs);
+        req_status = RAFT_CANCELED;
+    }
+    if (req_status != 0) {
+        HeapFree(snapshot);
+        snapshot = NULL;
+        size = 0;
+    }
+
+    req->cb(req, snapshot, size, req_status);
+    uvMaybeFireCloseCb(uv);
+}
+
+int UvSnapshotRead(struct raft_io *io,
+                   struct raft_io_snapshot_read *req,
+                   size_t offset,
+                   size_t len,
+                   raft_io_snapshot_read_cb cb)
+{
+    struct uv *uv;
+    struct uvSnapshotRead *read;
+    int rv;
+
+    uv = io->impl;
+    assert(!uv->closing);
+
+    read = HeapMalloc(sizeof *read);
+    if (read == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    read->uv = uv;
+    read->req = req;
+    read->offset = offset;
+    read->len = len;
+    read->size = 0;
+    read->status = 0;
+    read->work.data = read;
+    req->cb = cb;
+
+    read->snapshot = HeapMalloc(sizeof *read->snapshot);
+    if (read->snapshot == NULL) {
+        rv = RAFT_NOMEM;
+        goto err_after_req_alloc;
+    }
+
+    QUEUE_PUSH(&uv->snapshot_read_reqs, &read->queue);
+    rv = uv_queue_work(uv->loop, &read->work, uvSnapshotReadWorkCb,
+                       uvSnapshotReadAfterWorkCb);
+    if (rv != 0) {
+        QUEUE_REMOVE(&read->queue);
+        tracef("read snapshot: %s", uv_strerror(rv));
+        rv = RAFT_IOERR;
+        goto err_after_snapshot_alloc;
+    }
+
+    return 0;
+
+err_after_snapshot_alloc:
+    HeapFree(read->snapshot);
+err_after_req_alloc:
+    HeapFree(read);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
+/* Track a snapshot_write request. */
+struct uvSnapshotWrite
+{
+    struct uv *uv;
+    struct raft_io_snapshot_write *req;
+    const struct raft_snapshot *snapshot;
+    size_t offset;                   /* Offset to write the chunk at */
+    const struct raft_buffer *chunk; /* Chunk to write */
+    bool done;                       /* Whether this is the last chunk */
+    struct raft_io_snapshot_put put; /* Store the snapshot when done */
+    struct uv_work_s work;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    int status;
+};
+
+/* Append the chunk to the partial snapshot file. */
+static void uvSnapshotWriteWorkCb(uv_work_t *work)
+{
+    struct uvSnapshotWrite *write = work->data;
+    struct uv *uv = write->uv;
+    int rv;
+
+    rv = UvFsWriteFileAt(uv->dir, UV__SNAPSHOT_PARTIAL, (off_t)write->offset,
+                         write->chunk, write->errmsg);
+    if (rv != 0) {
+        ErrMsgWrapf(write->errmsg, "write %s", UV__SNAPSHOT_PARTIAL);
+    }
+    write->status = rv;
+}
+
+static void uvSnapshotWriteFinish(struct uvSnapshotWrite *write, int status)
+{
+    struct raft_io_snapshot_write *req = write->req;
+    struct uv *uv = write->uv;
+    assert(uv->snapshot_write == write);
+    uv->snapshot_write = NULL;
+    HeapFree(write);
+    req->cb(req, status);
+}
+
+static void uvSnapshotWritePutCb(struct raft_io_snapshot_put *put, int status)
+{
+    struct uvSnapshotWrite *write = put->data;
+    uvSnapshotWriteFinish(write, status);
+}
+
+static void uvSnapshotWriteAfterWorkCb(uv_work_t *work, int status)
+{
+    struct uvSnapshotWrite *write = work->data;
+    struct uv *uv = write->uv;
+    int rv;
+    assert(status == 0);
+
+    rv = write->status;
+    if (rv == 0 && uv->closing) {
+        rv = RAFT_CANCELED;
+    }
+    if (rv != 0 || !write->done) {
+        goto out;
+    }
+
+    /* That was the last chunk: store the snapshot, renaming the partial file
+     * instead of writing the data again. */
+    write->put.data = write;
+    rv = uvSnapshotPutSubmit(uv, 0, &write->put, write->snapshot, true,
+                             uvSnapshotWritePutCb);
+    if (rv == 0) {
+        return;
+    }
+
+out:
+    uvSnapshotWriteFinish(write, rv);
+    uvMaybeFireCloseCb(uv);
+}
+
+int UvSnapshotWrite(struct raft_io *io,
+                    struct raft_io_snapshot_write *req,
+                    const struct raft_snapshot *snapshot,
+                    size_t offset,
+                    const struct raft_buffer *chunk,
+                    bool done,
+                    raft_io_snapshot_write_cb cb)
+{
+    struct uv *uv;
+    struct uvSnapshotWrite *write;
+    int rv;
+
+    uv = io->impl;
+    assert(!uv->closing);
+    assert(uv->snapshot_write == NULL);
+
+    write = HeapMalloc(sizeof *write);
+    if (write == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    write->uv = uv;
+    write->req = req;
+    write->snapshot = snapshot;
+    write->offset = offset;
+    write->chunk = chunk;
+    write->done = done;
+    write->status = 0;
+    write->work.data = write;
+    req->cb = cb;
+
+    uv->snapshot_write = write;
+    rv = uv_queue_work(uv->loop, &write->work, uvSnapshotWriteWorkCb,
+                       uvSnapshotWriteAfterWorkCb);
+    if (rv != 0) {
+        uv->snapshot_write = NULL;
+        tracef("write snapshot chunk: %s", uv_strerror(rv));
+        rv = RAFT_IOERR;
+        goto err_after_req_alloc;
+    }
+
+    return 0;
+
+err_after_req_alloc:
+    HeapFree(write);
+err:
+    assert(rv != 0);
+    return rv;
+}
+
 #undef tracef
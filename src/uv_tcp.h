@@ -7,6 +7,11 @@
 /* Protocol version. */
 #define UV__TCP_HANDSHAKE_PROTOCOL 1
 
+/* Protocol version of handshakes that offer compression codecs. The preamble
+ * and address are followed by a word with the bitmask of the offered codecs,
+ * and the accepting server replies with a word containing the chosen one. */
+#define UV__TCP_HANDSHAKE_PROTOCOL_COMPRESSION 2
+
 struct UvTcp
 {
     struct raft_uv_transport *transport; /* Interface object we implement */
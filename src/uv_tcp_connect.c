@@ -13,13 +13,17 @@
  * - Once connected over TCP, submit a write request for the handshake.
  * - Once the write completes, fire the connection request callback.
  *
+ * If compression codecs are offered, the handshake also contains them and the
+ * connection request callback is fired only after reading the reply with the
+ * codec accepted by the other server.
+ *
  * Possible failure modes are:
  *
  * - The transport get closed, close the TCP handle and and fire the request
  *   callback with RAFT_CANCELED.
  *
- * - Either the TCP connect or the write request fails: close the TCP handle and
- *   fire the request callback with RAFT_NOCONNECTION.
+ * - Either the TCP connect, the write request or the reply read fails: close
+ *   the TCP handle and fire the request callback with RAFT_NOCONNECTION.
  */
 
 /* Hold state for a single connection request. */
@@ -31,12 +35,18 @@ struct uvTcpConnect
     struct uv_tcp_s *tcp;        /* TCP connection socket handle */
     struct uv_connect_s connect; /* TCP connectionr request */
     struct uv_write_s write;     /* TCP handshake request */
+    uint64_t reply;              /* Codec accepted by the other server */
+    size_t nread;                /* Number of reply bytes read */
     int status;                  /* Returned to the request callback */
     queue queue;                 /* Pending connect queue */
 };
 
-/* Encode an handshake message into the given buffer. */
-static int uvTcpEncodeHandshake(raft_id id, const char *address, uv_buf_t *buf)
+/* Encode an handshake message into the given buffer, offering the given
+ * compression codecs if any. */
+static int uvTcpEncodeHandshake(raft_id id,
+                                const char *address,
+                                unsigned codecs,
+                                uv_buf_t *buf)
 {
     void *cursor;
     size_t address_len = bytePad64(strlen(address) + 1);
@@ -44,15 +54,28 @@ static int uvTcpEncodeHandshake(raft_id id, const char *address, uv_buf_t *buf)
                sizeof(uint64_t) + /* Server ID. */
                sizeof(uint64_t) /* Size of the address buffer */;
     buf->len += address_len;
+    if (codecs != 0) {
+        buf->len += sizeof(uint64_t); /* Offered codecs. */
+    }
     buf->base = HeapMalloc(buf->len);
     if (buf->base == NULL) {
         return RAFT_NOMEM;
     }
+    memset(buf->base, 0, buf->len);
     cursor = buf->base;
-    bytePut64(&cursor, UV__TCP_HANDSHAKE_PROTOCOL);
+    if (codecs != 0) {
+        bytePut64(&cursor, UV__TCP_HANDSHAKE_PROTOCOL_COMPRESSION);
+    } else {
+        bytePut64(&cursor, UV__TCP_HANDSHAKE_PROTOCOL);
+    }
     bytePut64(&cursor, id);
-    bytePut64(&cursor, address_len);
+    bytePut64(&cursor, codecs != 0 ? address_len + sizeof(uint64_t)
+                                    : address_len);
     strcpy(cursor, address);
+    if (codecs != 0) {
+        cursor = (uint8_t *)cursor + address_len;
+        bytePut64(&cursor, codecs);
+    }
     return 0;
 }
 
@@ -91,11 +114,68 @@ static void uvTcpConnectAbort(struct uvTcpConnect *connect)
     uv_close((struct uv_handle_s *)connect->tcp, uvTcpConnectUvCloseCb);
 }
 
-/* The handshake TCP write completes. Fire the connect callback. */
+/* Read the reply to an handshake offering compression codecs. */
+static void uvTcpConnectUvAllocCb(struct uv_handle_s *handle,
+                                  size_t suggested_size,
+                                  uv_buf_t *buf)
+{
+    struct uvTcpConnect *connect = handle->data;
+    (void)suggested_size;
+    buf->base = (char *)&connect->reply + connect->nread;
+    buf->len = sizeof connect->reply - connect->nread;
+}
+
+static void uvTcpConnectUvReadCb(struct uv_stream_s *stream,
+                                 ssize_t nread,
+                                 const uv_buf_t *buf)
+{
+    struct uvTcpConnect *connect = stream->data;
+    uint64_t codec;
+    int rv;
+
+    (void)buf;
+    assert(!connect->t->closing);
+
+    if (nread == 0) {
+        /* Empty read just ignore it. */
+        return;
+    }
+    if (nread < 0) {
+        connect->status = RAFT_NOCONNECTION;
+        uvTcpConnectAbort(connect);
+        return;
+    }
+
+    /* We shouldn't have read more data than the pending amount. */
+    assert((size_t)nread <= sizeof connect->reply - connect->nread);
+    connect->nread += (size_t)nread;
+    if (connect->nread < sizeof connect->reply) {
+        return;
+    }
+
+    rv = uv_read_stop(stream);
+    assert(rv == 0);
+
+    /* The other server must have chosen one of the codecs we offered. */
+    codec = byteFlip64(connect->reply);
+    if (codec != 0 && (codec >= sizeof(unsigned) * 8 ||
+                       !(connect->req->codecs & (1U << codec)))) {
+        connect->status = RAFT_NOCONNECTION;
+        uvTcpConnectAbort(connect);
+        return;
+    }
+    connect->req->codec = (unsigned)codec;
+
+    uvTcpConnectFinish(connect);
+}
+
+/* The handshake TCP write completes. Fire the connect callback, or wait for
+ * the reply if we offered compression codecs. */
 static void uvTcpConnectUvWriteCb(struct uv_write_s *write, int status)
 {
     struct uvTcpConnect *connect = write->data;
     struct UvTcp *t = connect->t;
+    int rv;
 
     if (t->closing) {
         connect->status = RAFT_CANCELED;
@@ -109,6 +189,18 @@ static void uvTcpConnectUvWriteCb(struct uv_write_s *write, int status)
         return;
     }
 
+    if (connect->req->codecs != 0) {
+        connect->nread = 0;
+        rv = uv_read_start((struct uv_stream_s *)connect->tcp,
+                           uvTcpConnectUvAllocCb, uvTcpConnectUvReadCb);
+        if (rv != 0) {
+            /* UNTESTED: this should never fail for a connected handle */
+            connect->status = RAFT_NOCONNECTION;
+            uvTcpConnectAbort(connect);
+        }
+        return;
+    }
+
     uvTcpConnectFinish(connect);
 }
 
@@ -159,7 +251,8 @@ static int uvTcpConnectStart(struct uvTcpConnect *r, const char *address)
     }
 
     /* Initialize the handshake buffer. */
-    rv = uvTcpEncodeHandshake(t->id, t->address, &r->handshake);
+    rv = uvTcpEncodeHandshake(t->id, t->address, r->req->codecs,
+                              &r->handshake);
     if (rv != 0) {
         assert(rv == RAFT_NOMEM);
         ErrMsgOom(r->t->transport->errmsg);
@@ -250,6 +343,9 @@ void UvTcpConnectClose(struct UvTcp *t)
         queue *head;
         head = QUEUE_HEAD(&t->connecting);
         connect = QUEUE_DATA(head, struct uvTcpConnect, queue);
+        /* Connections waiting for the handshake reply have no pending request
+         * that would set the status once canceled. */
+        connect->status = RAFT_CANCELED;
         uvTcpConnectAbort(connect);
     }
 }
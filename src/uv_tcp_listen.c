@@ -2,6 +2,7 @@
 
 #include "assert.h"
 #include "byte.h"
+#include "compress.h"
 #include "heap.h"
 #include "uv_ip.h"
 #include "uv_tcp.h"
@@ -14,7 +15,9 @@
  *
  * - Once the preamble is received, we start waiting for the server address.
  *
- * - Once the server address is received, we fire the receive callback.
+ * - Once the server address is received, we fire the receive callback. If the
+ *   connecting server offered compression codecs, we first write a reply with
+ *   the one we accept.
  *
  * Possible failure modes are:
  *
@@ -28,10 +31,17 @@
 struct uvTcpHandshake
 {
     uint64_t preamble[3]; /* Preamble buffer */
-    uv_buf_t address;     /* Address buffer */
+    uv_buf_t address;     /* Address buffer, followed by the offered codecs */
     size_t nread;         /* Number of bytes read */
 };
 
+/* Hold the reply to an handshake offering compression codecs. */
+struct uvTcpReply
+{
+    struct uv_write_s write; /* TCP write request */
+    uint64_t codec;          /* Accepted codec */
+};
+
 /* Hold handshake data for a new connection being established. */
 struct uvTcpIncoming
 {
@@ -48,10 +58,15 @@ static int uvTcpDecodePreamble(struct uvTcpHandshake *h)
 {
     uint64_t protocol;
     protocol = byteFlip64(h->preamble[0]);
-    if (protocol != UV__TCP_HANDSHAKE_PROTOCOL) {
+    if (protocol != UV__TCP_HANDSHAKE_PROTOCOL &&
+        protocol != UV__TCP_HANDSHAKE_PROTOCOL_COMPRESSION) {
         return RAFT_MALFORMED;
     }
     h->address.len = (size_t)byteFlip64(h->preamble[2]);
+    if (protocol == UV__TCP_HANDSHAKE_PROTOCOL_COMPRESSION &&
+        h->address.len <= sizeof(uint64_t)) {
+        return RAFT_MALFORMED;
+    }
     h->address.base = HeapMalloc(h->address.len);
     if (h->address.base == NULL) {
         return RAFT_NOMEM;
@@ -87,6 +102,53 @@ static void uvTcpIncomingAbort(struct uvTcpIncoming *incoming)
     uv_close((struct uv_handle_s *)incoming->tcp, uvTcpIncomingCloseCb);
 }
 
+static void uvTcpReplyWriteCb(struct uv_write_s *write, int status)
+{
+    struct uvTcpReply *reply = write->data;
+    (void)status;
+    HeapFree(reply);
+}
+
+/* Pick the first of the offered codecs which is available, and write it back
+ * to the connecting server. */
+static int uvTcpIncomingReply(struct uvTcpIncoming *incoming)
+{
+    struct uvTcpHandshake *h = &incoming->handshake;
+    struct uvTcpReply *reply;
+    const void *cursor;
+    uint64_t codecs;
+    unsigned codec;
+    uv_buf_t buf;
+    int rv;
+
+    cursor = h->address.base + h->address.len - sizeof(uint64_t);
+    codecs = byteGet64Unaligned(&cursor);
+
+    reply = HeapMalloc(sizeof *reply);
+    if (reply == NULL) {
+        return RAFT_NOMEM;
+    }
+    reply->write.data = reply;
+    reply->codec = byteFlip64(COMPRESSION_NONE);
+    for (codec = 1; codec < sizeof(unsigned) * 8; codec++) {
+        if ((codecs & (1U << codec)) && compressionIsAvailable(codec)) {
+            reply->codec = byteFlip64(codec);
+            break;
+        }
+    }
+
+    buf.base = (char *)&reply->codec;
+    buf.len = sizeof reply->codec;
+    rv = uv_write(&reply->write, (struct uv_stream_s *)incoming->tcp, &buf, 1,
+                  uvTcpReplyWriteCb);
+    if (rv != 0) {
+        HeapFree(reply);
+        return RAFT_IOERR;
+    }
+
+    return 0;
+}
+
 /* Read the address part of the handshake. */
 static void uvTcpIncomingAllocCbAddress(struct uv_handle_s *handle,
                                         size_t suggested_size,
@@ -137,6 +199,14 @@ static void uvTcpIncomingReadCbAddress(uv_stream_t *stream,
     /* If we have completed reading the address, let's fire the callback. */
     rv = uv_read_stop(stream);
     assert(rv == 0);
+    if (byteFlip64(incoming->handshake.preamble[0]) ==
+        UV__TCP_HANDSHAKE_PROTOCOL_COMPRESSION) {
+        rv = uvTcpIncomingReply(incoming);
+        if (rv != 0) {
+            uvTcpIncomingAbort(incoming);
+            return;
+        }
+    }
     id = byteFlip64(incoming->handshake.preamble[1]);
     address = incoming->handshake.address.base;
     QUEUE_REMOVE(&incoming->queue);
@@ -156,6 +156,10 @@ int UvTruncate(struct raft_io *io, raft_index index)
     assert(index > 0);
     assert(index < uv->append_next_index);
 
+    if (uv->wal != NULL) {
+        return UvWalTruncate(uv, index);
+    }
+
     truncate = HeapMalloc(sizeof *truncate);
     if (truncate == NULL) {
         rv = RAFT_NOMEM;
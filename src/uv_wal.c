@@ -0,0 +1,1381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "assert.h"
+#include "byte.h"
+#include "entry.h"
+#include "heap.h"
+#include "uv.h"
+#include "uv_encoding.h"
+
+/* The shared write-ahead log stores the entries of all groups attached to a
+ * host in a single sequence of files named wal-<counter>, instead of using
+ * open and closed segments in the data directory of each group.
+ *
+ * Each file starts with a format version word, followed by a sequence of
+ * records. A record has the following layout:
+ *
+ * - two 32-bit checksums, one covering the rest of the record header and one
+ *   covering the entries data.
+ * - the ID of the group the record belongs to.
+ * - the record kind, either UV__WAL_ENTRIES or UV__WAL_TRUNCATE.
+ * - the index of the first entry appended, or the index to truncate from.
+ * - for UV__WAL_ENTRIES records, a batch header and the entries data, encoded
+ *   like in segment files.
+ *
+ * Append and truncate requests submitted by the groups are queued, and all
+ * requests submitted during the same loop iteration are encoded into a
+ * single buffer, which gets written to the current file and then synced with
+ * a single fdatasync() call in the thread pool. Requests submitted while a
+ * write is in flight are written together in the following one.
+ *
+ * Once the current file grows past the segment size a new file is started.
+ * Files are never written again once another file has been started, so a
+ * file with a torn record at its end can only be the last one: its tail is
+ * truncated away when opening the log.
+ *
+ * When opening the log all files are scanned, and for each group an index of
+ * its live records (extents) is built, applying truncations along the way.
+ * Loading the entries of a group reads just its records. Once a group has
+ * taken a snapshot, its entries preceding the trailing amount are released,
+ * and the oldest files which hold no unreleased entry are removed. */
+
+/* Format version of log files. */
+#define UV__WAL_FORMAT 1
+
+/* Template string for log filenames. */
+#define UV__WAL_TEMPLATE "wal-%llu"
+
+/* Record kinds. */
+#define UV__WAL_ENTRIES 1
+#define UV__WAL_TRUNCATE 2
+
+/* Size of the checksums, group ID, kind and index of a record. */
+#define UV__WAL_RECORD_HEADER_SIZE (sizeof(uint64_t) * 4)
+
+/* Initial capacity of the arrays of groups, extents and files. */
+#define UV__WAL_INITIAL_CAP 8
+
+/* Live entries of a group stored in a single record. */
+struct uvWalExtent
+{
+    unsigned long long counter; /* File containing the record */
+    size_t offset;              /* Offset of the record in the file */
+    size_t size;                /* Size of the record */
+    raft_index first_index;     /* Index of the first entry */
+    unsigned n;                 /* Number of entries not truncated */
+};
+
+/* Index of the records of a group. */
+struct uvWalGroup
+{
+    unsigned long long id;       /* Group ID */
+    struct uvWalExtent *extents; /* Live records, in index order */
+    unsigned n_extents;          /* Number of live records */
+    unsigned cap_extents;        /* Capacity of the extents array */
+    raft_index retain;           /* First entry not released */
+};
+
+/* Append or truncate request submitted by a group. */
+struct uvWalReq
+{
+    struct uv *uv;                    /* Group submitting the request */
+    struct raft_io_append *req;       /* User request, or NULL */
+    unsigned kind;                    /* Record kind */
+    raft_index index;                 /* First index or truncation index */
+    const struct raft_entry *entries; /* Entries to append */
+    unsigned n;                       /* Number of entries */
+    size_t offset;                    /* Offset of the record in the file */
+    size_t size;                      /* Size of the encoded record */
+    queue queue;                      /* Pending or writing queue */
+};
+
+struct UvWal
+{
+    struct uv_loop_s *loop;             /* Event loop */
+    char dir[UV__DIR_LEN];              /* Directory of the log files */
+    size_t segment_size;                /* Size after which to start a file */
+    struct uvWalGroup *groups;          /* Index of all groups, sorted by ID */
+    unsigned n_groups;                  /* Number of groups */
+    unsigned cap_groups;                /* Capacity of the groups array */
+    unsigned long long *files;          /* Counters of all files, ascending */
+    unsigned n_files;                   /* Number of files */
+    unsigned cap_files;                 /* Capacity of the files array */
+    unsigned long long next_counter;    /* Counter of the next file */
+    uv_file fd;                         /* Current file, or -1 */
+    unsigned long long counter;         /* Counter of the current file */
+    size_t size;                        /* Size of the current file */
+    bool rollover;                      /* Start a new file on next write */
+    queue pending;                      /* Requests waiting to be written */
+    queue writing;                      /* Requests being written */
+    struct uv_prepare_s prepare;        /* Write pending requests */
+    struct uv_work_s work;              /* Write in the thread pool */
+    uv_buf_t buf;                       /* Encoded records being written */
+    size_t buf_cap;                     /* Capacity of the buffer */
+    bool write_new_file;                /* The write starts a new file */
+    unsigned long long write_counter;   /* File being written */
+    size_t write_offset;                /* Offset of the write */
+    int status;                         /* Result of the write */
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];  /* Error of the write */
+    bool errored;                       /* A write failed */
+    struct uv_work_s cleanup_work;      /* Remove obsolete files */
+    unsigned long long *obsolete;       /* Files being removed */
+    unsigned n_obsolete;                /* Number of files being removed */
+    bool closing;                       /* True after UvWalClose */
+    UvWalCloseCb close_cb;              /* Invoked when finishing closing */
+    void *close_data;                   /* Argument of the close callback */
+};
+
+/* Return the position of the group with the given ID in the index, or the
+ * position where it should be inserted. */
+static unsigned uvWalSearch(struct UvWal *wal, unsigned long long id)
+{
+    unsigned lo = 0;
+    unsigned hi = wal->n_groups;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (wal->groups[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Return the index of the group with the given ID, or NULL. */
+static struct uvWalGroup *uvWalFindGroup(struct UvWal *wal,
+                                         unsigned long long id)
+{
+    unsigned i = uvWalSearch(wal, id);
+    if (i < wal->n_groups && wal->groups[i].id == id) {
+        return &wal->groups[i];
+    }
+    return NULL;
+}
+
+/* Return the index of the group with the given ID, creating an empty one if
+ * needed. */
+static struct uvWalGroup *uvWalGetGroup(struct UvWal *wal,
+                                        unsigned long long id)
+{
+    struct uvWalGroup *g;
+    unsigned i = uvWalSearch(wal, id);
+
+    if (i < wal->n_groups && wal->groups[i].id == id) {
+        return &wal->groups[i];
+    }
+
+    if (wal->n_groups == wal->cap_groups) {
+        unsigned cap = wal->cap_groups == 0 ? UV__WAL_INITIAL_CAP
+                                            : wal->cap_groups * 2;
+        struct uvWalGroup *groups;
+        groups = HeapRealloc(wal->groups, cap * sizeof *groups);
+        if (groups == NULL) {
+            return NULL;
+        }
+        wal->groups = groups;
+        wal->cap_groups = cap;
+    }
+
+    memmove(&wal->groups[i + 1], &wal->groups[i],
+            (wal->n_groups - i) * sizeof *wal->groups);
+    wal->n_groups++;
+
+    g = &wal->groups[i];
+    g->id = id;
+    g->extents = NULL;
+    g->n_extents = 0;
+    g->cap_extents = 0;
+    g->retain = 0;
+
+    return g;
+}
+
+/* Return the index of the entry following the last live one of the group, or
+ * 0 if it has no live entry. */
+static raft_index uvWalGroupNextIndex(const struct uvWalGroup *g)
+{
+    const struct uvWalExtent *last;
+    if (g->n_extents == 0) {
+        return 0;
+    }
+    last = &g->extents[g->n_extents - 1];
+    return last->first_index + last->n;
+}
+
+/* Add a new extent at the end of the index of the given group. */
+static int uvWalGroupPush(struct uvWalGroup *g,
+                          unsigned long long counter,
+                          size_t offset,
+                          size_t size,
+                          raft_index first_index,
+                          unsigned n)
+{
+    struct uvWalExtent *e;
+
+    if (g->n_extents == g->cap_extents) {
+        unsigned cap = g->cap_extents == 0 ? UV__WAL_INITIAL_CAP
+                                           : g->cap_extents * 2;
+        struct uvWalExtent *extents;
+        extents = HeapRealloc(g->extents, cap * sizeof *extents);
+        if (extents == NULL) {
+            return RAFT_NOMEM;
+        }
+        g->extents = extents;
+        g->cap_extents = cap;
+    }
+
+    e = &g->extents[g->n_extents];
+    e->counter = counter;
+    e->offset = offset;
+    e->size = size;
+    e->first_index = first_index;
+    e->n = n;
+    g->n_extents++;
+
+    return 0;
+}
+
+/* Drop all entries of the group from the given index onward. */
+static void uvWalGroupTruncate(struct uvWalGroup *g, raft_index index)
+{
+    while (g->n_extents > 0) {
+        struct uvWalExtent *e = &g->extents[g->n_extents - 1];
+        if (e->first_index >= index) {
+            g->n_extents--;
+            continue;
+        }
+        if (e->first_index + e->n > index) {
+            e->n = (unsigned)(index - e->first_index);
+        }
+        break;
+    }
+}
+
+/* Add the given counter at the end of the files array. */
+static int uvWalPushFile(struct UvWal *wal, unsigned long long counter)
+{
+    if (wal->n_files == wal->cap_files) {
+        unsigned cap = wal->cap_files == 0 ? UV__WAL_INITIAL_CAP
+                                           : wal->cap_files * 2;
+        unsigned long long *files;
+        files = HeapRealloc(wal->files, cap * sizeof *files);
+        if (files == NULL) {
+            return RAFT_NOMEM;
+        }
+        wal->files = files;
+        wal->cap_files = cap;
+    }
+    wal->files[wal->n_files] = counter;
+    wal->n_files++;
+    return 0;
+}
+
+/* Return the size of the record encoding the given entries. */
+static size_t uvWalSizeofRecord(const struct raft_entry entries[], unsigned n)
+{
+    size_t size = UV__WAL_RECORD_HEADER_SIZE;
+    unsigned i;
+    if (n == 0) {
+        return size;
+    }
+    size += uvSizeofBatchHeader(n);
+    for (i = 0; i < n; i++) {
+        size += bytePad64(entries[i].buf.len);
+    }
+    return size;
+}
+
+/* Encode a record into the given buffer, which must be uvWalSizeofRecord()
+ * bytes long. */
+static void uvWalEncodeRecord(void *buf,
+                              unsigned long long group,
+                              unsigned kind,
+                              raft_index index,
+                              const struct raft_entry entries[],
+                              unsigned n)
+{
+    uint8_t *header = (uint8_t *)buf + sizeof(uint64_t);
+    uint8_t *data;
+    size_t size;
+    void *cursor;
+    unsigned crc1;
+    unsigned crc2;
+    unsigned i;
+
+    cursor = header;
+    bytePut64(&cursor, group);
+    bytePut64(&cursor, kind);
+    bytePut64(&cursor, index);
+
+    if (n > 0) {
+        uvEncodeBatchHeader(entries, n, cursor);
+        cursor = (uint8_t *)cursor + uvSizeofBatchHeader(n);
+    }
+    data = cursor;
+    crc1 = byteCrc32(header, (size_t)(data - header), 0);
+
+    for (i = 0; i < n; i++) {
+        size = entries[i].buf.len;
+        memcpy(cursor, entries[i].buf.base, size);
+        memset((uint8_t *)cursor + size, 0, bytePad64(size) - size);
+        cursor = (uint8_t *)cursor + bytePad64(size);
+    }
+    crc2 = byteCrc32(data, (size_t)((uint8_t *)cursor - data), 0);
+
+    cursor = buf;
+    bytePut32(&cursor, crc1);
+    bytePut32(&cursor, crc2);
+}
+
+/* Decoded header of a record. */
+struct uvWalRecord
+{
+    unsigned long long group;
+    unsigned kind;
+    raft_index index;
+    unsigned n;
+    size_t size;
+};
+
+/* Decode the record at the beginning of the given buffer. Return false if the
+ * buffer doesn't contain a complete and valid record. */
+static bool uvWalDecodeRecord(const uint8_t *buf,
+                              size_t len,
+                              struct uvWalRecord *record)
+{
+    const void *cursor = buf;
+    unsigned crc1;
+    unsigned crc2;
+    size_t header = UV__WAL_RECORD_HEADER_SIZE;
+    size_t data = 0;
+    unsigned i;
+
+    if (len < header) {
+        return false;
+    }
+
+    crc1 = byteGet32(&cursor);
+    crc2 = byteGet32(&cursor);
+    record->group = byteGet64(&cursor);
+    record->kind = (unsigned)byteGet64(&cursor);
+    record->index = byteGet64(&cursor);
+    record->n = 0;
+
+    if (record->group == 0) {
+        return false;
+    }
+
+    switch (record->kind) {
+        case UV__WAL_ENTRIES:
+            if (len < header + sizeof(uint64_t)) {
+                return false;
+            }
+            record->n = (unsigned)byteGet64(&cursor);
+            /* Each entry takes 16 bytes in the batch header. */
+            if (record->n == 0 ||
+                record->n > (len - header - sizeof(uint64_t)) / 16) {
+                return false;
+            }
+            header += uvSizeofBatchHeader(record->n);
+            for (i = 0; i < record->n; i++) {
+                /* Skip the term, type and unused bytes. */
+                cursor = (const uint8_t *)cursor + sizeof(uint64_t) + 4;
+                data += bytePad64(byteGet32(&cursor));
+            }
+            if (len - header < data) {
+                return false;
+            }
+            break;
+        case UV__WAL_TRUNCATE:
+            break;
+        default:
+            return false;
+    }
+
+    if (byteCrc32(buf + sizeof(uint64_t), header - sizeof(uint64_t), 0) !=
+        crc1) {
+        return false;
+    }
+    if (byteCrc32(buf + header, data, 0) != crc2) {
+        return false;
+    }
+
+    record->size = header + data;
+
+    return true;
+}
+
+/* Update the index with the given record, found at the given position. */
+static int uvWalApply(struct UvWal *wal,
+                      const struct uvWalRecord *record,
+                      unsigned long long counter,
+                      size_t offset,
+                      char *errmsg)
+{
+    struct uvWalGroup *g;
+    raft_index next_index;
+    int rv;
+
+    g = uvWalGetGroup(wal, record->group);
+    if (g == NULL) {
+        ErrMsgOom(errmsg);
+        return RAFT_NOMEM;
+    }
+
+    if (record->kind == UV__WAL_TRUNCATE) {
+        uvWalGroupTruncate(g, record->index);
+        return 0;
+    }
+
+    next_index = uvWalGroupNextIndex(g);
+    if (next_index != 0 && record->index != next_index) {
+        ErrMsgPrintf(errmsg,
+                     "wal-%llu: group %llu has entry %llu after entry %llu",
+                     counter, record->group, record->index, next_index - 1);
+        return RAFT_CORRUPT;
+    }
+
+    rv = uvWalGroupPush(g, counter, offset, record->size, record->index,
+                        record->n);
+    if (rv != 0) {
+        ErrMsgOom(errmsg);
+        return rv;
+    }
+
+    return 0;
+}
+
+/* Truncate the given file at the given offset, dropping a torn write. */
+static int uvWalTruncateFile(struct UvWal *wal,
+                             const char *filename,
+                             size_t offset,
+                             char *errmsg)
+{
+    char path[UV__PATH_SZ];
+    uv_file fd;
+    int rv;
+
+    UvOsJoin(wal->dir, filename, path);
+    rv = UvOsOpen(path, UV_FS_O_WRONLY, 0, &fd);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "open", rv);
+        return RAFT_IOERR;
+    }
+    rv = UvOsTruncate(fd, (off_t)offset);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "ftruncate", rv);
+        UvOsClose(fd);
+        return RAFT_IOERR;
+    }
+    rv = UvOsFsync(fd);
+    UvOsClose(fd);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "fsync", rv);
+        return RAFT_IOERR;
+    }
+    return 0;
+}
+
+/* Scan all records of the given file, updating the index. */
+static int uvWalScanFile(struct UvWal *wal,
+                         unsigned long long counter,
+                         bool last,
+                         char *errmsg)
+{
+    char filename[UV__FILENAME_LEN];
+    struct raft_buffer buf;
+    const void *cursor;
+    off_t size;
+    size_t offset;
+    int rv;
+
+    sprintf(filename, UV__WAL_TEMPLATE, counter);
+
+    rv = UvFsFileSize(wal->dir, filename, &size, errmsg);
+    if (rv != 0) {
+        return RAFT_IOERR;
+    }
+
+    /* The last file might have been created right before a crash. */
+    if ((size_t)size < sizeof(uint64_t)) {
+        if (!last) {
+            ErrMsgPrintf(errmsg, "%s: file has only %lld bytes", filename,
+                         (long long)size);
+            return RAFT_CORRUPT;
+        }
+        if (size == 0) {
+            return 0;
+        }
+        return uvWalTruncateFile(wal, filename, 0, errmsg);
+    }
+
+    rv = UvFsReadFile(wal->dir, filename, &buf, errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+
+    cursor = buf.base;
+    if (byteGet64(&cursor) != UV__WAL_FORMAT) {
+        ErrMsgPrintf(errmsg, "%s: unexpected format version", filename);
+        rv = RAFT_CORRUPT;
+        goto out;
+    }
+
+    offset = sizeof(uint64_t);
+    while (offset < buf.len) {
+        struct uvWalRecord record;
+        if (!uvWalDecodeRecord((uint8_t *)buf.base + offset, buf.len - offset,
+                               &record)) {
+            break;
+        }
+        rv = uvWalApply(wal, &record, counter, offset, errmsg);
+        if (rv != 0) {
+            goto out;
+        }
+        offset += record.size;
+    }
+
+    if (offset < buf.len) {
+        if (!last) {
+            ErrMsgPrintf(errmsg, "%s: corrupted record at offset %zu",
+                         filename, offset);
+            rv = RAFT_CORRUPT;
+            goto out;
+        }
+        rv = uvWalTruncateFile(wal, filename, offset, errmsg);
+    }
+
+out:
+    HeapFree(buf.base);
+    return rv;
+}
+
+static int uvWalCompareCounters(const void *p1, const void *p2)
+{
+    unsigned long long c1 = *(const unsigned long long *)p1;
+    unsigned long long c2 = *(const unsigned long long *)p2;
+    if (c1 < c2) {
+        return -1;
+    }
+    return c1 > c2 ? 1 : 0;
+}
+
+/* Fill the files array with the counters of all log files in the directory,
+ * sorted in ascending order. */
+static int uvWalList(struct UvWal *wal, char *errmsg)
+{
+    struct uv_fs_s req;
+    struct uv_dirent_s entry;
+    int n;
+    int i;
+    int rv = 0;
+    int rv2;
+
+    n = uv_fs_scandir(NULL, &req, wal->dir, 0, NULL);
+    if (n < 0) {
+        ErrMsgPrintf(errmsg, "scan wal directory: %s", uv_strerror(n));
+        return RAFT_IOERR;
+    }
+
+    for (i = 0; i < n; i++) {
+        unsigned long long counter;
+        int consumed = 0;
+        rv2 = uv_fs_scandir_next(&req, &entry);
+        assert(rv2 == 0); /* Can't fail in libuv */
+        if (rv != 0) {
+            continue;
+        }
+        if (sscanf(entry.name, UV__WAL_TEMPLATE "%n", &counter, &consumed) !=
+                1 ||
+            (size_t)consumed != strlen(entry.name)) {
+            continue;
+        }
+        rv = uvWalPushFile(wal, counter);
+        if (rv != 0) {
+            ErrMsgOom(errmsg);
+        }
+    }
+
+    rv2 = uv_fs_scandir_next(&req, &entry);
+    assert(rv2 == UV_EOF);
+
+    if (rv == 0 && wal->n_files > 0) {
+        qsort(wal->files, wal->n_files, sizeof *wal->files,
+              uvWalCompareCounters);
+    }
+
+    return rv;
+}
+
+/* Release all memory used by the log. */
+static void uvWalDestroy(struct UvWal *wal)
+{
+    unsigned i;
+    for (i = 0; i < wal->n_groups; i++) {
+        HeapFree(wal->groups[i].extents);
+    }
+    HeapFree(wal->groups);
+    HeapFree(wal->files);
+    HeapFree(wal->buf.base);
+    HeapFree(wal);
+}
+
+int UvWalOpen(struct uv_loop_s *loop,
+              const char *dir,
+              size_t segment_size,
+              struct UvWal **wal,
+              char *errmsg)
+{
+    struct UvWal *w;
+    unsigned i;
+    int rv;
+
+    if (!UV__DIR_HAS_VALID_LEN(dir)) {
+        ErrMsgPrintf(errmsg, "directory path too long");
+        return RAFT_NAMETOOLONG;
+    }
+
+    rv = UvFsCheckDir(dir, errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+
+    w = HeapMalloc(sizeof *w);
+    if (w == NULL) {
+        ErrMsgOom(errmsg);
+        return RAFT_NOMEM;
+    }
+    memset(w, 0, sizeof *w);
+    w->loop = loop;
+    strcpy(w->dir, dir);
+    w->segment_size = segment_size;
+    w->fd = -1;
+    w->rollover = true;
+    QUEUE_INIT(&w->pending);
+    QUEUE_INIT(&w->writing);
+    w->work.data = NULL;
+    w->cleanup_work.data = NULL;
+
+    rv = uvWalList(w, errmsg);
+    if (rv != 0) {
+        goto err;
+    }
+
+    for (i = 0; i < w->n_files; i++) {
+        rv = uvWalScanFile(w, w->files[i], i == w->n_files - 1, errmsg);
+        if (rv != 0) {
+            goto err;
+        }
+    }
+    w->next_counter = w->n_files > 0 ? w->files[w->n_files - 1] + 1 : 1;
+
+    rv = uv_prepare_init(loop, &w->prepare);
+    assert(rv == 0); /* This should never fail */
+    w->prepare.data = w;
+
+    *wal = w;
+
+    return 0;
+
+err:
+    uvWalDestroy(w);
+    return rv;
+}
+
+static void uvWalWriteStart(struct UvWal *wal);
+
+/* Fire the callbacks of the requests that were being written, updating the
+ * index if the write succeeded. */
+static void uvWalWriteFinish(struct UvWal *wal, int status)
+{
+    if (status != 0) {
+        wal->errored = true;
+    }
+
+    while (!QUEUE_IS_EMPTY(&wal->writing)) {
+        queue *head;
+        struct uvWalReq *r;
+        struct raft_io_append *req;
+        struct uv *uv;
+        int rv = status;
+
+        head = QUEUE_HEAD(&wal->writing);
+        r = QUEUE_DATA(head, struct uvWalReq, queue);
+        QUEUE_REMOVE(head);
+
+        if (rv == 0) {
+            struct uvWalRecord record;
+            record.group = r->uv->group;
+            record.kind = r->kind;
+            record.index = r->index;
+            record.n = r->n;
+            record.size = r->size;
+            rv = uvWalApply(wal, &record, wal->write_counter, r->offset,
+                            wal->errmsg);
+            if (rv != 0) {
+                wal->errored = true;
+            }
+        }
+
+        uv = r->uv;
+        req = r->req;
+        HeapFree(r);
+        uv->wal_writes--;
+        if (req != NULL) {
+            req->cb(req, rv);
+        }
+        uvMaybeFireCloseCb(uv);
+    }
+}
+
+static void uvWalWorkCb(uv_work_t *work)
+{
+    struct UvWal *wal = work->data;
+    int rv;
+
+    if (wal->write_new_file) {
+        char filename[UV__FILENAME_LEN];
+        char path[UV__PATH_SZ];
+        if (wal->fd != -1) {
+            UvOsClose(wal->fd);
+            wal->fd = -1;
+        }
+        sprintf(filename, UV__WAL_TEMPLATE, wal->write_counter);
+        UvOsJoin(wal->dir, filename, path);
+        rv = UvOsOpen(path, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_EXCL,
+                      S_IRUSR | S_IWUSR, &wal->fd);
+        if (rv != 0) {
+            UvOsErrMsg(wal->errmsg, "open", rv);
+            goto err;
+        }
+        wal->counter = wal->write_counter;
+        wal->size = 0;
+    }
+
+    rv = UvOsWrite(wal->fd, &wal->buf, 1, (int64_t)wal->write_offset);
+    if (rv != (int)wal->buf.len) {
+        if (rv < 0) {
+            UvOsErrMsg(wal->errmsg, "write", rv);
+        } else {
+            ErrMsgPrintf(wal->errmsg, "short write: %d bytes", rv);
+        }
+        goto err;
+    }
+
+    rv = UvOsFdatasync(wal->fd);
+    if (rv != 0) {
+        UvOsErrMsg(wal->errmsg, "fdatasync", rv);
+        goto err;
+    }
+
+    if (wal->write_new_file) {
+        rv = UvFsSyncDir(wal->dir, wal->errmsg);
+        if (rv != 0) {
+            goto err;
+        }
+    }
+
+    wal->size = wal->write_offset + wal->buf.len;
+    wal->status = 0;
+    return;
+
+err:
+    wal->status = RAFT_IOERR;
+}
+
+static void uvWalMaybeFireCloseCb(struct UvWal *wal);
+
+static void uvWalAfterWorkCb(uv_work_t *work, int status)
+{
+    struct UvWal *wal = work->data;
+    assert(status == 0);
+    wal->work.data = NULL;
+    uvWalWriteFinish(wal, wal->status);
+    if (wal->closing) {
+        uvWalMaybeFireCloseCb(wal);
+        return;
+    }
+    /* Write the requests that accumulated in the meantime. */
+    if (!QUEUE_IS_EMPTY(&wal->pending)) {
+        uvWalWriteStart(wal);
+    }
+}
+
+/* Make sure the write buffer can hold the given amount of bytes. */
+static int uvWalEnsureBuf(struct UvWal *wal, size_t size)
+{
+    void *base;
+    size_t cap = wal->buf_cap == 0 ? 4096 : wal->buf_cap;
+    if (size <= wal->buf_cap) {
+        return 0;
+    }
+    while (cap < size) {
+        cap *= 2;
+    }
+    base = HeapRealloc(wal->buf.base, cap);
+    if (base == NULL) {
+        return RAFT_NOMEM;
+    }
+    wal->buf.base = base;
+    wal->buf_cap = cap;
+    return 0;
+}
+
+/* Encode all pending requests and write them out in the thread pool. */
+static void uvWalWriteStart(struct UvWal *wal)
+{
+    queue *head;
+    size_t size = 0;
+    size_t offset;
+    int rv;
+
+    assert(wal->work.data == NULL);
+    assert(QUEUE_IS_EMPTY(&wal->writing));
+
+    if (QUEUE_IS_EMPTY(&wal->pending)) {
+        return;
+    }
+
+    while (!QUEUE_IS_EMPTY(&wal->pending)) {
+        head = QUEUE_HEAD(&wal->pending);
+        QUEUE_REMOVE(head);
+        QUEUE_PUSH(&wal->writing, head);
+    }
+
+    if (wal->errored) {
+        rv = RAFT_IOERR;
+        goto err;
+    }
+
+    QUEUE_FOREACH(head, &wal->writing)
+    {
+        struct uvWalReq *r = QUEUE_DATA(head, struct uvWalReq, queue);
+        r->size = uvWalSizeofRecord(r->entries, r->n);
+        size += r->size;
+    }
+
+    wal->write_new_file =
+        wal->fd == -1 || wal->rollover ||
+        (wal->size > sizeof(uint64_t) && wal->size + size > wal->segment_size);
+
+    if (wal->write_new_file) {
+        rv = uvWalPushFile(wal, wal->next_counter);
+        if (rv != 0) {
+            goto err;
+        }
+        wal->write_counter = wal->next_counter;
+        wal->write_offset = 0;
+        wal->next_counter++;
+        wal->rollover = false;
+        offset = sizeof(uint64_t);
+    } else {
+        wal->write_counter = wal->counter;
+        wal->write_offset = wal->size;
+        offset = 0;
+    }
+
+    rv = uvWalEnsureBuf(wal, offset + size);
+    if (rv != 0) {
+        goto err;
+    }
+    if (offset > 0) {
+        void *cursor = wal->buf.base;
+        bytePut64(&cursor, UV__WAL_FORMAT);
+    }
+
+    QUEUE_FOREACH(head, &wal->writing)
+    {
+        struct uvWalReq *r = QUEUE_DATA(head, struct uvWalReq, queue);
+        uvWalEncodeRecord(wal->buf.base + offset, r->uv->group, r->kind,
+                          r->index, r->entries, r->n);
+        r->offset = wal->write_offset + offset;
+        offset += r->size;
+    }
+    wal->buf.len = offset;
+
+    wal->work.data = wal;
+    rv = uv_queue_work(wal->loop, &wal->work, uvWalWorkCb, uvWalAfterWorkCb);
+    if (rv != 0) {
+        wal->work.data = NULL;
+        rv = RAFT_IOERR;
+        goto err;
+    }
+
+    return;
+
+err:
+    uvWalWriteFinish(wal, rv);
+}
+
+static void uvWalPrepareCb(struct uv_prepare_s *prepare)
+{
+    struct UvWal *wal = prepare->data;
+    int rv;
+    rv = uv_prepare_stop(prepare);
+    assert(rv == 0);
+    if (wal->work.data == NULL) {
+        uvWalWriteStart(wal);
+    }
+}
+
+/* Queue a new request, to be written out before the loop polls for I/O. */
+static int uvWalSubmit(struct uv *uv,
+                       struct raft_io_append *req,
+                       unsigned kind,
+                       raft_index index,
+                       const struct raft_entry entries[],
+                       unsigned n)
+{
+    struct UvWal *wal = uv->wal;
+    struct uvWalReq *r;
+    int rv;
+
+    assert(!wal->closing);
+
+    if (wal->errored) {
+        ErrMsgPrintf(uv->io->errmsg, "shared wal is errored");
+        return RAFT_IOERR;
+    }
+
+    r = HeapMalloc(sizeof *r);
+    if (r == NULL) {
+        ErrMsgOom(uv->io->errmsg);
+        return RAFT_NOMEM;
+    }
+    r->uv = uv;
+    r->req = req;
+    r->kind = kind;
+    r->index = index;
+    r->entries = entries;
+    r->n = n;
+
+    QUEUE_PUSH(&wal->pending, &r->queue);
+    uv->wal_writes++;
+
+    if (wal->work.data == NULL) {
+        rv = uv_prepare_start(&wal->prepare, uvWalPrepareCb);
+        assert(rv == 0);
+    }
+
+    return 0;
+}
+
+int UvWalAppend(struct uv *uv,
+                struct raft_io_append *req,
+                const struct raft_entry entries[],
+                unsigned n,
+                raft_io_append_cb cb)
+{
+    int rv;
+    assert(n > 0);
+    req->cb = cb;
+    rv = uvWalSubmit(uv, req, UV__WAL_ENTRIES, uv->append_next_index, entries,
+                     n);
+    if (rv != 0) {
+        return rv;
+    }
+    uv->append_next_index += n;
+    return 0;
+}
+
+int UvWalTruncate(struct uv *uv, raft_index index)
+{
+    int rv;
+    rv = uvWalSubmit(uv, NULL, UV__WAL_TRUNCATE, index, NULL, 0);
+    if (rv != 0) {
+        return rv;
+    }
+    uv->append_next_index = index;
+    return 0;
+}
+
+int UvWalWriteSync(struct uv *uv,
+                   raft_index index,
+                   const struct raft_entry *entry)
+{
+    struct UvWal *wal = uv->wal;
+    char filename[UV__FILENAME_LEN];
+    struct raft_buffer buf;
+    struct uvWalRecord record;
+    unsigned long long counter;
+    void *cursor;
+    int rv;
+
+    record.group = uv->group;
+    record.kind = UV__WAL_ENTRIES;
+    record.index = index;
+    record.n = 1;
+    record.size = uvWalSizeofRecord(entry, 1);
+
+    buf.len = sizeof(uint64_t) + record.size;
+    buf.base = HeapMalloc(buf.len);
+    if (buf.base == NULL) {
+        rv = RAFT_NOMEM;
+        goto err;
+    }
+    cursor = buf.base;
+    bytePut64(&cursor, UV__WAL_FORMAT);
+    uvWalEncodeRecord(cursor, record.group, record.kind, index, entry, 1);
+
+    /* Since a write of other groups might be in flight, use a file of our
+     * own and make the next write start a new file, so files are still
+     * written in counter order. */
+    counter = wal->next_counter;
+    rv = uvWalPushFile(wal, counter);
+    if (rv != 0) {
+        goto err_after_buf_alloc;
+    }
+    wal->next_counter++;
+    wal->rollover = true;
+
+    sprintf(filename, UV__WAL_TEMPLATE, counter);
+    rv = UvFsMakeFile(wal->dir, filename, &buf, 1, uv->io->errmsg);
+    if (rv != 0) {
+        rv = RAFT_IOERR;
+        goto err_after_buf_alloc;
+    }
+    rv = UvFsSyncDir(wal->dir, uv->io->errmsg);
+    if (rv != 0) {
+        rv = RAFT_IOERR;
+        goto err_after_buf_alloc;
+    }
+
+    HeapFree(buf.base);
+
+    return uvWalApply(wal, &record, counter, sizeof(uint64_t), uv->io->errmsg);
+
+err_after_buf_alloc:
+    HeapFree(buf.base);
+err:
+    assert(rv != 0);
+    if (rv == RAFT_NOMEM) {
+        ErrMsgOom(uv->io->errmsg);
+    }
+    return rv;
+}
+
+/* Read the record of the given extent from the given file and decode its live
+ * entries into the given array. */
+static int uvWalLoadExtent(uv_file fd,
+                           const struct uvWalExtent *e,
+                           struct raft_entry *entries,
+                           char *errmsg)
+{
+    struct uv_fs_s req;
+    uv_buf_t buf;
+    const void *cursor;
+    unsigned n;
+    int rv;
+
+    buf.len = e->size;
+    buf.base = HeapMalloc(buf.len);
+    if (buf.base == NULL) {
+        ErrMsgOom(errmsg);
+        return RAFT_NOMEM;
+    }
+
+    rv = uv_fs_read(NULL, &req, fd, &buf, 1, (int64_t)e->offset, NULL);
+    if (rv != (int)buf.len) {
+        if (rv < 0) {
+            UvOsErrMsg(errmsg, "read", rv);
+        } else {
+            ErrMsgPrintf(errmsg, "short read: %d bytes", rv);
+        }
+        rv = RAFT_IOERR;
+        goto err;
+    }
+
+    cursor = buf.base + UV__WAL_RECORD_HEADER_SIZE;
+    n = (unsigned)byteGet64(&cursor);
+    assert(n >= e->n);
+
+    rv = uvDecodeBatchHeaderInto(buf.base + UV__WAL_RECORD_HEADER_SIZE,
+                                 entries, e->n);
+    if (rv != 0) {
+        ErrMsgPrintf(errmsg, "entries at offset %zu have unknown type",
+                     e->offset);
+        rv = RAFT_CORRUPT;
+        goto err;
+    }
+    uvDecodeEntriesBatch((uint8_t *)buf.base,
+                         UV__WAL_RECORD_HEADER_SIZE + uvSizeofBatchHeader(n),
+                         entries, e->n);
+
+    return 0;
+
+err:
+    HeapFree(buf.base);
+    return rv;
+}
+
+int UvWalLoad(struct uv *uv,
+              const struct raft_snapshot *snapshot,
+              raft_index *start_index,
+              struct raft_entry **entries,
+              size_t *n)
+{
+    struct UvWal *wal = uv->wal;
+    struct uvWalGroup *g;
+    char filename[UV__FILENAME_LEN];
+    unsigned long long counter = 0;
+    uv_file fd = -1;
+    raft_index last_index;
+    size_t total = 0;
+    size_t i;
+    unsigned j;
+    int rv;
+
+    *entries = NULL;
+    *n = 0;
+
+    g = uvWalFindGroup(wal, uv->group);
+    if (g == NULL || g->n_extents == 0) {
+        return 0;
+    }
+
+    last_index = uvWalGroupNextIndex(g) - 1;
+    if (snapshot != NULL) {
+        /* Entries behind the snapshot might still be around, if the files
+         * holding them also hold entries of other groups. Drop them, so new
+         * entries can be appended after the snapshot. */
+        if (last_index < snapshot->index) {
+            return uvWalSubmit(uv, NULL, UV__WAL_TRUNCATE, 1, NULL, 0);
+        }
+        if (g->extents[0].first_index > snapshot->index + 1) {
+            ErrMsgPrintf(uv->io->errmsg,
+                         "first entry in wal has index %llu, which is past "
+                         "last snapshot's index %llu",
+                         g->extents[0].first_index, snapshot->index);
+            return RAFT_CORRUPT;
+        }
+    }
+
+    for (j = 0; j < g->n_extents; j++) {
+        total += g->extents[j].n;
+    }
+    *entries = HeapMalloc(total * sizeof **entries);
+    if (*entries == NULL) {
+        ErrMsgOom(uv->io->errmsg);
+        return RAFT_NOMEM;
+    }
+
+    i = 0;
+    for (j = 0; j < g->n_extents; j++) {
+        const struct uvWalExtent *e = &g->extents[j];
+        if (fd == -1 || e->counter != counter) {
+            if (fd != -1) {
+                UvOsClose(fd);
+            }
+            counter = e->counter;
+            sprintf(filename, UV__WAL_TEMPLATE, counter);
+            rv = UvFsOpenFileForReading(wal->dir, filename, &fd,
+                                        uv->io->errmsg);
+            if (rv != 0) {
+                fd = -1;
+                rv = RAFT_IOERR;
+                goto err;
+            }
+        }
+        rv = uvWalLoadExtent(fd, e, &(*entries)[i], uv->io->errmsg);
+        if (rv != 0) {
+            goto err;
+        }
+        i += e->n;
+    }
+    UvOsClose(fd);
+
+    *start_index = g->extents[0].first_index;
+    *n = total;
+
+    return 0;
+
+err:
+    if (fd != -1) {
+        UvOsClose(fd);
+    }
+    if (i > 0) {
+        entryBatchesDestroy(*entries, i);
+    } else {
+        HeapFree(*entries);
+    }
+    *entries = NULL;
+    return rv;
+}
+
+static void uvWalCleanupWorkCb(uv_work_t *work)
+{
+    struct UvWal *wal = work->data;
+    char filename[UV__FILENAME_LEN];
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    unsigned i;
+    for (i = 0; i < wal->n_obsolete; i++) {
+        sprintf(filename, UV__WAL_TEMPLATE, wal->obsolete[i]);
+        UvFsRemoveFile(wal->dir, filename, errmsg);
+    }
+    UvFsSyncDir(wal->dir, errmsg);
+}
+
+static void uvWalMaybeCleanup(struct UvWal *wal);
+
+static void uvWalCleanupAfterWorkCb(uv_work_t *work, int status)
+{
+    struct UvWal *wal = work->data;
+    assert(status == 0);
+    wal->cleanup_work.data = NULL;
+    HeapFree(wal->obsolete);
+    wal->obsolete = NULL;
+    wal->n_obsolete = 0;
+    if (wal->closing) {
+        uvWalMaybeFireCloseCb(wal);
+        return;
+    }
+    uvWalMaybeCleanup(wal);
+}
+
+/* Return true if the given file holds no entry that is still needed. */
+static bool uvWalFileIsObsolete(struct UvWal *wal, unsigned long long counter)
+{
+    unsigned i;
+    unsigned j;
+
+    /* Never remove the file being written. */
+    if (wal->fd != -1 && counter == wal->counter) {
+        return false;
+    }
+    if (wal->work.data != NULL && counter == wal->write_counter) {
+        return false;
+    }
+
+    /* The extents of a group are sorted by file, like its entries. */
+    for (i = 0; i < wal->n_groups; i++) {
+        const struct uvWalGroup *g = &wal->groups[i];
+        for (j = 0; j < g->n_extents; j++) {
+            const struct uvWalExtent *e = &g->extents[j];
+            if (e->counter < counter) {
+                continue;
+            }
+            if (e->counter > counter) {
+                break;
+            }
+            if (e->first_index + e->n > g->retain) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Remove the oldest files holding no entry that is still needed. Records can
+ * only affect records in the same or older files, so only the oldest files
+ * can be removed. */
+static void uvWalMaybeCleanup(struct UvWal *wal)
+{
+    unsigned long long last;
+    unsigned n = 0;
+    unsigned i;
+    int rv;
+
+    if (wal->cleanup_work.data != NULL) {
+        return;
+    }
+
+    while (n + 1 < wal->n_files && uvWalFileIsObsolete(wal, wal->files[n])) {
+        n++;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    wal->obsolete = HeapMalloc(n * sizeof *wal->obsolete);
+    if (wal->obsolete == NULL) {
+        return;
+    }
+    memcpy(wal->obsolete, wal->files, n * sizeof *wal->obsolete);
+    wal->n_obsolete = n;
+    wal->n_files -= n;
+    memmove(wal->files, &wal->files[n], wal->n_files * sizeof *wal->files);
+
+    last = wal->obsolete[n - 1];
+    for (i = 0; i < wal->n_groups; i++) {
+        struct uvWalGroup *g = &wal->groups[i];
+        unsigned j = 0;
+        while (j < g->n_extents && g->extents[j].counter <= last) {
+            j++;
+        }
+        g->n_extents -= j;
+        memmove(g->extents, &g->extents[j], g->n_extents * sizeof *g->extents);
+    }
+
+    wal->cleanup_work.data = wal;
+    rv = uv_queue_work(wal->loop, &wal->cleanup_work, uvWalCleanupWorkCb,
+                       uvWalCleanupAfterWorkCb);
+    if (rv != 0) {
+        /* The files will be left around, they'll be removed on the next
+         * restart, once the groups take new snapshots. */
+        wal->cleanup_work.data = NULL;
+        HeapFree(wal->obsolete);
+        wal->obsolete = NULL;
+        wal->n_obsolete = 0;
+    }
+}
+
+void UvWalRelease(struct uv *uv, raft_index retain)
+{
+    struct UvWal *wal = uv->wal;
+    struct uvWalGroup *g;
+
+    g = uvWalFindGroup(wal, uv->group);
+    if (g == NULL) {
+        return;
+    }
+    if (retain > g->retain) {
+        g->retain = retain;
+    }
+
+    uvWalMaybeCleanup(wal);
+}
+
+static void uvWalMaybeFireCloseCb(struct UvWal *wal)
+{
+    UvWalCloseCb cb = wal->close_cb;
+    void *data = wal->close_data;
+
+    assert(wal->closing);
+
+    if (wal->prepare.data != NULL) {
+        return;
+    }
+    if (wal->work.data != NULL || wal->cleanup_work.data != NULL) {
+        return;
+    }
+
+    if (wal->fd != -1) {
+        UvOsClose(wal->fd);
+    }
+    uvWalDestroy(wal);
+
+    if (cb != NULL) {
+        cb(data);
+    }
+}
+
+static void uvWalPrepareCloseCb(uv_handle_t *handle)
+{
+    struct UvWal *wal = handle->data;
+    handle->data = NULL;
+    uvWalMaybeFireCloseCb(wal);
+}
+
+void UvWalClose(struct UvWal *wal, UvWalCloseCb cb, void *data)
+{
+    assert(!wal->closing);
+    assert(QUEUE_IS_EMPTY(&wal->pending));
+    wal->closing = true;
+    wal->close_cb = cb;
+    wal->close_data = data;
+    uv_close((uv_handle_t *)&wal->prepare, uvWalPrepareCloseCb);
+}
@@ -59,6 +59,141 @@ static int uvWriterIoSetup(unsigned n, aio_context_t *ctx, char *errmsg)
     return 0;
 }
 
+#if defined(UV__HAVE_IO_URING)
+
+/* Create the io_uring instance of the writer and register its file
+ * descriptor, so the kernel doesn't need to look it up at every write. */
+static int uvWriterUringSetup(struct UvWriter *w, char *errmsg)
+{
+    int rv;
+    rv = UvOsUringInit(&w->ring, w->n_events);
+    if (rv != 0) {
+        switch (rv) {
+            case UV_EMFILE:
+            case UV_ENFILE:
+                ErrMsgPrintf(errmsg, "io_uring instances limit exceeded");
+                rv = RAFT_TOOMANY;
+                break;
+            default:
+                UvOsErrMsg(errmsg, "io_uring_setup", rv);
+                rv = RAFT_IOERR;
+                break;
+        }
+        return rv;
+    }
+    rv = UvOsUringRegister(&w->ring, IORING_REGISTER_FILES, &w->fd, 1);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "io_uring_register", rv);
+        UvOsUringClose(&w->ring);
+        return RAFT_IOERR;
+    }
+    return 0;
+}
+
+/* Arrange for the writer's event fd to be signaled when a write completes. */
+static int uvWriterUringRegisterEventfd(struct UvWriter *w, char *errmsg)
+{
+    int rv;
+    rv = UvOsUringRegister(&w->ring, IORING_REGISTER_EVENTFD, &w->event_fd, 1);
+    if (rv != 0) {
+        UvOsErrMsg(errmsg, "io_uring_register", rv);
+        return RAFT_IOERR;
+    }
+    return 0;
+}
+
+static void uvWriterUringTeardown(struct UvWriter *w)
+{
+    UvOsUringClose(&w->ring);
+}
+
+/* Queue a vectored write against the registered file. */
+static int uvWriterUringSubmit(struct UvWriter *w,
+                               struct UvWriterReq *req,
+                               const uv_buf_t bufs[],
+                               unsigned n,
+                               size_t offset)
+{
+    struct io_uring_sqe *sqe;
+    int rv;
+
+    sqe = UvOsUringGetSqe(&w->ring);
+    if (sqe == NULL) {
+        /* UNTESTED: entries are consumed by the kernel upon submission, so the
+         * submission queue should never be full. */
+        ErrMsgPrintf(w->errmsg, "io_uring submission queue is full");
+        return RAFT_TOOMANY;
+    }
+
+    /* The layout of uv_buf_t matches the one of struct iovec on Linux. */
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0; /* Index of the registered file */
+    sqe->addr = (uint64_t)(uintptr_t)bufs;
+    sqe->len = n;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+
+    QUEUE_PUSH(&w->poll_queue, &req->queue);
+    rv = UvOsUringSubmit(&w->ring, 0);
+    if (rv != 0) {
+        QUEUE_REMOVE(&req->queue);
+        UvOsErrMsg(w->errmsg, "io_uring_enter", rv);
+        return RAFT_IOERR;
+    }
+
+    return 0;
+}
+
+/* Fire the callbacks of all writes whose completion entry is available. */
+static void uvWriterUringReap(struct UvWriter *w)
+{
+    struct io_uring_cqe *cqe;
+    while ((cqe = UvOsUringPeekCqe(&w->ring)) != NULL) {
+        struct UvWriterReq *req = (void *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        UvOsUringCqeSeen(&w->ring);
+        if (res < 0) {
+            UvOsErrMsg(req->errmsg, "io_uring write", res);
+        }
+        uvWriterReqSetStatus(req, res);
+        uvWriterReqFinish(req);
+    }
+}
+
+#endif /* UV__HAVE_IO_URING */
+
+/* Setup the KAIO context and the array of re-usable event objects. */
+static int uvWriterKaioSetup(struct UvWriter *w, char *errmsg)
+{
+    int rv;
+    rv = uvWriterIoSetup(w->n_events, &w->ctx, errmsg);
+    if (rv != 0) {
+        return rv;
+    }
+    w->events = HeapCalloc(w->n_events, sizeof *w->events);
+    if (w->events == NULL) {
+        /* UNTESTED: todo */
+        ErrMsgOom(errmsg);
+        UvOsIoDestroy(w->ctx);
+        return RAFT_NOMEM;
+    }
+    return 0;
+}
+
+/* Release the resources allocated by the I/O engine in use. */
+static void uvWriterEngineTeardown(struct UvWriter *w)
+{
+#if defined(UV__HAVE_IO_URING)
+    if (w->uring) {
+        uvWriterUringTeardown(w);
+        return;
+    }
+#endif /* UV__HAVE_IO_URING */
+    HeapFree(w->events);
+    UvOsIoDestroy(w->ctx);
+}
+
 /* Run blocking syscalls involved in a file write request.
  *
  * Perform a KAIO write request and synchronously wait for it to complete. */
@@ -163,6 +298,13 @@ static void uvWriterPollCb(uv_poll_t *poller, int status, int events)
     /* TODO: this assertion fails in unit tests */
     /* assert(completed == 1); */
 
+#if defined(UV__HAVE_IO_URING)
+    if (w->uring) {
+        uvWriterUringReap(w);
+        return;
+    }
+#endif /* UV__HAVE_IO_URING */
+
     /* Try to fetch the write responses.
      *
      * If we got here at least one write should have completed and io_events
@@ -210,6 +352,7 @@ int UvWriterInit(struct UvWriter *w,
                  uv_file fd,
                  bool direct /* Whether to use direct I/O */,
                  bool async /* Whether async I/O is available */,
+                 bool uring /* Whether io_uring is available */,
                  unsigned max_concurrent_writes,
                  char *errmsg)
 {
@@ -220,6 +363,7 @@ int UvWriterInit(struct UvWriter *w,
     w->loop = loop;
     w->fd = fd;
     w->async = async;
+    w->uring = uring;
     w->ctx = 0;
     w->events = NULL;
     w->n_events = max_concurrent_writes;
@@ -241,21 +385,21 @@ int UvWriterInit(struct UvWriter *w,
         }
     }
 
-    /* Setup the AIO context. */
-    rv = uvWriterIoSetup(w->n_events, &w->ctx, errmsg);
+    /* Setup either the io_uring instance or the AIO context. */
+#if defined(UV__HAVE_IO_URING)
+    if (w->uring) {
+        rv = uvWriterUringSetup(w, errmsg);
+    } else {
+        rv = uvWriterKaioSetup(w, errmsg);
+    }
+#else
+    assert(!w->uring);
+    rv = uvWriterKaioSetup(w, errmsg);
+#endif /* UV__HAVE_IO_URING */
     if (rv != 0) {
         goto err;
     }
 
-    /* Initialize the array of re-usable event objects. */
-    w->events = HeapCalloc(w->n_events, sizeof *w->events);
-    if (w->events == NULL) {
-        /* UNTESTED: todo */
-        ErrMsgOom(errmsg);
-        rv = RAFT_NOMEM;
-        goto err_after_io_setup;
-    }
-
     /* Create an event file descriptor to get notified when a write has
      * completed. */
     rv = UvOsEventfd(0, UV_FS_O_NONBLOCK);
@@ -263,10 +407,19 @@ int UvWriterInit(struct UvWriter *w,
         /* UNTESTED: should fail only with ENOMEM */
         UvOsErrMsg(errmsg, "eventfd", rv);
         rv = RAFT_IOERR;
-        goto err_after_events_alloc;
+        goto err_after_engine_setup;
     }
     w->event_fd = rv;
 
+#if defined(UV__HAVE_IO_URING)
+    if (w->uring) {
+        rv = uvWriterUringRegisterEventfd(w, errmsg);
+        if (rv != 0) {
+            goto err_after_event_fd;
+        }
+    }
+#endif /* UV__HAVE_IO_URING */
+
     rv = uv_poll_init(loop, &w->event_poller, w->event_fd);
     if (rv != 0) {
         /* UNTESTED: with the current libuv implementation this should never
@@ -300,10 +453,8 @@ int UvWriterInit(struct UvWriter *w,
 
 err_after_event_fd:
     UvOsClose(w->event_fd);
-err_after_events_alloc:
-    HeapFree(w->events);
-err_after_io_setup:
-    UvOsIoDestroy(w->ctx);
+err_after_engine_setup:
+    uvWriterEngineTeardown(w);
 err:
     assert(rv != 0);
     return rv;
@@ -314,8 +465,7 @@ static void uvWriterCleanUpAndFireCloseCb(struct UvWriter *w)
     assert(w->closing);
 
     UvOsClose(w->fd);
-    HeapFree(w->events);
-    UvOsIoDestroy(w->ctx);
+    uvWriterEngineTeardown(w);
 
     if (w->close_cb != NULL) {
         w->close_cb(w);
@@ -355,21 +505,33 @@ static void uvWriterCheckCloseCb(struct uv_handle_s *handle)
     uvWriterCleanUpAndFireCloseCb(w);
 }
 
-static void uvWriterCheckCb(struct uv_check_s *check)
+/* Return true if there are writes that must complete before the writer's
+ * resources can be released. */
+static bool uvWriterHasInflightWrites(struct UvWriter *w)
 {
-    struct UvWriter *w = check->data;
     if (!QUEUE_IS_EMPTY(&w->work_queue)) {
-        return;
+        return true;
     }
-    uv_close((struct uv_handle_s *)&w->check, uvWriterCheckCloseCb);
+#if defined(UV__HAVE_IO_URING)
+    /* Writes submitted to io_uring can't be canceled, and the kernel might
+     * still be reading their buffers. Their completions keep being reaped by
+     * the poll callback. */
+    if (w->uring && !QUEUE_IS_EMPTY(&w->poll_queue)) {
+        return true;
+    }
+#endif /* UV__HAVE_IO_URING */
+    return false;
 }
 
-void UvWriterClose(struct UvWriter *w, UvWriterCloseCb cb)
+/* Stop polling the event file descriptor, if not done already. Pending KAIO
+ * writes get canceled by the poller close callback. */
+static void uvWriterStopPolling(struct UvWriter *w)
 {
     int rv;
-    assert(!w->closing);
-    w->closing = true;
-    w->close_cb = cb;
+
+    if (uv_is_closing((struct uv_handle_s *)&w->event_poller)) {
+        return;
+    }
 
     /* We can close the event file descriptor right away, but we shoudln't close
      * the main file descriptor or destroy the AIO context since there might be
@@ -380,12 +542,34 @@ void UvWriterClose(struct UvWriter *w, UvWriterCloseCb cb)
     assert(rv == 0); /* Can this ever fail? */
 
     uv_close((struct uv_handle_s *)&w->event_poller, uvWriterPollerCloseCb);
+}
 
-    /* If we have requests executing in the threadpool, we need to wait for
-     * them. That's done in the check callback. */
-    if (!QUEUE_IS_EMPTY(&w->work_queue)) {
+static void uvWriterCheckCb(struct uv_check_s *check)
+{
+    struct UvWriter *w = check->data;
+    if (uvWriterHasInflightWrites(w)) {
+        return;
+    }
+    uvWriterStopPolling(w);
+    uv_close((struct uv_handle_s *)&w->check, uvWriterCheckCloseCb);
+}
+
+void UvWriterClose(struct UvWriter *w, UvWriterCloseCb cb)
+{
+    assert(!w->closing);
+    w->closing = true;
+    w->close_cb = cb;
+
+    if (!w->uring) {
+        uvWriterStopPolling(w);
+    }
+
+    /* If we have requests executing in the threadpool or submitted to
+     * io_uring, we need to wait for them. That's done in the check callback. */
+    if (uvWriterHasInflightWrites(w)) {
         uv_check_start(&w->check, uvWriterCheckCb);
     } else {
+        uvWriterStopPolling(w);
         uv_close((struct uv_handle_s *)&w->check, uvWriterCheckCloseCb);
     }
 }
@@ -414,9 +598,8 @@ int UvWriterSubmit(struct UvWriter *w,
 #endif /* RWF_NOWAIT */
     assert(!w->closing);
 
-    /* TODO: at the moment we are not leveraging the support for concurrent
-     *       writes, so ensure that we're getting write requests
-     *       sequentially. */
+    /* If the writer was set up for a single write at a time, ensure that we're
+     * getting write requests sequentially. */
     if (w->n_events == 1) {
         assert(QUEUE_IS_EMPTY(&w->poll_queue));
         assert(QUEUE_IS_EMPTY(&w->work_queue));
@@ -424,7 +607,7 @@ int UvWriterSubmit(struct UvWriter *w,
 
     assert(w->fd >= 0);
     assert(w->event_fd >= 0);
-    assert(w->ctx != 0);
+    assert(w->uring || w->ctx != 0);
     assert(req != NULL);
     assert(bufs != NULL);
     assert(n > 0);
@@ -437,6 +620,13 @@ int UvWriterSubmit(struct UvWriter *w,
     memset(&req->iocb, 0, sizeof req->iocb);
     memset(req->errmsg, 0, sizeof req->errmsg);
 
+#if defined(UV__HAVE_IO_URING)
+    /* With io_uring the write never blocks and never needs the threadpool. */
+    if (w->uring) {
+        return uvWriterUringSubmit(w, req, bufs, n, offset);
+    }
+#endif /* UV__HAVE_IO_URING */
+
     req->iocb.aio_fildes = (uint32_t)w->fd;
     req->iocb.aio_lio_opcode = IOCB_CMD_PWRITEV;
     req->iocb.aio_reqprio = 0;
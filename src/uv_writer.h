@@ -22,6 +22,10 @@ struct UvWriter
     struct uv_loop_s *loop;        /* Event loop */
     uv_file fd;                    /* File handle */
     bool async;                    /* Whether fully async I/O is supported */
+    bool uring;                    /* Whether to use io_uring instead of KAIO */
+#if defined(UV__HAVE_IO_URING)
+    struct UvOsUring ring;         /* io_uring instance with fd registered */
+#endif
     aio_context_t ctx;             /* KAIO handle */
     struct io_event *events;       /* Array of KAIO response objects */
     unsigned n_events;             /* Length of the events array */
@@ -41,6 +45,7 @@ int UvWriterInit(struct UvWriter *w,
                  uv_file fd,
                  bool direct /* Whether to use direct I/O */,
                  bool async /* Whether async I/O is available */,
+                 bool uring /* Whether io_uring is available */,
                  unsigned max_concurrent_writes,
                  char *errmsg);
 
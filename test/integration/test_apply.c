@@ -112,6 +112,56 @@ TEST(raft_apply, first, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+#define N_PENDING 1000
+
+struct pending
+{
+    unsigned i;        /* Submission order of the request */
+    unsigned *n_fired; /* Number of callbacks fired so far */
+};
+
+static void applyCbAssertOrder(struct raft_apply *req, int status, void *_)
+{
+    struct pending *pending = req->data;
+    (void)_;
+    munit_assert_int(status, ==, 0);
+    munit_assert_int(*pending->n_fired, ==, pending->i);
+    (*pending->n_fired)++;
+}
+
+static bool allPendingFired(struct raft_fixture *f, void *arg)
+{
+    unsigned *n_fired = arg;
+    (void)f;
+    return *n_fired == N_PENDING;
+}
+
+/* Many outstanding requests all complete, in submission order. */
+TEST(raft_apply, manyPending, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_apply *reqs = munit_malloc(N_PENDING * sizeof *reqs);
+    struct pending *pending = munit_malloc(N_PENDING * sizeof *pending);
+    unsigned n_fired = 0;
+    unsigned i;
+    int rv;
+    for (i = 0; i < N_PENDING; i++) {
+        struct raft_buffer buf;
+        FsmEncodeAddX(1, &buf);
+        pending[i].i = i;
+        pending[i].n_fired = &n_fired;
+        reqs[i].data = &pending[i];
+        rv = raft_apply(CLUSTER_RAFT(0), &reqs[i], &buf, 1,
+                        applyCbAssertOrder);
+        munit_assert_int(rv, ==, 0);
+    }
+    CLUSTER_STEP_UNTIL(allPendingFired, &n_fired, 5000);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, N_PENDING);
+    free(pending);
+    free(reqs);
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * Failure scenarios
@@ -137,3 +187,125 @@ TEST(raft_apply, leadershipLost, setUp, tearDown, 0, NULL)
     APPLY_WAIT;
     return MUNIT_OK;
 }
+
+/******************************************************************************
+ *
+ * Asynchronous FSM
+ *
+ *****************************************************************************/
+
+static char *async_apply[] = {"1", NULL};
+
+static MunitParameterEnum async_params[] = {
+    {CLUSTER_ASYNC_APPLY_PARAM, async_apply},
+    {NULL, NULL},
+};
+
+static void applyCbIncrement(struct raft_apply *req, int status, void *_)
+{
+    unsigned *n = req->data;
+    (void)_;
+    munit_assert_int(status, ==, 0);
+    (*n)++;
+}
+
+/* Return true if the leader has committed the entry at the given index. */
+static bool leaderHasCommitted(struct raft_fixture *f, void *arg)
+{
+    raft_index *index = arg;
+    return raft_fixture_get(f, 0)->commit_index >= *index;
+}
+
+/* Committed commands are applied only once the FSM acknowledges them. */
+TEST(raft_apply, async, setUp, tearDown, 0, async_params)
+{
+    struct fixture *f = data;
+    raft_index index = raft_last_index(CLUSTER_RAFT(0)) + 1;
+    APPLY_SUBMIT(0);
+
+    CLUSTER_STEP_UNTIL(leaderHasCommitted, &index, 2000);
+    munit_assert_false(_result.done);
+    munit_assert_int(raft_last_applied(CLUSTER_RAFT(0)), ==, index - 1);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 0);
+
+    munit_assert_int(FsmApplyFlush(CLUSTER_FSM(0)), ==, 1);
+    munit_assert_true(_result.done);
+    munit_assert_int(raft_last_applied(CLUSTER_RAFT(0)), ==, index);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 123);
+
+    return MUNIT_OK;
+}
+
+/* New entries keep being committed while the FSM is applying a batch, and are
+ * then submitted all together in the next batch. */
+TEST(raft_apply, asyncBatch, setUp, tearDown, 0, async_params)
+{
+    struct fixture *f = data;
+    raft_index index = raft_last_index(CLUSTER_RAFT(0)) + 1;
+    struct raft_apply req1;
+    struct raft_apply req2;
+    struct raft_apply req3;
+    unsigned n = 0;
+    req1.data = &n;
+    req2.data = &n;
+    req3.data = &n;
+
+    CLUSTER_APPLY_ADD_X(0, &req1, 1, applyCbIncrement);
+    CLUSTER_STEP_UNTIL(leaderHasCommitted, &index, 2000);
+
+    CLUSTER_APPLY_ADD_X(0, &req2, 2, applyCbIncrement);
+    CLUSTER_APPLY_ADD_X(0, &req3, 3, applyCbIncrement);
+    index += 2;
+    CLUSTER_STEP_UNTIL(leaderHasCommitted, &index, 2000);
+    munit_assert_int(n, ==, 0);
+
+    munit_assert_int(FsmApplyFlush(CLUSTER_FSM(0)), ==, 1);
+    munit_assert_int(n, ==, 1);
+    munit_assert_int(FsmApplyFlush(CLUSTER_FSM(0)), ==, 2);
+    munit_assert_int(n, ==, 3);
+    munit_assert_int(raft_last_applied(CLUSTER_RAFT(0)), ==, index);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 6);
+
+    return MUNIT_OK;
+}
+
+/* If the FSM fails to apply a batch, the batch is submitted again at the next
+ * tick. */
+TEST(raft_apply, asyncRetry, setUp, tearDown, 0, async_params)
+{
+    struct fixture *f = data;
+    raft_index index = raft_last_index(CLUSTER_RAFT(0)) + 1;
+    APPLY_SUBMIT(0);
+
+    CLUSTER_STEP_UNTIL(leaderHasCommitted, &index, 2000);
+    munit_assert_int(FsmApplyFail(CLUSTER_FSM(0), RAFT_IOERR), ==, 1);
+    munit_assert_false(_result.done);
+    munit_assert_int(raft_last_applied(CLUSTER_RAFT(0)), ==, index - 1);
+    munit_assert_int(CLUSTER_STATE(0), ==, RAFT_LEADER);
+
+    /* Nothing is submitted until the next tick. */
+    munit_assert_int(FsmApplyFlush(CLUSTER_FSM(0)), ==, 0);
+    CLUSTER_STEP_UNTIL_ELAPSED(CLUSTER_RAFT(0)->heartbeat_timeout);
+
+    munit_assert_int(FsmApplyFlush(CLUSTER_FSM(0)), ==, 1);
+    munit_assert_true(_result.done);
+    munit_assert_int(raft_last_applied(CLUSTER_RAFT(0)), ==, index);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 123);
+
+    return MUNIT_OK;
+}
+
+/* The raft instance can be closed while the FSM is applying a batch, and the
+ * close completes once the batch is done. */
+TEST(raft_apply, asyncClose, setUp, tearDown, 0, async_params)
+{
+    struct fixture *f = data;
+    raft_index index = raft_last_index(CLUSTER_RAFT(0)) + 1;
+    /* The request fails when the cluster gets torn down after returning. */
+    static struct result result = {RAFT_LEADERSHIPLOST, false};
+    static struct raft_apply req;
+    req.data = &result;
+    CLUSTER_APPLY_ADD_X(0, &req, 1, applyCbAssertResult);
+    CLUSTER_STEP_UNTIL(leaderHasCommitted, &index, 2000);
+    return MUNIT_OK;
+}
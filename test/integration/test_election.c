@@ -134,6 +134,37 @@ TEST(election, twoVoters, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* If the term and vote are stored asynchronously, vote requests and replies
+ * are sent only once the new values are durable. */
+TEST(election, asyncMeta, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    (void)params;
+    CLUSTER_SET_ASYNC_META(0);
+    CLUSTER_SET_ASYNC_META(1);
+    CLUSTER_START;
+
+    /* The first server eventually times out and converts to candidate, but it
+     * doesn't send RequestVote RPCs until it has stored its new term. */
+    STEP_UNTIL_CANDIDATE(0);
+    ASSERT_TIME(1000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_REQUEST_VOTE), ==, 0);
+    CLUSTER_STEP_UNTIL_ELAPSED(25);
+    ASSERT_TIME(1025);
+    munit_assert_int(CLUSTER_VOTED_FOR(0), ==, 1);
+
+    /* The second server grants its vote, but it replies only once the vote
+     * has been stored. */
+    munit_assert_int(CLUSTER_VOTED_FOR(1), ==, 0);
+    munit_assert_int(CLUSTER_N_SEND(1, RAFT_IO_REQUEST_VOTE_RESULT), ==, 0);
+
+    STEP_UNTIL_LEADER(0);
+    ASSERT_TIME(1050);
+    munit_assert_int(CLUSTER_VOTED_FOR(1), ==, 1);
+
+    return MUNIT_OK;
+}
+
 /* If we have already voted and the same candidate requests the vote again, the
  * vote is granted. */
 TEST(election, grantAgain, setUp, tearDown, 0, NULL)
@@ -0,0 +1,383 @@
+#include "../lib/cluster.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_CLUSTER;
+};
+
+static void *setUp(const MunitParameter params[], MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(3);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    return f;
+}
+
+static void *setUpSingle(const MunitParameter params[],
+                         MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(1);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    return f;
+}
+
+static void *setUpNoLeader(const MunitParameter params[],
+                           MUNIT_UNUSED void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_CLUSTER(3);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_CLUSTER;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+struct result
+{
+    int status;
+    bool done;
+};
+
+static void readIndexCbAssertResult(struct raft_read_index *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+}
+
+static bool readIndexCbHasFired(struct raft_fixture *f, void *arg)
+{
+    struct result *result = arg;
+    (void)f;
+    return result->done;
+}
+
+/* Submit a read index request. */
+#define READ_INDEX_SUBMIT(I)                                                   \
+    struct raft_read_index _req;                                               \
+    struct result _result = {0, false};                                        \
+    int _rv;                                                                   \
+    _req.data = &_result;                                                      \
+    _rv = raft_read_index(CLUSTER_RAFT(I), &_req, readIndexCbAssertResult);    \
+    munit_assert_int(_rv, ==, 0);
+
+/* Expect the read index callback to fire with the given status. */
+#define READ_INDEX_EXPECT(STATUS) _result.status = STATUS
+
+/* Wait until the read index request completes. */
+#define READ_INDEX_WAIT CLUSTER_STEP_UNTIL(readIndexCbHasFired, &_result, 2000)
+
+/* Submit to the I'th server a read index request and wait for the operation to
+ * succeed. */
+#define READ_INDEX(I)         \
+    do {                      \
+        READ_INDEX_SUBMIT(I); \
+        READ_INDEX_WAIT;      \
+    } while (0)
+
+/******************************************************************************
+ *
+ * Success scenarios
+ *
+ *****************************************************************************/
+
+SUITE(raft_read_index)
+
+/* If the leader has no entry from its current term, a barrier is appended and
+ * the request completes once it's applied. */
+TEST(raft_read_index, barrier, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_index last_index = raft_last_index(CLUSTER_RAFT(0));
+    READ_INDEX_SUBMIT(0);
+    munit_assert_int(raft_last_index(CLUSTER_RAFT(0)), ==, last_index + 1);
+    munit_assert_false(_result.done);
+    READ_INDEX_WAIT;
+    munit_assert_int(CLUSTER_LAST_APPLIED(0), >=, last_index + 1);
+    return MUNIT_OK;
+}
+
+/* Once an entry from the current term is committed, no entry is appended. */
+TEST(raft_read_index, noLogWrite, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_index last_index;
+    CLUSTER_MAKE_PROGRESS;
+    last_index = raft_last_index(CLUSTER_RAFT(0));
+    READ_INDEX_SUBMIT(0);
+    READ_INDEX_WAIT;
+    munit_assert_int(raft_last_index(CLUSTER_RAFT(0)), ==, last_index);
+    return MUNIT_OK;
+}
+
+/* Requests submitted while a confirmation round is in flight are served by a
+ * single further round. */
+TEST(raft_read_index, batch, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_read_index reqs[3];
+    struct result results[3];
+    unsigned i;
+    int rv;
+    CLUSTER_MAKE_PROGRESS;
+    for (i = 0; i < 3; i++) {
+        results[i].status = 0;
+        results[i].done = false;
+        reqs[i].data = &results[i];
+        rv = raft_read_index(CLUSTER_RAFT(0), &reqs[i],
+                             readIndexCbAssertResult);
+        munit_assert_int(rv, ==, 0);
+    }
+    munit_assert_int(reqs[0].round, ==, 1);
+    munit_assert_int(reqs[1].round, ==, 2);
+    munit_assert_int(reqs[2].round, ==, 2);
+    CLUSTER_STEP_UNTIL(readIndexCbHasFired, &results[2], 2000);
+    munit_assert_true(results[0].done);
+    munit_assert_true(results[1].done);
+    munit_assert_int(CLUSTER_RAFT(0)->leader_state.read_round, ==, 2);
+    return MUNIT_OK;
+}
+
+/* With a single voter the request completes without any network round. */
+TEST(raft_read_index, singleVoter, setUpSingle, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_MAKE_PROGRESS;
+    READ_INDEX_SUBMIT(0);
+    munit_assert_false(_result.done);
+    READ_INDEX_WAIT;
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Failure scenarios
+ *
+ *****************************************************************************/
+
+/* Trying to submit a read request on a follower that doesn't know the leader
+ * results in an error. */
+TEST(raft_read_index, notLeader, setUpNoLeader, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_read_index req;
+    int rv;
+    rv = raft_read_index(CLUSTER_RAFT(1), &req, NULL);
+    munit_assert_int(rv, ==, RAFT_NOTLEADER);
+    return MUNIT_OK;
+}
+
+/* If the leader is deposed before the confirmation round completes, the
+ * request fails. */
+TEST(raft_read_index, leadershipLost, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_MAKE_PROGRESS;
+    READ_INDEX_SUBMIT(0);
+    READ_INDEX_EXPECT(RAFT_LEADERSHIPLOST);
+    CLUSTER_DEPOSE;
+    munit_assert_true(_result.done);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Follower reads
+ *
+ *****************************************************************************/
+
+/* A follower asks the leader for a read index and completes the request once
+ * it has applied it. */
+TEST(raft_read_index, follower, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_index last_index;
+    CLUSTER_MAKE_PROGRESS;
+    last_index = raft_last_index(CLUSTER_RAFT(0));
+    READ_INDEX_SUBMIT(1);
+    READ_INDEX_WAIT;
+    munit_assert_int(_req.index, ==, last_index);
+    munit_assert_int(CLUSTER_LAST_APPLIED(1), >=, last_index);
+    munit_assert_int(raft_last_index(CLUSTER_RAFT(0)), ==, last_index);
+    munit_assert_int(CLUSTER_N_SEND(1, RAFT_IO_FORWARD_READ), ==, 1);
+    munit_assert_int(CLUSTER_N_RECV(1, RAFT_IO_FORWARD_READ_RESULT), ==, 1);
+    return MUNIT_OK;
+}
+
+/* Requests submitted to a follower while a ForwardRead RPC is in flight share
+ * the next one. */
+TEST(raft_read_index, followerBatch, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_read_index reqs[3];
+    struct result results[3];
+    unsigned i;
+    int rv;
+    CLUSTER_MAKE_PROGRESS;
+    for (i = 0; i < 3; i++) {
+        results[i].status = 0;
+        results[i].done = false;
+        reqs[i].data = &results[i];
+        rv = raft_read_index(CLUSTER_RAFT(1), &reqs[i],
+                             readIndexCbAssertResult);
+        munit_assert_int(rv, ==, 0);
+    }
+    CLUSTER_STEP_UNTIL(readIndexCbHasFired, &results[2], 2000);
+    munit_assert_true(results[0].done);
+    munit_assert_true(results[1].done);
+    munit_assert_int(CLUSTER_N_SEND(1, RAFT_IO_FORWARD_READ), ==, 2);
+    return MUNIT_OK;
+}
+
+/* If the ForwardRead RPC gets lost, it's sent again after an election
+ * timeout. */
+TEST(raft_read_index, followerRetry, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_SATURATE(1, 0);
+    READ_INDEX_SUBMIT(1);
+    CLUSTER_STEP_UNTIL_ELAPSED(500);
+    munit_assert_false(_result.done);
+    CLUSTER_DESATURATE(1, 0);
+    READ_INDEX_WAIT;
+    munit_assert_int(CLUSTER_N_SEND(1, RAFT_IO_FORWARD_READ), ==, 2);
+    return MUNIT_OK;
+}
+
+/* If the follower stops hearing from the leader and starts an election,
+ * pending requests fail. */
+TEST(raft_read_index, followerLeadershipLost, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_SATURATE_BOTHWAYS(0, 1);
+    READ_INDEX_SUBMIT(1);
+    READ_INDEX_EXPECT(RAFT_LEADERSHIPLOST);
+    CLUSTER_STEP_UNTIL(readIndexCbHasFired, &_result, 10000);
+    munit_assert_int(CLUSTER_STATE(1), !=, RAFT_FOLLOWER);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Lease reads
+ *
+ *****************************************************************************/
+
+SUITE(raft_lease_valid)
+
+/* Lease reads are disabled by default. */
+TEST(raft_lease_valid, disabled, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_index index;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    munit_assert_false(raft_lease_valid(CLUSTER_RAFT(0), &index));
+    return MUNIT_OK;
+}
+
+/* Once a majority of voters acknowledged a confirmation round, the leader
+ * holds a valid lease and the read index is its commit index. */
+TEST(raft_lease_valid, valid, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_index index;
+    raft_set_lease_reads(CLUSTER_RAFT(0), true);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    munit_assert_true(raft_lease_valid(CLUSTER_RAFT(0), &index));
+    munit_assert_int(index, ==, CLUSTER_RAFT(0)->commit_index);
+    munit_assert_false(raft_lease_valid(CLUSTER_RAFT(1), &index));
+    return MUNIT_OK;
+}
+
+/* The lease is kept valid by renewing it while followers are reachable. */
+TEST(raft_lease_valid, renew, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_index index;
+    raft_set_lease_reads(CLUSTER_RAFT(0), true);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(3000);
+    munit_assert_true(raft_lease_valid(CLUSTER_RAFT(0), &index));
+    munit_assert_int(raft_lease_expirations(CLUSTER_RAFT(0)), ==, 0);
+    return MUNIT_OK;
+}
+
+/* If followers stop acknowledging confirmation rounds, the lease expires
+ * before the leader steps down, and the expiration is accounted. */
+TEST(raft_lease_valid, expire, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_index index;
+    raft_set_lease_reads(CLUSTER_RAFT(0), true);
+    raft_set_lease_drift(CLUSTER_RAFT(0), 300);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    munit_assert_true(raft_lease_valid(CLUSTER_RAFT(0), &index));
+    CLUSTER_SATURATE_BOTHWAYS(0, 1);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_ELAPSED(800);
+    munit_assert_int(CLUSTER_STATE(0), ==, RAFT_LEADER);
+    munit_assert_false(raft_lease_valid(CLUSTER_RAFT(0), &index));
+    munit_assert_int(raft_lease_expirations(CLUSTER_RAFT(0)), ==, 1);
+    return MUNIT_OK;
+}
+
+static void transferCb(struct raft_transfer *req)
+{
+    bool *done = req->data;
+    *done = true;
+}
+
+static bool transferCbHasFired(struct raft_fixture *f, void *arg)
+{
+    bool *done = arg;
+    (void)f;
+    return *done;
+}
+
+/* The lease is not valid while a leadership transfer is in progress. */
+TEST(raft_lease_valid, transfer, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_transfer req;
+    bool transferred = false;
+    raft_index index;
+    int rv;
+    raft_set_lease_reads(CLUSTER_RAFT(0), true);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_STEP_UNTIL_ELAPSED(200);
+    munit_assert_true(raft_lease_valid(CLUSTER_RAFT(0), &index));
+    req.data = &transferred;
+    rv = raft_transfer(CLUSTER_RAFT(0), &req, 2, transferCb);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_false(raft_lease_valid(CLUSTER_RAFT(0), &index));
+    CLUSTER_STEP_UNTIL(transferCbHasFired, &transferred, 2000);
+    return MUNIT_OK;
+}
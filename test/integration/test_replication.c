@@ -293,6 +293,442 @@ TEST(replication, sendPipeline, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* A leader in pipeline mode stops sending new entries to a follower once the
+ * maximum number of in-flight AppendEntries messages is reached, and resumes
+ * as results come back. */
+TEST(replication, sendPipelineMaxInflight, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req1;
+    struct raft_apply req2;
+    struct raft_apply req3;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+    raft_set_max_inflight_messages(raft, 2);
+
+    /* Server 0 becomes leader and server 1 transitions to pipeline mode. */
+    CLUSTER_STEP_UNTIL_ELAPSED(1060);
+    ASSERT_LEADER(0);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 1);
+
+    /* The first two entries are sent immediately. */
+    CLUSTER_APPLY_ADD_X(0, &req1, 1, NULL);
+    CLUSTER_STEP;
+    CLUSTER_APPLY_ADD_X(0, &req2, 1, NULL);
+    CLUSTER_STEP;
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 3);
+    munit_assert_int(raft->leader_state.progress[1].inflight_n, ==, 2);
+
+    /* The third one has to wait, since the window is full. */
+    CLUSTER_APPLY_ADD_X(0, &req3, 1, NULL);
+    CLUSTER_STEP;
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 3);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 4);
+
+    /* Once results start to come back, the third entry gets sent too. */
+    CLUSTER_STEP_UNTIL_APPLIED(0, 4, 1000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 4);
+    munit_assert_int(raft->leader_state.progress[1].inflight_n, ==, 0);
+
+    return MUNIT_OK;
+}
+
+/* A leader in pipeline mode stops sending new entries to a follower once the
+ * total size of the in-flight entries reaches the configured maximum. */
+TEST(replication, sendPipelineMaxInflightBytes, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req1;
+    struct raft_apply req2;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+    raft_set_max_inflight_bytes(raft, 1);
+
+    CLUSTER_STEP_UNTIL_ELAPSED(1060);
+    ASSERT_LEADER(0);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 1);
+
+    /* The first entry is always sent, regardless of its size. */
+    CLUSTER_APPLY_ADD_X(0, &req1, 1, NULL);
+    CLUSTER_STEP;
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 2);
+    munit_assert_int(raft->leader_state.progress[1].inflight_bytes, >, 1);
+
+    /* The second one has to wait for the first to be acknowledged. */
+    CLUSTER_APPLY_ADD_X(0, &req2, 1, NULL);
+    CLUSTER_STEP;
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 2);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, 3, 1000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 3);
+
+    return MUNIT_OK;
+}
+
+/* With group commit enabled, entries applied during the same loop iteration
+ * are written to disk and sent to followers all at once. */
+TEST(replication, sendGroupCommit, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req1;
+    struct raft_apply req2;
+    struct raft_apply req3;
+    unsigned n_append;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+    raft_set_group_commit(raft, true);
+
+    CLUSTER_STEP_UNTIL_ELAPSED(1060);
+    ASSERT_LEADER(0);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 1);
+    n_append = CLUSTER_N_APPEND(0);
+
+    /* Nothing is submitted until the deferred callback fires. */
+    CLUSTER_APPLY_ADD_X(0, &req1, 1, NULL);
+    CLUSTER_APPLY_ADD_X(0, &req2, 1, NULL);
+    CLUSTER_APPLY_ADD_X(0, &req3, 1, NULL);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 2);
+    CLUSTER_STEP;
+    ASSERT_TIME(1060);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 5);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, 4, 1000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 2);
+    munit_assert_int(CLUSTER_N_APPEND(0), ==, n_append + 1);
+    munit_assert_int(CLUSTER_N_APPEND(1), ==, 1);
+
+    return MUNIT_OK;
+}
+
+/* With a group commit window, new entries are submitted only once the window
+ * has expired. */
+TEST(replication, sendGroupCommitWindow, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req1;
+    struct raft_apply req2;
+    raft_time time;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+    raft_set_group_commit(raft, true);
+    raft_set_group_commit_window(raft, 4500);
+
+    /* Wait for the result of the initial heartbeat, which would otherwise
+     * trigger sending new entries. */
+    CLUSTER_STEP_UNTIL_ELAPSED(1080);
+    ASSERT_LEADER(0);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 1);
+
+    CLUSTER_APPLY_ADD_X(0, &req1, 1, NULL);
+    CLUSTER_APPLY_ADD_X(0, &req2, 1, NULL);
+    time = CLUSTER_TIME;
+
+    /* The window is rounded up to 5 milliseconds by the fixture. */
+    while (CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES) == 1) {
+        CLUSTER_STEP;
+    }
+    munit_assert_int(CLUSTER_TIME, ==, time + 5);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 4);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, 3, 1000);
+
+    return MUNIT_OK;
+}
+
+/* A leader doing group commit submits deferred entries right away once their
+ * number reaches the configured maximum. */
+TEST(replication, sendGroupCommitMaxEntries, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req1;
+    struct raft_apply req2;
+    struct raft_apply req3;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+    raft_set_group_commit(raft, true);
+    raft_set_group_commit_max_entries(raft, 2);
+
+    CLUSTER_STEP_UNTIL_ELAPSED(1060);
+    ASSERT_LEADER(0);
+
+    CLUSTER_APPLY_ADD_X(0, &req1, 1, NULL);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 2);
+    CLUSTER_APPLY_ADD_X(0, &req2, 1, NULL);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 4);
+    CLUSTER_APPLY_ADD_X(0, &req3, 1, NULL);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 4);
+
+    CLUSTER_STEP_UNTIL_APPLIED(0, 4, 1000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 3);
+
+    return MUNIT_OK;
+}
+
+/* A leader stepping down stores the entries waiting for a group commit. */
+TEST(replication, sendGroupCommitStepDown, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+    raft_set_group_commit(raft, true);
+    raft_set_group_commit_window(raft, 10 * 1000 * 1000);
+
+    CLUSTER_STEP_UNTIL_ELAPSED(1060);
+    ASSERT_LEADER(0);
+
+    CLUSTER_APPLY_ADD_X(0, &req, 1, NULL);
+    CLUSTER_DEPOSE;
+    ASSERT_FOLLOWER(0);
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    munit_assert_int(raft->last_stored, ==, 2);
+
+    return MUNIT_OK;
+}
+
+struct result
+{
+    int status;
+    unsigned n; /* Number of times the callback fired. */
+};
+
+static void applyCbRecord(struct raft_apply *req, int status, void *result)
+{
+    struct result *r = req->data;
+    (void)result;
+    r->status = status;
+    r->n++;
+}
+
+static void barrierCbRecord(struct raft_barrier *req, int status)
+{
+    struct result *r = req->data;
+    r->status = status;
+    r->n++;
+}
+
+#define APPLY_ADD_X_RECORD(REQ, RESULT)                                   \
+    {                                                                     \
+        struct raft_buffer buf_;                                          \
+        int rv_;                                                          \
+        FsmEncodeAddX(1, &buf_);                                          \
+        (REQ)->data = RESULT;                                             \
+        rv_ = raft_apply(CLUSTER_RAFT(0), REQ, &buf_, 1, applyCbRecord); \
+        munit_assert_int(rv_, ==, 0);                                     \
+    }
+
+static char *cluster_1[] = {"1", NULL};
+
+static MunitParameterEnum cluster_1_params[] = {
+    {CLUSTER_N_PARAM, cluster_1},
+    {NULL, NULL},
+};
+
+/* If the disk write of a group commit fails, all requests whose entries were
+ * part of it fail exactly once, and their indexes get reused. */
+TEST(replication,
+     sendGroupCommitDiskError,
+     setUp,
+     tearDown,
+     0,
+     cluster_1_params)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req1;
+    struct raft_apply req2;
+    struct raft_barrier barrier;
+    struct raft_apply req3;
+    struct raft_apply req4;
+    struct raft_apply req5;
+    struct result results[6];
+    raft_index index;
+    unsigned i;
+    int rv;
+    memset(results, 0, sizeof results);
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+    raft_set_group_commit(raft, true);
+
+    CLUSTER_STEP_UNTIL_STATE_IS(0, RAFT_LEADER, 2000);
+    CLUSTER_STEP_UNTIL_APPLIED(0, raft_last_index(raft), 1000);
+    index = raft_last_index(raft) + 1;
+
+    CLUSTER_APPEND_FAULT(0, 0);
+    APPLY_ADD_X_RECORD(&req1, &results[0]);
+    APPLY_ADD_X_RECORD(&req2, &results[1]);
+    barrier.data = &results[2];
+    rv = raft_barrier(raft, &barrier, barrierCbRecord);
+    munit_assert_int(rv, ==, 0);
+    APPLY_ADD_X_RECORD(&req3, &results[3]);
+    munit_assert_int(raft_last_index(raft), ==, index + 3);
+
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+    for (i = 0; i < 4; i++) {
+        munit_assert_int(results[i].n, ==, 1);
+        munit_assert_int(results[i].status, ==, RAFT_IOERR);
+    }
+    munit_assert_int(raft_last_index(raft), ==, index - 1);
+
+    /* New entries take the indexes of the failed ones. */
+    APPLY_ADD_X_RECORD(&req4, &results[4]);
+    APPLY_ADD_X_RECORD(&req5, &results[5]);
+    munit_assert_int(req4.index, ==, index);
+    munit_assert_int(req5.index, ==, index + 1);
+    CLUSTER_STEP_UNTIL_APPLIED(0, index + 1, 1000);
+    CLUSTER_STEP_UNTIL_ELAPSED(100);
+
+    for (i = 0; i < 4; i++) {
+        munit_assert_int(results[i].n, ==, 1);
+    }
+    for (i = 4; i < 6; i++) {
+        munit_assert_int(results[i].n, ==, 1);
+        munit_assert_int(results[i].status, ==, 0);
+    }
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 2);
+
+    return MUNIT_OK;
+}
+
+/* Add N entries to the log of the first server only, so that the second
+ * server will be behind after the first one gets elected. */
+#define ADD_ENTRIES_TO_FIRST(N)                  \
+    {                                            \
+        struct raft_entry entry_;                \
+        unsigned i_;                             \
+        for (i_ = 0; i_ < N; i_++) {             \
+            entry_.type = RAFT_COMMAND;          \
+            entry_.term = 1;                     \
+            FsmEncodeSetX((int)i_, &entry_.buf); \
+            CLUSTER_ADD_ENTRY(0, &entry_);       \
+        }                                        \
+    }
+
+/* Step the cluster until the second server has applied the entry at INDEX,
+ * asserting that it never receives more than MAX entries with a single
+ * AppendEntries message. */
+#define STEP_UNTIL_APPLIED_WITH_MAX_ENTRIES(INDEX, MAX)               \
+    {                                                                 \
+        raft_index last_index_ = raft_last_index(CLUSTER_RAFT(1));    \
+        unsigned n_recv_ = CLUSTER_N_RECV(1, RAFT_IO_APPEND_ENTRIES); \
+        unsigned i_;                                                  \
+        for (i_ = 0; i_ < 1000; i_++) {                               \
+            raft_index index_;                                        \
+            unsigned n_;                                              \
+            if (CLUSTER_LAST_APPLIED(1) >= INDEX) {                   \
+                break;                                                \
+            }                                                         \
+            CLUSTER_STEP;                                             \
+            index_ = raft_last_index(CLUSTER_RAFT(1));                \
+            n_ = CLUSTER_N_RECV(1, RAFT_IO_APPEND_ENTRIES);           \
+            if (index_ > last_index_) {                               \
+                munit_assert_int(index_ - last_index_, <=,            \
+                                 (n_ - n_recv_) * MAX);               \
+            }                                                         \
+            last_index_ = index_;                                     \
+            n_recv_ = n_;                                             \
+        }                                                             \
+        munit_assert_int(CLUSTER_LAST_APPLIED(1), ==, INDEX);         \
+    }
+
+/* A follower that is behind receives the missing entries in chunks no larger
+ * than the configured maximum number of entries per message. */
+TEST(replication, sendMaxEntries, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_BOOTSTRAP;
+    ADD_ENTRIES_TO_FIRST(9);
+    raft_set_max_append_entries_count(CLUSTER_RAFT(0), 2);
+
+    CLUSTER_START;
+    CLUSTER_STEP_UNTIL_HAS_LEADER(5000);
+    munit_assert_int(CLUSTER_LEADER, ==, 0);
+
+    STEP_UNTIL_APPLIED_WITH_MAX_ENTRIES(10, 2);
+    munit_assert_int(CLUSTER_N_RECV(1, RAFT_IO_APPEND_ENTRIES), >=, 5);
+
+    return MUNIT_OK;
+}
+
+/* A leader in pipeline mode sends all the chunks of a batch of new entries
+ * back to back, without waiting for each of them to be acknowledged, until the
+ * flow control window is full. */
+TEST(replication, sendMaxEntriesPipeline, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    struct raft_apply req;
+    struct raft_buffer bufs[5];
+    unsigned i;
+    int rv;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+
+    raft = CLUSTER_RAFT(0);
+    raft_set_max_append_entries_count(raft, 2);
+    raft_set_max_inflight_messages(raft, 2);
+
+    /* Server 0 becomes leader and server 1 transitions to pipeline mode. */
+    CLUSTER_STEP_UNTIL_ELAPSED(1060);
+    ASSERT_LEADER(0);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 1);
+
+    /* The first two chunks of the five new entries are sent right away, the
+     * third one has to wait, since the window is full. */
+    for (i = 0; i < 5; i++) {
+        FsmEncodeAddX(1, &bufs[i]);
+    }
+    rv = raft_apply(raft, &req, bufs, 5, NULL);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_int(raft->leader_state.progress[1].inflight_n, ==, 2);
+    munit_assert_int(raft->leader_state.progress[1].next_index, ==, 6);
+
+    /* Once results start to come back, the last chunk gets sent too. */
+    CLUSTER_STEP_UNTIL_APPLIED(0, 6, 1000);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_APPEND_ENTRIES), ==, 4);
+
+    return MUNIT_OK;
+}
+
+/* A follower that is behind receives the missing entries in chunks no larger
+ * than the configured maximum number of bytes per message, but at least one
+ * entry is always sent. */
+TEST(replication, sendMaxBytes, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    CLUSTER_BOOTSTRAP;
+    ADD_ENTRIES_TO_FIRST(4);
+    raft_set_max_append_entries_bytes(CLUSTER_RAFT(0), 1);
+
+    CLUSTER_START;
+    CLUSTER_STEP_UNTIL_HAS_LEADER(5000);
+    munit_assert_int(CLUSTER_LEADER, ==, 0);
+
+    STEP_UNTIL_APPLIED_WITH_MAX_ENTRIES(5, 1);
+
+    return MUNIT_OK;
+}
+
 /* A follower disconnects while in probe mode. */
 TEST(replication, sendDisconnect, setUp, tearDown, 0, NULL)
 {
@@ -456,6 +892,57 @@ TEST(replication, recvStaleTerm, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Return true if the server with the given index has sent the given number of
+ * AppendEntries results. */
+struct sentResults
+{
+    unsigned i;
+    unsigned n;
+};
+
+static bool hasSentResults(struct raft_fixture *f, void *arg)
+{
+    struct sentResults *expect = arg;
+    return raft_fixture_n_send(f, expect->i, RAFT_IO_APPEND_ENTRIES_RESULT) >=
+           expect->n;
+}
+
+/* If the term and vote are stored asynchronously, a follower that learns about
+ * a new term from an AppendEntries request doesn't acknowledge it until the
+ * new term is durable, so crashing right after the acknowledgement doesn't
+ * lose the term. */
+TEST(replication, recvHigherTermAsyncMeta, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct sentResults expect = {1, 0};
+    CLUSTER_GROW;
+    CLUSTER_SET_ASYNC_META(1);
+    BOOTSTRAP_START_AND_ELECT;
+
+    /* Elect server 2 in term 3 while server 1 is partitioned away. */
+    CLUSTER_DEPOSE;
+    CLUSTER_SATURATE_BOTHWAYS(1, 0);
+    CLUSTER_SATURATE_BOTHWAYS(1, 2);
+    CLUSTER_ELECT(2);
+    munit_assert_int(CLUSTER_TERM(2), ==, 3);
+    munit_assert_int(CLUSTER_PERSISTED_TERM(1), ==, 2);
+
+    /* Server 1 bumps its term when the new leader reaches it, but its first
+     * AppendEntries result is sent only after the new term is stored. */
+    expect.n = CLUSTER_N_SEND(1, RAFT_IO_APPEND_ENTRIES_RESULT) + 1;
+    CLUSTER_DESATURATE_BOTHWAYS(1, 0);
+    CLUSTER_DESATURATE_BOTHWAYS(1, 2);
+    CLUSTER_STEP_UNTIL(hasSentResults, &expect, 1000);
+    munit_assert_int(CLUSTER_TERM(1), ==, 3);
+    munit_assert_int(CLUSTER_PERSISTED_TERM(1), ==, 3);
+
+    /* Crash server 1: the term it acknowledged entries in survives. */
+    CLUSTER_KILL(1);
+    munit_assert_int(CLUSTER_PERSISTED_TERM(1), ==, 3);
+
+    return MUNIT_OK;
+}
+
 /* If server's log is shorter than prevLogIndex, the request is rejected . */
 TEST(replication, recvMissingEntries, setUp, tearDown, 0, NULL)
 {
@@ -814,3 +1301,125 @@ TEST(replication, resultRetry, setUp, tearDown, 0, NULL)
 
     return MUNIT_OK;
 }
+
+/* If the follower has a long tail of entries from a term that the leader
+ * doesn't know about, it tells the leader where that term starts, so the leader
+ * skips all of them with a single retry instead of one per heartbeat. */
+TEST(replication, resultRetryConflictTerm, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entry;
+    unsigned i;
+    CLUSTER_BOOTSTRAP;
+
+    /* The first server has 50 entries from term 2 and the second one has 50
+     * entries from term 1, after the initial configuration entry. */
+    for (i = 0; i < 50; i++) {
+        entry.type = RAFT_COMMAND;
+        entry.term = 2;
+        FsmEncodeSetX(1, &entry.buf);
+        CLUSTER_ADD_ENTRY(0, &entry);
+
+        entry.type = RAFT_COMMAND;
+        entry.term = 1;
+        FsmEncodeSetX(2, &entry.buf);
+        CLUSTER_ADD_ENTRY(1, &entry);
+    }
+    CLUSTER_SET_TERM(0, 2);
+    CLUSTER_SET_TERM(1, 2);
+
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+
+    /* After the first rejection the leader goes straight back to the entry at
+     * index 2, without probing the entries in between one heartbeat at a
+     * time. */
+    CLUSTER_STEP_UNTIL_APPLIED(1, 51, 300);
+    munit_assert_int(CLUSTER_N_SEND(1, RAFT_IO_APPEND_ENTRIES_RESULT), <=, 3);
+
+    return MUNIT_OK;
+}
+
+static char *cluster_3[] = {"3", NULL};
+
+static MunitParameterEnum cluster_3_params[] = {
+    {CLUSTER_N_PARAM, cluster_3},
+    {NULL, NULL},
+};
+
+/* If the payloads of the entries a follower is missing were evicted from the
+ * leader's memory, they get read back from disk. */
+TEST(replication, readEvicted, setUp, tearDown, 0, cluster_3_params)
+{
+    struct fixture *f = data;
+    struct raft *raft;
+    unsigned i;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+    raft = CLUSTER_RAFT(0);
+    raft_set_log_cache_size(raft, 16);
+
+    CLUSTER_DISCONNECT(0, 2);
+    CLUSTER_DISCONNECT(2, 0);
+    for (i = 0; i < 10; i++) {
+        CLUSTER_MAKE_PROGRESS;
+    }
+    munit_assert_int(raft->log.cache.evicted, >=, 2);
+
+    CLUSTER_RECONNECT(0, 2);
+    CLUSTER_RECONNECT(2, 0);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 11, 3000);
+    munit_assert_int(CLUSTER_N_RECV(2, RAFT_IO_APPEND_ENTRIES), >, 0);
+
+    return MUNIT_OK;
+}
+
+static char *cluster_large[] = {"300", NULL};
+static char *cluster_large_voting[] = {"101", NULL};
+
+static MunitParameterEnum cluster_large_params[] = {
+    {CLUSTER_N_PARAM, cluster_large},
+    {CLUSTER_N_VOTING_PARAM, cluster_large_voting},
+    {NULL, NULL},
+};
+
+static void applyCbFree(struct raft_apply *req, int status, void *result)
+{
+    (void)status;
+    (void)result;
+    free(req);
+}
+
+/* Entries get committed once a majority of voters has them, and are then
+ * replicated to all servers, also in large clusters with many standbys. */
+TEST(replication, largeCluster, setUp, tearDown, 0, cluster_large_params)
+{
+    struct fixture *f = data;
+    struct raft_apply *req = munit_malloc(sizeof *req);
+    raft_index index;
+    unsigned i;
+    bool committed;
+    CLUSTER_BOOTSTRAP;
+    CLUSTER_START;
+    CLUSTER_ELECT(0);
+
+    /* Kill 50 voters, the remaining 51 are still a majority. */
+    for (i = 1; i <= 50; i++) {
+        CLUSTER_KILL(i);
+    }
+    CLUSTER_MAKE_PROGRESS;
+    index = CLUSTER_RAFT(0)->commit_index;
+    CLUSTER_STEP_UNTIL_APPLIED(CLUSTER_N - 1, index, 2000);
+
+    /* With one more voter killed new entries can't be committed. */
+    CLUSTER_KILL(51);
+    CLUSTER_APPLY_ADD_X(0, req, 1, applyCbFree);
+    committed =
+        raft_fixture_step_until_applied(&f->cluster, 0, index + 1, 200);
+    munit_assert_false(committed);
+    munit_assert_int(CLUSTER_RAFT(0)->commit_index, ==, index);
+    munit_assert_int(CLUSTER_RAFT(0)->last_stored, ==, index + 1);
+
+    return MUNIT_OK;
+}
@@ -53,6 +53,43 @@ static void tearDown(void *data)
         }                                                       \
     }
 
+/* Set the snapshot chunk size on all servers of the cluster */
+#define SET_SNAPSHOT_CHUNK_SIZE(VALUE)                            \
+    {                                                             \
+        unsigned i;                                               \
+        for (i = 0; i < CLUSTER_N; i++) {                         \
+            raft_set_snapshot_chunk_size(CLUSTER_RAFT(i), VALUE); \
+        }                                                         \
+    }
+
+/* Let all servers of the cluster read and write snapshots in chunks, if the
+ * "snapshot-chunks" parameter is set. */
+#define SET_SNAPSHOT_CHUNKS                                                   \
+    {                                                                         \
+        const char *value_ = munit_parameters_get(params, "snapshot-chunks"); \
+        unsigned i;                                                           \
+        for (i = 0; i < CLUSTER_N; i++) {                                     \
+            raft_fixture_set_snapshot_chunks(&f->cluster, i,                  \
+                                             value_ != NULL &&                \
+                                                 strcmp(value_, "1") == 0);   \
+        }                                                                     \
+    }
+
+/* Return true if the server with the given index has received at least the
+ * given number of InstallSnapshot messages. */
+struct receivedChunks
+{
+    unsigned i;
+    unsigned n;
+};
+
+static bool hasReceivedChunks(struct raft_fixture *f, void *arg)
+{
+    struct receivedChunks *expect = arg;
+    return raft_fixture_n_recv(f, expect->i, RAFT_IO_INSTALL_SNAPSHOT) >=
+           expect->n;
+}
+
 /******************************************************************************
  *
  * Successfully install a snapshot
@@ -83,3 +120,215 @@ TEST(snapshot, installOne, setUp, tearDown, 0, NULL)
 
     return MUNIT_OK;
 }
+
+static char *snapshot_chunks[] = {"0", "1", NULL};
+
+static MunitParameterEnum chunks_params[] = {
+    {"snapshot-chunks", snapshot_chunks},
+    {NULL, NULL},
+};
+
+/* Install a snapshot which is larger than the chunk size, sending it in
+ * multiple InstallSnapshot messages. With snapshot chunks I/O, the leader reads
+ * each chunk from disk and the follower writes it as soon as it arrives. */
+TEST(snapshot, installChunks, setUp, tearDown, 0, chunks_params)
+{
+    struct fixture *f = data;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    SET_SNAPSHOT_CHUNK_SIZE(5);
+    SET_SNAPSHOT_CHUNKS;
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 4, 5000);
+
+    /* The 16 bytes snapshot was sent in 4 chunks, and all but the last were
+     * acknowledged with an InstallSnapshot result. */
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), ==, 4);
+    munit_assert_int(CLUSTER_N_RECV(0, RAFT_IO_INSTALL_SNAPSHOT_RESULT), ==,
+                     3);
+
+    return MUNIT_OK;
+}
+
+/* If the connection with the follower is interrupted in the middle of a
+ * snapshot transfer, the leader resumes sending chunks from where it left. */
+TEST(snapshot, installChunksResume, setUp, tearDown, 0, chunks_params)
+{
+    struct fixture *f = data;
+    struct receivedChunks expect = {2 /* server */, 2 /* chunks */};
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    SET_SNAPSHOT_CHUNK_SIZE(4);
+    SET_SNAPSHOT_CHUNKS;
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+
+    /* Interrupt the transfer after the second chunk has been received. */
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL(hasReceivedChunks, &expect, 5000);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_ELAPSED(300);
+
+    /* Once the connection is back, the transfer completes without starting
+     * over, which would have required at least 4 more chunks. At most one
+     * chunk is received twice, since its result might have been lost. */
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 4, 5000);
+    munit_assert_int(CLUSTER_N_RECV(2, RAFT_IO_INSTALL_SNAPSHOT), <=, 5);
+
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Asynchronous FSM snapshots
+ *
+ *****************************************************************************/
+
+static char *async_snapshot[] = {"1", NULL};
+
+static MunitParameterEnum async_params[] = {
+    {CLUSTER_ASYNC_SNAPSHOT_PARAM, async_snapshot},
+    {NULL, NULL},
+};
+
+/* The leader keeps committing and applying entries while the FSM serializes a
+ * snapshot, which captures the state at the time it was frozen. */
+TEST(snapshot, async, setUp, tearDown, 0, async_params)
+{
+    struct fixture *f = data;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    munit_assert_ptr_not_null(CLUSTER_RAFT(0)->snapshot.serialize.data);
+
+    CLUSTER_MAKE_PROGRESS;
+    munit_assert_int(CLUSTER_RAFT(0)->log.snapshot.last_index, ==, 0);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(0)), ==, 4);
+
+    /* Once the snapshot is stored, a follower that has fallen behind installs
+     * it and then applies the entries that followed. */
+    munit_assert_true(FsmSnapshotFlush(CLUSTER_FSM(0)));
+    munit_assert_ptr_null(CLUSTER_RAFT(0)->snapshot.serialize.data);
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL_APPLIED(2, 5, 5000);
+    munit_assert_int(CLUSTER_RAFT(0)->log.snapshot.last_index, >, 0);
+    munit_assert_int(CLUSTER_RAFT(0)->log.snapshot.last_index, <, 5);
+    munit_assert_int(CLUSTER_N_SEND(0, RAFT_IO_INSTALL_SNAPSHOT), ==, 1);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(2)), ==, 4);
+
+    return MUNIT_OK;
+}
+
+/* The raft instance can be closed while the FSM is serializing a snapshot, and
+ * the close completes once the FSM is done. */
+TEST(snapshot, asyncClose, setUp, tearDown, 0, async_params)
+{
+    struct fixture *f = data;
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    CLUSTER_MAKE_PROGRESS;
+    munit_assert_ptr_not_null(CLUSTER_RAFT(0)->snapshot.serialize.data);
+
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * Asynchronous FSM apply
+ *
+ *****************************************************************************/
+
+static char *async_apply[] = {"1", NULL};
+
+static MunitParameterEnum async_apply_params[] = {
+    {CLUSTER_ASYNC_APPLY_PARAM, async_apply},
+    {NULL, NULL},
+};
+
+/* Return true if the FSM of the server with the given index is applying a
+ * batch of commands. */
+static bool isApplyingBatch(struct raft_fixture *f, void *arg)
+{
+    unsigned *i = arg;
+    return raft_fixture_get(f, *i)->apply.n > 0;
+}
+
+/* Return true if the server with the given index has taken a snapshot. */
+static bool hasSnapshot(struct raft_fixture *f, void *arg)
+{
+    unsigned *i = arg;
+    return raft_fixture_get(f, *i)->log.snapshot.last_index > 0;
+}
+
+/* Apply a command on the leader and wait for its FSM to apply it. */
+#define APPLY_AND_FLUSH                                              \
+    {                                                                \
+        raft_index index_ = raft_last_index(CLUSTER_RAFT(0)) + 1;    \
+        unsigned leader_ = 0;                                        \
+        struct raft_apply req_;                                      \
+        CLUSTER_APPLY_ADD_X(0, &req_, 1, NULL);                      \
+        CLUSTER_STEP_UNTIL(isApplyingBatch, &leader_, 2000);         \
+        munit_assert_int(FsmApplyFlush(CLUSTER_FSM(0)), ==, 1);      \
+        munit_assert_int(raft_last_applied(CLUSTER_RAFT(0)), ==,     \
+                         index_);                                    \
+    }
+
+/* A follower receiving a snapshot while its FSM is applying a batch of
+ * commands installs it once the batch completes. */
+TEST(snapshot, installAfterApplyBatch, setUp, tearDown, 0, async_apply_params)
+{
+    struct fixture *f = data;
+    struct receivedChunks expect = {2 /* server */, 1 /* chunks */};
+    unsigned leader = 0;
+    unsigned follower = 2;
+    struct raft *raft = CLUSTER_RAFT(2);
+
+    SET_SNAPSHOT_THRESHOLD(3);
+    SET_SNAPSHOT_TRAILING(1);
+
+    /* Let the follower start applying a first command, then disconnect it
+     * while the leader takes a snapshot. */
+    APPLY_AND_FLUSH;
+    CLUSTER_STEP_UNTIL(isApplyingBatch, &follower, 2000);
+    CLUSTER_SATURATE_BOTHWAYS(0, 2);
+    APPLY_AND_FLUSH;
+    APPLY_AND_FLUSH;
+    CLUSTER_STEP_UNTIL(hasSnapshot, &leader, 2000);
+
+    /* The snapshot is received but kept aside. */
+    CLUSTER_DESATURATE_BOTHWAYS(0, 2);
+    CLUSTER_STEP_UNTIL(hasReceivedChunks, &expect, 2000);
+    munit_assert_ptr_not_null(raft->follower_state.install);
+    munit_assert_int(raft->log.snapshot.last_index, ==, 0);
+
+    /* Once the batch is done, the snapshot gets installed. It was taken at
+     * index 3, when x was 2. */
+    munit_assert_int(FsmApplyFlush(CLUSTER_FSM(2)), ==, 1);
+    munit_assert_ptr_null(raft->follower_state.install);
+    CLUSTER_STEP_UNTIL_APPLIED(2, CLUSTER_RAFT(0)->log.snapshot.last_index,
+                               2000);
+    munit_assert_int(raft->log.snapshot.last_index, ==,
+                     CLUSTER_RAFT(0)->log.snapshot.last_index);
+    munit_assert_int(FsmGetX(CLUSTER_FSM(2)), ==, 2);
+
+    return MUNIT_OK;
+}
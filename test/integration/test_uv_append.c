@@ -1,3 +1,6 @@
+#include <sys/resource.h>
+
+#include "../../src/uv.h"
 #include "../lib/runner.h"
 #include "../lib/uv.h"
 #include "../lib/aio.h"
@@ -34,12 +37,16 @@ struct result
 {
     int status;
     bool done;
+    struct result *prev; /* Request that must complete first, if any */
 };
 
 static void appendCbAssertResult(struct raft_io_append *req, int status)
 {
     struct result *result = req->data;
     munit_assert_int(status, ==, result->status);
+    if (result->prev != NULL) {
+        munit_assert_true(result->prev->done);
+    }
     result->done = true;
 }
 
@@ -70,7 +77,7 @@ static void appendCbAssertResult(struct raft_io_append *req, int status)
  * custom STATUS can be set with APPEND_EXPECT. */
 #define APPEND_SUBMIT(I, N_ENTRIES, ENTRY_SIZE)                     \
     struct raft_io_append _req##I;                                  \
-    struct result _result##I = {0, false};                          \
+    struct result _result##I = {0, false, NULL};                    \
     int _rv##I;                                                     \
     ENTRIES(I, N_ENTRIES, ENTRY_SIZE);                              \
     _req##I.data = &_result##I;                                     \
@@ -92,6 +99,10 @@ static void appendCbAssertResult(struct raft_io_append *req, int status)
 
 #define APPEND_EXPECT(I, STATUS) _result##I.status = STATUS
 
+/* Expect the append request identified by I to complete after the one
+ * identified by J. */
+#define APPEND_AFTER(I, J) _result##I.prev = &_result##J
+
 /* Wait for the append request identified by I to complete. */
 #define APPEND_WAIT(I) LOOP_RUN_UNTIL(&_result##I.done)
 
@@ -259,11 +270,12 @@ TEST(append, finalizeSegment, setUp, tearDown, 0, NULL)
     struct fixture *f = data;
     APPEND(MAX_SEGMENT_BLOCKS, SEGMENT_BLOCK_SIZE);
     APPEND(1, 64);
-    while (!DirHasFile(f->dir, "open-4")) {
+    /* Finalizing the first segment and preparing the fourth one happen
+     * concurrently, so wait for both. */
+    while (!DirHasFile(f->dir, "open-4") ||
+           !DirHasFile(f->dir, "0000000000000001-0000000000000004")) {
         LOOP_RUN(1);
     }
-    munit_assert_true(
-        DirHasFile(f->dir, "0000000000000001-0000000000000004"));
     munit_assert_false(DirHasFile(f->dir, "open-1"));
     munit_assert_true(DirHasFile(f->dir, "open-4"));
     return MUNIT_OK;
@@ -398,6 +410,44 @@ TEST(append, wait, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* With concurrent writes enabled, append requests submitted while a write
+ * operation is in progress are written right away, and their callbacks still
+ * fire in submission order. */
+TEST(append, concurrent, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_uv_set_max_concurrent_writes(&f->io, 4);
+    APPEND(1, 64);
+    APPEND_SUBMIT(1, 1, 64);
+    APPEND_SUBMIT(2, 2, 64);
+    APPEND_AFTER(2, 1);
+    APPEND_SUBMIT(3, 1, SEGMENT_BLOCK_SIZE);
+    APPEND_AFTER(3, 2);
+    APPEND_WAIT(3);
+    ASSERT_ENTRIES(5, 64 * 4 + SEGMENT_BLOCK_SIZE);
+    return MUNIT_OK;
+}
+
+/* With concurrent writes enabled, append requests that don't fit in the current
+ * segment are written to the next one once the in flight writes complete. */
+TEST(append, concurrentSeveralSegments, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_uv_set_max_concurrent_writes(&f->io, 2);
+    APPEND_SUBMIT(0, 1, 64);
+    APPEND_SUBMIT(1, 1, 64);
+    APPEND_AFTER(1, 0);
+    APPEND_SUBMIT(2, 1, 64);
+    APPEND_AFTER(2, 1);
+    APPEND_SUBMIT(3, 1, 64);
+    APPEND_AFTER(3, 2);
+    APPEND_SUBMIT(4, 1, 64);
+    APPEND_AFTER(4, 3);
+    APPEND_WAIT(4);
+    ASSERT_ENTRIES(5, 64 * 5);
+    return MUNIT_OK;
+}
+
 /* Several batches with different size gets appended in fast pace, forcing the
  * segment arena to grow. */
 TEST(append, resizeArena, setUp, tearDownDeps, 0, NULL)
@@ -666,8 +716,11 @@ TEST(append, currentSegment, setUp, tearDownDeps, 0, NULL)
 TEST(append, ioSetupError, setUp, tearDown, 0, NULL)
 {
     struct fixture *f = data;
+    struct uv *uv = f->io.impl;
     aio_context_t ctx = 0;
     int rv;
+    /* Make writers use KAIO even if io_uring is available. */
+    uv->uring_io = false;
     rv = AioFill(&ctx, 0);
     if (rv != 0) {
         return MUNIT_SKIP;
@@ -676,3 +729,45 @@ TEST(append, ioSetupError, setUp, tearDown, 0, NULL)
                    "setup writer for open-1: AIO events user limit exceeded");
     return MUNIT_OK;
 }
+
+/* The process has ran out of file descriptors when creating the io_uring
+ * instance of a writer. */
+TEST(append, uringSetupError, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct uv *uv = f->io.impl;
+    struct rlimit limit;
+    struct rlimit lowered;
+    const char *errmsg =
+        "setup writer for open-2: io_uring instances limit exceeded";
+    int fd;
+    int rv;
+    if (!uv->uring_io) {
+        return MUNIT_SKIP;
+    }
+
+    /* Wait for the next open segments to be prepared, so no file needs to be
+     * created when switching to the second one. */
+    APPEND(1, 64);
+    while (uv->prepare_inflight != NULL) {
+        LOOP_RUN(1);
+    }
+
+    /* Prevent any new file descriptor from being created. */
+    fd = dup(STDIN_FILENO);
+    munit_assert_int(fd, >=, 0);
+    close(fd);
+    rv = getrlimit(RLIMIT_NOFILE, &limit);
+    munit_assert_int(rv, ==, 0);
+    lowered = limit;
+    lowered.rlim_cur = (rlim_t)fd;
+    rv = setrlimit(RLIMIT_NOFILE, &lowered);
+    munit_assert_int(rv, ==, 0);
+
+    APPEND_ERROR(MAX_SEGMENT_BLOCKS, SEGMENT_BLOCK_SIZE, RAFT_TOOMANY, errmsg);
+    munit_assert_string_equal(f->io.errmsg, errmsg);
+
+    rv = setrlimit(RLIMIT_NOFILE, &limit);
+    munit_assert_int(rv, ==, 0);
+    return MUNIT_OK;
+}
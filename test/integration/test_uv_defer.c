@@ -0,0 +1,149 @@
+#include "../lib/runner.h"
+#include "../lib/uv.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_UV_DEPS;
+    FIXTURE_UV;
+    bool closed;
+};
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+struct result
+{
+    int status;
+    bool done;
+    bool closed; /* Whether the close callback had fired already */
+    struct fixture *f;
+};
+
+static void deferCbAssertResult(struct raft_io_defer *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+    result->closed = result->f->closed;
+}
+
+static void closeCb(struct raft_io *io)
+{
+    struct fixture *f = io->data;
+    f->closed = true;
+}
+
+/* Submit a defer request with the given window. */
+#define DEFER_SUBMIT(USECS)                                         \
+    struct raft_io_defer _req;                                      \
+    struct result _result = {0, false, false, f};                   \
+    int _rv;                                                        \
+    _req.data = &_result;                                           \
+    _rv = f->io.defer(&f->io, &_req, USECS, deferCbAssertResult);   \
+    munit_assert_int(_rv, ==, 0)
+
+/* Wait for the defer request to complete. */
+#define DEFER_WAIT LOOP_RUN_UNTIL(&_result.done)
+
+#define DEFER_EXPECT(STATUS) _result.status = STATUS
+
+/******************************************************************************
+ *
+ * Set up and tear down.
+ *
+ *****************************************************************************/
+
+static void *setUp(const MunitParameter params[], void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_UV_DEPS;
+    SETUP_UV;
+    f->closed = false;
+    return f;
+}
+
+static void tearDownDeps(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_UV_DEPS;
+    free(f);
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_UV;
+    tearDownDeps(f);
+}
+
+/******************************************************************************
+ *
+ * raft_io->defer()
+ *
+ *****************************************************************************/
+
+SUITE(defer)
+
+/* Without a window, the callback fires in the next loop iteration. */
+TEST(defer, noWindow, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    DEFER_SUBMIT(0);
+    munit_assert_false(_result.done);
+    LOOP_RUN(1);
+    munit_assert_true(_result.done);
+    return MUNIT_OK;
+}
+
+/* With a window, the callback fires once it has expired. */
+TEST(defer, window, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uint64_t start;
+    uv_update_time(&f->loop);
+    start = uv_now(&f->loop);
+    DEFER_SUBMIT(1500);
+    DEFER_WAIT;
+    munit_assert_int(uv_now(&f->loop) - start, >=, 2);
+    return MUNIT_OK;
+}
+
+/* A new request can be submitted once the previous one has completed. */
+TEST(defer, again, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    {
+        DEFER_SUBMIT(0);
+        DEFER_WAIT;
+    }
+    {
+        DEFER_SUBMIT(1000);
+        DEFER_WAIT;
+    }
+    return MUNIT_OK;
+}
+
+/* If the instance is closed, pending requests are canceled before the close
+ * callback fires. */
+TEST(defer, cancel, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    DEFER_SUBMIT(1000 * 1000);
+    DEFER_EXPECT(RAFT_CANCELED);
+    f->io.data = f;
+    f->io.close(&f->io, closeCb);
+    LOOP_RUN_UNTIL(&f->closed);
+    raft_uv_close(&f->io);
+    munit_assert_true(_result.done);
+    munit_assert_false(_result.closed);
+    return MUNIT_OK;
+}
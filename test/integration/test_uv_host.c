@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "../lib/runner.h"
+#include "../lib/uv.h"
+
+/******************************************************************************
+ *
+ * Fixture with two nodes, each running a host with two raft groups.
+ *
+ *****************************************************************************/
+
+#define N_NODES 2
+#define N_GROUPS 2
+
+struct fixture;
+
+struct group
+{
+    struct fixture *f;
+    struct raft_io io;
+    char dir[256];
+    unsigned ticks;           /* Number of times the tick cb fired */
+    unsigned received;        /* Number of messages received */
+    struct raft_message last; /* Last message received */
+    bool closed;
+};
+
+struct node
+{
+    struct raft_uv_transport transport;
+    struct raft_uv_host host;
+    char address[64];
+    struct group groups[N_GROUPS];
+    bool closed;
+};
+
+struct fixture
+{
+    FIXTURE_DIR;
+    FIXTURE_HEAP;
+    FIXTURE_LOOP;
+    struct node nodes[N_NODES];
+};
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+static void tickCb(struct raft_io *io)
+{
+    struct group *g = io->data;
+    g->ticks++;
+}
+
+static void recvCb(struct raft_io *io, struct raft_message *message)
+{
+    struct group *g = io->data;
+    g->received++;
+    g->last = *message;
+    if (message->type == RAFT_IO_APPEND_ENTRIES &&
+        message->append_entries.n_entries > 0) {
+        raft_free(message->append_entries.entries[0].batch);
+        raft_free(message->append_entries.entries);
+    }
+}
+
+static void groupCloseCb(struct raft_io *io)
+{
+    struct group *g = io->data;
+    g->closed = true;
+}
+
+static void hostCloseCb(struct raft_uv_host *host)
+{
+    struct node *n = host->data;
+    n->closed = true;
+}
+
+struct result
+{
+    int status;
+    bool done;
+    bool closed; /* Whether the group close callback had fired already */
+    struct group *g;
+};
+
+static void sendCbAssertResult(struct raft_io_send *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+    result->closed = result->g->closed;
+}
+
+/* Return the J'th group of the I'th node. */
+#define GROUP(I, J) (&f->nodes[I].groups[J])
+
+/* Initialize and start a new group with the given ID on the I'th node. */
+#define GROUP_START(I, G, ID)                                                 \
+    do {                                                                      \
+        int _rv;                                                              \
+        sprintf((G)->dir, "%s/%u-%llu", f->dir, I, (unsigned long long)(ID)); \
+        munit_assert_int(mkdir((G)->dir, 0755), ==, 0);                       \
+        (G)->f = f;                                                           \
+        (G)->ticks = 0;                                                       \
+        (G)->received = 0;                                                    \
+        (G)->closed = false;                                                  \
+        (G)->io.data = G;                                                     \
+        _rv = raft_uv_init_group(&(G)->io, &f->nodes[I].host, (G)->dir, ID); \
+        munit_assert_int(_rv, ==, 0);                                         \
+        _rv = (G)->io.init(&(G)->io, I + 1, f->nodes[I].address);            \
+        munit_assert_int(_rv, ==, 0);                                         \
+        _rv = (G)->io.start(&(G)->io, 10, tickCb, recvCb);                   \
+        munit_assert_int(_rv, ==, 0);                                         \
+    } while (0)
+
+/* Close the given group and wait for its close callback to fire. */
+#define GROUP_CLOSE(G)                         \
+    do {                                       \
+        (G)->io.close(&(G)->io, groupCloseCb); \
+        LOOP_RUN_UNTIL(&(G)->closed);          \
+        raft_uv_close(&(G)->io);               \
+    } while (0)
+
+/* Submit a send request of the given message from the given group to the
+ * server with the given ID and address. */
+#define SEND_SUBMIT_TO(G, MESSAGE, ID, ADDRESS, STATUS)               \
+    struct raft_io_send _req;                                         \
+    struct result _result = {STATUS, false, false, G};                \
+    int _rv;                                                          \
+    _req.data = &_result;                                             \
+    (MESSAGE)->server_id = ID;                                        \
+    (MESSAGE)->server_address = ADDRESS;                              \
+    _rv = (G)->io.send(&(G)->io, &_req, MESSAGE, sendCbAssertResult); \
+    munit_assert_int(_rv, ==, 0)
+
+/* Submit a send request of the given message from the given group to the I'th
+ * node. */
+#define SEND_SUBMIT(G, MESSAGE, I, STATUS) \
+    SEND_SUBMIT_TO(G, MESSAGE, I + 1, f->nodes[I].address, STATUS)
+
+/* Wait for the send request to complete. */
+#define SEND_WAIT LOOP_RUN_UNTIL(&_result.done)
+
+/******************************************************************************
+ *
+ * Set up and tear down.
+ *
+ *****************************************************************************/
+
+static void *setUp(const MunitParameter params[], void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    unsigned i;
+    unsigned j;
+    SET_UP_DIR;
+    SET_UP_HEAP;
+    SETUP_LOOP;
+    for (i = 0; i < N_NODES; i++) {
+        struct node *n = &f->nodes[i];
+        int rv;
+        sprintf(n->address, "127.0.0.1:900%u", i + 1);
+        n->closed = false;
+        n->host.data = n;
+        rv = raft_uv_tcp_init(&n->transport, &f->loop);
+        munit_assert_int(rv, ==, 0);
+        rv = raft_uv_host_init(&n->host, &f->loop, &n->transport);
+        munit_assert_int(rv, ==, 0);
+        raft_uv_set_connect_retry_delay(raft_uv_host_io(&n->host), 1);
+        rv = raft_uv_host_start(&n->host, i + 1, n->address);
+        munit_assert_int(rv, ==, 0);
+        for (j = 0; j < N_GROUPS; j++) {
+            GROUP_START(i, GROUP(i, j), j + 1);
+        }
+    }
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    unsigned i;
+    unsigned j;
+    for (i = 0; i < N_NODES; i++) {
+        struct node *n = &f->nodes[i];
+        for (j = 0; j < N_GROUPS; j++) {
+            GROUP_CLOSE(GROUP(i, j));
+        }
+        raft_uv_host_close(&n->host, hostCloseCb);
+        LOOP_RUN_UNTIL(&n->closed);
+        raft_uv_tcp_close(&n->transport);
+    }
+    TEAR_DOWN_LOOP;
+    TEAR_DOWN_HEAP;
+    TEAR_DOWN_DIR;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Attached groups
+ *
+ *****************************************************************************/
+
+SUITE(host)
+
+/* Messages are delivered to the group with the same ID on the other node. */
+TEST(host, dispatch, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    message.type = RAFT_IO_REQUEST_VOTE;
+    message.request_vote.term = 3;
+    message.request_vote.candidate_id = 1;
+    message.request_vote.last_log_index = 123;
+    message.request_vote.last_log_term = 2;
+    message.request_vote.disrupt_leader = false;
+    message.request_vote.pre_vote = false;
+    {
+        SEND_SUBMIT(GROUP(0, 1), &message, 1, 0);
+        SEND_WAIT;
+    }
+    LOOP_RUN_UNTIL(&GROUP(1, 1)->received);
+    munit_assert_int(GROUP(1, 0)->received, ==, 0);
+    munit_assert_int(GROUP(1, 1)->last.type, ==, RAFT_IO_REQUEST_VOTE);
+    munit_assert_int(GROUP(1, 1)->last.server_id, ==, 1);
+    munit_assert_int(GROUP(1, 1)->last.request_vote.last_log_index, ==, 123);
+
+    /* The reply travels on the connection opened by the other node. */
+    {
+        SEND_SUBMIT(GROUP(1, 0), &message, 0, 0);
+        SEND_WAIT;
+    }
+    LOOP_RUN_UNTIL(&GROUP(0, 0)->received);
+    munit_assert_int(GROUP(0, 1)->received, ==, 0);
+    munit_assert_int(GROUP(0, 0)->last.server_id, ==, 2);
+    return MUNIT_OK;
+}
+
+/* All groups of a host are ticked by the same timer. */
+TEST(host, tick, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    while (GROUP(0, 1)->ticks < 3) {
+        LOOP_RUN(1);
+    }
+    munit_assert_int(GROUP(0, 0)->ticks, ==, GROUP(0, 1)->ticks);
+    return MUNIT_OK;
+}
+
+/* Messages for a group which is not attached to the receiving host are
+ * dropped, without affecting the other groups. */
+TEST(host, unknownGroup, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct group *g = munit_malloc(sizeof *g);
+    struct raft_message message;
+    struct raft_entry entry;
+    GROUP_START(0, g, 3);
+    entry.type = RAFT_COMMAND;
+    entry.term = 1;
+    entry.buf.base = raft_malloc(8);
+    entry.buf.len = 8;
+    memset(entry.buf.base, 0, entry.buf.len);
+    entry.batch = NULL;
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.term = 1;
+    message.append_entries.prev_log_index = 0;
+    message.append_entries.prev_log_term = 0;
+    message.append_entries.leader_commit = 0;
+    message.append_entries.entries = &entry;
+    message.append_entries.n_entries = 1;
+    {
+        SEND_SUBMIT(g, &message, 1, 0);
+        SEND_WAIT;
+    }
+    raft_free(entry.buf.base);
+    message.append_entries.n_entries = 0;
+    message.append_entries.entries = NULL;
+    {
+        SEND_SUBMIT(GROUP(0, 0), &message, 1, 0);
+        SEND_WAIT;
+    }
+    LOOP_RUN_UNTIL(&GROUP(1, 0)->received);
+    munit_assert_int(GROUP(1, 0)->last.type, ==, RAFT_IO_APPEND_ENTRIES);
+    munit_assert_int(GROUP(1, 1)->received, ==, 0);
+    GROUP_CLOSE(g);
+    free(g);
+    return MUNIT_OK;
+}
+
+/* Two groups with the same ID can't be attached to the same host. */
+TEST(host, duplicateGroup, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct group *g = munit_malloc(sizeof *g);
+    int rv;
+    sprintf(g->dir, "%s/dup", f->dir);
+    munit_assert_int(mkdir(g->dir, 0755), ==, 0);
+    g->closed = false;
+    g->io.data = g;
+    rv = raft_uv_init_group(&g->io, &f->nodes[0].host, g->dir, 1);
+    munit_assert_int(rv, ==, 0);
+    rv = g->io.init(&g->io, 1, f->nodes[0].address);
+    munit_assert_int(rv, ==, 0);
+    rv = g->io.start(&g->io, 10, tickCb, recvCb);
+    munit_assert_int(rv, ==, RAFT_DUPLICATEID);
+    munit_assert_string_equal(g->io.errmsg, "group 1 is already attached");
+    GROUP_CLOSE(g);
+    free(g);
+    return MUNIT_OK;
+}
+
+/* Group IDs must fit in the tag of the message preamble. */
+TEST(host, invalidGroup, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_io io;
+    int rv;
+    rv = raft_uv_init_group(&io, &f->nodes[0].host, f->dir, 0);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    rv = raft_uv_init_group(&io, &f->nodes[0].host, f->dir, 1ULL << 48);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    munit_assert_string_equal(io.errmsg, "invalid group ID 281474976710656");
+    return MUNIT_OK;
+}
+
+/* The ID passed to raft_io->init() must match the one of the host. */
+TEST(host, mismatchingId, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_io io;
+    int rv;
+    rv = raft_uv_init_group(&io, &f->nodes[0].host, f->dir, 3);
+    munit_assert_int(rv, ==, 0);
+    rv = io.init(&io, 2, f->nodes[0].address);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    munit_assert_string_equal(io.errmsg, "server ID 2 doesn't match host 1");
+    raft_uv_close(&io);
+    return MUNIT_OK;
+}
+
+/* When a group is closed, its requests waiting for a connection are canceled
+ * before the close callback fires, while the connection attempts of the host
+ * go on. */
+TEST(host, cancelOnClose, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct group *g = munit_malloc(sizeof *g);
+    struct raft_message message;
+    GROUP_START(0, g, 3);
+    message.type = RAFT_IO_TIMEOUT_NOW;
+    message.timeout_now.term = 1;
+    message.timeout_now.last_log_index = 0;
+    message.timeout_now.last_log_term = 0;
+    {
+        SEND_SUBMIT_TO(g, &message, 3, "127.0.0.1:9003", RAFT_CANCELED);
+        GROUP_CLOSE(g);
+        munit_assert_true(_result.done);
+        munit_assert_false(_result.closed);
+    }
+    free(g);
+    return MUNIT_OK;
+}
@@ -12,6 +12,7 @@ struct fixture
 {
     FIXTURE_UV_DEPS;
     FIXTURE_UV;
+    unsigned max_writes; /* Concurrent writes used by APPEND */
 };
 
 /******************************************************************************
@@ -103,6 +104,7 @@ struct snapshot
         munit_assert_int(_rv, ==, 0);                                        \
         raft_uv_set_block_size(&_io, SEGMENT_BLOCK_SIZE);                    \
         raft_uv_set_segment_size(&_io, SEGMENT_SIZE);                        \
+        raft_uv_set_max_concurrent_writes(&_io, f->max_writes);              \
         _rv = _io.load(&_io, &_term, &_voted_for, &_snapshot, &_start_index, \
                        &_entries, &_n);                                      \
         munit_assert_int(_rv, ==, 0);                                        \
@@ -329,6 +331,7 @@ static void *setUp(const MunitParameter params[], void *user_data)
 {
     struct fixture *f = munit_malloc(sizeof *f);
     SETUP_UV_DEPS;
+    f->max_writes = 1;
     return f;
 }
 
@@ -442,6 +445,46 @@ TEST(load, bothOpenAndClosedSegments, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The data directory has many closed segments, which get loaded by several
+ * threads. */
+TEST(load, manyClosedSegments, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned i;
+    for (i = 0; i < 20; i++) {
+        APPEND(2, 1 + i * 2);
+    }
+    LOAD(0,    /* term                                              */
+         0,    /* voted for                                         */
+         NULL, /* snapshot                                          */
+         1,    /* start index                                       */
+         1,    /* data for first loaded entry    */
+         40    /* n entries                                         */
+    );
+    return MUNIT_OK;
+}
+
+/* If several closed segments are corrupted, the error about the first one is
+ * reported. */
+TEST(load, manyClosedSegmentsCorrupted, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    size_t offset = WORD_SIZE /* Format version */;
+    uint64_t corrupted = 12345678;
+    unsigned i;
+    for (i = 0; i < 20; i++) {
+        APPEND(1, 1 + i);
+    }
+    DirOverwriteFile(f->dir, CLOSED_SEGMENT_FILENAME(7, 7), &corrupted,
+                     sizeof corrupted, offset);
+    DirOverwriteFile(f->dir, CLOSED_SEGMENT_FILENAME(9, 9), &corrupted,
+                     sizeof corrupted, offset);
+    LOAD_ERROR(RAFT_CORRUPT,
+               "load closed segment 0000000000000007-0000000000000007: entries "
+               "batch 1 starting at byte 8: header checksum mismatch");
+    return MUNIT_OK;
+}
+
 /* The data directory has an allocated open segment which contains non-zero
  * corrupted data in its second batch. */
 TEST(load, openSegmentWithNonZeroData, setUp, tearDown, 0, NULL)
@@ -581,6 +624,24 @@ TEST(load, openSegment, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The data directory has a valid open segment containing padding records,
+ * written with concurrent writes enabled. */
+TEST(load, openSegmentWithPadding, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    f->max_writes = 2;
+    APPEND(3, 1);
+    UNFINALIZE(1, 3, 1);
+    LOAD(0,    /* term                                              */
+         0,    /* voted for                                         */
+         NULL, /* snapshot                                          */
+         1,    /* start index                                       */
+         1,    /* data for first loaded entry    */
+         3     /* n entries                                         */
+    );
+    return MUNIT_OK;
+}
+
 /* There is exactly one snapshot and no segments.  */
 TEST(load, onlyOneSnapshot, setUp, tearDown, 0, NULL)
 {
@@ -897,6 +958,24 @@ TEST(load, closedSegmentWithCorruptedBatchHeader, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The data directory has a closed segment whose padding record, following the
+ * first batch, has a corrupted header checksum. */
+TEST(load, closedSegmentWithCorruptedPadding, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    size_t offset = WORD_SIZE /* Format version */ +
+                    WORD_SIZE * 5 /* First batch with one 8-byte entry */;
+    uint32_t corrupted = 123456789;
+    f->max_writes = 2;
+    APPEND(3, 1);
+    DirOverwriteFile(f->dir, CLOSED_SEGMENT_FILENAME(1, 3), &corrupted,
+                     sizeof corrupted, offset);
+    LOAD_ERROR(RAFT_CORRUPT,
+               "load closed segment 0000000000000001-0000000000000003: entries "
+               "batch 2 starting at byte 48: header checksum mismatch");
+    return MUNIT_OK;
+}
+
 /* The data directory has a closed segment which has corrupted batch data. */
 TEST(load, closedSegmentWithCorruptedBatchData, setUp, tearDown, 0, NULL)
 {
@@ -942,11 +1021,11 @@ TEST(load, emptyClosedSegment, setUp, tearDown, 0, NULL)
 TEST(load, closedSegmentWithBadFormat, setUp, tearDown, 0, NULL)
 {
     struct fixture *f = data;
-    uint8_t buf[8] = {2, 0, 0, 0, 0, 0, 0, 0};
+    uint8_t buf[8] = {3, 0, 0, 0, 0, 0, 0, 0};
     DirWriteFile(f->dir, CLOSED_SEGMENT_FILENAME(1, 1), buf, sizeof buf);
     LOAD_ERROR(RAFT_CORRUPT,
                "load closed segment 0000000000000001-0000000000000001: "
-               "unexpected format version 2");
+               "unexpected format version 3");
     return MUNIT_OK;
 }
 
@@ -980,11 +1059,11 @@ TEST(load, openSegmentWithZeroFormatAndThenData, setUp, tearDown, 0, NULL)
 TEST(load, openSegmentWithBadFormat, setUp, tearDown, 0, NULL)
 {
     struct fixture *f = data;
-    uint8_t version[8] = {2, 0, 0, 0, 0, 0, 0, 0};
+    uint8_t version[8] = {3, 0, 0, 0, 0, 0, 0, 0};
     APPEND(1, 1);
     UNFINALIZE(1, 1, 1);
     DirOverwriteFile(f->dir, "open-1", version, sizeof version, 0);
     LOAD_ERROR(RAFT_CORRUPT,
-               "load open segment open-1: unexpected format version 2");
+               "load open segment open-1: unexpected format version 3");
     return MUNIT_OK;
 }
@@ -0,0 +1,206 @@
+#include "../lib/runner.h"
+#include "../lib/uv.h"
+
+/******************************************************************************
+ *
+ * Fixture
+ *
+ *****************************************************************************/
+
+struct fixture
+{
+    FIXTURE_UV_DEPS;
+    FIXTURE_UV;
+    int count; /* To generate deterministic entry data */
+};
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+struct result
+{
+    int status;
+    bool done;
+    struct raft_entry *entries;
+    unsigned n;
+};
+
+static void appendCbAssertResult(struct raft_io_append *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+}
+
+static void readCbAssertResult(struct raft_io_read *req,
+                               struct raft_entry entries[],
+                               unsigned n,
+                               int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->entries = entries;
+    result->n = n;
+    result->done = true;
+}
+
+/* Append N entries of 8 bytes each, and wait for the request to complete. */
+#define APPEND(N)                                                             \
+    do {                                                                      \
+        struct raft_entry entries_[N];                                        \
+        uint64_t data_[N];                                                    \
+        struct raft_io_append req_;                                           \
+        struct result result_ = {0, false, NULL, 0};                          \
+        int i_;                                                               \
+        int rv_;                                                              \
+        for (i_ = 0; i_ < N; i_++) {                                          \
+            f->count++;                                                       \
+            data_[i_] = (uint64_t)f->count;                                   \
+            entries_[i_].term = 1;                                            \
+            entries_[i_].type = RAFT_COMMAND;                                 \
+            entries_[i_].buf.base = &data_[i_];                               \
+            entries_[i_].buf.len = sizeof data_[i_];                          \
+            entries_[i_].batch = NULL;                                        \
+        }                                                                     \
+        req_.data = &result_;                                                 \
+        rv_ = f->io.append(&f->io, &req_, entries_, N, appendCbAssertResult); \
+        munit_assert_int(rv_, ==, 0);                                         \
+        LOOP_RUN_UNTIL(&result_.done);                                        \
+    } while (0)
+
+#define TRUNCATE(N)                      \
+    do {                                 \
+        int rv_;                         \
+        rv_ = f->io.truncate(&f->io, N); \
+        munit_assert_int(rv_, ==, 0);    \
+    } while (0)
+
+/* Submit a read request identified by I, for at most N entries starting at
+ * INDEX. */
+#define READ_SUBMIT(I, INDEX, N)                                              \
+    struct raft_io_read _req##I;                                              \
+    struct result _result##I = {0, false, NULL, 0};                          \
+    int _rv##I;                                                               \
+    _req##I.data = &_result##I;                                               \
+    _rv##I = f->io.read(&f->io, &_req##I, INDEX, N, readCbAssertResult);      \
+    munit_assert_int(_rv##I, ==, 0)
+
+/* Wait for the read request identified by I to complete. */
+#define READ_WAIT(I) LOOP_RUN_UNTIL(&_result##I.done)
+
+#define READ_EXPECT(I, STATUS) _result##I.status = STATUS
+
+/* Assert that the read request identified by I returned N entries, with data
+ * matching the given values, and release them. */
+#define ASSERT_READ(I, N, ...)                                              \
+    do {                                                                    \
+        uint64_t _data[N] = {__VA_ARGS__};                                  \
+        struct raft_entry *_entries = _result##I.entries;                   \
+        unsigned _i;                                                        \
+        munit_assert_int(_result##I.n, ==, N);                              \
+        for (_i = 0; _i < N; _i++) {                                        \
+            munit_assert_int(_entries[_i].term, ==, 1);                     \
+            munit_assert_int(_entries[_i].buf.len, ==, 8);                  \
+            munit_assert_int(*(uint64_t *)_entries[_i].buf.base, ==,        \
+                             _data[_i]);                                    \
+            munit_assert_ptr_equal(_entries[_i].batch, _entries[0].batch);  \
+        }                                                                   \
+        raft_free(_entries[0].batch);                                       \
+        raft_free(_entries);                                                \
+    } while (0)
+
+/******************************************************************************
+ *
+ * Set up and tear down.
+ *
+ *****************************************************************************/
+
+static void *setUp(const MunitParameter params[], void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SETUP_UV_DEPS;
+    SETUP_UV;
+    f->count = 0;
+    return f;
+}
+
+static void tearDownDeps(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_UV_DEPS;
+    free(f);
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    TEAR_DOWN_UV;
+    tearDownDeps(f);
+}
+
+/******************************************************************************
+ *
+ * raft_io->read()
+ *
+ *****************************************************************************/
+
+SUITE(read)
+
+/* Read all entries of a closed segment. Truncating the log closes the segment
+ * being written, so entries appended afterwards go to a new one. */
+TEST(read, closedSegment, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(3);
+    TRUNCATE(3);
+    APPEND(1);
+    READ_SUBMIT(0, 1 /* index */, 10 /* n */);
+    READ_WAIT(0);
+    ASSERT_READ(0, 2 /* n entries */, 1, 2 /* entries data */);
+    return MUNIT_OK;
+}
+
+/* Read only some of the entries of a closed segment. */
+TEST(read, range, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(4);
+    TRUNCATE(4);
+    APPEND(1);
+    READ_SUBMIT(0, 2 /* index */, 1 /* n */);
+    READ_WAIT(0);
+    ASSERT_READ(0, 1 /* n entries */, 2 /* entries data */);
+    return MUNIT_OK;
+}
+
+/* Entries that are only found in the open segment can't be read. */
+TEST(read, openSegment, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(3);
+    TRUNCATE(3);
+    APPEND(1);
+    READ_SUBMIT(0, 3 /* index */, 1 /* n */);
+    READ_EXPECT(0, RAFT_NOTFOUND);
+    READ_WAIT(0);
+    munit_assert_int(_result0.n, ==, 0);
+    return MUNIT_OK;
+}
+
+/* The read request gets canceled because we're closing. */
+TEST(read, closing, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(3);
+    TRUNCATE(3);
+    APPEND(1);
+    READ_SUBMIT(0, 1 /* index */, 2 /* n */);
+    READ_EXPECT(0, RAFT_CANCELED);
+    TEAR_DOWN_UV;
+    munit_assert_true(_result0.done);
+    munit_assert_int(_result0.n, ==, 0);
+    return MUNIT_OK;
+}
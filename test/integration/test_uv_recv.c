@@ -34,6 +34,7 @@ struct result
 {
     struct raft_message *message;
     bool done;
+    unsigned n; /* Number of further messages expected */
 };
 
 static void recvCb(struct raft_io *io, struct raft_message *m1)
@@ -85,6 +86,12 @@ static void recvCb(struct raft_io *io, struct raft_message *m1)
                              m2->append_entries_result.rejected);
             munit_assert_int(m1->append_entries_result.last_log_index, ==,
                              m2->append_entries_result.last_log_index);
+            munit_assert_int(m1->append_entries_result.read_round, ==,
+                             m2->append_entries_result.read_round);
+            munit_assert_int(m1->append_entries_result.conflict_term, ==,
+                             m2->append_entries_result.conflict_term);
+            munit_assert_int(m1->append_entries_result.conflict_index, ==,
+                             m2->append_entries_result.conflict_index);
             break;
         case RAFT_IO_INSTALL_SNAPSHOT:
             munit_assert_int(m1->install_snapshot.conf.n, ==,
@@ -102,6 +109,10 @@ static void recvCb(struct raft_io *io, struct raft_message *m1)
                                     m2->install_snapshot.data.base,
                                     m2->install_snapshot.data.len),
                              ==, 0);
+            munit_assert_int(m1->install_snapshot.offset, ==,
+                             m2->install_snapshot.offset);
+            munit_assert_int(m1->install_snapshot.done, ==,
+                             m2->install_snapshot.done);
             raft_configuration_close(&m1->install_snapshot.conf);
             raft_free(m1->install_snapshot.data.base);
             break;
@@ -112,7 +123,31 @@ static void recvCb(struct raft_io *io, struct raft_message *m1)
             munit_assert_int(m1->timeout_now.last_log_term, ==,
                              m2->timeout_now.last_log_term);
             break;
+        case RAFT_IO_INSTALL_SNAPSHOT_RESULT:
+            munit_assert_int(m1->install_snapshot_result.term, ==,
+                             m2->install_snapshot_result.term);
+            munit_assert_int(m1->install_snapshot_result.last_index, ==,
+                             m2->install_snapshot_result.last_index);
+            munit_assert_int(m1->install_snapshot_result.offset, ==,
+                             m2->install_snapshot_result.offset);
+            break;
+        case RAFT_IO_FORWARD_READ:
+            munit_assert_int(m1->forward_read.term, ==, m2->forward_read.term);
+            munit_assert_int(m1->forward_read.seq, ==, m2->forward_read.seq);
+            break;
+        case RAFT_IO_FORWARD_READ_RESULT:
+            munit_assert_int(m1->forward_read_result.term, ==,
+                             m2->forward_read_result.term);
+            munit_assert_int(m1->forward_read_result.seq, ==,
+                             m2->forward_read_result.seq);
+            munit_assert_int(m1->forward_read_result.index, ==,
+                             m2->forward_read_result.index);
+            break;
     };
+    if (result->n > 0) {
+        result->n--;
+        return;
+    }
     result->done = true;
 }
 
@@ -194,6 +229,30 @@ static void peerCloseCb(struct raft_io *io)
         munit_assert_true(_done);                         \
     } while (0)
 
+/* Like PEER_SEND, but also run the main fixture's loop until the message is
+ * received, since the main instance must reply to an handshake offering
+ * compression before the peer can write the message. */
+#define PEER_SEND_RECV(MESSAGE)                                       \
+    do {                                                              \
+        struct raft_io *_io = &f->peer.io;                            \
+        struct raft_io_send _req;                                     \
+        struct result _result = {MESSAGE, false, 0};                  \
+        bool _done = false;                                           \
+        uint64_t _start = uv_hrtime();                                \
+        int _rv;                                                      \
+        (MESSAGE)->server_id = 1;                                     \
+        (MESSAGE)->server_address = "127.0.0.1:9001";                 \
+        f->io.data = &_result;                                        \
+        _req.data = &_done;                                           \
+        _rv = _io->send(_io, &_req, MESSAGE, peerSendCb);             \
+        munit_assert_int(_rv, ==, 0);                                 \
+        while (!_done || !_result.done) {                             \
+            munit_assert_ullong(uv_hrtime() - _start, <, 5000000000); \
+            uv_run(&f->peer.loop, UV_RUN_NOWAIT);                     \
+            uv_run(&f->loop, UV_RUN_NOWAIT);                          \
+        }                                                             \
+    } while (0)
+
 /* Establish a connection and send an handshake using plain TCP. */
 #define PEER_HANDSHAKE                                             \
     do {                                                           \
@@ -211,11 +270,20 @@ static void peerCloseCb(struct raft_io *io)
 
 /* Run the loop until a new message is received. Assert that the received
  * message matches the given one. */
-#define RECV(MESSAGE)                             \
-    do {                                          \
-        struct result _result = {MESSAGE, false}; \
-        f->io.data = &_result;                    \
-        LOOP_RUN_UNTIL(&_result.done);            \
+#define RECV(MESSAGE)                                \
+    do {                                             \
+        struct result _result = {MESSAGE, false, 0}; \
+        f->io.data = &_result;                       \
+        LOOP_RUN_UNTIL(&_result.done);               \
+    } while (0)
+
+/* Run the loop until N new messages are received, asserting that each of them
+ * matches the given one. */
+#define RECV_N(MESSAGE, N)                                 \
+    do {                                                   \
+        struct result _result = {MESSAGE, false, (N) - 1}; \
+        f->io.data = &_result;                             \
+        LOOP_RUN_UNTIL(&_result.done);                     \
     } while (0)
 
 /******************************************************************************
@@ -342,6 +410,230 @@ TEST(recv, appendEntries, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Receive several AppendEntries messages that were sent back-to-back, and are
+ * likely to be read from the socket at once. */
+TEST(recv, appendEntriesBatched, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[1];
+    struct raft_message message;
+    uint8_t data1[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    unsigned i;
+
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = sizeof data1;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 1;
+
+    for (i = 0; i < 5; i++) {
+        PEER_SEND(&message);
+    }
+    RECV_N(&message, 5);
+
+    return MUNIT_OK;
+}
+
+/* Receive several messages that the peer wrote out in a single batch. */
+TEST(recv, batchedSends, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[2];
+    struct raft_message message;
+    struct raft_io_send reqs[3];
+    bool done[3] = {false, false, false};
+    uint8_t data1[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t data2[16] = {8, 7, 6, 5, 4, 3, 2, 1};
+    unsigned i;
+    int rv;
+
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = sizeof data1;
+
+    entries[1].type = RAFT_COMMAND;
+    entries[1].buf.base = data2;
+    entries[1].buf.len = sizeof data2;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 2;
+
+    /* The first message establishes the connection. */
+    raft_uv_set_send_batching(&f->peer.io, true);
+    PEER_SEND(&message);
+    RECV(&message);
+
+    for (i = 0; i < 3; i++) {
+        reqs[i].data = &done[i];
+        rv = f->peer.io.send(&f->peer.io, &reqs[i], &message, peerSendCb);
+        munit_assert_int(rv, ==, 0);
+    }
+    for (i = 0; i < 10 && !done[2]; i++) {
+        uv_run(&f->peer.loop, UV_RUN_ONCE);
+    }
+    munit_assert_true(done[0]);
+    munit_assert_true(done[1]);
+    munit_assert_true(done[2]);
+
+    RECV_N(&message, 3);
+
+    return MUNIT_OK;
+}
+
+/* Receive an AppendEntries message whose payload is larger than the receive
+ * buffer, followed by an heartbeat. */
+TEST(recv, appendEntriesLargePayload, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[2];
+    struct raft_message message;
+    size_t size = 48 * 1024;
+    uint8_t *data1 = munit_malloc(size);
+    uint8_t *data2 = munit_malloc(size);
+
+    memset(data1, 'a', size);
+    memset(data2, 'b', size);
+
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = size;
+
+    entries[1].type = RAFT_COMMAND;
+    entries[1].buf.base = data2;
+    entries[1].buf.len = size;
+
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 2;
+
+    PEER_SEND(&message);
+    RECV(&message);
+
+    message.append_entries.entries = NULL;
+    message.append_entries.n_entries = 0;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    free(data1);
+    free(data2);
+
+    return MUNIT_OK;
+}
+
+/* Send an AppendEntries message whose entries have the given size and
+ * content, after connecting with compression enabled, and return the number of
+ * bytes saved by compressing it. */
+static unsigned long long sendCompressed(struct fixture *f,
+                                         size_t size,
+                                         bool random)
+{
+    struct raft_entry entries[2];
+    struct raft_message message;
+    uint8_t *data1 = munit_malloc(size);
+    uint8_t *data2 = munit_malloc(size);
+    unsigned long long saved;
+
+    if (random) {
+        munit_rand_memory(size, data1);
+        munit_rand_memory(size, data2);
+    } else {
+        memset(data1, 'a', size);
+        memset(data2, 'b', size);
+    }
+
+    entries[0].type = RAFT_COMMAND;
+    entries[0].buf.base = data1;
+    entries[0].buf.len = size;
+
+    entries[1].type = RAFT_COMMAND;
+    entries[1].buf.base = data2;
+    entries[1].buf.len = size;
+
+    /* The first message establishes the connection. */
+    message.type = RAFT_IO_APPEND_ENTRIES;
+    message.append_entries.entries = NULL;
+    message.append_entries.n_entries = 0;
+    PEER_SEND_RECV(&message);
+
+    message.append_entries.entries = entries;
+    message.append_entries.n_entries = 2;
+    PEER_SEND(&message);
+    RECV(&message);
+    saved = raft_uv_message_compression_saved(&f->peer.io);
+
+    /* The stream is still in sync. */
+    message.append_entries.entries = NULL;
+    message.append_entries.n_entries = 0;
+    PEER_SEND(&message);
+    RECV(&message);
+
+    free(data1);
+    free(data2);
+
+    return saved;
+}
+
+/* Receive an AppendEntries message whose payload was compressed. */
+TEST(recv, appendEntriesCompressed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = raft_uv_set_message_compression(&f->peer.io, true);
+    if (rv == RAFT_INVALID) {
+        return MUNIT_SKIP;
+    }
+    munit_assert_int(rv, ==, 0);
+    munit_assert_ullong(sendCompressed(f, 8 * 1024, false), >, 0);
+    return MUNIT_OK;
+}
+
+/* Receive an AppendEntries message whose payload was compressed in the thread
+ * pool, since it's large. */
+TEST(recv, appendEntriesCompressedLarge, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = raft_uv_set_message_compression(&f->peer.io, true);
+    if (rv == RAFT_INVALID) {
+        return MUNIT_SKIP;
+    }
+    munit_assert_int(rv, ==, 0);
+    munit_assert_ullong(sendCompressed(f, 256 * 1024, false), >, 0);
+    return MUNIT_OK;
+}
+
+/* A payload that can't be compressed is sent as is. */
+TEST(recv, appendEntriesIncompressible, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = raft_uv_set_message_compression(&f->peer.io, true);
+    if (rv == RAFT_INVALID) {
+        return MUNIT_SKIP;
+    }
+    munit_assert_int(rv, ==, 0);
+    munit_assert_ullong(sendCompressed(f, 8 * 1024, true), ==, 0);
+    return MUNIT_OK;
+}
+
+/* Payloads smaller than the compression threshold are sent as is. */
+TEST(recv, appendEntriesBelowThreshold, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = raft_uv_set_message_compression(&f->peer.io, true);
+    if (rv == RAFT_INVALID) {
+        return MUNIT_SKIP;
+    }
+    munit_assert_int(rv, ==, 0);
+    raft_uv_set_message_compression_threshold(&f->peer.io, 64 * 1024);
+    munit_assert_ullong(sendCompressed(f, 8 * 1024, false), ==, 0);
+    return MUNIT_OK;
+}
+
 /* Receive an AppendEntries message with no entries (i.e. an heartbeat). */
 TEST(recv, heartbeat, setUp, tearDown, 0, NULL)
 {
@@ -364,11 +656,58 @@ TEST(recv, appendEntriesResult, setUp, tearDown, 0, NULL)
     message.append_entries_result.term = 3;
     message.append_entries_result.rejected = 0;
     message.append_entries_result.last_log_index = 123;
+    message.append_entries_result.read_round = 7;
+    message.append_entries_result.conflict_term = 2;
+    message.append_entries_result.conflict_index = 100;
     PEER_SEND(&message);
     RECV(&message);
     return MUNIT_OK;
 }
 
+/* Receive AppendEntries results whose header is too short to contain the
+ * conflict fields. They are not read past the end of the header. */
+TEST(recv, appendEntriesResultShort, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    uint8_t handshake[] = {
+        1, 0, 0, 0, 0, 0, 0, 0,  /* Protocol */
+        2, 0, 0, 0, 0, 0, 0, 0,  /* Server ID */
+        16, 0, 0, 0, 0, 0, 0, 0, /* Address length */
+        0, 0, 0, 0, 0, 0, 0, 0,  /* First address word */
+        0, 0, 0, 0, 0, 0, 0, 0   /* Second address word */
+    };
+    uint8_t buf[] = {
+        2, 0, 0, 0, 0, 0, 0, 0,   /* Message type */
+        40, 0, 0, 0, 0, 0, 0, 0,  /* Message size */
+        3, 0, 0, 0, 0, 0, 0, 0,   /* Term */
+        0, 0, 0, 0, 0, 0, 0, 0,   /* Rejected */
+        123, 0, 0, 0, 0, 0, 0, 0, /* Last log index */
+        7, 0, 0, 0, 0, 0, 0, 0,   /* Read round */
+        0, 0, 0, 0, 0, 0, 0, 0,   /* Unused */
+        2, 0, 0, 0, 0, 0, 0, 0,   /* Message type */
+        40, 0, 0, 0, 0, 0, 0, 0,  /* Message size */
+        3, 0, 0, 0, 0, 0, 0, 0,   /* Term */
+        0, 0, 0, 0, 0, 0, 0, 0,   /* Rejected */
+        123, 0, 0, 0, 0, 0, 0, 0, /* Last log index */
+        7, 0, 0, 0, 0, 0, 0, 0,   /* Read round */
+        0, 0, 0, 0, 0, 0, 0, 0    /* Unused */
+    };
+    message.type = RAFT_IO_APPEND_ENTRIES_RESULT;
+    message.append_entries_result.term = 3;
+    message.append_entries_result.rejected = 0;
+    message.append_entries_result.last_log_index = 123;
+    message.append_entries_result.read_round = 7;
+    message.append_entries_result.conflict_term = 0;
+    message.append_entries_result.conflict_index = 0;
+    sprintf((char *)&handshake[24], "127.0.0.1:9002");
+    TCP_CLIENT_CONNECT(9001);
+    TCP_CLIENT_SEND(handshake, sizeof handshake);
+    TCP_CLIENT_SEND(buf, sizeof buf);
+    RECV_N(&message, 2);
+    return MUNIT_OK;
+}
+
 /* Receive an InstallSnapshot message. */
 TEST(recv, installSnapshot, setUp, tearDown, 0, NULL)
 {
@@ -387,6 +726,8 @@ TEST(recv, installSnapshot, setUp, tearDown, 0, NULL)
     munit_assert_int(rv, ==, 0);
     message.install_snapshot.data.len = sizeof snapshot_data;
     message.install_snapshot.data.base = snapshot_data;
+    message.install_snapshot.offset = 0;
+    message.install_snapshot.done = true;
 
     PEER_SEND(&message);
     RECV(&message);
@@ -396,6 +737,49 @@ TEST(recv, installSnapshot, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Receive an InstallSnapshot message carrying a chunk of a larger snapshot. */
+TEST(recv, installSnapshotChunk, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    uint8_t snapshot_data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    int rv;
+
+    message.type = RAFT_IO_INSTALL_SNAPSHOT;
+    message.install_snapshot.term = 2;
+    message.install_snapshot.last_index = 123;
+    message.install_snapshot.last_term = 1;
+    raft_configuration_init(&message.install_snapshot.conf);
+    rv = raft_configuration_add(&message.install_snapshot.conf, 1, "1",
+                                RAFT_VOTER);
+    munit_assert_int(rv, ==, 0);
+    message.install_snapshot.data.len = sizeof snapshot_data;
+    message.install_snapshot.data.base = snapshot_data;
+    message.install_snapshot.offset = 16;
+    message.install_snapshot.done = false;
+
+    PEER_SEND(&message);
+    RECV(&message);
+
+    raft_configuration_close(&message.install_snapshot.conf);
+
+    return MUNIT_OK;
+}
+
+/* Receive an InstallSnapshot result message. */
+TEST(recv, installSnapshotResult, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    message.type = RAFT_IO_INSTALL_SNAPSHOT_RESULT;
+    message.install_snapshot_result.term = 2;
+    message.install_snapshot_result.last_index = 123;
+    message.install_snapshot_result.offset = 4096;
+    PEER_SEND(&message);
+    RECV(&message);
+    return MUNIT_OK;
+}
+
 /* Receive a TimeoutNow message. */
 TEST(recv, timeoutNow, setUp, tearDown, 0, NULL)
 {
@@ -410,6 +794,33 @@ TEST(recv, timeoutNow, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Receive a ForwardRead message. */
+TEST(recv, forwardRead, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    message.type = RAFT_IO_FORWARD_READ;
+    message.forward_read.term = 3;
+    message.forward_read.seq = 5;
+    PEER_SEND(&message);
+    RECV(&message);
+    return MUNIT_OK;
+}
+
+/* Receive a ForwardRead result message. */
+TEST(recv, forwardReadResult, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_message message;
+    message.type = RAFT_IO_FORWARD_READ_RESULT;
+    message.forward_read_result.term = 3;
+    message.forward_read_result.seq = 5;
+    message.forward_read_result.index = 123;
+    PEER_SEND(&message);
+    RECV(&message);
+    return MUNIT_OK;
+}
+
 /* The handshake fails because of an unexpected protocon version. */
 TEST(recv, badProtocol, setUp, tearDown, 0, NULL)
 {
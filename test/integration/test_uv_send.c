@@ -382,3 +382,110 @@ TEST(send, closeDuringConnection, setUp, tearDownDeps, 0, NULL)
     TEAR_DOWN_UV;
     return MUNIT_OK;
 }
+
+/******************************************************************************
+ *
+ * raft_io->send() with batching enabled
+ *
+ *****************************************************************************/
+
+SUITE(sendBatching)
+
+/* Messages sent during the same loop iteration are written out together. */
+TEST(sendBatching, parallel, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_uv_set_send_batching(&f->io, true);
+    SEND(0);
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_SUBMIT(2 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_SUBMIT(3 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_WAIT(1);
+    SEND_WAIT(2);
+    SEND_WAIT(3);
+    SEND(4);
+    return MUNIT_OK;
+}
+
+/* Batch messages with payloads and messages without. */
+TEST(sendBatching, appendEntries, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry entries[2];
+    raft_uv_set_send_batching(&f->io, true);
+    entries[0].buf.base = raft_malloc(16);
+    entries[0].buf.len = 16;
+    entries[1].buf.base = raft_malloc(8);
+    entries[1].buf.len = 8;
+
+    MESSAGE(1)->type = RAFT_IO_APPEND_ENTRIES;
+    MESSAGE(1)->append_entries.entries = entries;
+    MESSAGE(1)->append_entries.n_entries = 2;
+    MESSAGE(2)->type = RAFT_IO_APPEND_ENTRIES_RESULT;
+
+    SEND(0);
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_SUBMIT(2 /* message */, 0 /* rv */, 0 /* status */);
+    SEND_WAIT(1);
+    SEND_WAIT(2);
+
+    raft_free(entries[0].buf.base);
+    raft_free(entries[1].buf.base);
+
+    return MUNIT_OK;
+}
+
+/* The peer dies while several messages are batched. */
+TEST(sendBatching, writeError, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int socket;
+    signal(SIGPIPE, SIG_IGN);
+    raft_uv_set_send_batching(&f->io, true);
+    SEND(0);
+    socket = TcpServerAccept(&f->server);
+    close(socket);
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, RAFT_IOERR /* status */);
+    SEND_SUBMIT(2 /* message */, 0 /* rv */, RAFT_IOERR /* status */);
+    SEND_WAIT(1);
+    SEND_WAIT(2);
+    SEND(3);
+    return MUNIT_OK;
+}
+
+static char *batchOomHeapFaultDelay[] = {"0", "1", "2", "3", NULL};
+static char *batchOomHeapFaultRepeat[] = {"1", NULL};
+
+static MunitParameterEnum batchOomParams[] = {
+    {TEST_HEAP_FAULT_DELAY, batchOomHeapFaultDelay},
+    {TEST_HEAP_FAULT_REPEAT, batchOomHeapFaultRepeat},
+    {NULL, NULL},
+};
+
+/* Out of memory conditions while batching a message. Messages sent afterwards
+ * are still written out, with or without batching. */
+TEST(sendBatching, oom, setUp, tearDown, 0, batchOomParams)
+{
+    struct fixture *f = data;
+    raft_uv_set_send_batching(&f->io, true);
+    SEND(0);
+    HEAP_FAULT_ENABLE;
+    SEND_ERROR(1, RAFT_NOMEM, "");
+    raft_uv_set_send_batching(&f->io, false);
+    SEND(2);
+    raft_uv_set_send_batching(&f->io, true);
+    SEND(3);
+    return MUNIT_OK;
+}
+
+/* The backend gets closed while there are batched messages. */
+TEST(sendBatching, close, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    raft_uv_set_send_batching(&f->io, true);
+    SEND(0);
+    SEND_SUBMIT(1 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
+    SEND_SUBMIT(2 /* message */, 0 /* rv */, RAFT_CANCELED /* status */);
+    TEAR_DOWN_UV;
+    return MUNIT_OK;
+}
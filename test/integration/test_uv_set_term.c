@@ -64,6 +64,48 @@ static void closeCb(struct raft_io *io)
         munit_assert_string_equal(f->io.errmsg_(&f->io), ERRMSG); \
     } while (0)
 
+struct result
+{
+    int status;
+    bool done;
+    bool closed; /* Whether the close callback had fired already */
+    struct fixture *f;
+};
+
+static void setMetaCbAssertResult(struct raft_io_set_meta *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+    result->closed = result->f->closed;
+}
+
+/* Submit an asynchronous set_term request with index I. */
+#define ASYNC_SET_TERM_SUBMIT(I, TERM)                                   \
+    struct raft_io_set_meta _req##I;                                     \
+    struct result _result##I = {0, false, false, f};                     \
+    int _rv##I;                                                          \
+    _req##I.data = &_result##I;                                          \
+    _rv##I = f->io.async_set_term(&f->io, &_req##I, TERM,                \
+                                  setMetaCbAssertResult);                \
+    munit_assert_int(_rv##I, ==, 0)
+
+/* Submit an asynchronous set_vote request with index I. */
+#define ASYNC_SET_VOTE_SUBMIT(I, SERVER_ID)                              \
+    struct raft_io_set_meta _req##I;                                     \
+    struct result _result##I = {0, false, false, f};                     \
+    int _rv##I;                                                          \
+    _req##I.data = &_result##I;                                          \
+    _rv##I = f->io.async_set_vote(&f->io, &_req##I, SERVER_ID,           \
+                                  setMetaCbAssertResult);                \
+    munit_assert_int(_rv##I, ==, 0)
+
+/* Wait for the asynchronous request with index I to complete. */
+#define ASYNC_WAIT(I) LOOP_RUN_UNTIL(&_result##I.done)
+
+/* Set the expected status of the asynchronous request with index I. */
+#define ASYNC_EXPECT(I, STATUS) _result##I.status = STATUS
+
 /* Write either the metadata1 or metadata2 file, filling it with the given
  * values. */
 #define WRITE_METADATA_FILE(N, FORMAT, VERSION, TERM, VOTED_FOR) \
@@ -116,14 +158,20 @@ static void *setUp(const MunitParameter params[], void *user_data)
     return f;
 }
 
-static void tearDown(void *data)
+static void tearDownDeps(void *data)
 {
     struct fixture *f = data;
-    CLOSE;
     TEAR_DOWN_UV_DEPS;
     free(f);
 }
 
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    CLOSE;
+    tearDownDeps(data);
+}
+
 /******************************************************************************
  *
  * raft_io->set_term()
@@ -240,3 +288,66 @@ TEST(set_term, metadataTwoIsGreater, setUpDeps, tearDown, 0, NULL)
                          0 /* voted for */);
     return MUNIT_OK;
 }
+
+/******************************************************************************
+ *
+ * raft_io->async_set_term() and raft_io->async_set_vote()
+ *
+ *****************************************************************************/
+
+SUITE(async_set_meta)
+
+/* Store the term asynchronously. */
+TEST(async_set_meta, term, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    ASYNC_SET_TERM_SUBMIT(1, 1);
+    ASYNC_WAIT(1);
+    ASSERT_METADATA_FILE(1, 1, 1, 0);
+    munit_assert_false(DirHasFile(f->dir, "metadata2"));
+    return MUNIT_OK;
+}
+
+/* Requests submitted in the same loop iteration are covered by a single
+ * write. */
+TEST(async_set_meta, coalesce, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    ASYNC_SET_TERM_SUBMIT(1, 2);
+    ASYNC_SET_VOTE_SUBMIT(2, 3);
+    ASYNC_WAIT(2);
+    munit_assert_true(_result1.done);
+    ASSERT_METADATA_FILE(1, 1, 2, 3);
+    munit_assert_false(DirHasFile(f->dir, "metadata2"));
+    return MUNIT_OK;
+}
+
+/* Successive writes alternate between the two metadata files. */
+TEST(async_set_meta, alternate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    ASYNC_SET_TERM_SUBMIT(1, 1);
+    ASYNC_WAIT(1);
+    ASYNC_SET_TERM_SUBMIT(2, 2);
+    ASYNC_SET_VOTE_SUBMIT(3, 5);
+    ASYNC_WAIT(3);
+    ASYNC_SET_VOTE_SUBMIT(4, 1);
+    ASYNC_WAIT(4);
+    ASSERT_METADATA_FILE(1, 3, 2, 1);
+    ASSERT_METADATA_FILE(2, 2, 2, 5);
+    return MUNIT_OK;
+}
+
+/* Requests still pending when the instance is closed are canceled, and their
+ * callbacks fire before the close callback. */
+TEST(async_set_meta, cancel, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    ASYNC_SET_TERM_SUBMIT(1, 1);
+    ASYNC_EXPECT(1, RAFT_CANCELED);
+    CLOSE;
+    munit_assert_true(_result1.done);
+    munit_assert_false(_result1.closed);
+    munit_assert_false(DirHasFile(f->dir, "metadata1"));
+    return MUNIT_OK;
+}
@@ -68,6 +68,41 @@ static void snapshotGetCbAssertResult(struct raft_io_snapshot_get *req,
     raft_free(snapshot);
 }
 
+struct compressedSnapshot
+{
+    struct raft_buffer *bufs;
+    unsigned n_bufs;
+    bool done;
+};
+
+/* Check that the loaded snapshot contains the concatenation of the expected
+ * buffers. */
+static void snapshotGetCbAssertData(struct raft_io_snapshot_get *req,
+                                    struct raft_snapshot *snapshot,
+                                    int status)
+{
+    struct compressedSnapshot *expect = req->data;
+    const char *cursor;
+    unsigned i;
+    munit_assert_int(status, ==, 0);
+    munit_assert_ptr_not_null(snapshot);
+    munit_assert_int(snapshot->n_bufs, ==, 1);
+    cursor = snapshot->bufs[0].base;
+    for (i = 0; i < expect->n_bufs; i++) {
+        munit_assert_memory_equal(expect->bufs[i].len, cursor,
+                                  expect->bufs[i].base);
+        cursor += expect->bufs[i].len;
+    }
+    munit_assert_ptr_equal(cursor,
+                           (char *)snapshot->bufs[0].base +
+                               snapshot->bufs[0].len);
+    expect->done = true;
+    raft_configuration_close(&snapshot->configuration);
+    raft_free(snapshot->bufs[0].base);
+    raft_free(snapshot->bufs);
+    raft_free(snapshot);
+}
+
 /* Submit an append request to append N entries and wait for the operation to
  * successfully complete. */
 #define APPEND(N)                                                 \
@@ -282,3 +317,316 @@ TEST(snapshot_put, installWithoutPreviousEntries, setUp, tearDown, 0, NULL)
     );
     return MUNIT_OK;
 }
+
+/* With compression enabled, the snapshot data is compressed on disk and
+ * decompressed when loaded. */
+TEST(snapshot_put, compressed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_snapshot snapshot;
+    struct raft_buffer bufs[2];
+    struct raft_io_snapshot_put req;
+    struct raft_io_snapshot_get get;
+    struct result result = {0, false};
+    struct compressedSnapshot expect;
+    unsigned i;
+    int rv;
+
+    rv = raft_uv_set_snapshot_compression(&f->io, true);
+    if (rv == RAFT_INVALID) {
+        return MUNIT_SKIP;
+    }
+    munit_assert_int(rv, ==, 0);
+
+    for (i = 0; i < 2; i++) {
+        bufs[i].len = 32 * 1024;
+        bufs[i].base = munit_malloc(bufs[i].len);
+        memset(bufs[i].base, 'a' + (int)i, bufs[i].len);
+    }
+    snapshot.term = 1;
+    snapshot.index = 1;
+    snapshot.configuration_index = 1;
+    raft_configuration_init(&snapshot.configuration);
+    rv = raft_configuration_add(&snapshot.configuration, 1, "1", RAFT_VOTER);
+    munit_assert_int(rv, ==, 0);
+    snapshot.bufs = bufs;
+    snapshot.n_bufs = 2;
+
+    req.data = &result;
+    rv = f->io.snapshot_put(&f->io, 10, &req, &snapshot,
+                            snapshotPutCbAssertResult);
+    munit_assert_int(rv, ==, 0);
+    LOOP_RUN_UNTIL(&result.done);
+    raft_configuration_close(&snapshot.configuration);
+
+    expect.bufs = bufs;
+    expect.n_bufs = 2;
+    expect.done = false;
+    get.data = &expect;
+    rv = f->io.snapshot_get(&f->io, &get, snapshotGetCbAssertData);
+    munit_assert_int(rv, ==, 0);
+    LOOP_RUN_UNTIL(&expect.done);
+
+    for (i = 0; i < 2; i++) {
+        free(bufs[i].base);
+    }
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * raft_io->snapshot_read
+ *
+ *****************************************************************************/
+
+struct readResult
+{
+    int status;
+    bool done;
+    struct raft_snapshot *snapshot;
+    size_t size;
+};
+
+static void snapshotReadCbAssertResult(struct raft_io_snapshot_read *req,
+                                       struct raft_snapshot *snapshot,
+                                       size_t size,
+                                       int status)
+{
+    struct readResult *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->snapshot = snapshot;
+    result->size = size;
+    result->done = true;
+}
+
+/* Store a snapshot at index 1 whose data is the 16 bytes "abcd...p". */
+#define SNAPSHOT_PUT_ALPHABET                                               \
+    do {                                                                    \
+        struct raft_snapshot _snapshot;                                     \
+        struct raft_buffer _buf;                                            \
+        char _data[16];                                                     \
+        struct raft_io_snapshot_put _req;                                   \
+        struct result _result = {0, false};                                 \
+        int _i;                                                             \
+        int _rv;                                                            \
+        for (_i = 0; _i < 16; _i++) {                                       \
+            _data[_i] = (char)('a' + _i);                                   \
+        }                                                                   \
+        _snapshot.term = 1;                                                 \
+        _snapshot.index = 1;                                                \
+        _snapshot.configuration_index = 1;                                  \
+        raft_configuration_init(&_snapshot.configuration);                  \
+        _rv = raft_configuration_add(&_snapshot.configuration, 1, "1",      \
+                                     RAFT_VOTER);                           \
+        munit_assert_int(_rv, ==, 0);                                       \
+        _buf.base = _data;                                                  \
+        _buf.len = sizeof _data;                                            \
+        _snapshot.bufs = &_buf;                                             \
+        _snapshot.n_bufs = 1;                                               \
+        _req.data = &_result;                                               \
+        _rv = f->io.snapshot_put(&f->io, 10, &_req, &_snapshot,             \
+                                 snapshotPutCbAssertResult);                \
+        munit_assert_int(_rv, ==, 0);                                       \
+        LOOP_RUN_UNTIL(&_result.done);                                      \
+        raft_configuration_close(&_snapshot.configuration);                 \
+    } while (0)
+
+/* Submit a snapshot read request identified by I. */
+#define SNAPSHOT_READ_SUBMIT(I, OFFSET, LEN)                                  \
+    struct raft_io_snapshot_read _req##I;                                     \
+    struct readResult _result##I = {0, false, NULL, 0};                       \
+    int _rv##I;                                                               \
+    _req##I.data = &_result##I;                                               \
+    _rv##I = f->io.snapshot_read(&f->io, &_req##I, OFFSET, LEN,               \
+                                 snapshotReadCbAssertResult);                 \
+    munit_assert_int(_rv##I, ==, 0)
+
+#define SNAPSHOT_READ_EXPECT(I, STATUS) _result##I.status = STATUS
+
+#define SNAPSHOT_READ_WAIT(I) LOOP_RUN_UNTIL(&_result##I.done)
+
+/* Assert that the read request identified by I returned the given data, out of
+ * a snapshot of SIZE bytes, and release the snapshot. */
+#define ASSERT_SNAPSHOT_READ(I, SIZE, DATA)                                 \
+    do {                                                                    \
+        struct raft_snapshot *_snapshot = _result##I.snapshot;              \
+        munit_assert_ptr_not_null(_snapshot);                               \
+        munit_assert_int(_snapshot->index, ==, 1);                          \
+        munit_assert_int(_snapshot->configuration.n, ==, 1);                \
+        munit_assert_int(_result##I.size, ==, SIZE);                        \
+        munit_assert_int(_snapshot->n_bufs, ==, 1);                         \
+        munit_assert_int(_snapshot->bufs[0].len, ==, strlen(DATA));         \
+        munit_assert_memory_equal(strlen(DATA), _snapshot->bufs[0].base,    \
+                                  DATA);                                    \
+        raft_configuration_close(&_snapshot->configuration);                \
+        raft_free(_snapshot->bufs[0].base);                                 \
+        raft_free(_snapshot->bufs);                                         \
+        raft_free(_snapshot);                                               \
+    } while (0)
+
+SUITE(snapshot_read)
+
+/* Read a range in the middle of the snapshot data. */
+TEST(snapshot_read, range, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    SNAPSHOT_PUT_ALPHABET;
+    SNAPSHOT_READ_SUBMIT(0, 4 /* offset */, 8 /* len */);
+    SNAPSHOT_READ_WAIT(0);
+    ASSERT_SNAPSHOT_READ(0, 16 /* size */, "efghijkl");
+    return MUNIT_OK;
+}
+
+/* A read past the end of the data returns only the remaining bytes. */
+TEST(snapshot_read, end, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    SNAPSHOT_PUT_ALPHABET;
+    SNAPSHOT_READ_SUBMIT(0, 12 /* offset */, 8 /* len */);
+    SNAPSHOT_READ_WAIT(0);
+    ASSERT_SNAPSHOT_READ(0, 16 /* size */, "mnop");
+    return MUNIT_OK;
+}
+
+/* Compressed snapshot data is decompressed before the range is extracted. */
+TEST(snapshot_read, compressed, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    int rv;
+    rv = raft_uv_set_snapshot_compression(&f->io, true);
+    if (rv == RAFT_INVALID) {
+        return MUNIT_SKIP;
+    }
+    munit_assert_int(rv, ==, 0);
+    SNAPSHOT_PUT_ALPHABET;
+    SNAPSHOT_READ_SUBMIT(0, 2 /* offset */, 3 /* len */);
+    SNAPSHOT_READ_WAIT(0);
+    ASSERT_SNAPSHOT_READ(0, 16 /* size */, "cde");
+    return MUNIT_OK;
+}
+
+/* If there's no snapshot, RAFT_NOTFOUND is returned. */
+TEST(snapshot_read, none, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    SNAPSHOT_READ_SUBMIT(0, 0 /* offset */, 8 /* len */);
+    SNAPSHOT_READ_EXPECT(0, RAFT_NOTFOUND);
+    SNAPSHOT_READ_WAIT(0);
+    munit_assert_ptr_null(_result0.snapshot);
+    return MUNIT_OK;
+}
+
+/* The read request gets canceled because we're closing. */
+TEST(snapshot_read, closing, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    SNAPSHOT_PUT_ALPHABET;
+    SNAPSHOT_READ_SUBMIT(0, 0 /* offset */, 8 /* len */);
+    SNAPSHOT_READ_EXPECT(0, RAFT_CANCELED);
+    TEAR_DOWN_UV;
+    munit_assert_true(_result0.done);
+    munit_assert_ptr_null(_result0.snapshot);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * raft_io->snapshot_write
+ *
+ *****************************************************************************/
+
+static void snapshotWriteCbAssertResult(struct raft_io_snapshot_write *req,
+                                        int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+}
+
+/* Write the chunk DATA at OFFSET of the data of a snapshot at index 1, and wait
+ * for the request to complete with the given status. */
+#define SNAPSHOT_WRITE_STATUS(OFFSET, DATA, DONE, STATUS)                   \
+    do {                                                                    \
+        struct raft_snapshot _snapshot;                                     \
+        struct raft_buffer _chunk;                                          \
+        struct raft_io_snapshot_write _req;                                 \
+        struct result _result = {STATUS, false};                            \
+        int _rv;                                                            \
+        _snapshot.term = 1;                                                 \
+        _snapshot.index = 1;                                                \
+        _snapshot.configuration_index = 1;                                  \
+        raft_configuration_init(&_snapshot.configuration);                  \
+        _rv = raft_configuration_add(&_snapshot.configuration, 1, "1",      \
+                                     RAFT_VOTER);                           \
+        munit_assert_int(_rv, ==, 0);                                       \
+        _snapshot.bufs = NULL;                                              \
+        _snapshot.n_bufs = 0;                                               \
+        _chunk.base = DATA;                                                 \
+        _chunk.len = strlen(DATA);                                          \
+        _req.data = &_result;                                               \
+        _rv = f->io.snapshot_write(&f->io, &_req, &_snapshot, OFFSET,       \
+                                   &_chunk, DONE,                           \
+                                   snapshotWriteCbAssertResult);            \
+        munit_assert_int(_rv, ==, 0);                                       \
+        LOOP_RUN_UNTIL(&_result.done);                                      \
+        raft_configuration_close(&_snapshot.configuration);                 \
+    } while (0)
+
+#define SNAPSHOT_WRITE(OFFSET, DATA, DONE) \
+    SNAPSHOT_WRITE_STATUS(OFFSET, DATA, DONE, 0)
+
+/* Load the last snapshot and check that its data matches DATA. */
+#define ASSERT_SNAPSHOT_DATA(DATA)                                          \
+    do {                                                                    \
+        struct raft_io_snapshot_get _req;                                   \
+        struct raft_buffer _buf;                                            \
+        struct compressedSnapshot _expect;                                  \
+        int _rv;                                                            \
+        _buf.base = DATA;                                                   \
+        _buf.len = strlen(DATA);                                            \
+        _expect.bufs = &_buf;                                               \
+        _expect.n_bufs = 1;                                                 \
+        _expect.done = false;                                               \
+        _req.data = &_expect;                                               \
+        _rv = f->io.snapshot_get(&f->io, &_req, snapshotGetCbAssertData);   \
+        munit_assert_int(_rv, ==, 0);                                       \
+        LOOP_RUN_UNTIL(&_expect.done);                                      \
+    } while (0)
+
+SUITE(snapshot_write)
+
+/* Write a snapshot in two chunks. The data is set aside in a partial file until
+ * the last chunk is written. */
+TEST(snapshot_write, chunks, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(4);
+    SNAPSHOT_WRITE(0 /* offset */, "abcd", false /* done */);
+    munit_assert_true(DirHasFile(f->dir, "snapshot-partial"));
+    SNAPSHOT_WRITE(4 /* offset */, "efgh", true /* done */);
+    munit_assert_false(DirHasFile(f->dir, "snapshot-partial"));
+    ASSERT_SNAPSHOT_DATA("abcdefgh");
+    return MUNIT_OK;
+}
+
+/* Writing a chunk at an offset that was already written discards the data
+ * past it. */
+TEST(snapshot_write, overwrite, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    SNAPSHOT_WRITE(0 /* offset */, "abcd", false /* done */);
+    SNAPSHOT_WRITE(4 /* offset */, "efgh", false /* done */);
+    SNAPSHOT_WRITE(2 /* offset */, "xy", true /* done */);
+    ASSERT_SNAPSHOT_DATA("abxy");
+    return MUNIT_OK;
+}
+
+/* A chunk can't be written past the end of the data written so far. */
+TEST(snapshot_write, gap, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    SNAPSHOT_WRITE(0 /* offset */, "abcd", false /* done */);
+    SNAPSHOT_WRITE_STATUS(8 /* offset */, "ijkl", true /* done */,
+                          RAFT_IOERR);
+    return MUNIT_OK;
+}
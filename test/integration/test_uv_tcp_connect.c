@@ -68,15 +68,21 @@ static void connectCbAssertResult(struct raft_uv_connect *req,
     CLOSE_SUBMIT; \
     CLOSE_WAIT
 
-#define CONNECT_REQ(ID, ADDRESS, RV, STATUS)                      \
+/* Submit a connect request offering the given compression codecs. */
+#define CONNECT_REQ_CODECS(ID, ADDRESS, CODECS, RV, STATUS)       \
     struct raft_uv_connect _req;                                  \
     struct result _result = {STATUS, false};                      \
     int _rv;                                                      \
     _req.data = &_result;                                         \
+    _req.codecs = CODECS;                                         \
+    _req.codec = 0;                                               \
     _rv = f->transport.connect(&f->transport, &_req, ID, ADDRESS, \
                                connectCbAssertResult);            \
     munit_assert_int(_rv, ==, RV)
 
+#define CONNECT_REQ(ID, ADDRESS, RV, STATUS) \
+    CONNECT_REQ_CODECS(ID, ADDRESS, 0, RV, STATUS)
+
 /* Try to submit a connect request and assert that the given error code and
  * message are returned. */
 #define CONNECT_ERROR(ID, ADDRESS, RV, ERRMSG)                  \
@@ -221,6 +227,24 @@ TEST(tcp_connect, closeDuringHandshake, setUp, tearDownDeps, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The transport gets closed while waiting for the reply to an handshake
+ * offering compression codecs. */
+TEST(tcp_connect, closeWaitingForReply, setUp, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned i;
+    CONNECT_REQ_CODECS(2, TCP_SERVER_ADDRESS, 1U << 1, 0, RAFT_CANCELED);
+    /* The test server never replies, so don't block waiting for it. */
+    for (i = 0; i < 10; i++) {
+        uv_run(&f->loop, UV_RUN_NOWAIT);
+    }
+    CLOSE_SUBMIT;
+    munit_assert_false(_result.done);
+    LOOP_RUN_UNTIL(&_result.done);
+    CLOSE_WAIT;
+    return MUNIT_OK;
+}
+
 static void checkCb(struct uv_check_s *check)
 {
     struct fixture *f = check->data;
@@ -185,6 +185,33 @@ TEST(tcp_listen, first, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* If the client offers compression codecs that are not supported, the accept
+ * callback is invoked after replying that no codec was accepted. */
+TEST(tcp_listen, unknownCodec, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uint8_t handshake[sizeof(uint64_t) * 6];
+    uint64_t reply;
+    void *cursor;
+
+    memset(handshake, 0, sizeof handshake);
+    cursor = handshake;
+    bytePut64(&cursor, 2);
+    bytePut64(&cursor, PEER_ID);
+    bytePut64(&cursor, 24);
+    strcpy(cursor, PEER_ADDRESS);
+    cursor = handshake + sizeof(uint64_t) * 5;
+    bytePut64(&cursor, 1U << 30);
+
+    PEER_CONNECT;
+    TCP_CLIENT_SEND(handshake, sizeof handshake);
+    ACCEPT;
+    TCP_CLIENT_RECV(&reply, sizeof reply);
+    munit_assert_int(byteFlip64(reply), ==, 0);
+
+    return MUNIT_OK;
+}
+
 /* The client sends us a bad protocol version */
 TEST(tcp_listen, badProtocol, setUp, tearDown, 0, NULL)
 {
@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "../lib/runner.h"
+#include "../lib/uv.h"
+
+/******************************************************************************
+ *
+ * Fixture with a host using a shared write-ahead log for two raft groups.
+ *
+ *****************************************************************************/
+
+#define N_GROUPS 2
+
+struct group
+{
+    struct raft_io io;
+    char dir[256];
+    raft_index next_index; /* Index of the next entry to append */
+    bool closed;
+};
+
+struct fixture
+{
+    FIXTURE_DIR;
+    FIXTURE_HEAP;
+    FIXTURE_LOOP;
+    FIXTURE_UV_TRANSPORT;
+    struct raft_uv_host host;
+    char wal[256];
+    size_t segment_size;
+    struct group groups[N_GROUPS];
+    bool closed;
+};
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+struct result
+{
+    int status;
+    bool done;
+};
+
+static void appendCbAssertResult(struct raft_io_append *req, int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+}
+
+static void snapshotPutCbAssertResult(struct raft_io_snapshot_put *req,
+                                      int status)
+{
+    struct result *result = req->data;
+    munit_assert_int(status, ==, result->status);
+    result->done = true;
+}
+
+/* Release entries loaded from the log, which might come from several
+ * batches. */
+static void entriesDestroy(struct raft_entry *entries, size_t n)
+{
+    void *batch = NULL;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if (entries[i].batch != batch) {
+            batch = entries[i].batch;
+            raft_free(batch);
+        }
+    }
+    raft_free(entries);
+}
+
+static void groupCloseCb(struct raft_io *io)
+{
+    struct group *g = io->data;
+    g->closed = true;
+}
+
+static void hostCloseCb(struct raft_uv_host *host)
+{
+    struct fixture *f = host->data;
+    f->closed = true;
+}
+
+/* Return the I'th group. */
+#define GROUP(I) (&f->groups[I])
+
+/* Initialize the transport and the host, and open the shared log. */
+#define HOST_OPEN                                                   \
+    do {                                                            \
+        struct raft_io *_io;                                        \
+        int _rv;                                                    \
+        SETUP_UV_TRANSPORT;                                         \
+        f->closed = false;                                          \
+        f->host.data = f;                                           \
+        _rv = raft_uv_host_init(&f->host, &f->loop, &f->transport); \
+        munit_assert_int(_rv, ==, 0);                               \
+        _io = raft_uv_host_io(&f->host);                            \
+        raft_uv_set_segment_size(_io, f->segment_size);             \
+        _rv = raft_uv_host_start(&f->host, 1, "127.0.0.1:9001");    \
+        munit_assert_int(_rv, ==, 0);                               \
+        _rv = raft_uv_host_set_wal(&f->host, f->wal);               \
+        munit_assert_int(_rv, ==, 0);                               \
+    } while (0)
+
+/* Close the host and the transport. */
+#define HOST_CLOSE                                 \
+    do {                                           \
+        raft_uv_host_close(&f->host, hostCloseCb); \
+        LOOP_RUN_UNTIL(&f->closed);                \
+        TEAR_DOWN_UV_TRANSPORT;                    \
+    } while (0)
+
+/* Initialize the I'th group, which has ID I + 1. */
+#define GROUP_OPEN(I)                                                \
+    do {                                                             \
+        struct group *_g = GROUP(I);                                 \
+        int _rv;                                                     \
+        _g->closed = false;                                          \
+        _g->io.data = _g;                                            \
+        _rv = raft_uv_init_group(&_g->io, &f->host, _g->dir, I + 1); \
+        munit_assert_int(_rv, ==, 0);                                \
+        _rv = _g->io.init(&_g->io, 1, "127.0.0.1:9001");             \
+        munit_assert_int(_rv, ==, 0);                                \
+    } while (0)
+
+/* Close the I'th group. */
+#define GROUP_CLOSE(I)                                   \
+    do {                                                 \
+        GROUP(I)->io.close(&GROUP(I)->io, groupCloseCb); \
+        LOOP_RUN_UNTIL(&GROUP(I)->closed);               \
+        raft_uv_close(&GROUP(I)->io);                    \
+    } while (0)
+
+/* Close and reopen the host, its shared log and all groups. */
+#define REOPEN                              \
+    do {                                    \
+        unsigned _i;                        \
+        for (_i = 0; _i < N_GROUPS; _i++) { \
+            GROUP_CLOSE(_i);                \
+        }                                   \
+        HOST_CLOSE;                         \
+        HOST_OPEN;                          \
+        for (_i = 0; _i < N_GROUPS; _i++) { \
+            GROUP_OPEN(_i);                 \
+        }                                   \
+    } while (0)
+
+/* Submit a request to append N entries to the I'th group. The data of each
+ * entry is its index. */
+#define APPEND_SUBMIT(I, N)                                                \
+    struct raft_entry _entries##I[N];                                      \
+    uint64_t _data##I[N];                                                  \
+    struct raft_io_append _req##I;                                         \
+    struct result _result##I = {0, false};                                 \
+    do {                                                                   \
+        unsigned _i;                                                       \
+        int _rv;                                                           \
+        for (_i = 0; _i < N; _i++) {                                       \
+            _data##I[_i] = GROUP(I)->next_index++;                         \
+            _entries##I[_i].term = 1;                                      \
+            _entries##I[_i].type = RAFT_COMMAND;                           \
+            _entries##I[_i].buf.base = &_data##I[_i];                      \
+            _entries##I[_i].buf.len = sizeof _data##I[_i];                 \
+            _entries##I[_i].batch = NULL;                                  \
+        }                                                                  \
+        _req##I.data = &_result##I;                                        \
+        _rv = GROUP(I)->io.append(&GROUP(I)->io, &_req##I, _entries##I, N, \
+                                  appendCbAssertResult);                   \
+        munit_assert_int(_rv, ==, 0);                                      \
+    } while (0)
+
+/* Wait for the append request of the I'th group to complete. */
+#define APPEND_WAIT(I) LOOP_RUN_UNTIL(&_result##I.done)
+
+/* Append N entries to the I'th group and wait for the request to complete. */
+#define APPEND(I, N)         \
+    do {                     \
+        APPEND_SUBMIT(I, N); \
+        APPEND_WAIT(I);      \
+    } while (0)
+
+/* Truncate the log of the I'th group from index N onward. */
+#define TRUNCATE(I, N)                                 \
+    do {                                               \
+        int _rv;                                       \
+        _rv = GROUP(I)->io.truncate(&GROUP(I)->io, N); \
+        munit_assert_int(_rv, ==, 0);                  \
+        GROUP(I)->next_index = N;                      \
+    } while (0)
+
+/* Put a snapshot of the I'th group at the given index, keeping TRAILING
+ * entries, and wait for the request to complete. */
+#define SNAPSHOT_PUT(I, TRAILING, INDEX)                                \
+    do {                                                                \
+        struct raft_snapshot _snapshot;                                 \
+        struct raft_buffer _snapshot_buf;                               \
+        uint64_t _snapshot_data = 0;                                    \
+        struct raft_io_snapshot_put _req;                               \
+        struct result _result = {0, false};                             \
+        int _rv;                                                        \
+        _snapshot.term = 1;                                             \
+        _snapshot.index = INDEX;                                        \
+        raft_configuration_init(&_snapshot.configuration);              \
+        _rv = raft_configuration_add(&_snapshot.configuration, 1, "1",  \
+                                     RAFT_VOTER);                       \
+        munit_assert_int(_rv, ==, 0);                                   \
+        _snapshot.configuration_index = 1;                              \
+        _snapshot.bufs = &_snapshot_buf;                                \
+        _snapshot.n_bufs = 1;                                           \
+        _snapshot_buf.base = &_snapshot_data;                           \
+        _snapshot_buf.len = sizeof _snapshot_data;                      \
+        _req.data = &_result;                                           \
+        _rv = GROUP(I)->io.snapshot_put(&GROUP(I)->io, TRAILING, &_req, \
+                                        &_snapshot,                     \
+                                        snapshotPutCbAssertResult);     \
+        munit_assert_int(_rv, ==, 0);                                   \
+        LOOP_RUN_UNTIL(&_result.done);                                  \
+        raft_configuration_close(&_snapshot.configuration);             \
+    } while (0)
+
+/* Load the log of the I'th group and assert that it has N entries starting at
+ * START, each one with its index as data. */
+#define ASSERT_ENTRIES(I, START, N)                                         \
+    do {                                                                    \
+        raft_term _term;                                                    \
+        raft_id _voted_for;                                                 \
+        struct raft_snapshot *_snapshot;                                    \
+        raft_index _start_index;                                            \
+        struct raft_entry *_entries;                                        \
+        size_t _n;                                                          \
+        size_t _i;                                                          \
+        int _rv;                                                            \
+        _rv = GROUP(I)->io.load(&GROUP(I)->io, &_term, &_voted_for,         \
+                                &_snapshot, &_start_index, &_entries, &_n); \
+        munit_assert_int(_rv, ==, 0);                                       \
+        munit_assert_int(_start_index, ==, START);                          \
+        munit_assert_int(_n, ==, N);                                        \
+        for (_i = 0; _i < _n; _i++) {                                       \
+            uint64_t _value = *(uint64_t *)_entries[_i].buf.base;           \
+            munit_assert_int(_entries[_i].type, ==, RAFT_COMMAND);          \
+            munit_assert_int(_value, ==, START + _i);                       \
+        }                                                                   \
+        if (_entries != NULL) {                                             \
+            entriesDestroy(_entries, _n);                                   \
+        }                                                                   \
+        if (_snapshot != NULL) {                                            \
+            raft_configuration_close(&_snapshot->configuration);            \
+            raft_free(_snapshot->bufs[0].base);                             \
+            raft_free(_snapshot->bufs);                                     \
+            raft_free(_snapshot);                                           \
+        }                                                                   \
+        GROUP(I)->next_index = START + N;                                   \
+    } while (0)
+
+/******************************************************************************
+ *
+ * Set up and tear down.
+ *
+ *****************************************************************************/
+
+static void setUpGroups(struct fixture *f)
+{
+    unsigned i;
+    sprintf(f->wal, "%s/wal", f->dir);
+    munit_assert_int(mkdir(f->wal, 0755), ==, 0);
+    for (i = 0; i < N_GROUPS; i++) {
+        struct group *g = GROUP(i);
+        sprintf(g->dir, "%s/%u", f->dir, i + 1);
+        munit_assert_int(mkdir(g->dir, 0755), ==, 0);
+        g->next_index = 1;
+    }
+    HOST_OPEN;
+    for (i = 0; i < N_GROUPS; i++) {
+        GROUP_OPEN(i);
+    }
+}
+
+static void *setUp(const MunitParameter params[], void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SET_UP_DIR;
+    SET_UP_HEAP;
+    SETUP_LOOP;
+    f->segment_size = 8 * 1024 * 1024;
+    setUpGroups(f);
+    return f;
+}
+
+/* Use files of the shared log that can hold a single write. */
+static void *setUpSmallFiles(const MunitParameter params[], void *user_data)
+{
+    struct fixture *f = munit_malloc(sizeof *f);
+    SET_UP_DIR;
+    SET_UP_HEAP;
+    SETUP_LOOP;
+    f->segment_size = 64;
+    setUpGroups(f);
+    return f;
+}
+
+static void tearDown(void *data)
+{
+    struct fixture *f = data;
+    unsigned i;
+    if (f == NULL) {
+        return;
+    }
+    for (i = 0; i < N_GROUPS; i++) {
+        GROUP_CLOSE(i);
+    }
+    HOST_CLOSE;
+    TEAR_DOWN_LOOP;
+    TEAR_DOWN_HEAP;
+    TEAR_DOWN_DIR;
+    free(f);
+}
+
+/******************************************************************************
+ *
+ * Shared write-ahead log
+ *
+ *****************************************************************************/
+
+SUITE(wal)
+
+/* Appends of different groups submitted in the same loop iteration are written
+ * to the same file, and each group loads back only its own entries. */
+TEST(wal, appendAndLoad, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    {
+        APPEND_SUBMIT(0, 2);
+        APPEND_SUBMIT(1, 3);
+        APPEND_WAIT(0);
+        APPEND_WAIT(1);
+    }
+    munit_assert_true(DirHasFile(f->wal, "wal-1"));
+    munit_assert_false(DirHasFile(f->wal, "wal-2"));
+    munit_assert_false(DirHasFile(GROUP(0)->dir, "open-1"));
+    munit_assert_false(DirHasFile(GROUP(1)->dir, "open-1"));
+    REOPEN;
+    ASSERT_ENTRIES(0, 1, 2);
+    ASSERT_ENTRIES(1, 1, 3);
+    APPEND(1, 1);
+    REOPEN;
+    ASSERT_ENTRIES(0, 1, 2);
+    ASSERT_ENTRIES(1, 1, 4);
+    return MUNIT_OK;
+}
+
+/* Truncating the log of a group doesn't affect the other groups. */
+TEST(wal, truncate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(0, 3);
+    APPEND(1, 2);
+    TRUNCATE(0, 2);
+    APPEND(0, 2);
+    REOPEN;
+    ASSERT_ENTRIES(0, 1, 3);
+    ASSERT_ENTRIES(1, 1, 2);
+    return MUNIT_OK;
+}
+
+/* A file is removed only once all groups have taken a snapshot past the
+ * entries it holds. */
+TEST(wal, snapshotCleanup, setUpSmallFiles, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    unsigned i;
+    for (i = 0; i < 3; i++) {
+        APPEND_SUBMIT(0, 1);
+        APPEND_SUBMIT(1, 1);
+        APPEND_WAIT(0);
+        APPEND_WAIT(1);
+    }
+    munit_assert_true(DirHasFile(f->wal, "wal-3"));
+
+    SNAPSHOT_PUT(0, 1, 2);
+    munit_assert_true(DirHasFile(f->wal, "wal-1"));
+
+    SNAPSHOT_PUT(1, 1, 2);
+    while (DirHasFile(f->wal, "wal-1")) {
+        LOOP_RUN(1);
+    }
+    munit_assert_true(DirHasFile(f->wal, "wal-2"));
+    munit_assert_true(DirHasFile(f->wal, "wal-3"));
+
+    REOPEN;
+    ASSERT_ENTRIES(0, 2, 2);
+    ASSERT_ENTRIES(1, 2, 2);
+    return MUNIT_OK;
+}
+
+/* Bootstrapping a group writes its first entry to the shared log. */
+TEST(wal, bootstrap, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_configuration configuration;
+    raft_term term;
+    raft_id voted_for;
+    struct raft_snapshot *snapshot;
+    raft_index start_index;
+    struct raft_entry *entries;
+    size_t n;
+    int rv;
+    raft_configuration_init(&configuration);
+    rv = raft_configuration_add(&configuration, 1, "1", RAFT_VOTER);
+    munit_assert_int(rv, ==, 0);
+    rv = GROUP(0)->io.bootstrap(&GROUP(0)->io, &configuration);
+    munit_assert_int(rv, ==, 0);
+    raft_configuration_close(&configuration);
+    munit_assert_false(DirHasFile(GROUP(0)->dir,
+                                  "0000000000000001-0000000000000001"));
+    REOPEN;
+    rv = GROUP(0)->io.load(&GROUP(0)->io, &term, &voted_for, &snapshot,
+                           &start_index, &entries, &n);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_int(term, ==, 1);
+    munit_assert_ptr_null(snapshot);
+    munit_assert_int(start_index, ==, 1);
+    munit_assert_int(n, ==, 1);
+    munit_assert_int(entries[0].type, ==, RAFT_CHANGE);
+    entriesDestroy(entries, n);
+    ASSERT_ENTRIES(1, 1, 0);
+    return MUNIT_OK;
+}
+
+/* A record torn by a crash at the end of the last file is dropped when the
+ * log is opened again. */
+TEST(wal, tornTail, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND(0, 1);
+    APPEND(0, 1);
+    GROUP_CLOSE(0);
+    GROUP_CLOSE(1);
+    HOST_CLOSE;
+    DirTruncateFile(f->wal, "wal-1", 100);
+    HOST_OPEN;
+    GROUP_OPEN(0);
+    GROUP_OPEN(1);
+    ASSERT_ENTRIES(0, 1, 1);
+    APPEND(0, 1);
+    REOPEN;
+    ASSERT_ENTRIES(0, 1, 2);
+    return MUNIT_OK;
+}
@@ -12,9 +12,13 @@
 #include "munit.h"
 #include "snapshot.h"
 
-#define FIXTURE_CLUSTER                             \
-    FIXTURE_HEAP;                                   \
-    struct raft_fsm fsms[RAFT_FIXTURE_MAX_SERVERS]; \
+/* Maximum number of servers in a test cluster, including the ones added with
+ * CLUSTER_GROW. */
+#define CLUSTER_MAX_SERVERS 512
+
+#define FIXTURE_CLUSTER                        \
+    FIXTURE_HEAP;                              \
+    struct raft_fsm fsms[CLUSTER_MAX_SERVERS]; \
     struct raft_fixture cluster
 
 /* N is the default number of servers, but can be tweaked with the cluster-n
@@ -24,6 +28,8 @@
     do {                                                                     \
         unsigned _n = DEFAULT_N;                                             \
         bool _pre_vote = false;                                              \
+        bool _async_apply = false;                                           \
+        bool _async_snapshot = false;                                        \
         unsigned _i;                                                         \
         int _rv;                                                             \
         if (munit_parameters_get(params, CLUSTER_N_PARAM) != NULL) {         \
@@ -33,9 +39,26 @@
             _pre_vote =                                                      \
                 atoi(munit_parameters_get(params, CLUSTER_PRE_VOTE_PARAM));  \
         }                                                                    \
+        if (munit_parameters_get(params, CLUSTER_ASYNC_APPLY_PARAM) !=       \
+            NULL) {                                                          \
+            _async_apply = atoi(                                             \
+                munit_parameters_get(params, CLUSTER_ASYNC_APPLY_PARAM));    \
+        }                                                                    \
+        if (munit_parameters_get(params, CLUSTER_ASYNC_SNAPSHOT_PARAM) !=    \
+            NULL) {                                                          \
+            _async_snapshot = atoi(                                          \
+                munit_parameters_get(params, CLUSTER_ASYNC_SNAPSHOT_PARAM)); \
+        }                                                                    \
         munit_assert_int(_n, >, 0);                                          \
+        munit_assert_int(_n, <=, CLUSTER_MAX_SERVERS);                       \
         for (_i = 0; _i < _n; _i++) {                                        \
-            FsmInit(&f->fsms[_i]);                                           \
+            if (_async_apply) {                                              \
+                FsmInitAsync(&f->fsms[_i]);                                  \
+            } else if (_async_snapshot) {                                    \
+                FsmInitAsyncSnapshot(&f->fsms[_i]);                          \
+            } else {                                                         \
+                FsmInit(&f->fsms[_i]);                                       \
+            }                                                                \
         }                                                                    \
         _rv = raft_fixture_init(&f->cluster, _n, f->fsms);                   \
         munit_assert_int(_rv, ==, 0);                                        \
@@ -63,6 +86,12 @@
 /* Munit parameter for enabling pre-vote */
 #define CLUSTER_PRE_VOTE_PARAM "cluster-pre-vote"
 
+/* Use FSMs applying commands asynchronously, see FsmInitAsync(). */
+#define CLUSTER_ASYNC_APPLY_PARAM "cluster-async-apply"
+
+/* Use FSMs serializing snapshots asynchronously, see FsmInitAsyncSnapshot(). */
+#define CLUSTER_ASYNC_SNAPSHOT_PARAM "cluster-async-snapshot"
+
 /* Get the number of servers in the cluster. */
 #define CLUSTER_N raft_fixture_n(&f->cluster)
 
@@ -94,6 +123,9 @@
 /* Return the ID of the server the I'th server has voted for. */
 #define CLUSTER_VOTED_FOR(I) raft_fixture_voted_for(&f->cluster, I)
 
+/* Return the term persisted by the I'th server. */
+#define CLUSTER_PERSISTED_TERM(I) raft_fixture_term(&f->cluster, I)
+
 /* Return a description of the last error occured on the I'th server. */
 #define CLUSTER_ERRMSG(I) raft_errmsg(CLUSTER_RAFT(I))
 
@@ -272,6 +304,7 @@
 #define CLUSTER_GROW                                               \
     {                                                              \
         int rv_;                                                   \
+        munit_assert_int(CLUSTER_N, <, CLUSTER_MAX_SERVERS);       \
         FsmInit(&f->fsms[CLUSTER_N]);                              \
         rv_ = raft_fixture_grow(&f->cluster, &f->fsms[CLUSTER_N]); \
         munit_assert_int(rv_, ==, 0);                              \
@@ -353,6 +386,10 @@
 #define CLUSTER_SET_DISK_LATENCY(I, MSECS) \
     raft_fixture_set_disk_latency(&f->cluster, I, MSECS)
 
+/* Enable the asynchronous term and vote methods of the I'th server. */
+#define CLUSTER_SET_ASYNC_META(I) \
+    raft_fixture_set_async_meta(&f->cluster, I, true)
+
 /* Set the term persisted on the I'th server. This must be called before
  * starting the cluster. */
 #define CLUSTER_SET_TERM(I, TERM) raft_fixture_set_term(&f->cluster, I, TERM)
@@ -383,12 +420,20 @@
 #define CLUSTER_IO_FAULT(I, DELAY, REPEAT) \
     raft_fixture_io_fault(&f->cluster, I, DELAY, REPEAT)
 
+/* Make the I'th server's append request after @DELAY others fail when it
+ * completes. */
+#define CLUSTER_APPEND_FAULT(I, DELAY) \
+    raft_fixture_append_fault(&f->cluster, I, DELAY)
+
 /* Return the number of messages sent by the given server. */
 #define CLUSTER_N_SEND(I, TYPE) raft_fixture_n_send(&f->cluster, I, TYPE)
 
 /* Return the number of messages sent by the given server. */
 #define CLUSTER_N_RECV(I, TYPE) raft_fixture_n_recv(&f->cluster, I, TYPE)
 
+/* Return the number of disk writes of new entries done by the given server. */
+#define CLUSTER_N_APPEND(I) raft_fixture_n_append(&f->cluster, I)
+
 /* Set a fixture hook that randomizes election timeouts, disk latency and
  * network latency. */
 #define CLUSTER_RANDOMIZE                \
@@ -8,6 +8,17 @@ struct fsm
 {
     int x;
     int y;
+    /* Batch of commands submitted with apply_batch and not yet applied. */
+    struct raft_fsm_apply *req;
+    const struct raft_buffer *bufs;
+    void **results;
+    unsigned n;
+    /* State frozen with snapshot_freeze and not yet serialized. */
+    int frozen_x;
+    int frozen_y;
+    struct raft_fsm_snapshot *snapshot;
+    struct raft_buffer **snapshot_bufs;
+    unsigned *snapshot_n_bufs;
 };
 
 /* Command codes */
@@ -51,6 +62,26 @@ static int fsmApply(struct raft_fsm *fsm,
     return 0;
 }
 
+static int fsmApplyBatch(struct raft_fsm *fsm,
+                         struct raft_fsm_apply *req,
+                         raft_index index,
+                         const struct raft_buffer bufs[],
+                         void *results[],
+                         unsigned n,
+                         raft_fsm_apply_cb cb)
+{
+    struct fsm *f = fsm->data;
+    (void)index;
+    munit_assert_ptr_null(f->req);
+    munit_assert_int(n, >, 0);
+    req->cb = cb;
+    f->req = req;
+    f->bufs = bufs;
+    f->results = results;
+    f->n = n;
+    return 0;
+}
+
 static int fsmRestore(struct raft_fsm *fsm, struct raft_buffer *buf)
 {
     struct fsm *f = fsm->data;
@@ -104,23 +135,147 @@ static int fsmSnapshot(struct raft_fsm *fsm,
     return fsmEncodeSnapshot(f->x, f->y, bufs, n_bufs);
 }
 
+static int fsmSnapshotFreeze(struct raft_fsm *fsm)
+{
+    struct fsm *f = fsm->data;
+    munit_assert_ptr_null(f->snapshot);
+    f->frozen_x = f->x;
+    f->frozen_y = f->y;
+    return 0;
+}
+
+static int fsmSnapshotSerialize(struct raft_fsm *fsm,
+                                struct raft_fsm_snapshot *req,
+                                struct raft_buffer *bufs[],
+                                unsigned *n_bufs,
+                                raft_fsm_snapshot_cb cb)
+{
+    struct fsm *f = fsm->data;
+    munit_assert_ptr_null(f->snapshot);
+    req->cb = cb;
+    f->snapshot = req;
+    f->snapshot_bufs = bufs;
+    f->snapshot_n_bufs = n_bufs;
+    return 0;
+}
+
 void FsmInit(struct raft_fsm *fsm)
 {
-    struct fsm *f = munit_malloc(sizeof *fsm);
+    struct fsm *f = munit_malloc(sizeof *f);
 
     f->x = 0;
     f->y = 0;
-
-    fsm->version = 1;
+    f->req = NULL;
+    f->bufs = NULL;
+    f->results = NULL;
+    f->n = 0;
+    f->frozen_x = 0;
+    f->frozen_y = 0;
+    f->snapshot = NULL;
+    f->snapshot_bufs = NULL;
+    f->snapshot_n_bufs = NULL;
+
+    fsm->version = 3;
     fsm->data = f;
     fsm->apply = fsmApply;
     fsm->snapshot = fsmSnapshot;
     fsm->restore = fsmRestore;
+    fsm->apply_batch = NULL;
+    fsm->snapshot_freeze = NULL;
+    fsm->snapshot_serialize = NULL;
+}
+
+void FsmInitAsync(struct raft_fsm *fsm)
+{
+    FsmInit(fsm);
+    fsm->apply_batch = fsmApplyBatch;
+}
+
+unsigned FsmApplyFlush(struct raft_fsm *fsm)
+{
+    struct fsm *f = fsm->data;
+    struct raft_fsm_apply *req = f->req;
+    unsigned n = f->n;
+    unsigned i;
+    int rv = 0;
+
+    if (req == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        rv = fsmApply(fsm, &f->bufs[i], &f->results[i]);
+        if (rv != 0) {
+            break;
+        }
+    }
+
+    f->req = NULL;
+    f->bufs = NULL;
+    f->results = NULL;
+    f->n = 0;
+
+    req->cb(req, rv);
+
+    return n;
+}
+
+unsigned FsmApplyFail(struct raft_fsm *fsm, int status)
+{
+    struct fsm *f = fsm->data;
+    struct raft_fsm_apply *req = f->req;
+    unsigned n = f->n;
+
+    if (req == NULL) {
+        return 0;
+    }
+
+    f->req = NULL;
+    f->bufs = NULL;
+    f->results = NULL;
+    f->n = 0;
+
+    req->cb(req, status);
+
+    return n;
+}
+
+void FsmInitAsyncSnapshot(struct raft_fsm *fsm)
+{
+    FsmInit(fsm);
+    fsm->snapshot_freeze = fsmSnapshotFreeze;
+    fsm->snapshot_serialize = fsmSnapshotSerialize;
+}
+
+bool FsmSnapshotFlush(struct raft_fsm *fsm)
+{
+    struct fsm *f = fsm->data;
+    struct raft_fsm_snapshot *req = f->snapshot;
+    int rv;
+
+    if (req == NULL) {
+        return false;
+    }
+
+    rv = fsmEncodeSnapshot(f->frozen_x, f->frozen_y, f->snapshot_bufs,
+                           f->snapshot_n_bufs);
+
+    f->snapshot = NULL;
+    f->snapshot_bufs = NULL;
+    f->snapshot_n_bufs = NULL;
+
+    req->cb(req, rv);
+
+    return true;
 }
 
 void FsmClose(struct raft_fsm *fsm)
 {
     struct fsm *f = fsm->data;
+    /* Complete any pending batch or snapshot, so a closing raft instance can
+     * finish. */
+    FsmApplyFlush(fsm);
+    FsmSnapshotFlush(fsm);
     free(f);
 }
 
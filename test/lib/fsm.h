@@ -9,6 +9,27 @@
 
 void FsmInit(struct raft_fsm *fsm);
 
+/* Like FsmInit(), but implementing the apply_batch method: committed commands
+ * are applied only when FsmApplyFlush() is called. */
+void FsmInitAsync(struct raft_fsm *fsm);
+
+/* Apply the batch of commands submitted to an FSM initialized with
+ * FsmInitAsync(), if any, and fire its callback. Return the number of commands
+ * in the batch. */
+unsigned FsmApplyFlush(struct raft_fsm *fsm);
+
+/* Like FsmApplyFlush(), but fail the batch with the given status without
+ * applying any of its commands. */
+unsigned FsmApplyFail(struct raft_fsm *fsm, int status);
+
+/* Like FsmInit(), but implementing the snapshot_freeze and snapshot_serialize
+ * methods: snapshots are encoded only when FsmSnapshotFlush() is called. */
+void FsmInitAsyncSnapshot(struct raft_fsm *fsm);
+
+/* Encode the snapshot frozen by an FSM initialized with FsmInitAsyncSnapshot(),
+ * if any, and fire its callback. Return true if there was one. */
+bool FsmSnapshotFlush(struct raft_fsm *fsm);
+
 void FsmClose(struct raft_fsm *fsm);
 
 /* Encode a command to set x to the given value. */
@@ -218,6 +218,23 @@ void test_tcp_send(struct test_tcp *t, const void *buf, int len)
     }
 }
 
+void test_tcp_recv(struct test_tcp *t, void *buf, int len)
+{
+    int n = 0;
+    int rv;
+
+    while (n < len) {
+        rv = read(t->client.socket, (char *)buf + n, len - n);
+        if (rv == -1) {
+            munit_errorf("tcp: read(): %s", strerror(errno));
+        }
+        if (rv == 0) {
+            munit_error("tcp: read(): connection closed");
+        }
+        n += rv;
+    }
+}
+
 int test_tcp_accept(struct test_tcp *t)
 {
     int socket;
@@ -23,6 +23,7 @@
 
 #define TCP_CLIENT_CONNECT(PORT) test_tcp_connect(&f->tcp, PORT)
 #define TCP_CLIENT_SEND(BUF, N) test_tcp_send(&f->tcp, BUF, N)
+#define TCP_CLIENT_RECV(BUF, N) test_tcp_recv(&f->tcp, BUF, N)
 #define TCP_CLIENT_CLOSE test_tcp_close(&f->tcp)
 
 struct TcpServer
@@ -95,6 +96,11 @@ void test_tcp_close(struct test_tcp *t);
  */
 void test_tcp_send(struct test_tcp *t, const void *buf, int len);
 
+/**
+ * Receive exactly @len bytes using the client socket.
+ */
+void test_tcp_recv(struct test_tcp *t, void *buf, int len);
+
 /**
  * Accept inbound client connection and return the relevant socket.
  */
@@ -38,6 +38,52 @@ TEST(byteCrc32, invalid, NULL, NULL, 0, NULL)
     return MUNIT_OK;
 }
 
+/* The checksum of a well-known input doesn't change. */
+TEST(byteCrc32, check, NULL, NULL, 0, NULL)
+{
+    const char *value = "123456789";
+    munit_assert_uint(byteCrc32(value, strlen(value), 0), ==, 0x89a1897f);
+    return MUNIT_OK;
+}
+
+/* All implementations supported by the CPU produce the same checksum as the
+ * byte at a time one, regardless of size, alignment and initial value. */
+TEST(byteCrc32, implementations, NULL, NULL, 0, NULL)
+{
+    byteCrc32Fn table = byteCrc32Impl(BYTE_CRC32_TABLE);
+    uint8_t buf[1024 + 8];
+    unsigned inits[] = {0, 1, 0xdeadbeef, 0xffffffff};
+    unsigned i;
+    int impl;
+
+    for (i = 0; i < sizeof buf; i++) {
+        buf[i] = (uint8_t)munit_rand_uint32();
+    }
+
+    for (impl = BYTE_CRC32_TABLE; impl < BYTE_CRC32_N; impl++) {
+        byteCrc32Fn fn = byteCrc32Impl(impl);
+        size_t size;
+        if (fn == NULL) {
+            continue;
+        }
+        for (size = 0; size <= 1024; size += size < 160 ? 1 : 61) {
+            unsigned offset;
+            for (offset = 0; offset < 8; offset += 3) {
+                unsigned j;
+                for (j = 0; j < sizeof inits / sizeof *inits; j++) {
+                    munit_assert_uint(fn(buf + offset, size, inits[j]), ==,
+                                      table(buf + offset, size, inits[j]));
+                }
+            }
+        }
+    }
+
+    munit_assert_uint(byteCrc32(buf, sizeof buf, 0), ==,
+                      table(buf, sizeof buf, 0));
+
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * Convert to little endian representation (least significant byte first).
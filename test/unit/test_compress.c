@@ -0,0 +1,147 @@
+#include <string.h>
+
+#include "../../src/compress.h"
+#include "../lib/runner.h"
+
+/******************************************************************************
+ *
+ * Helper macros
+ *
+ *****************************************************************************/
+
+#define SKIP_IF_NO_DEFLATE                                       \
+    if (!compressionIsAvailable(COMPRESSION_DEFLATE)) {          \
+        return MUNIT_SKIP;                                       \
+    }
+
+/* Fill the given buffer with compressible text. */
+static void fillText(struct raft_buffer *buf, size_t len)
+{
+    const char *text = "{\"key\": \"value\", \"n\": 123}\n";
+    size_t n = strlen(text);
+    size_t i;
+    buf->base = munit_malloc(len);
+    buf->len = len;
+    for (i = 0; i < len; i++) {
+        ((char *)buf->base)[i] = text[i % n];
+    }
+}
+
+/******************************************************************************
+ *
+ * compressionEncode and compressionDecode
+ *
+ *****************************************************************************/
+
+SUITE(compression)
+
+/* Several buffers are compressed as one and decompressed back. */
+TEST(compression, roundTrip, NULL, NULL, 0, NULL)
+{
+    struct raft_buffer bufs[3];
+    struct raft_buffer compressed;
+    struct raft_buffer decompressed;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    size_t len = 0;
+    unsigned i;
+    int rv;
+    SKIP_IF_NO_DEFLATE;
+
+    fillText(&bufs[0], 4096);
+    fillText(&bufs[1], 1);
+    fillText(&bufs[2], 70000);
+    for (i = 0; i < 3; i++) {
+        len += bufs[i].len;
+    }
+
+    rv = compressionEncode(COMPRESSION_DEFLATE, bufs, 3, &compressed, errmsg);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_ulong(compressed.len, <, len / 5);
+
+    rv = compressionDecode(COMPRESSION_DEFLATE, &compressed, len,
+                           &decompressed, errmsg);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_ulong(decompressed.len, ==, len);
+    munit_assert_memory_equal(bufs[0].len, decompressed.base, bufs[0].base);
+    munit_assert_memory_equal(bufs[2].len,
+                              (char *)decompressed.base + len - bufs[2].len,
+                              bufs[2].base);
+
+    raft_free(compressed.base);
+    raft_free(decompressed.base);
+    for (i = 0; i < 3; i++) {
+        free(bufs[i].base);
+    }
+    return MUNIT_OK;
+}
+
+/* Empty input is supported. */
+TEST(compression, empty, NULL, NULL, 0, NULL)
+{
+    struct raft_buffer compressed;
+    struct raft_buffer decompressed;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    int rv;
+    SKIP_IF_NO_DEFLATE;
+
+    rv = compressionEncode(COMPRESSION_DEFLATE, NULL, 0, &compressed, errmsg);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_ulong(compressed.len, >, 0);
+
+    rv = compressionDecode(COMPRESSION_DEFLATE, &compressed, 0, &decompressed,
+                           errmsg);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_ulong(decompressed.len, ==, 0);
+
+    raft_free(compressed.base);
+    raft_free(decompressed.base);
+    return MUNIT_OK;
+}
+
+/* Corrupted data or an unexpected length are detected. */
+TEST(compression, corrupt, NULL, NULL, 0, NULL)
+{
+    struct raft_buffer buf;
+    struct raft_buffer compressed;
+    struct raft_buffer decompressed;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    int rv;
+    SKIP_IF_NO_DEFLATE;
+
+    fillText(&buf, 1024);
+    rv = compressionEncode(COMPRESSION_DEFLATE, &buf, 1, &compressed, errmsg);
+    munit_assert_int(rv, ==, 0);
+
+    rv = compressionDecode(COMPRESSION_DEFLATE, &compressed, buf.len + 1,
+                           &decompressed, errmsg);
+    munit_assert_int(rv, ==, RAFT_CORRUPT);
+    rv = compressionDecode(COMPRESSION_DEFLATE, &compressed, buf.len - 1,
+                           &decompressed, errmsg);
+    munit_assert_int(rv, ==, RAFT_CORRUPT);
+
+    ((uint8_t *)compressed.base)[compressed.len / 2] ^= 0xff;
+    rv = compressionDecode(COMPRESSION_DEFLATE, &compressed, buf.len,
+                           &decompressed, errmsg);
+    munit_assert_int(rv, ==, RAFT_CORRUPT);
+
+    raft_free(compressed.base);
+    free(buf.base);
+    return MUNIT_OK;
+}
+
+/* Unknown codecs are rejected. */
+TEST(compression, unknownCodec, NULL, NULL, 0, NULL)
+{
+    struct raft_buffer buf = {NULL, 0};
+    struct raft_buffer out;
+    char errmsg[RAFT_ERRMSG_BUF_SIZE];
+    int rv;
+
+    munit_assert_false(compressionIsAvailable(255));
+    rv = compressionEncode(255, &buf, 1, &out, errmsg);
+    munit_assert_int(rv, ==, RAFT_INVALID);
+    munit_assert_string_equal(errmsg, "unsupported compression codec 255");
+    rv = compressionDecode(255, &buf, 0, &out, errmsg);
+    munit_assert_int(rv, ==, RAFT_MALFORMED);
+    return MUNIT_OK;
+}
@@ -154,6 +154,59 @@ TEST(configurationIndexOf, no_match, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/******************************************************************************
+ *
+ * configurationHashIndexOf
+ *
+ *****************************************************************************/
+
+SUITE(configurationHashIndexOf)
+
+/* Point the given raft instance to the fixture's configuration and rebuild its
+ * hash table. */
+#define HASH_REBUILD(R)                      \
+    (R)->configuration = f->configuration;   \
+    configurationHashRebuild(R)
+
+/* Large configurations are looked up through a hash table, which is rebuilt as
+ * servers get added and removed. */
+TEST(configurationHashIndexOf, large, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft r;
+    char address[32];
+    unsigned i;
+    r.configuration_hash.slots = NULL;
+    r.configuration_hash.size = 0;
+    for (i = 0; i < 300; i++) {
+        sprintf(address, "10.0.%u.%u:666", i / 256, i % 256);
+        ADD(i * 7 + 1, address, RAFT_SPARE);
+    }
+    HASH_REBUILD(&r);
+    munit_assert_ptr_not_null(r.configuration_hash.slots);
+    for (i = 0; i < 300; i++) {
+        munit_assert_int(configurationHashIndexOf(&r, i * 7 + 1), ==, i);
+    }
+    munit_assert_int(configurationHashIndexOf(&r, 2), ==, 300);
+    munit_assert_ptr_null(configurationHashGet(&r, 2));
+    REMOVE(1);
+    HASH_REBUILD(&r);
+    for (i = 1; i < 300; i++) {
+        munit_assert_int(configurationHashIndexOf(&r, i * 7 + 1), ==, i - 1);
+    }
+    munit_assert_int(configurationHashIndexOf(&r, 1), ==, 299);
+    for (i = 1; i < 290; i++) {
+        REMOVE(i * 7 + 1);
+    }
+    HASH_REBUILD(&r);
+    munit_assert_ptr_null(r.configuration_hash.slots);
+    munit_assert_int(configurationHashIndexOf(&r, 290 * 7 + 1), ==, 0);
+    munit_assert_int(configurationHashGet(&r, 299 * 7 + 1)->id, ==,
+                     299 * 7 + 1);
+    configurationHashClose(&r);
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * configurationIndexOfVoter
@@ -90,9 +90,11 @@ struct fixture
         munit_assert_int(rv2, ==, 0);                   \
     }
 
-#define RELEASE(INDEX) logRelease(&f->log, INDEX, entries, n);
+#define RELEASE logRelease(&f->log, entries, n)
 
 #define TRUNCATE(N) logTruncate(&f->log, N)
+#define EVICT(INDEX) logEvict(&f->log, INDEX)
+#define IS_EVICTED(INDEX) logIsEvicted(&f->log, INDEX)
 #define SNAPSHOT(INDEX, TRAILING) logSnapshot(&f->log, INDEX, TRAILING)
 #define RESTORE(INDEX, TERM) logRestore(&f->log, INDEX, TERM)
 
@@ -147,22 +149,18 @@ static void tearDown(void *data)
         munit_assert_int(entry->term, ==, TERM); \
     }
 
-/* Assert that the number of outstanding references for the entry at INDEX
- * equals COUNT. */
-#define ASSERT_REFCOUNT(INDEX, COUNT)                                 \
-    {                                                                 \
-        size_t i;                                                     \
-        munit_assert_ptr_not_null(f->log.refs);                       \
-        for (i = 0; i < f->log.refs_size; i++) {                      \
-            if (f->log.refs[i].index == INDEX) {                      \
-                munit_assert_int(f->log.refs[i].count, ==, COUNT);    \
-                break;                                                \
-            }                                                         \
-        }                                                             \
-        if (i == f->log.refs_size) {                                  \
-            munit_errorf("no refcount found for entry with index %d", \
-                         (int)INDEX);                                 \
-        }                                                             \
+/* Assert the number of outstanding references to the log's current buffer and
+ * the number of retired buffers. */
+#define ASSERT_REFS(REFS, RETIRED)                      \
+    {                                                   \
+        struct raft_log_buffer *buffer_;                \
+        unsigned n_retired_ = 0;                        \
+        for (buffer_ = f->log.retired; buffer_ != NULL; \
+             buffer_ = buffer_->next) {                 \
+            n_retired_++;                               \
+        }                                               \
+        munit_assert_int(f->log.refs, ==, REFS);        \
+        munit_assert_int(n_retired_, ==, RETIRED);      \
     }
 
 /******************************************************************************
@@ -380,6 +378,68 @@ TEST(logTermOf, snapshotTrailing, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/******************************************************************************
+ *
+ * logFirstIndexOfTerm
+ *
+ *****************************************************************************/
+
+SUITE(logFirstIndexOfTerm)
+
+/* The entries of the term start somewhere in the middle of the log. */
+TEST(logFirstIndexOfTerm, middle, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND_MANY(1 /* term */, 3 /* n */);
+    APPEND_MANY(2 /* term */, 4 /* n */);
+    APPEND_MANY(3 /* term */, 2 /* n */);
+    munit_assert_int(logFirstIndexOfTerm(&f->log, 1), ==, 1);
+    munit_assert_int(logFirstIndexOfTerm(&f->log, 6), ==, 4);
+    munit_assert_int(logFirstIndexOfTerm(&f->log, 9), ==, 8);
+    return MUNIT_OK;
+}
+
+/* Entries preceding the snapshot are not considered. */
+TEST(logFirstIndexOfTerm, withSnapshot, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND_MANY(1 /* term */, 5 /* n */);
+    SNAPSHOT(3 /* last index */, 0 /* trailing */);
+    munit_assert_int(logFirstIndexOfTerm(&f->log, 5), ==, 3);
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * logLastIndexUpToTerm
+ *
+ *****************************************************************************/
+
+SUITE(logLastIndexUpToTerm)
+
+/* Return the last index whose term is not greater than the given one. */
+TEST(logLastIndexUpToTerm, middle, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND_MANY(1 /* term */, 3 /* n */);
+    APPEND_MANY(3 /* term */, 4 /* n */);
+    munit_assert_int(logLastIndexUpToTerm(&f->log, 1, 7), ==, 3);
+    munit_assert_int(logLastIndexUpToTerm(&f->log, 2, 7), ==, 3);
+    munit_assert_int(logLastIndexUpToTerm(&f->log, 3, 5), ==, 5);
+    munit_assert_int(logLastIndexUpToTerm(&f->log, 4, 9), ==, 7);
+    return MUNIT_OK;
+}
+
+/* Return 0 if all known entries have a greater term. */
+TEST(logLastIndexUpToTerm, none, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    munit_assert_int(logLastIndexUpToTerm(&f->log, 1, 1), ==, 0);
+    APPEND_MANY(2 /* term */, 3 /* n */);
+    munit_assert_int(logLastIndexUpToTerm(&f->log, 1, 3), ==, 0);
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * logGet
@@ -464,7 +524,6 @@ TEST(logAppend, one, setUp, tearDown, 0, NULL)
            0 /* offset                                                  */,
            1 /* n */);
     ASSERT_TERM_OF(1 /* entry index */, 1 /* term */);
-    ASSERT_REFCOUNT(1 /* entry index */, 1 /* count */);
     return MUNIT_OK;
 }
 
@@ -481,8 +540,6 @@ TEST(logAppend, two, setUp, tearDown, 0, NULL)
            2 /* n */);
     ASSERT_TERM_OF(1 /* entry index */, 1 /* term */);
     ASSERT_TERM_OF(2 /* entry index */, 1 /* term */);
-    ASSERT_REFCOUNT(1 /* entry index */, 1 /* count */);
-    ASSERT_REFCOUNT(2 /* entry index */, 1 /* count */);
     return MUNIT_OK;
 }
 
@@ -508,15 +565,11 @@ TEST(logAppend, three, setUp, tearDown, 0, NULL)
     ASSERT_TERM_OF(1 /* entry index */, 1 /* term */);
     ASSERT_TERM_OF(2 /* entry index */, 1 /* term */);
     ASSERT_TERM_OF(3 /* entry index */, 1 /* term */);
-    ASSERT_REFCOUNT(1 /* entry index */, 1 /* count */);
-    ASSERT_REFCOUNT(2 /* entry index */, 1 /* count */);
-    ASSERT_REFCOUNT(3 /* entry index */, 1 /* count */);
 
     return MUNIT_OK;
 }
 
-/* Append enough entries to force the reference count hash table to be
- * resized. */
+/* Append enough entries to force the buffer to be grown several times. */
 TEST(logAppend, many, setUp, tearDown, 0, NULL)
 {
     struct fixture *f = data;
@@ -524,7 +577,7 @@ TEST(logAppend, many, setUp, tearDown, 0, NULL)
     for (i = 0; i < 3000; i++) {
         APPEND(1 /* term */);
     }
-    munit_assert_int(f->log.refs_size, ==, 4096);
+    munit_assert_int(f->log.size, ==, 4094);
     return MUNIT_OK;
 }
 
@@ -588,7 +641,7 @@ TEST(logAppend, batch, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
-static char *logAppendOomHeapFaultDelay[] = {"0", "1", NULL};
+static char *logAppendOomHeapFaultDelay[] = {"0", NULL};
 static char *logAppendOomHeapFaultRepeat[] = {"1", NULL};
 
 static MunitParameterEnum logAppendOom[] = {
@@ -611,14 +664,19 @@ TEST(logAppend, oom, setUp, tearDown, 0, logAppendOom)
     return MUNIT_OK;
 }
 
-/* Out of memory when trying to grow the refs count table. */
-TEST(logAppend, oomRefs, setUp, tearDown, 0, NULL)
+/* Out of memory when trying to grow a buffer that is referenced. */
+TEST(logAppend, oomReferenced, setUp, tearDown, 0, NULL)
 {
     struct fixture *f = data;
-    APPEND_MANY(1, LOG__REFS_INITIAL_SIZE);
+    struct raft_entry *entries;
+    unsigned n;
+    APPEND(1 /* term */);
+    ACQUIRE(1 /* index */);
     HeapFaultConfig(&f->heap, 1, 1);
     HeapFaultEnable(&f->heap);
-    APPEND_ERROR(1, RAFT_NOMEM);
+    APPEND_ERROR(1 /* term */, RAFT_NOMEM);
+    ASSERT_REFS(1 /* refs */, 0 /* retired */);
+    RELEASE;
     return MUNIT_OK;
 }
 
@@ -679,9 +737,10 @@ TEST(logAcquire, one, setUp, tearDown, 0, NULL)
     munit_assert_ptr_not_null(entries);
     munit_assert_int(n, ==, 1);
     munit_assert_int(entries[0].type, ==, RAFT_COMMAND);
-    ASSERT_REFCOUNT(1 /* index */, 2 /* count */);
-    RELEASE(1 /* index */);
-    ASSERT_REFCOUNT(1 /* index */, 1 /* count */);
+    munit_assert_ptr_equal(entries, &f->log.entries[0]);
+    ASSERT_REFS(1 /* refs */, 0 /* retired */);
+    RELEASE;
+    ASSERT_REFS(0 /* refs */, 0 /* retired */);
     return MUNIT_OK;
 }
 
@@ -698,11 +757,9 @@ TEST(logAcquire, two, setUp, tearDown, 0, NULL)
     munit_assert_int(n, ==, 2);
     munit_assert_int(entries[0].type, ==, RAFT_COMMAND);
     munit_assert_int(entries[1].type, ==, RAFT_COMMAND);
-    ASSERT_REFCOUNT(1 /* index */, 2 /* count */);
-    ASSERT_REFCOUNT(2 /* index */, 2 /* count */);
-    RELEASE(1 /* index */);
-    ASSERT_REFCOUNT(1 /* index */, 1 /* count */);
-    ASSERT_REFCOUNT(2 /* index */, 1 /* count */);
+    ASSERT_REFS(1 /* refs */, 0 /* retired */);
+    RELEASE;
+    ASSERT_REFS(0 /* refs */, 0 /* retired */);
     return MUNIT_OK;
 }
 
@@ -744,7 +801,76 @@ TEST(logAcquire, wrap, setUp, tearDown, 0, NULL)
 
     ACQUIRE(6 /* index */);
     munit_assert_int(n, ==, 3);
-    RELEASE(6 /* index */);
+
+    /* The entries got rearranged in place, so they don't wrap anymore. */
+    ASSERT(6 /* size                                                 */,
+           0 /* front                                                */,
+           4 /* back                                                 */,
+           4 /* offset                                               */,
+           4 /* n */);
+    munit_assert_ptr_equal(entries, &f->log.entries[1]);
+    ASSERT_TERM_OF(5 /* index */, 1 /* term */);
+    ASSERT_TERM_OF(8 /* index */, 1 /* term */);
+
+    RELEASE;
+
+    return MUNIT_OK;
+}
+
+/* Acquire entries in a wrapped log while other entries are referenced. */
+TEST(logAcquire, wrapReferenced, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry *entries1;
+    struct raft_entry *entries2;
+    unsigned n1;
+    unsigned n2;
+    int rv;
+
+    APPEND_MANY(1 /* term */, 5 /* n */);
+    SNAPSHOT(4 /* last index */, 0 /* trailing */);
+    APPEND_MANY(1 /* term */, 3 /* n */);
+
+    /* Now the log is [e7, e8, NULL, NULL, e5, e6] */
+    rv = logAcquire(&f->log, 8, &entries1, &n1);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_int(n1, ==, 1);
+
+    /* The referenced buffer gets retired and the entries are copied into a new
+     * one, without wrapping. */
+    rv = logAcquire(&f->log, 5, &entries2, &n2);
+    munit_assert_int(rv, ==, 0);
+    munit_assert_int(n2, ==, 4);
+    munit_assert_ptr_equal(entries2, &f->log.entries[0]);
+    ASSERT_REFS(1 /* refs */, 1 /* retired */);
+
+    logRelease(&f->log, entries1, n1);
+    ASSERT_REFS(1 /* refs */, 0 /* retired */);
+    logRelease(&f->log, entries2, n2);
+    ASSERT_REFS(0 /* refs */, 0 /* retired */);
+
+    return MUNIT_OK;
+}
+
+/* Acquire some entries and then append enough new ones to force the buffer to
+ * be grown. The acquired entries are still valid. */
+TEST(logAcquire, grow, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry *entries;
+    unsigned n;
+
+    APPEND(1 /* term */);
+    ACQUIRE(1 /* index */);
+    APPEND_MANY(2 /* term */, 10 /* n */);
+    ASSERT_REFS(0 /* refs */, 1 /* retired */);
+
+    munit_assert_int(n, ==, 1);
+    munit_assert_int(entries[0].term, ==, 1);
+    munit_assert_string_equal((const char *)entries[0].buf.base, "hello");
+
+    RELEASE;
+    ASSERT_REFS(0 /* refs */, 0 /* retired */);
 
     return MUNIT_OK;
 }
@@ -764,15 +890,18 @@ TEST(logAcquire, batch, setUp, tearDown, 0, NULL)
     ACQUIRE(2 /* index */);
     munit_assert_ptr_not_null(entries);
     munit_assert_int(n, ==, 6);
-    ASSERT_REFCOUNT(2 /* index */, 2 /* count */);
 
     /* Truncate the last 5 entries, so the only references left for the second
      * batch are the ones in the acquired entries. */
     TRUNCATE(3 /* index */);
 
-    RELEASE(2 /* index */);
+    munit_assert_int(*(uint64_t *)entries[1].buf.base, ==, 1000);
+    munit_assert_int(*(uint64_t *)entries[5].buf.base, ==, 2000);
+
+    RELEASE;
 
-    ASSERT_REFCOUNT(2 /* index */, 1 /* count */);
+    /* The first batch is still in use by the entry at index 2. */
+    munit_assert_int(*(uint64_t *)GET(2)->buf.base, ==, 0);
 
     return MUNIT_OK;
 }
@@ -796,22 +925,156 @@ TEST(logAcquire, outOfRange, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
-/* Out of memory. */
+/* Out of memory when a wrapped buffer that is referenced needs to be
+ * retired. */
 TEST(logAcquire, oom, setUp, tearDown, 0, NULL)
 {
     struct fixture *f = data;
-    struct raft_entry *entries;
-    unsigned n;
+    struct raft_entry *entries1;
+    struct raft_entry *entries2;
+    unsigned n1;
+    unsigned n2;
     int rv;
 
-    APPEND(1 /* term */);
+    APPEND_MANY(1 /* term */, 5 /* n */);
+    SNAPSHOT(4 /* last index */, 0 /* trailing */);
+    APPEND_MANY(1 /* term */, 3 /* n */);
+
+    rv = logAcquire(&f->log, 8, &entries1, &n1);
+    munit_assert_int(rv, ==, 0);
 
     HeapFaultConfig(&f->heap, 0, 1);
     HeapFaultEnable(&f->heap);
 
-    rv = logAcquire(&f->log, 1, &entries, &n);
+    rv = logAcquire(&f->log, 5, &entries2, &n2);
     munit_assert_int(rv, ==, RAFT_NOMEM);
 
+    logRelease(&f->log, entries1, n1);
+
+    return MUNIT_OK;
+}
+
+/******************************************************************************
+ *
+ * logEvict
+ *
+ *****************************************************************************/
+
+SUITE(logEvict)
+
+/* If no cache size is set, nothing gets evicted. */
+TEST(logEvict, noCacheSize, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    APPEND_MANY(1 /* term */, 3 /* n */);
+    EVICT(3 /* index */);
+    munit_assert_false(IS_EVICTED(1));
+    munit_assert_ptr_not_null(GET(1)->buf.base);
+    return MUNIT_OK;
+}
+
+/* The oldest payloads get evicted until the rest fits the cache size. */
+TEST(logEvict, oldest, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    f->log.cache.max = 16;
+    APPEND_MANY(1 /* term */, 4 /* n */);
+    EVICT(4 /* index */);
+    munit_assert_true(IS_EVICTED(1));
+    munit_assert_true(IS_EVICTED(2));
+    munit_assert_false(IS_EVICTED(3));
+    munit_assert_ptr_null(GET(1)->buf.base);
+    munit_assert_int(GET(1)->buf.len, ==, 0);
+    munit_assert_int(GET(1)->term, ==, 1);
+    munit_assert_string_equal(GET(3)->buf.base, "hello");
+    munit_assert_int(f->log.cache.size, ==, 16);
+    return MUNIT_OK;
+}
+
+/* Entries past the given index are never evicted. */
+TEST(logEvict, bound, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    f->log.cache.max = 8;
+    APPEND_MANY(1 /* term */, 4 /* n */);
+    EVICT(2 /* index */);
+    munit_assert_true(IS_EVICTED(2));
+    munit_assert_false(IS_EVICTED(3));
+    munit_assert_int(f->log.cache.size, ==, 16);
+    return MUNIT_OK;
+}
+
+/* Nothing is evicted while entries are acquired, eviction resumes as soon as
+ * they are released. */
+TEST(logEvict, acquired, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry *entries;
+    unsigned n;
+    f->log.cache.max = 8;
+    APPEND_MANY(1 /* term */, 3 /* n */);
+    ACQUIRE(1 /* index */);
+    EVICT(3 /* index */);
+    munit_assert_false(IS_EVICTED(1));
+    munit_assert_string_equal(entries[0].buf.base, "hello");
+    RELEASE;
+    munit_assert_true(IS_EVICTED(2));
+    munit_assert_false(IS_EVICTED(3));
+    return MUNIT_OK;
+}
+
+/* The payload of configuration entries stays in memory, and keeps counting
+ * against the cache size. */
+TEST(logEvict, configuration, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_buffer buf;
+    int rv;
+    f->log.cache.max = 8;
+    buf.base = raft_malloc(8);
+    buf.len = 8;
+    strcpy(buf.base, "config");
+    rv = logAppend(&f->log, 1, RAFT_CHANGE, &buf, NULL);
+    munit_assert_int(rv, ==, 0);
+    APPEND_MANY(1 /* term */, 2 /* n */);
+    EVICT(3 /* index */);
+    munit_assert_true(IS_EVICTED(1));
+    munit_assert_string_equal(GET(1)->buf.base, "config");
+    munit_assert_true(IS_EVICTED(3));
+    munit_assert_int(f->log.cache.size, ==, 8);
+    return MUNIT_OK;
+}
+
+/* A batch is released along with the last of its entries. */
+TEST(logEvict, batch, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    f->log.cache.max = 8;
+    APPEND_BATCH(3);
+    EVICT(3 /* index */);
+    munit_assert_true(IS_EVICTED(2));
+    munit_assert_ptr_null(GET(2)->batch);
+    munit_assert_int(*(uint64_t *)GET(3)->buf.base, ==, 2000);
+    f->log.cache.max = 1;
+    EVICT(3 /* index */);
+    munit_assert_true(IS_EVICTED(3));
+    munit_assert_int(f->log.cache.size, ==, 0);
+    return MUNIT_OK;
+}
+
+/* Truncating the log forgets about evicted entries that got deleted. */
+TEST(logEvict, truncate, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    f->log.cache.max = 8;
+    APPEND_MANY(1 /* term */, 3 /* n */);
+    EVICT(3 /* index */);
+    TRUNCATE(2 /* index */);
+    munit_assert_true(IS_EVICTED(1));
+    munit_assert_false(IS_EVICTED(2));
+    APPEND(2 /* term */);
+    munit_assert_false(IS_EVICTED(2));
+    munit_assert_int(f->log.cache.size, ==, 8);
     return MUNIT_OK;
 }
 
@@ -919,19 +1182,23 @@ TEST(logTruncate, referenced, setUp, tearDown, 0, NULL)
     ACQUIRE(1 /* index */);
     TRUNCATE(1 /* index */);
 
-    ASSERT(0 /* size                                                 */,
+    /* The entry has still an outstanding reference, so the buffer is kept. */
+    ASSERT(2 /* size                                                 */,
            0 /* front                                                */,
            0 /* back                                                 */,
            0 /* offset                                               */,
            0 /* n */);
-
-    /* The entry has still an outstanding reference. */
-    ASSERT_REFCOUNT(1 /* index */, 1 /* count */);
+    ASSERT_REFS(1 /* refs */, 0 /* retired */);
 
     munit_assert_string_equal((const char *)entries[0].buf.base, "hello");
 
-    RELEASE(1 /* index */);
-    ASSERT_REFCOUNT(1 /* index */, 0 /* count */);
+    RELEASE;
+
+    ASSERT(0 /* size                                                 */,
+           0 /* front                                                */,
+           0 /* back                                                 */,
+           0 /* offset                                               */,
+           0 /* n */);
 
     return MUNIT_OK;
 }
@@ -964,13 +1231,13 @@ TEST(logTruncate, acquired, setUp, tearDown, 0, NULL)
 
     APPEND(2 /* term */);
 
-    RELEASE(2 /*index */);
+    RELEASE;
 
     return MUNIT_OK;
 }
 
 /* Acquire some entries, truncate the log and then append new ones forcing the
-   log to be grown and the reference count hash table to be re-built. */
+   log to be grown several times. */
 TEST(logTruncate, acquireAppend, setUp, tearDown, 0, NULL)
 {
     struct fixture *f = data;
@@ -987,11 +1254,11 @@ TEST(logTruncate, acquireAppend, setUp, tearDown, 0, NULL)
 
     TRUNCATE(2);
 
-    for (i = 0; i < LOG__REFS_INITIAL_SIZE; i++) {
+    for (i = 0; i < 256; i++) {
         APPEND(2 /* term */);
     }
 
-    RELEASE(2);
+    RELEASE;
 
     return MUNIT_OK;
 }
@@ -1032,7 +1299,7 @@ TEST(logTruncate, acquiredOom, setUp, tearDown, 0, logTruncateAcquiredOom)
     rv = logAppend(&f->log, 2, RAFT_COMMAND, &buf, NULL);
     munit_assert_int(rv, ==, RAFT_NOMEM);
 
-    RELEASE(2);
+    RELEASE;
 
     return MUNIT_OK;
 }
@@ -1203,6 +1470,34 @@ TEST(logSnapshot, wrap, setUp, tearDown, 0, NULL)
     return MUNIT_OK;
 }
 
+/* Take a snapshot deleting entries that are still referenced, then append new
+ * entries. */
+TEST(logSnapshot, acquired, setUp, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    struct raft_entry *entries;
+    unsigned n;
+
+    APPEND_MANY(1 /* term */, 3 /* n entries */);
+    ACQUIRE(1 /* index */);
+    munit_assert_int(n, ==, 3);
+
+    SNAPSHOT(2 /* last index */, 0 /* trailing */);
+    APPEND(2 /* term */);
+
+    /* The buffer holding the deleted entries was retired. */
+    ASSERT_REFS(0 /* refs */, 1 /* retired */);
+    munit_assert_string_equal((const char *)entries[0].buf.base, "hello");
+    munit_assert_string_equal((const char *)entries[1].buf.base, "hello");
+
+    RELEASE;
+    ASSERT_REFS(0 /* refs */, 0 /* retired */);
+    ASSERT_TERM_OF(3 /* index */, 1 /* term */);
+    ASSERT_TERM_OF(4 /* index */, 2 /* term */);
+
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
  * logRestore
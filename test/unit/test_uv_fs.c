@@ -235,32 +235,36 @@ TEST(UvFsAllocateFile, noSpace, DirSetUp, DirTearDown, 0, DirTmpfsParams)
 
 /* Invoke UvFsProbeCapabilities against the given dir and assert that it returns
  * the given values for direct I/O and async I/O. */
-#define PROBE_CAPABILITIES(DIR, DIRECT_IO, ASYNC_IO)                         \
-    {                                                                        \
-        size_t direct_io_;                                                   \
-        bool async_io_;                                                      \
-        char errmsg_;                                                        \
-        int rv_;                                                             \
-        rv_ = UvFsProbeCapabilities(DIR, &direct_io_, &async_io_, &errmsg_); \
-        munit_assert_int(rv_, ==, 0);                                        \
-        munit_assert_int(direct_io_, ==, DIRECT_IO);                         \
-        if (ASYNC_IO) {                                                      \
-            munit_assert_true(async_io_);                                    \
-        } else {                                                             \
-            munit_assert_false(async_io_);                                   \
-        }                                                                    \
+#define PROBE_CAPABILITIES(DIR, DIRECT_IO, ASYNC_IO)              \
+    {                                                             \
+        size_t direct_io_;                                        \
+        bool async_io_;                                           \
+        bool uring_io_;                                           \
+        char errmsg_;                                             \
+        int rv_;                                                  \
+        rv_ = UvFsProbeCapabilities(DIR, &direct_io_, &async_io_, \
+                                    &uring_io_, &errmsg_);        \
+        munit_assert_int(rv_, ==, 0);                             \
+        munit_assert_int(direct_io_, ==, DIRECT_IO);              \
+        if (ASYNC_IO) {                                           \
+            munit_assert_true(async_io_);                         \
+        } else {                                                  \
+            munit_assert_false(async_io_);                        \
+        }                                                         \
     }
 
 /* Invoke UvFsProbeCapabilities and check that the given error occurs. */
-#define PROBE_CAPABILITIES_ERROR(DIR, RV, ERRMSG)                           \
-    {                                                                       \
-        size_t direct_io_;                                                  \
-        bool async_io_;                                                     \
-        char errmsg_[RAFT_ERRMSG_BUF_SIZE];                                 \
-        int rv_;                                                            \
-        rv_ = UvFsProbeCapabilities(DIR, &direct_io_, &async_io_, errmsg_); \
-        munit_assert_int(rv_, ==, RV);                                      \
-        munit_assert_string_equal(errmsg_, ERRMSG);                         \
+#define PROBE_CAPABILITIES_ERROR(DIR, RV, ERRMSG)                 \
+    {                                                             \
+        size_t direct_io_;                                        \
+        bool async_io_;                                           \
+        bool uring_io_;                                           \
+        char errmsg_[RAFT_ERRMSG_BUF_SIZE];                       \
+        int rv_;                                                  \
+        rv_ = UvFsProbeCapabilities(DIR, &direct_io_, &async_io_, \
+                                    &uring_io_, errmsg_);         \
+        munit_assert_int(rv_, ==, RV);                            \
+        munit_assert_string_equal(errmsg_, ERRMSG);               \
     }
 
 SUITE(UvFsProbeCapabilities)
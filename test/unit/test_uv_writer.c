@@ -19,6 +19,7 @@ struct fixture
     size_t block_size;
     size_t direct_io;
     bool async_io;
+    bool uring_io;
     char errmsg[256];
     struct UvWriter writer;
     bool closed;
@@ -49,12 +50,23 @@ static void submitCbAssertResult(struct UvWriterReq *req, int status)
     result->done = true;
 }
 
-/* Initialize the fixture's writer. */
+/* Initialize the fixture's writer, using KAIO. */
 #define INIT(MAX_WRITES)                                                   \
     do {                                                                   \
         int _rv;                                                           \
         _rv = UvWriterInit(&f->writer, &f->loop, f->fd, f->direct_io != 0, \
-                           f->async_io, MAX_WRITES, f->errmsg);            \
+                           f->async_io, false, MAX_WRITES, f->errmsg);     \
+        munit_assert_int(_rv, ==, 0);                                      \
+        f->writer.data = f;                                                \
+        f->closed = false;                                                 \
+    } while (0)
+
+/* Initialize the fixture's writer, using io_uring. */
+#define INIT_URING(MAX_WRITES)                                             \
+    do {                                                                   \
+        int _rv;                                                           \
+        _rv = UvWriterInit(&f->writer, &f->loop, f->fd, f->direct_io != 0, \
+                           f->async_io, true, MAX_WRITES, f->errmsg);      \
         munit_assert_int(_rv, ==, 0);                                      \
         f->writer.data = f;                                                \
         f->closed = false;                                                 \
@@ -66,7 +78,7 @@ static void submitCbAssertResult(struct UvWriterReq *req, int status)
     do {                                                                   \
         int _rv;                                                           \
         _rv = UvWriterInit(&f->writer, &f->loop, f->fd, f->direct_io != 0, \
-                           f->async_io, 1, f->errmsg);                     \
+                           f->async_io, false, 1, f->errmsg);              \
         munit_assert_int(_rv, ==, RV);                                     \
         munit_assert_string_equal(f->errmsg, ERRMSG);                      \
     } while (0)
@@ -191,7 +203,8 @@ static void *setUpDeps(const MunitParameter params[], void *user_data)
     int rv;
     SET_UP_DIR;
     SETUP_LOOP;
-    rv = UvFsProbeCapabilities(f->dir, &f->direct_io, &f->async_io, errmsg);
+    rv = UvFsProbeCapabilities(f->dir, &f->direct_io, &f->async_io,
+                               &f->uring_io, errmsg);
     munit_assert_int(rv, ==, 0);
     f->block_size = f->direct_io != 0 ? f->direct_io : 4096;
     UvOsJoin(f->dir, "foo", path);
@@ -224,6 +237,21 @@ static void *setUp(const MunitParameter params[], void *user_data)
     return f;
 }
 
+/* Set up a writer using io_uring, skipping the test if it's not available. */
+static void *setUpUring(const MunitParameter params[], void *user_data)
+{
+    struct fixture *f = setUpDeps(params, user_data);
+    if (f == NULL) {
+        return NULL;
+    }
+    if (!f->uring_io) {
+        tearDownDeps(f);
+        return NULL;
+    }
+    INIT_URING(2);
+    return f;
+}
+
 static void tearDown(void *data)
 {
     struct fixture *f = data;
@@ -361,9 +389,49 @@ TEST(UvWriterSubmit, noResources, setUpDeps, tearDown, 0, DirNoAioParams)
     return MUNIT_OK;
 }
 
+/* Write a buffer using io_uring. */
+TEST(UvWriterSubmit, uring, setUpUring, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    SKIP_IF_NO_FIXTURE;
+    WRITE(1 /* n bufs */, 1 /* content */, 0 /* offset */);
+    WRITE(2 /* n bufs */, 2 /* content */, f->block_size /* offset */);
+    ASSERT_CONTENT(3);
+    return MUNIT_OK;
+}
+
+/* Write two different blocks concurrently using io_uring. */
+TEST(UvWriterSubmit, uringConcurrent, setUpUring, tearDown, 0, NULL)
+{
+    struct fixture *f = data;
+    uv_buf_t *bufs1;
+    uv_buf_t *bufs2;
+    struct UvWriterReq req1;
+    struct UvWriterReq req2;
+    struct result result1 = {0, false};
+    struct result result2 = {0, false};
+    int rv;
+    SKIP_IF_NO_FIXTURE;
+    MAKE_BUFS(bufs1, 1, 1);
+    MAKE_BUFS(bufs2, 1, 2);
+    req1.data = &result1;
+    req2.data = &result2;
+    rv = UvWriterSubmit(&f->writer, &req1, bufs1, 1, 0, submitCbAssertResult);
+    munit_assert_int(rv, ==, 0);
+    rv = UvWriterSubmit(&f->writer, &req2, bufs2, 1, f->block_size,
+                        submitCbAssertResult);
+    munit_assert_int(rv, ==, 0);
+    LOOP_RUN_UNTIL(&result1.done);
+    LOOP_RUN_UNTIL(&result2.done);
+    DESTROY_BUFS(bufs1, 1);
+    DESTROY_BUFS(bufs2, 1);
+    ASSERT_CONTENT(2);
+    return MUNIT_OK;
+}
+
 /******************************************************************************
  *
- * UvWriterSubmit
+ * UvWriterClose
  *
  *****************************************************************************/
 
@@ -396,3 +464,13 @@ TEST(UvWriterClose, aio, setUp, tearDownDeps, 0, DirAioParams)
 }
 
 #endif
+
+/* Close with an inflight io_uring write, which is waited for. */
+TEST(UvWriterClose, uring, setUpUring, tearDownDeps, 0, NULL)
+{
+    struct fixture *f = data;
+    SKIP_IF_NO_FIXTURE;
+    WRITE_CLOSE(1, 1, 0, 0);
+    ASSERT_CONTENT(1);
+    return MUNIT_OK;
+}